@@ -57,9 +57,20 @@
 typedef struct dbuf {
 	u_int length;		/* Current number of bytes stored */
 //	u_int offset;		/* Offset to the first byte */
+	long long *total;	/* Counter that is kept up to date with 'length', or NULL */
 	struct list_head dbuf_list;
 } dbuf;
 
+/*
+** Global dbuf statistics, maintained as data is added and removed,
+** so they can be read without walking all the clients.
+*/
+typedef struct DBufStats {
+	long long blocks;	/* Number of dbufbuf blocks in use */
+	long long sendq_bytes;	/* Bytes in the sendQ of all local clients */
+	long long recvq_bytes;	/* Bytes in the recvQ of all local clients */
+} DBufStats;
+
 /*
 ** And this 'dbufbuf' should never be referenced outside the
 ** implementation of 'dbuf'--would be "hidden" if C had such
@@ -106,6 +117,7 @@ void dbuf_delete(dbuf *, size_t);
 extern int dbuf_getmsg(dbuf *, char *);
 extern int dbuf_get(dbuf *dyn, char **buf);
 extern void dbuf_queue_init(dbuf *dyn);
+extern void dbuf_queue_init_ex(dbuf *dyn, long long *total);
 extern void dbuf_init(void);
 
 #endif /* __dbuf_include__ */
@@ -34,6 +34,7 @@ struct DNSCache {
 	char *name;			/**< The hostname */
 	char *ip;			/**< The IP address */
 	time_t expires;			/**< When record expires */
+	ExpiryHeapNode expiry;		/**< Position in the expiry heap */
 };
 
 typedef struct DNSStats DNSStats;
@@ -44,6 +45,8 @@ struct DNSStats {
 	unsigned int cache_adds;
 };
 
+extern MODVAR DNSStats dnsstats;
+
 /** Time to keep cache records. */
 #define DNS_CACHE_TTL			600
 #define DNS_NEGCACHE_TTL		60
@@ -136,12 +136,14 @@ struct Configuration {
 	int kick_length;
 	int quit_length;
 	int away_length;
+	int whowas_history_length;
 	int hide_list;
 	int max_unknown_connections_per_ip;
 	long handshake_timeout;
 	long sasl_timeout;
 	long handshake_delay;
 	long handshake_boot_delay;
+	long slow_loop_threshold;
 	BanTarget automatic_ban_target;
 	BanTarget manual_ban_target;
 	char *reject_message_too_many_connections;
@@ -253,6 +255,8 @@ extern MODVAR int ipv6_disabled;
 
 #define UHNAMES_ENABLED	iConf.uhnames
 
+#define WHOWAS_HISTORY_LENGTH	iConf.whowas_history_length
+
 /** Used for testing the set { } block configuration.
  * It tests if a setting is present and is also used for duplicate checking.
  */
@@ -65,6 +65,7 @@ extern MODVAR Channel *channels;
 extern MODVAR ModData local_variable_moddata[MODDATA_MAX_LOCAL_VARIABLE];
 extern MODVAR ModData global_variable_moddata[MODDATA_MAX_GLOBAL_VARIABLE];
 extern MODVAR IRCStatistics ircstats;
+extern MODVAR DBufStats dbufstats;
 extern MODVAR int bootopt;
 extern MODVAR time_t timeofday;
 extern MODVAR struct timeval timeofday_tv;
@@ -430,9 +431,7 @@ extern void del_queries(const char *);
 /* Hash stuff */
 #define NICK_HASH_TABLE_SIZE 32768
 #define CHAN_HASH_TABLE_SIZE 32768
-#define WHOWAS_HASH_TABLE_SIZE 32768
-#define THROTTLING_HASH_TABLE_SIZE 8192
-#define IPUSERS_HASH_TABLE_SIZE 8192
+#define WHOWAS_HASH_TABLE_SIZE 32768 /* minimum, grows with set::whowas-history-length */
 extern uint64_t siphash(const char *in, const char *k);
 extern uint64_t siphash_raw(const char *in, size_t len, const char *k);
 extern uint64_t siphash_nocase(const char *in, const char *k);
@@ -443,8 +442,24 @@ extern void del_whowas_from_clist(WhoWas **, WhoWas *);
 extern void add_whowas_to_list(WhoWas **, WhoWas *);
 extern void del_whowas_from_list(WhoWas **, WhoWas *);
 extern uint64_t hash_whowas_name(const char *name);
+extern uint64_t hash_whowas_string(const char *str);
 extern void create_whowas_entry(Client *client, WhoWas *e, WhoWasEvent event);
 extern void free_whowas_fields(WhoWas *e);
+extern const char *whowas_intern(const char *str);
+extern void whowas_unintern(const char *str);
+extern WhoWas *whowas_alloc(void);
+extern void whowas_link(WhoWas *e, Client *online);
+extern WhoWas *whowas_find_nick(const char *nick);
+extern WhoWas *whowas_next_nick(WhoWas *e);
+extern WhoWas *whowas_find_ip(const char *ip);
+extern WhoWas *whowas_next_ip(WhoWas *e);
+extern WhoWas *whowas_find_account(const char *account);
+extern WhoWas *whowas_next_account(WhoWas *e);
+extern WhoWas *whowas_oldest(void);
+extern WhoWas *whowas_newer(WhoWas *e);
+extern void whowas_resize(int size);
+extern MODVAR int whowas_count;
+extern MODVAR uint64_t whowas_serial;
 extern int add_to_client_hash_table(const char *, Client *);
 extern int del_from_client_hash_table(const char *, Client *);
 extern int add_to_id_hash_table(const char *, Client *);
@@ -460,9 +475,8 @@ extern Client *hash_find_server(const char *, Client *);
 extern IpUsersBucket *find_ipusers_bucket(Client *client);
 extern IpUsersBucket *add_ipusers_bucket(Client *client);
 extern void decrease_ipusers_bucket(Client *client);
-extern MODVAR struct ThrottlingBucket *ThrottlingHash[THROTTLING_HASH_TABLE_SIZE];
-extern MODVAR IpUsersBucket *IpUsersHash_ipv4[IPUSERS_HASH_TABLE_SIZE];
-extern MODVAR IpUsersBucket *IpUsersHash_ipv6[IPUSERS_HASH_TABLE_SIZE];
+extern MODVAR struct ThrottlingBucket *ThrottlingList;
+extern MODVAR IPIndex ipusers_index;
 
 
 /* Mode externs
@@ -551,6 +565,10 @@ extern AuthenticationType Auth_FindType(const char *hash, const char *type);
 extern AuthConfig	*AuthBlockToAuthConfig(ConfigEntry *ce);
 extern void		Auth_FreeAuthConfig(AuthConfig *as);
 extern int		Auth_Check(Client *cptr, AuthConfig *as, const char *para);
+extern void		Auth_CheckAsync(Client *client, AuthConfig *as, const char *para, AuthCheckCallback callback, void *data);
+extern void		Auth_CancelAsync(Client *client);
+extern void		Auth_CancelAsyncByCallback(AuthCheckCallback callback);
+extern int		Auth_CheckCached(Client *client, AuthConfig *as, const char *name, const char *para);
 extern const char	*Auth_Hash(int type, const char *para);
 extern int   		Auth_CheckError(ConfigEntry *ce);
 extern int              Auth_AutoDetectHashType(const char *hash);
@@ -883,8 +901,12 @@ extern MODVAR void (*kick_user)(MessageTag *mtags, Channel *channel, Client *cli
 extern MODVAR int (*watch_add)(const char *nick, Client *client, int flags);
 extern MODVAR int (*watch_del)(const char *nick, Client *client, int flags);
 extern MODVAR int (*watch_del_list)(Client *client, int flags);
+extern MODVAR int (*watch_add_many)(Client *client, const char **nicks, int count, int flags, int max);
+extern MODVAR int (*watch_del_many)(Client *client, const char **nicks, int count, int flags);
+extern MODVAR void (*tkl_bulk_begin)(Client *client);
+extern MODVAR int (*tkl_bulk_end)(Client *client);
 extern MODVAR Watch *(*watch_get)(const char *nick);
-extern MODVAR int (*watch_check)(Client *client, int reply, int (*watch_notify)(Client *client, Watch *watch, Link *lp, int event));
+extern MODVAR int (*watch_check)(Client *client, int reply, void *data, int (*watch_notify)(Client *client, Watch *watch, WatchSubscriber *sub, int event, void *data));
 extern MODVAR char *(*tkl_uhost)(TKL *tkl, char *buf, size_t buflen, int options);
 extern MODVAR void (*do_unreal_log_remote_deliver)(LogLevel loglevel, const char *subsystem, const char *event_id, MultiLine *msg, const char *json_serialized);
 extern MODVAR char *(*get_chmodes_for_user)(Client *client, const char *flags);
@@ -923,6 +945,7 @@ extern void unreal_tls_client_handshake(int, int, void *);
 extern void SSL_set_nonblocking(SSL *s);
 extern SSL_CTX *init_ctx(TLSOptions *tlsoptions, int server);
 extern const char *tls_get_cipher(Client *client);
+extern long tls_memory_estimate(Client *client, int *buffered);
 extern TLSOptions *get_tls_options_for_client(Client *acptr);
 extern int outdated_tls_client(Client *acptr);
 extern const char *outdated_tls_client_build_string(const char *pattern, Client *acptr);
@@ -967,6 +990,9 @@ extern MODVAR int max_connection_count;
 extern int add_listmode(Ban **list, Client *cptr, Channel *channel, const char *banid);
 extern int add_listmode_ex(Ban **list, Client *cptr, Channel *channel, const char *banid, const char *setby, time_t seton);
 extern int del_listmode(Ban **list, Channel *channel, const char *banid);
+extern Ban *find_listmode(Channel *channel, Ban **list, const char *banid);
+extern void link_listmode(Channel *channel, Ban **list, Ban *ban);
+extern void free_listmode_list(Channel *channel, Ban **list);
 extern int Halfop_mode(long mode);
 extern const char *convert_regular_ban(char *mask, char *buf, size_t buflen);
 extern const char *clean_ban_mask(const char *, int, Client *, int);
@@ -978,6 +1004,8 @@ extern void sha256hash_binary(char *dst, const char *src, unsigned long n);
 extern void sha1hash_binary(char *dst, const char *src, unsigned long n);
 extern MODVAR TKL *tklines[TKLISTLEN];
 extern MODVAR TKL *tklines_ip_hash[TKLIPHASHLEN1][TKLIPHASHLEN2];
+extern MODVAR ExpiryHeap tkl_expiry_heap;
+extern MODVAR TKL *tkl_sync_leaf[TKL_SYNC_LEAVES];
 extern const char *cmdname_by_spamftarget(int target);
 extern void unrealdns_delreq_bycptr(Client *cptr);
 extern void unrealdns_gethostbyname_link(const char *name, ConfigItem_link *conf, int ipv4_only);
@@ -1011,6 +1039,7 @@ extern MODVAR char serveropts[];
 extern MODVAR char *ISupportStrings[];
 extern void read_packet(int fd, int revents, void *data);
 extern int process_packet(Client *cptr, char *readbuf, int length, int killsafely);
+extern int process_recvq(Client *client, int killsafely);
 extern int parse_chanmode(ParseMode *pm, const char *modebuf_in, const char *parabuf_in);
 extern int dead_socket(Client *to, const char *notice);
 extern Match *unreal_create_match(MatchType type, const char *str, char **error);
@@ -1074,6 +1103,7 @@ extern int has_common_channels(Client *c1, Client *c2);
 extern int user_can_see_member(Client *user, Client *target, Channel *channel);
 extern int user_can_see_member_fast(Client *user, Client *target, Channel *channel, Member *target_member, const char *user_member_modes);
 extern int invisible_user_in_channel(Client *target, Channel *channel);
+extern int invisible_user_in_channel_fast(Client *target, Channel *channel, Member *target_member);
 extern MODVAR int tls_client_index;
 extern TLSOptions *FindTLSOptionsForUser(Client *acptr);
 extern int IsWebsocket(Client *acptr);
@@ -1109,6 +1139,9 @@ extern MODVAR int maxclients;
 extern int fast_badword_match(ConfigItem_badword *badword, const char *line);
 extern int fast_badword_replace(ConfigItem_badword *badword, const char *line, char *buf, int max);
 extern const char *stripbadwords(const char *str, ConfigItem_badword *start_bw, int *blocked);
+extern BadwordMatcher *badword_matcher_compile(ConfigItem_badword *start_bw);
+extern void badword_matcher_free(BadwordMatcher *m);
+extern const char *stripbadwords_matcher(const char *str, BadwordMatcher *m, int *blocked);
 extern int badword_config_process(ConfigItem_badword *ca, const char *str);
 extern void badword_config_free(ConfigItem_badword *ca);
 extern const char *badword_config_check_regex(const char *s, int fastsupport, int check_broadness);
@@ -1127,7 +1160,9 @@ extern MessageTag *find_mtag(MessageTag *mtags, const char *token);
 extern MessageTag *duplicate_mtag(MessageTag *mtag);
 #define safe_free_message_tags(x) do { if (x) free_message_tags(x); x = NULL; } while(0)
 extern void free_message_tags(MessageTag *m);
+extern void history_backend_init(void);
 extern int history_set_limit(const char *object, int max_lines, long max_t);
+extern const char *history_last_activity(const char *object);
 extern int history_add(const char *object, MessageTag *mtags, const char *line);
 extern HistoryResult *history_request(const char *object, HistoryFilter *filter);
 extern int history_delete(const char *object, HistoryFilter *filter, int *rejected_deletes);
@@ -1135,6 +1170,11 @@ extern int history_destroy(const char *object);
 extern int can_receive_history(Client *client);
 extern void history_send_result(Client *client, HistoryResult *r);
 extern void free_history_result(HistoryResult *r);
+extern HistoryLogLine *history_log_line_ref(HistoryLogLine *l);
+extern void history_log_line_unref(HistoryLogLine *l);
+extern void history_result_append_line(HistoryResult *r, HistoryLogLine *l);
+extern void history_result_prepend_line(HistoryResult *r, HistoryLogLine *l);
+extern void history_send_playback(Client *client, const char *object, HistoryFilter *filter);
 extern void free_history_filter(HistoryFilter *f);
 extern void special_delayed_unloading(void);
 extern int write_int64(FILE *fd, uint64_t t);
@@ -1223,6 +1263,14 @@ extern void skip_whitespace(char **p);
 extern void read_until(char **p, char *stopchars);
 extern int is_ip_valid(const char *ip);
 extern int is_file_readable(const char *file, const char *dir);
+/* textsimd.c */
+extern void text_kernels_init(void);
+extern const char *text_kernels_name(void);
+extern size_t text_ascii_span(const char *s, size_t len);
+extern size_t text_plain_span(const char *s, size_t len);
+extern size_t text_eol_span(const char *s, size_t len);
+extern void text_tolower(char *dst, const char *src, size_t len);
+extern uint64_t text_tolower64(uint64_t x);
 /* json.c */
 extern int log_json_filter;
 extern json_t *json_string_unreal(const char *s);
@@ -1361,7 +1409,9 @@ extern GeoIPResult *geoip_lookup(const char *ip);
 extern void free_geoip_result(GeoIPResult *r);
 extern const char *get_operlogin(Client *client);
 extern const char *get_operclass(Client *client);
+extern int get_reputation(Client *client);
 extern struct sockaddr *raw_client_ip(Client *client);
+extern void set_client_ip(Client *client, const char *ip);
 /* url stuff */
 extern const char *unreal_mkcache(const char *url);
 extern int has_cached_version(const char *url);
@@ -1401,6 +1451,12 @@ extern long get_connected_time(Client *client);
 extern time_t get_creationtime(Client *client);
 extern const char *StripControlCodes(const char *text);
 extern const char *StripControlCodesEx(const char *text, char *output, size_t outputlen, int strip_flags);
+extern TextContext *text_context_begin(const char *text);
+extern void text_context_end(TextContext *ctx);
+extern const char *text_context_stripped(const char *text);
+extern const char *text_context_casefolded(const char *text);
+extern int text_context_is_ascii(const char *text);
+extern uint64_t text_context_hash(const char *text);
 extern MODVAR Module *Modules;
 extern const char *command_issued_by_rpc(MessageTag *mtags);
 extern MODVAR int quick_close;
@@ -1425,3 +1481,37 @@ extern MODVAR DynamicSetBlock dynamic_set;
 extern void start_dns_and_ident_lookup(Client *client);
 extern void free_webserver(WebServer *webserver);
 #define safe_free_webserver(x)	do { if (x) { free_webserver(x); x = NULL; } } while(0)
+/* loopstats.c */
+extern MODVAR LoopHistogram loop_histogram[LOOP_PHASES];
+extern MODVAR LoopSlowIteration loop_slow_iterations[LOOP_SLOW_HISTORY];
+extern MODVAR long long loop_slow_iterations_total;
+extern long long loop_time_usec(void);
+extern void loop_iteration_start(void);
+extern void loop_phase_record(LoopPhase phase, long long start);
+extern void loop_io_start(void);
+extern void loop_io_ready(void);
+extern void loop_io_end(void);
+extern void loop_iteration_end(void);
+extern void loop_trace_record(LoopTraceType type, const char *name, const char *client, long long start);
+extern long long loop_histogram_percentile(LoopHistogram *h, double percentile);
+extern long long loop_histogram_bucket_value(int bucket);
+extern const char *loop_phase_name(LoopPhase phase);
+extern const char *loop_trace_type_name(LoopTraceType type);
+extern LoopSlowIteration *loop_slow_iteration(int n);
+/* expiryheap.c */
+extern void expiry_heap_add(ExpiryHeap *h, ExpiryHeapNode *n, time_t expire_at);
+extern void expiry_heap_del(ExpiryHeap *h, ExpiryHeapNode *n);
+extern ExpiryHeapNode *expiry_heap_first(ExpiryHeap *h);
+extern ExpiryHeapNode *expiry_heap_pop(ExpiryHeap *h, time_t now);
+extern void expiry_heap_free(ExpiryHeap *h);
+/* ipindex.c */
+extern int ipindex_key(const char *ip, char *key);
+extern int ipindex_key_is_ipv4(const char *key);
+extern int ipindex_mask_key(const char *mask, char *key, int *bits);
+extern const char *ipindex_key_to_ip(const char *key, char *buf, size_t buflen);
+extern int ipindex_add(IPIndex *idx, const char *key, int bits, void *value);
+extern void *ipindex_find(IPIndex *idx, const char *key, int bits);
+extern void *ipindex_match(IPIndex *idx, const char *key, int *bits);
+extern void *ipindex_del(IPIndex *idx, const char *key, int bits);
+extern void ipindex_walk(IPIndex *idx, const char *key, int bits, void (*callback)(const char *key, int bits, void *value, void *data), void *data);
+extern void ipindex_free(IPIndex *idx, void (*freefunc)(void *value));
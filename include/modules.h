@@ -151,8 +151,26 @@ struct ModDataInfo {
 	ModDataSync sync; /**< Send in netsynch (when servers connect) */
 	int remote_write; /**< Allow remote servers to set/unset this moddata, even if it they target one of our own clients */
 	int self_write; /**< Allow remote servers to set/unset moddata of their own server object (irc1.example.net writing the MD object of irc1.example.net) */
+	ModDataInfo *hnext; /**< Next entry in the by-name lookup hash (internal) */
 };
 
+/** A reference to a ModData slot by name, for code that does not
+ * register the moddata itself (eg: core code reading "certfp").
+ * Declare it once, eg:
+ * static ModDataRef certfp_ref = MODDATA_REF("certfp", MODDATATYPE_CLIENT);
+ * and pass it to moddata_ref() or the moddata_client_ref_*() accessors.
+ * The name is only looked up again after moddata was added or removed
+ * (eg: a module load or unload), otherwise it is a plain slot access.
+ */
+typedef struct ModDataRef ModDataRef;
+struct ModDataRef {
+	const char *name; /**< Name of the moddata */
+	ModDataType type; /**< Type of the moddata */
+	ModDataInfo *md; /**< Resolved moddata (internal, can be NULL) */
+	unsigned int generation; /**< When 'md' was resolved (internal) */
+};
+#define MODDATA_REF(name, type)	{ name, type, NULL, 0 }
+
 #define moddata_client(acptr, md)    acptr->moddata[md->slot]
 #define moddata_local_client(acptr, md)    acptr->local->moddata[md->slot]
 #define moddata_channel(channel, md)   channel->moddata[md->slot]
@@ -576,20 +594,31 @@ struct HistoryFilter {
         int limit;			/**< Maximum number of lines to return */
 };
 
-/** History log lines, used by HistoryResult among others */
+/** History log lines, as stored by the history backend.
+ * These are reference counted and shared with any HistoryResult
+ * that contains them, so they must be treated as read-only once added.
+ */
 typedef struct HistoryLogLine HistoryLogLine;
 struct HistoryLogLine {
 	HistoryLogLine *prev, *next;
+	int refcnt; /**< Reference count, see history_log_line_unref() */
 	time_t t;
 	MessageTag *mtags;
 	char line[1];
 };
 
+/** Entry in a HistoryResult, referencing a (shared) HistoryLogLine */
+typedef struct HistoryResultLine HistoryResultLine;
+struct HistoryResultLine {
+	HistoryResultLine *prev, *next;
+	HistoryLogLine *line;				/**< The log line (read-only!) */
+};
+
 typedef struct HistoryResult HistoryResult;
 struct HistoryResult {
         char *object;					/**< Name of the history object, eg '#test' */
-        HistoryLogLine *log;				/**< The resulting log lines */
-        HistoryLogLine *log_tail;			/**< Last entry in the log lines */
+        HistoryResultLine *log;				/**< The resulting log lines */
+        HistoryResultLine *log_tail;			/**< Last entry in the log lines */
 };
 
 /** History Backend */
@@ -995,6 +1024,13 @@ extern const char *moddata_client_get(Client *acptr, const char *varname);
 extern ModData *moddata_client_get_raw(Client *client, const char *varname);
 extern int moddata_local_client_set(Client *acptr, const char *varname, const char *value);
 extern const char *moddata_local_client_get(Client *acptr, const char *varname);
+extern ModDataInfo *moddata_ref(ModDataRef *ref);
+extern ModData *moddata_client_ref(Client *client, ModDataRef *ref);
+extern const char *moddata_client_ref_str(Client *client, ModDataRef *ref);
+extern int moddata_client_ref_int(Client *client, ModDataRef *ref);
+extern long moddata_client_ref_long(Client *client, ModDataRef *ref);
+extern long long moddata_client_ref_ll(Client *client, ModDataRef *ref);
+extern void *moddata_client_ref_ptr(Client *client, ModDataRef *ref);
 
 extern int LoadPersistentPointerX(ModuleInfo *modinfo, const char *varshortname, void **var, void (*free_variable)(ModData *m));
 #define LoadPersistentPointer(modinfo, var, free_variable) LoadPersistentPointerX(modinfo, #var, (void **)&var, free_variable)
@@ -2621,6 +2657,10 @@ enum EfunctionType {
 	EFUNC_CHECK_DENY_LINK,
 	EFUNC_MTAG_GENERATE_ISSUED_BY_IRC,
 	EFUNC_CANCEL_IDENT_LOOKUP,
+	EFUNC_WATCH_ADD_MANY,
+	EFUNC_WATCH_DEL_MANY,
+	EFUNC_TKL_BULK_BEGIN,
+	EFUNC_TKL_BULK_END,
 };
 
 /* Module flags */
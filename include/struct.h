@@ -133,6 +133,7 @@ typedef struct Server Server;
 typedef struct RPCClient RPCClient;
 typedef struct Link Link;
 typedef struct Ban Ban;
+typedef struct ListModeIndex ListModeIndex;
 typedef struct Mode Mode;
 typedef struct MessageTag MessageTag;
 typedef struct MOTDFile MOTDFile; /* represents a whole MOTD, including remote MOTD support info */
@@ -428,6 +429,9 @@ typedef enum ClientStatus {
 #define CLIENT_FLAG_IPUSERS_BUMPED	0x100000000	/**< The IpUsersBucket for this IP has been bumped (and needs to be decreased on disconnect) */
 #define CLIENT_FLAG_DEADSOCKET_IS_BANNED	0x200000000	/**< The deadsocket message should also send ERR_YOUREBANNEDCREEP and such */
 #define CLIENT_FLAG_CONNECT_FLOOD_CHECKED	0x400000000	/**< connect-flood has been checked (there are two hooks, so need this) */
+#define CLIENT_FLAG_AUTHPENDING		0x800000000	/**< Waiting for an asynchronous password check (Auth_CheckAsync) */
+#define CLIENT_FLAG_NOERRORMSG		0x1000000000	/**< Don't send "ERROR :Closing Link" on exit (plain HTTP clients) */
+#define CLIENT_FLAG_RAWIP		0x2000000000	/**< client->rawip is set (client->ip is an IP address) */
 /** @} */
 
 #define OPER_SNOMASKS "+bBcdfkqsSoO"
@@ -451,6 +455,7 @@ typedef enum ClientStatus {
 #define PROTO_MTAGS	0x000040	/* Support message tags and big buffers */
 #define PROTO_NEXTBANS	0x000080	/* Server supports named extended bans */
 #define PROTO_BIGLINES	0x000100	/* BIGLINES support */
+#define PROTO_TKLSYNC	0x000200	/* TKL digest sync (TKLD) support */
 
 /* For client capabilities: */
 #define CAP_INVERT	1L
@@ -522,6 +527,9 @@ typedef enum ClientStatus {
 #define IsVirus(x)			((x)->flags & CLIENT_FLAG_VIRUS)
 #define IsIdentLookupSent(x)		((x)->flags & CLIENT_FLAG_IDENTLOOKUPSENT)
 #define IsAsyncRPC(x)			((x)->flags & CLIENT_FLAG_ASYNC_RPC)
+#define IsAuthPending(x)		((x)->flags & CLIENT_FLAG_AUTHPENDING)
+#define IsNoErrorMsg(x)			((x)->flags & CLIENT_FLAG_NOERRORMSG)
+#define HasRawIP(x)			((x)->flags & CLIENT_FLAG_RAWIP)
 #define SetIdentLookup(x)		do { (x)->flags |= CLIENT_FLAG_IDENTLOOKUP; } while(0)
 #define SetClosing(x)			do { (x)->flags |= CLIENT_FLAG_CLOSING; } while(0)
 #define SetDCCBlock(x)			do { (x)->flags |= CLIENT_FLAG_DCCBLOCK; } while(0)
@@ -531,6 +539,8 @@ typedef enum ClientStatus {
 #define SetServerDisconnectLogged(x)	do { (x)->flags |= CLIENT_FLAG_SERVER_DISCONNECT_LOGGED; } while(0)
 #define SetUseIdent(x)			do { (x)->flags |= CLIENT_FLAG_USEIDENT; } while(0)
 #define SetDNSLookup(x)			do { (x)->flags |= CLIENT_FLAG_DNSLOOKUP; } while(0)
+#define SetAuthPending(x)		do { (x)->flags |= CLIENT_FLAG_AUTHPENDING; } while(0)
+#define SetNoErrorMsg(x)		do { (x)->flags |= CLIENT_FLAG_NOERRORMSG; } while(0)
 #define SetEAuth(x)			do { (x)->flags |= CLIENT_FLAG_EAUTH; } while(0)
 #define SetIdentSuccess(x)		do { (x)->flags |= CLIENT_FLAG_IDENTSUCCESS; } while(0)
 #define SetKilled(x)			do { (x)->flags |= CLIENT_FLAG_KILLED; } while(0)
@@ -562,6 +572,7 @@ typedef enum ClientStatus {
 #define ClearDeadSocket(x)		do { (x)->flags &= ~CLIENT_FLAG_DEADSOCKET; } while(0)
 #define ClearUseIdent(x)		do { (x)->flags &= ~CLIENT_FLAG_USEIDENT; } while(0)
 #define ClearDNSLookup(x)		do { (x)->flags &= ~CLIENT_FLAG_DNSLOOKUP; } while(0)
+#define ClearAuthPending(x)		do { (x)->flags &= ~CLIENT_FLAG_AUTHPENDING; } while(0)
 #define ClearEAuth(x)			do { (x)->flags &= ~CLIENT_FLAG_EAUTH; } while(0)
 #define ClearIdentSuccess(x)		do { (x)->flags &= ~CLIENT_FLAG_IDENTSUCCESS; } while(0)
 #define ClearKilled(x)			do { (x)->flags &= ~CLIENT_FLAG_KILLED; } while(0)
@@ -601,7 +612,7 @@ typedef enum ClientStatus {
 #define IsServerSent(x) (x->server && x->server->flags.server_sent)
 
 /* And more that access client stuff - but actually modularized */
-#define GetReputation(client) (moddata_client_get(client, "reputation") ? atoi(moddata_client_get(client, "reputation")) : 0) /**< Get reputation value for a client */
+#define GetReputation(client) get_reputation(client) /**< Get reputation value for a client */
 
 /* PROTOCTL (Server protocol) stuff */
 #ifndef DEBUGMODE
@@ -617,6 +628,7 @@ typedef enum ClientStatus {
 #define SupportMTAGS(x)		(CHECKSERVERPROTO(x, PROTO_MTAGS))
 #define SupportNEXTBANS(x)	(CHECKSERVERPROTO(x, PROTO_NEXTBANS))
 #define SupportBIGLINES(x)	(CHECKSERVERPROTO(x, PROTO_BIGLINES))
+#define SupportTKLSYNC(x)	(CHECKSERVERPROTO(x, PROTO_TKLSYNC))
 
 #define SetVL(x)		((x)->local->proto |= PROTO_VL)
 #define SetSJSBY(x)		((x)->local->proto |= PROTO_SJSBY)
@@ -625,6 +637,7 @@ typedef enum ClientStatus {
 #define SetMTAGS(x)		((x)->local->proto |= PROTO_MTAGS)
 #define SetNEXTBANS(x)		((x)->local->proto |= PROTO_NEXTBANS)
 #define SetBIGLINES(x)		((x)->local->proto |= PROTO_BIGLINES)
+#define SetTKLSYNC(x)		((x)->local->proto |= PROTO_TKLSYNC)
 
 /* Dcc deny types (see src/s_extra.c) */
 #define DCCDENY_HARD	0
@@ -808,6 +821,25 @@ struct MultiLine {
 	char *line;
 };
 
+typedef struct TextContext TextContext;
+/** Per-message text context.
+ * Holds the derived forms of a message text that several modules
+ * need (floodprot, censor, spamfilter, antimixedutf8, ..), so they
+ * are only calculated once per message instead of once per module.
+ * The fields are filled in lazily by the text_context_*() functions.
+ * @see text_context_begin(), text_context_end()
+ */
+struct TextContext {
+	TextContext *prev; /**< Outer context, in case of nesting */
+	int refcnt; /**< Number of text_context_begin() calls for this text */
+	const char *text; /**< The original text (not owned by us) */
+	char *stripped; /**< Text with control codes stripped, or NULL if not calculated yet */
+	char *casefolded; /**< Stripped text in lowercase, or NULL if not calculated yet */
+	int is_ascii; /**< Text consists of ASCII characters only (-1 if not calculated yet) */
+	int have_hash; /**< Is 'hash' set? */
+	uint64_t hash; /**< Hash of the casefolded text, see text_context_hash() */
+};
+
 struct MOTDFile 
 {
 	struct MOTDLine *lines;
@@ -867,15 +899,15 @@ typedef struct Match {
 } Match;
 
 typedef struct Whowas {
-	int  hashv;
+	uint64_t serial;	/**< Serial number, 0 if not in the WHOWAS store */
 	char *name;
-	char *username;
-	char *hostname;
-	char *virthost;
-	char *ip;
-	char *servername;
-	char *realname;
-	char *account;
+	const char *username;	/**< Interned, see whowas_intern() */
+	const char *hostname;	/**< Interned */
+	const char *virthost;	/**< Interned */
+	const char *ip;		/**< Interned */
+	char *servername;	/**< Points into the scache */
+	const char *realname;	/**< Interned */
+	const char *account;	/**< Interned */
 	long umodes;
 	time_t logon;
 	time_t logoff;
@@ -883,9 +915,9 @@ typedef struct Whowas {
 	WhoWasEvent event;
 	struct Client *online;	/* Pointer to new nickname for chasing or NULL */
 	struct Whowas *next;	/* for hash table... */
-	struct Whowas *prev;	/* for hash table... */
 	struct Whowas *cnext;	/* for client struct linked list */
-	struct Whowas *cprev;	/* for client struct linked list */
+	struct Whowas *ipnext;	/* for IP index */
+	struct Whowas *accountnext;	/* for account index */
 } WhoWas;
 
 typedef struct SWhois SWhois;
@@ -1141,6 +1173,33 @@ typedef enum BanAction {
                               (x == BAN_ACT_SOFT_WARN))
 
 
+/** A node in an ExpiryHeap, embedded in the item that can expire. See expiryheap.c */
+typedef struct ExpiryHeapNode ExpiryHeapNode;
+struct ExpiryHeapNode {
+	time_t expire_at; /**< When the item expires */
+	int index; /**< Position in the heap plus one, or 0 if not in the heap */
+};
+
+/** A min-heap of items, ordered by expiry time. See expiryheap.c */
+typedef struct ExpiryHeap ExpiryHeap;
+struct ExpiryHeap {
+	ExpiryHeapNode **node;
+	int num;
+	int max;
+};
+
+/** Length of a key in an IPIndex: an IPv6 address, IPv4 is stored IPv4-mapped. See ipindex.c */
+#define IPINDEX_KEYLEN	16
+
+typedef struct IPIndexNode IPIndexNode;
+
+/** An index of IP addresses and CIDR ranges. See ipindex.c */
+typedef struct IPIndex IPIndex;
+struct IPIndex {
+	IPIndexNode *root;
+	int count; /**< Number of entries */
+};
+
 /** Server ban sub-struct of TKL entry (KLINE/GLINE/ZLINE/GZLINE/SHUN) */
 struct ServerBan {
 	char *usermask; /**< User mask */
@@ -1180,6 +1239,9 @@ struct BanException {
 #define TKL_SUBTYPE_SOFT	0x0001 /* (require SASL) */
 
 #define TKL_FLAG_CONFIG		0x0001 /* Entry from configuration file. Cannot be removed by using commands. */
+#define TKL_FLAG_BANCHECK_PENDING	0x0002 /* New server ban, not yet checked against the local users */
+#define TKL_FLAG_BULK_PENDING		0x0004 /* Added during a bulk operation, not yet broadcasted */
+#define TKL_FLAG_SYNC_INDEXED		0x0008 /* In tkl_sync_leaf[] */
 
 /** A TKL entry, such as a KLINE, GLINE, Spamfilter, QLINE, Exception, .. */
 struct TKL {
@@ -1189,6 +1251,9 @@ struct TKL {
 	char *set_by; /**< By who was this entry added */
 	time_t set_at; /**< When this entry was added */
 	time_t expire_at; /**< When this entry will expire */
+	ExpiryHeapNode expiry; /**< Position in tkl_expiry_heap, if expire_at is set */
+	TKL *sync_prev, *sync_next; /**< In tkl_sync_leaf[], only for global entries */
+	unsigned short sync_leaf; /**< Index in tkl_sync_leaf[] */
 	union {
 		Spamfilter *spamfilter;
 		ServerBan *serverban;
@@ -1309,6 +1374,7 @@ extern void unload_all_unused_moddata(void);
 #define TLSFLAG_FAILIFNOCERT 		0x0001
 #define TLSFLAG_NOSTARTTLS		0x0002
 #define TLSFLAG_DISABLECLIENTCERT	0x0004
+#define TLSFLAG_NORELEASEBUFFERS	0x0008
 
 /** Flood counters for local clients */
 typedef struct FloodCounter {
@@ -1336,6 +1402,60 @@ struct TrafficStats {
 	long long messages_received;	/* IRC lines received */
 	long long bytes_sent;		/* Bytes sent */
 	long long bytes_received;	/* Received bytes */
+	long long reads;		/* Socket reads that returned data */
+};
+
+/** Phases of the main loop, see SocketLoop() and loopstats.c */
+typedef enum LoopPhase {
+	LOOP_PHASE_EVENTS	= 0,	/**< DoEvents() */
+	LOOP_PHASE_IO		= 1,	/**< fd_select() callback dispatching (not the waiting) */
+	LOOP_PHASE_CLIENTS	= 2,	/**< process_clients() */
+	LOOP_PHASE_ITERATION	= 3,	/**< Entire loop iteration, excluding time spent waiting for I/O */
+} LoopPhase;
+#define LOOP_PHASES 4
+
+/** What a loop trace item refers to */
+typedef enum LoopTraceType {
+	LOOP_TRACE_EVENT	= 0,	/**< An event, name is the event name */
+	LOOP_TRACE_IO		= 1,	/**< An I/O callback, name is the fd description */
+	LOOP_TRACE_COMMAND	= 2,	/**< A command, name is the command and client is the sender */
+} LoopTraceType;
+
+/* Latency histogram: exact below 8 usec, above that 8 sub-buckets
+ * per power of two, so every bucket is within 12.5% of its value.
+ */
+#define LOOP_HISTOGRAM_SUB_BITS	3
+#define LOOP_HISTOGRAM_BUCKETS	(((32 - LOOP_HISTOGRAM_SUB_BITS) + 1) << LOOP_HISTOGRAM_SUB_BITS)
+
+typedef struct LoopHistogram LoopHistogram;
+/** Latency histogram of one loop phase, all values in microseconds */
+struct LoopHistogram {
+	long long count;			/**< Number of samples */
+	long long total;			/**< Sum of all samples */
+	long long max;				/**< Highest sample */
+	long long bucket[LOOP_HISTOGRAM_BUCKETS];
+};
+
+#define LOOP_TRACE_TOP		5	/**< Costliest items remembered per loop iteration */
+#define LOOP_SLOW_HISTORY	16	/**< Slow loop iterations remembered */
+
+typedef struct LoopTraceItem LoopTraceItem;
+/** A single timed callback, command or event within a loop iteration */
+struct LoopTraceItem {
+	LoopTraceType type;
+	char name[64];
+	char client[NICKLEN+1];
+	long long usec;
+};
+
+typedef struct LoopSlowIteration LoopSlowIteration;
+/** A loop iteration that took longer than set::slow-loop-threshold */
+struct LoopSlowIteration {
+	time_t when;
+	long long usec;				/**< Total (busy) time of the iteration */
+	long long phase_usec[LOOP_PHASES];	/**< Time spent in each phase */
+	int num_items;
+	LoopTraceItem item[LOOP_TRACE_TOP];	/**< Costliest items, most expensive first */
 };
 
 /** Socket type (IPv4, IPv6, UNIX) */
@@ -1374,6 +1494,7 @@ struct Client {
 	struct list_head id_hash;		/**< For UID/SID hash table (idTable) */
 	Client *uplink;				/**< Server on where this client is connected to (can be &me) */
 	char *ip;				/**< IP address of user or server (never NULL) */
+	char rawip[IPINDEX_KEYLEN];		/**< IP address in binary form, if HasRawIP(). Set by set_client_ip() */
 	ModData moddata[MODDATA_MAX_CLIENT];	/**< Client attached module data, used by the ModData system */
 };
 
@@ -1510,6 +1631,11 @@ struct AuthConfig {
 	char			*data; /**< Data associated with this record */
 };
 
+/** Callback for Auth_CheckAsync(), result is 1 on success, 0 on failure
+ * and -1 if the check was cancelled by Auth_CancelAsyncByCallback().
+ */
+typedef void (*AuthCheckCallback)(Client *client, int result, void *data);
+
 #ifndef HAVE_CRYPT
 #define crypt DES_crypt
 #endif
@@ -1834,6 +1960,14 @@ struct WebRequest {
 	TransferEncoding transfer_encoding;
 	long long config_max_request_buffer_size; /**< CONFIG: Maximum request length allowed */
 	HTTPForwardedHeader *forwarded; /**< If using a proxy */
+	int keep_alive; /**< Connection is kept open after the response (HTTP keep-alive) */
+	int num_requests; /**< Number of requests answered on this connection */
+	int response_status; /**< HTTP status of the deferred response */
+	int response_deferred; /**< Response headers are held back until the body is complete (keep-alive) */
+	dbuf response; /**< Body of the deferred response */
+	const char *response_content_type; /**< Content-Type of the response, if set by the request handler */
+	char *pipeline; /**< Data received after the current request (pipelining) */
+	int pipelinelen; /**< Length of pipeline buffer */
 };
 
 typedef struct WebServer WebServer;
@@ -1888,6 +2022,7 @@ struct ConfigItem_listen {
 	void (*start_handshake)(Client *client); /**< Function to call on accept() */
 	int websocket_options;		/**< Websocket options (for the websocket module) */
 	int rpc_options;		/**< For the RPC module */
+	int metrics_options;		/**< For the metrics module */
 };
 
 struct ConfigItem_sni {
@@ -2135,6 +2270,8 @@ struct IRCStatistics {
 	unsigned int is_abad;	/* bad auth requests */
 	unsigned int is_udp;	/* packets recv'd on udp port */
 	unsigned int is_loc;	/* local connections made */
+	unsigned int is_tls;	/* completed TLS handshakes */
+	unsigned int is_tlsbad;	/* failed TLS handshakes */
 };
 
 #define EXTCMODETABLESZ 32
@@ -2154,7 +2291,7 @@ struct Mode {
 	void *mode_params[MAXPARAMMODES+1];	/**< Parameters for extended channel modes */
 };
 
-/* flags for Link if used to contain Watch --k4be */
+/* flags for WatchSubscriber and WatchListEntry --k4be */
 
 /* WATCH type */
 #define WATCH_FLAG_TYPE_WATCH	(1<<0) /* added via /WATCH command */
@@ -2174,16 +2311,47 @@ struct Mode {
 #define WATCH_EVENT_LOGGEDIN	7
 #define WATCH_EVENT_LOGGEDOUT	8
 
+/** A client that is watching a nick, see struct Watch */
+typedef struct WatchSubscriber WatchSubscriber;
+struct WatchSubscriber {
+	Client *client;		/**< The client watching the nick (NULL for an unused hash slot) */
+	int flags;		/**< WATCH_FLAG_* */
+};
+
+/** Number of subscribers stored inside the Watch itself. Nicks with
+ * more subscribers than this use a hash set (see watch-backend).
+ */
+#define WATCH_INLINE_SUBSCRIBERS	2
+
 /* Used for notify-hash buckets... -Donwulff */
 
 struct Watch {
 	Watch *hnext;
 	time_t lasttime;
-	Link *watch;
+	int num_subscribers;		/**< Number of clients watching this nick */
+	int subscribers_size;		/**< Number of slots in 'subscribers', or 0 if 'inline_subscribers' is used */
+	WatchSubscriber *subscribers;	/**< Hash set of subscribers (only if subscribers_size is non-zero) */
+	WatchSubscriber inline_subscribers[WATCH_INLINE_SUBSCRIBERS];	/**< Subscribers, for nicks with few of them */
+	char del_mark;			/**< Used internally by watch_del_many() */
 	char nick[1];
 };
 
-/** General link structure used for certain chains (watch list, invite list, dccallow).
+/** A nick on the watch list of a client */
+typedef struct WatchListEntry WatchListEntry;
+struct WatchListEntry {
+	Watch *watch;
+	int flags;		/**< WATCH_FLAG_* */
+};
+
+/** The watch list of a client (WATCH and MONITOR entries) */
+typedef struct WatchList WatchList;
+struct WatchList {
+	int num_entries;
+	int size;
+	WatchListEntry *entries;
+};
+
+/** General link structure used for certain chains (invite list, dccallow).
  * Note that these always require you to use the make_link() and free_link() functions.
  * Do not combine with other alloc/free functions!!
  */
@@ -2193,7 +2361,6 @@ struct Link {
 	union {
 		Client *client;
 		Channel *channel;
-		Watch *wptr;
 		/* there used to be 'char *cp' here too,
 		 * but in such a case you better use NameList
 		 * instead of Link!
@@ -2220,9 +2387,14 @@ struct Channel {
 	time_t topic_time;			/**< Time at which the topic was last set */
 	int users;				/**< Number of users in the channel */
 	Member *members;			/**< List of channel members (users in the channel) */
+	Member **local_members;			/**< The members that are local users (a subset of 'members') */
+	int local_member_count;			/**< Number of entries in 'local_members' */
+	int local_member_size;			/**< Allocated size of 'local_members' */
+	unsigned int member_serial;		/**< Changed on every join, part and member mode change (for caches) */
 	Ban *banlist;				/**< List of bans (+b) */
 	Ban *exlist;				/**< List of ban exceptions (+e) */
 	Ban *invexlist;				/**< List of invite exceptions (+I) */
+	ListModeIndex *listmode_index[3];	/**< Hash indexes for banlist, exlist and invexlist (or NULL) */
 	char *mode_lock;			/**< Mode lock (MLOCK) applied to channel - usually by Services */
 	ModData moddata[MODDATA_MAX_CHANNEL];	/**< Channel attached module data, used by the ModData system */
 	char name[CHANNELLEN+1];		/**< Channel name */
@@ -2238,6 +2410,7 @@ struct Member
 	struct Member *next;				/**< Next entry in list */
 	Client	      *client;				/**< The client */
 	char member_modes[MEMBERMODESLEN];		/**< The access of the user on this channel (eg "vhoqa") */
+	int local_index;				/**< Position in channel->local_members (local users only) */
 	ModData moddata[MODDATA_MAX_MEMBER];		/** Member attached module data, used by the ModData system */
 };
 
@@ -2259,11 +2432,24 @@ struct Membership
 /** A ban, exempt or invite exception entry */
 struct Ban {
 	struct Ban *next;	/**< Next entry in list */
+	struct Ban *prev;	/**< Previous entry in list (only maintained for channel lists) */
+	struct Ban *hnext;	/**< Next entry in the ListModeIndex hash bucket */
 	char *banstr;		/**< The string (eg: *!*@*.example.org) */
 	char *who;		/**< Person or server who set the entry (eg: Nick) */
 	time_t when;		/**< When the entry was added */
 };
 
+/** Hash index over one list mode (+b/+e/+I) of a channel.
+ * The Ban list itself stays the authoritative (display) order,
+ * this only serves lookups by mask. Maintained by add_listmode_ex(),
+ * del_listmode(), link_listmode() and free_listmode_list().
+ */
+struct ListModeIndex {
+	Ban **table;		/**< Hash buckets, chained via Ban->hnext */
+	unsigned int size;	/**< Number of buckets (power of two) */
+	unsigned int count;	/**< Number of entries in the list */
+};
+
 /* Channel macros */
 #define MODE_EXCEPT		0x0200
 #define	MODE_BAN		0x0400
@@ -2335,7 +2521,7 @@ extern MODVAR SSL_CTX *ctx_client;
 struct ThrottlingBucket
 {
 	struct ThrottlingBucket *prev, *next;
-	char *ip;
+	char rawip[IPINDEX_KEYLEN];
 	time_t since;
 	char count;
 };
@@ -2343,8 +2529,7 @@ struct ThrottlingBucket
 typedef struct IpUsersBucket IpUsersBucket;
 struct IpUsersBucket
 {
-	IpUsersBucket *prev, *next;
-	char rawip[16];
+	char rawip[IPINDEX_KEYLEN];
 	int local_clients;
 	int global_clients;
 };
@@ -2419,6 +2604,11 @@ struct MaxTarget {
 #define TKLISTLEN		26
 #define TKLIPHASHLEN1		4
 #define TKLIPHASHLEN2		1021
+/* TKL digest sync: global entries are spread over TKL_SYNC_LEAVES
+ * leaves, which are grouped in TKL_SYNC_BUCKETS buckets.
+ */
+#define TKL_SYNC_BUCKETS	64
+#define TKL_SYNC_LEAVES		(TKL_SYNC_BUCKETS*64)
 
 #define MATCH_CHECK_IP              0x0001
 #define MATCH_CHECK_REAL_HOST       0x0002
@@ -2468,6 +2658,9 @@ struct ConfigItem_badword {
 	pcre2_code	*pcre2_expr;
 };
 
+/** Compiled badword list, see badword_matcher_compile() */
+typedef struct BadwordMatcher BadwordMatcher;
+
 /*-- end of badwords --*/
 
 /* Flags for 'sendflags' in 'sendto_channel' */
@@ -919,12 +919,14 @@ void add_member_mode_fast(Member *mb, Membership *mbs, char letter)
 {
 	addlettertomstring(mb->member_modes, letter);
 	addlettertomstring(mbs->member_modes, letter);
+	mbs->channel->member_serial++;
 }
 
 void del_member_mode_fast(Member *mb, Membership *mbs, char letter)
 {
 	delletterfromstring(mb->member_modes, letter);
 	delletterfromstring(mbs->member_modes, letter);
+	mbs->channel->member_serial++;
 }
 
 int find_mbs(Client *client, Channel *channel, Member **mb, Membership **mbs)
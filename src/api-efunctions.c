@@ -135,8 +135,12 @@ void (*kick_user)(MessageTag *mtags, Channel *channel, Client *client, Client *v
 int (*watch_add)(const char *nick, Client *client, int flags);
 int (*watch_del)(const char *nick, Client *client, int flags);
 int (*watch_del_list)(Client *client, int flags);
+int (*watch_add_many)(Client *client, const char **nicks, int count, int flags, int max);
+int (*watch_del_many)(Client *client, const char **nicks, int count, int flags);
+void (*tkl_bulk_begin)(Client *client);
+int (*tkl_bulk_end)(Client *client);
 Watch *(*watch_get)(const char *nick);
-int (*watch_check)(Client *client, int reply, int (*watch_notify)(Client *client, Watch *watch, Link *lp, int event));
+int (*watch_check)(Client *client, int reply, void *data, int (*watch_notify)(Client *client, Watch *watch, WatchSubscriber *sub, int event, void *data));
 void (*do_unreal_log_remote_deliver)(LogLevel loglevel, const char *subsystem, const char *event_id, MultiLine *msg, const char *json_serialized);
 char *(*get_chmodes_for_user)(Client *client, const char *flags);
 WhoisConfigDetails (*whois_get_policy)(Client *client, Client *target, const char *name);
@@ -453,4 +457,8 @@ void efunctions_init(void)
 	efunc_init_function(EFUNC_CHECK_DENY_LINK, check_deny_link, NULL);
 	efunc_init_function(EFUNC_MTAG_GENERATE_ISSUED_BY_IRC, mtag_add_issued_by, mtag_add_issued_by_default_handler);
 	efunc_init_function(EFUNC_CANCEL_IDENT_LOOKUP, cancel_ident_lookup, cancel_ident_lookup_default_handler);
+	efunc_init_function(EFUNC_WATCH_ADD_MANY, watch_add_many, NULL);
+	efunc_init_function(EFUNC_WATCH_DEL_MANY, watch_del_many, NULL);
+	efunc_init_function(EFUNC_TKL_BULK_BEGIN, tkl_bulk_begin, NULL);
+	efunc_init_function(EFUNC_TKL_BULK_END, tkl_bulk_end, NULL);
 }
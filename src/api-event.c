@@ -193,7 +193,9 @@ void DoEvents(void)
 		}
 		if ((e->every_msec == 0) || minimum_msec_since_last_run(&e->last_run, e->every_msec))
 		{
+			long long start = loop_time_usec();
 			(*e->event)(e->data);
+			loop_trace_record(LOOP_TRACE_EVENT, e->name, NULL, start);
 			if (e->count > 0)
 			{
 				e->count--;
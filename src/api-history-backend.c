@@ -24,8 +24,55 @@
 
 MODVAR HistoryBackend *historybackends = NULL; /**< List of registered history backends */
 
+#define HISTORY_CACHE_HASH_TABLE_SIZE 1019
+
+/** Pre-rendered playback lines for one type of receiving client.
+ * Clients with the same user type (oper or not) and the same
+ * capabilities that affect message tags get the exact same output,
+ * the same principle as the LineCache in src/send.c.
+ */
+typedef struct HistoryPlaybackVariant HistoryPlaybackVariant;
+struct HistoryPlaybackVariant {
+	HistoryPlaybackVariant *prev, *next;
+	int oper;		/**< Rendered for an IRCOp? */
+	unsigned long caps;	/**< Client capabilities that affect message tags */
+	int num_lines;		/**< Number of entries in 'lines' */
+	char **lines;		/**< Rendered lines: message tags (if any) and the line, without batch tag and CRLF */
+};
+
+/** Per-object state kept by the history layer itself (not by the backend) */
+typedef struct HistoryObjectCache HistoryObjectCache;
+struct HistoryObjectCache {
+	HistoryObjectCache *prev, *next;
+	char *object;			/**< Name of the history object, eg '#test' */
+	long max_time;			/**< Maximum time, as last set through history_set_limit() */
+	/* Playback cache, see history_send_playback(): */
+	int last_lines;			/**< Filter used to build 'playback': number of lines */
+	int last_seconds;		/**< Filter used to build 'playback': number of seconds */
+	HistoryResult *playback;	/**< Cached result (referencing the backend lines) or NULL */
+	time_t playback_valid_until;	/**< When the oldest line in 'playback' falls out of the window */
+	HistoryPlaybackVariant *variants; /**< Pre-rendered output of 'playback' */
+	/* Last activity, see history_last_activity(): */
+	int last_activity_known;	/**< Set if 'last_activity' is up to date */
+	char *last_activity;		/**< Timestamp of the newest line, NULL if there are no lines */
+	time_t last_activity_t;		/**< Same as 'last_activity' but as a unix timestamp */
+};
+
+static char siphashkey_history_cache[SIPHASH_KEY_LENGTH];
+static HistoryObjectCache *history_cache_hash_table[HISTORY_CACHE_HASH_TABLE_SIZE];
+
+/* Forward declarations */
+static HistoryObjectCache *history_cache_find(const char *object);
+static HistoryObjectCache *history_cache_find_or_add(const char *object);
+static void history_cache_invalidate(const char *object);
+static void history_cache_clear_last_activity(HistoryObjectCache *c);
+static void history_cache_invalidate_all(void);
+static void history_cache_delete(const char *object);
+
 void history_backend_init(void)
 {
+	siphash_generate_key(siphashkey_history_cache);
+	memset(history_cache_hash_table, 0, sizeof(history_cache_hash_table));
 }
 
 /**
@@ -114,6 +161,8 @@ void unload_history_backend_commit(HistoryBackend *m)
 	DelListItem(m, historybackends);
 	safe_free(m->name);
 	safe_free(m);
+	/* Cached results may have come from this backend */
+	history_cache_invalidate_all();
 }
 
 /**
@@ -153,15 +202,43 @@ void unload_all_unused_history_backends(void)
 		if (m->unloaded)
 			unload_history_backend_commit(m);
 	}
+
+	/* The pre-rendered playback depends on the loaded message tag
+	 * handlers and client capabilities, which may have changed.
+	 */
+	history_cache_invalidate_all();
 }
 
 int history_add(const char *object, MessageTag *mtags, const char *line)
 {
 	HistoryBackend *hb;
+	HistoryObjectCache *c;
+	MessageTag *m;
+	const char *t;
 
 	for (hb = historybackends; hb; hb=hb->next)
 		hb->history_add(object, mtags, line);
 
+	history_cache_invalidate(object);
+
+	/* Keep the last activity up to date, if we know it.
+	 * If we don't, then history_last_activity() will ask the backend.
+	 */
+	c = history_cache_find(object);
+	if (c && c->last_activity_known)
+	{
+		/* Without a time tag the backends stamp the line with the current time */
+		if ((m = find_mtag(mtags, "time")) && m->value)
+			t = m->value;
+		else
+			t = timestamp_iso8601_now();
+		if (!c->last_activity || (strcmp(t, c->last_activity) > 0))
+		{
+			safe_strdup(c->last_activity, t);
+			c->last_activity_t = server_time_to_unix_time(t);
+		}
+	}
+
 	return 1;
 }
 
@@ -208,6 +285,14 @@ int history_delete(const char *object, HistoryFilter *filter, int *rejected_dele
 	if (rejected_deletes)
 		*rejected_deletes = max_rejected_deletes;
 
+	if (max_deleted)
+	{
+		HistoryObjectCache *c = history_cache_find(object);
+		history_cache_invalidate(object);
+		if (c)
+			history_cache_clear_last_activity(c);
+	}
+
 	return max_deleted;
 }
 
@@ -218,28 +303,139 @@ int history_destroy(const char *object)
 	for (hb = historybackends; hb; hb=hb->next)
 		hb->history_destroy(object);
 
+	history_cache_delete(object);
+
 	return 1;
 }
 
 int history_set_limit(const char *object, int max_lines, long max_t)
 {
 	HistoryBackend *hb;
+	HistoryObjectCache *c;
 
 	for (hb = historybackends; hb; hb=hb->next)
 		hb->history_set_limit(object, max_lines, max_t);
 
+	c = history_cache_find_or_add(object);
+	c->max_time = max_t;
+	history_cache_invalidate(object);
+
 	return 1;
 }
 
+/** Returns the time of the most recent line in a history object.
+ * This is cheap: it is maintained by history_add() and the backend
+ * is only asked after a restart, deletion or backend change.
+ * It is used by things like CHATHISTORY TARGETS that only need to
+ * know when a target was last active, and not the line itself.
+ * @param object	The history object, eg '#test'
+ * @returns The "time" message tag value of the newest line,
+ *          or NULL if there is no history for this object.
+ * @note The returned value is only valid until the next history call.
+ */
+const char *history_last_activity(const char *object)
+{
+	HistoryObjectCache *c;
+	HistoryFilter filter;
+	HistoryResult *r;
+	MessageTag *m;
+
+	if (!historybackends)
+		return NULL;
+
+	/* Objects with history always had history_set_limit() called on them */
+	c = history_cache_find(object);
+	if (!c)
+		return NULL;
+
+	/* If the newest line expired, then so did all the others */
+	if (c->last_activity_known && c->last_activity && c->max_time &&
+	    (c->last_activity_t < TStime() - c->max_time))
+	{
+		history_cache_clear_last_activity(c);
+	}
+
+	if (!c->last_activity_known)
+	{
+		memset(&filter, 0, sizeof(filter));
+		filter.cmd = HFC_LATEST;
+		filter.limit = 1;
+		r = history_request(object, &filter);
+		if (r && r->log && (m = find_mtag(r->log->line->mtags, "time")) && m->value)
+		{
+			safe_strdup(c->last_activity, m->value);
+			c->last_activity_t = server_time_to_unix_time(m->value);
+		}
+		if (r)
+			free_history_result(r);
+		c->last_activity_known = 1;
+	}
+
+	return c->last_activity;
+}
+
+/** Take a reference to a history log line.
+ * @param l	The history log line
+ * @returns The same line, for convenience.
+ */
+HistoryLogLine *history_log_line_ref(HistoryLogLine *l)
+{
+	l->refcnt++;
+	return l;
+}
+
+/** Drop a reference to a history log line, freeing it if this was the last one.
+ * History backends use this instead of freeing lines directly, since the
+ * line may still be referenced from a HistoryResult or the playback cache.
+ * @param l	The history log line
+ */
+void history_log_line_unref(HistoryLogLine *l)
+{
+	if (--l->refcnt > 0)
+		return;
+	free_message_tags(l->mtags);
+	safe_free(l);
+}
+
+/** Append history log line 'l' to result 'r' (without copying) */
+void history_result_append_line(HistoryResult *r, HistoryLogLine *l)
+{
+	HistoryResultLine *n = safe_alloc(sizeof(HistoryResultLine));
+
+	n->line = history_log_line_ref(l);
+	if (!r->log)
+	{
+		/* First item */
+		r->log = r->log_tail = n;
+	} else
+	{
+		/* Quick append to tail */
+		r->log_tail->next = n;
+		n->prev = r->log_tail;
+		r->log_tail = n; /* we are the new tail */
+	}
+}
+
+/** Prepend history log line 'l' to result 'r' (without copying) */
+void history_result_prepend_line(HistoryResult *r, HistoryLogLine *l)
+{
+	HistoryResultLine *n = safe_alloc(sizeof(HistoryResultLine));
+
+	n->line = history_log_line_ref(l);
+	if (!r->log)
+		r->log_tail = n;
+	AddListItem(n, r->log);
+}
+
 /** Free a HistoryResult object that was returned from request_result() earlier */
 void free_history_result(HistoryResult *r)
 {
-	HistoryLogLine *l, *l_next;
-	for (l = r->log; l; l = l_next)
+	HistoryResultLine *n, *n_next;
+	for (n = r->log; n; n = n_next)
 	{
-		l_next = l->next;
-		free_message_tags(l->mtags);
-		safe_free(l);
+		n_next = n->next;
+		history_log_line_unref(n->line);
+		safe_free(n);
 	}
 	safe_free(r->object);
 	safe_free(r);
@@ -264,14 +460,31 @@ static void history_send_result_line(Client *client, HistoryLogLine *l, const ch
 	{
 		sendto_one(client, l->mtags, "%s", l->line);
 	} else {
-		MessageTag *m = safe_alloc(sizeof(MessageTag));
-		m->name = "batch";
-		m->value = strdup(batchid);
-		AddListItem(m, l->mtags);
-		sendto_one(client, l->mtags, "%s", l->line);
-		safe_free(m->value);
-		DelListItem(m, l->mtags);
-		safe_free(m);
+		/* The log line is shared, so we must not modify l->mtags.
+		 * Simply put the batch tag in front of it instead.
+		 */
+		MessageTag m;
+		memset(&m, 0, sizeof(m));
+		m.name = "batch";
+		m.value = (char *)batchid;
+		m.next = l->mtags;
+		sendto_one(client, &m, "%s", l->line);
+	}
+}
+
+/** Start a chathistory batch for 'object', if the client supports batches.
+ * @param client	The client to send to.
+ * @param object	The history object, eg '#test'.
+ * @param batch		Buffer of BATCHLEN+1, set to the batch id or an empty string.
+ */
+static void history_send_batch_start(Client *client, const char *object, char *batch)
+{
+	batch[0] = '\0';
+	if (HasCapability(client, "batch"))
+	{
+		/* Start a new batch */
+		generate_batch_id(batch);
+		sendto_one(client, NULL, ":%s BATCH +%s chathistory %s", me.name, batch, object);
 	}
 }
 
@@ -282,21 +495,233 @@ static void history_send_result_line(Client *client, HistoryLogLine *l, const ch
 void history_send_result(Client *client, HistoryResult *r)
 {
 	char batch[BATCHLEN+1];
-	HistoryLogLine *l;
+	HistoryResultLine *n;
 
 	if (!can_receive_history(client))
 		return;
 
-	batch[0] = '\0';
-	if (HasCapability(client, "batch"))
+	history_send_batch_start(client, r->object, batch);
+
+	for (n = r->log; n; n = n->next)
+		history_send_result_line(client, n->line, batch);
+
+	/* End of batch */
+	if (*batch)
+		sendto_one(client, NULL, ":%s BATCH -%s", me.name, batch);
+}
+
+/*** Playback cache ***/
+
+static uint64_t history_cache_hash(const char *object)
+{
+	return siphash_nocase(object, siphashkey_history_cache) % HISTORY_CACHE_HASH_TABLE_SIZE;
+}
+
+static HistoryObjectCache *history_cache_find(const char *object)
+{
+	HistoryObjectCache *c;
+
+	for (c = history_cache_hash_table[history_cache_hash(object)]; c; c = c->next)
+		if (!strcasecmp(object, c->object))
+			return c;
+	return NULL;
+}
+
+static HistoryObjectCache *history_cache_find_or_add(const char *object)
+{
+	HistoryObjectCache *c = history_cache_find(object);
+
+	if (c)
+		return c;
+	c = safe_alloc(sizeof(HistoryObjectCache));
+	safe_strdup(c->object, object);
+	AddListItem(c, history_cache_hash_table[history_cache_hash(object)]);
+	return c;
+}
+
+static void free_history_playback_variants(HistoryObjectCache *c)
+{
+	HistoryPlaybackVariant *v, *v_next;
+	int i;
+
+	for (v = c->variants; v; v = v_next)
 	{
-		/* Start a new batch */
-		generate_batch_id(batch);
-		sendto_one(client, NULL, ":%s BATCH +%s chathistory %s", me.name, batch, r->object);
+		v_next = v->next;
+		for (i = 0; i < v->num_lines; i++)
+			safe_free(v->lines[i]);
+		safe_free(v->lines);
+		safe_free(v);
+	}
+	c->variants = NULL;
+}
+
+static void history_cache_clear_playback(HistoryObjectCache *c)
+{
+	free_history_playback_variants(c);
+	if (c->playback)
+	{
+		free_history_result(c->playback);
+		c->playback = NULL;
+	}
+}
+
+/** Forget the last activity of a history object, eg after lines were deleted */
+static void history_cache_clear_last_activity(HistoryObjectCache *c)
+{
+	c->last_activity_known = 0;
+	safe_free(c->last_activity);
+	c->last_activity_t = 0;
+}
+
+/** Invalidate the playback cache of a history object, eg after a new line was added */
+static void history_cache_invalidate(const char *object)
+{
+	HistoryObjectCache *c = history_cache_find(object);
+
+	if (c)
+		history_cache_clear_playback(c);
+}
+
+/** Invalidate all playback caches and last activity (backend or module changes) */
+static void history_cache_invalidate_all(void)
+{
+	HistoryObjectCache *c;
+	int i;
+
+	for (i = 0; i < HISTORY_CACHE_HASH_TABLE_SIZE; i++)
+		for (c = history_cache_hash_table[i]; c; c = c->next)
+		{
+			history_cache_clear_playback(c);
+			history_cache_clear_last_activity(c);
+		}
+}
+
+/** Forget everything about a history object, called from history_destroy() */
+static void history_cache_delete(const char *object)
+{
+	HistoryObjectCache *c = history_cache_find(object);
+
+	if (!c)
+		return;
+	history_cache_clear_playback(c);
+	history_cache_clear_last_activity(c);
+	DelListItem(c, history_cache_hash_table[history_cache_hash(object)]);
+	safe_free(c->object);
+	safe_free(c);
+}
+
+/** Render the cached playback for this type of client */
+static HistoryPlaybackVariant *history_playback_variant(HistoryObjectCache *c, Client *client)
+{
+	HistoryPlaybackVariant *v;
+	HistoryResultLine *n;
+	const char *mtags_str;
+	int oper = IsOper(client) ? 1 : 0;
+	unsigned long caps = client->local->caps & clicaps_affecting_mtag;
+	int i;
+
+	for (v = c->variants; v; v = v->next)
+		if ((v->oper == oper) && (v->caps == caps))
+			return v;
+
+	v = safe_alloc(sizeof(HistoryPlaybackVariant));
+	v->oper = oper;
+	v->caps = caps;
+	for (n = c->playback->log; n; n = n->next)
+		v->num_lines++;
+	v->lines = safe_alloc(sizeof(char *) * (v->num_lines ? v->num_lines : 1));
+	for (n = c->playback->log, i = 0; n; n = n->next, i++)
+	{
+		char buf[MAXLINELENGTH];
+		mtags_str = n->line->mtags ? mtags_to_string(n->line->mtags, client) : NULL;
+		if (BadPtr(mtags_str))
+			strlcpy(buf, n->line->line, sizeof(buf));
+		else
+			snprintf(buf, sizeof(buf), "@%s %s", mtags_str, n->line->line);
+		safe_strdup(v->lines[i], buf);
+	}
+	AddListItem(v, c->variants);
+	return v;
+}
+
+/** Send history playback (a HFC_SIMPLE request) to a client.
+ * This is the same as calling history_request() and history_send_result(),
+ * except that the result and the rendered lines are cached per history
+ * object and reused for other clients until the history changes.
+ * This makes on-join playback cheap, even when many users (re)join.
+ * @param client	The client to send to.
+ * @param object	The history object, eg '#test'.
+ * @param filter	The filter, the only supported cmd is HFC_SIMPLE.
+ */
+void history_send_playback(Client *client, const char *object, HistoryFilter *filter)
+{
+	HistoryObjectCache *c;
+	HistoryPlaybackVariant *v;
+	HistoryResult *r;
+	char batch[BATCHLEN+1];
+	char buf[MAXLINELENGTH];
+	int i;
+
+	if (!MyConnect(client) || !can_receive_history(client))
+		return;
+
+	c = history_cache_find(object);
+	if (!c || (filter->cmd != HFC_SIMPLE))
+	{
+		/* Object is not known to us (no limit set), don't cache */
+		r = history_request(object, filter);
+		if (r)
+		{
+			history_send_result(client, r);
+			free_history_result(r);
+		}
+		return;
+	}
+
+	if (c->playback &&
+	    ((c->last_lines != filter->last_lines) ||
+	     (c->last_seconds != filter->last_seconds) ||
+	     (TStime() > c->playback_valid_until)))
+	{
+		history_cache_clear_playback(c);
+	}
+
+	if (!c->playback)
+	{
+		long window = filter->last_seconds;
+
+		r = history_request(object, filter);
+		if (!r)
+			return;
+		c->playback = r;
+		c->last_lines = filter->last_lines;
+		c->last_seconds = filter->last_seconds;
+		/* Lines are only sent if they are not older than 'window',
+		 * so the result is valid until the oldest line falls out of it.
+		 */
+		if (c->max_time && (c->max_time < window))
+			window = c->max_time;
+		if (r->log)
+			c->playback_valid_until = r->log->line->t + window;
+		else
+			c->playback_valid_until = LONG_MAX;
 	}
 
-	for (l = r->log; l; l = l->next)
-		history_send_result_line(client, l, batch);
+	v = history_playback_variant(c, client);
+
+	history_send_batch_start(client, c->playback->object, batch);
+
+	for (i = 0; i < v->num_lines; i++)
+	{
+		/* sendbufto_one() may modify the buffer, so always use a copy */
+		if (!*batch)
+			strlcpy(buf, v->lines[i], sizeof(buf));
+		else if (*v->lines[i] == '@')
+			snprintf(buf, sizeof(buf), "@batch=%s;%s", batch, v->lines[i] + 1);
+		else
+			snprintf(buf, sizeof(buf), "@batch=%s %s", batch, v->lines[i]);
+		sendbufto_one(client, buf, 0);
+	}
 
 	/* End of batch */
 	if (*batch)
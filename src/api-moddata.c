@@ -27,6 +27,22 @@ MODVAR ModDataInfo *MDInfo = NULL;
 MODVAR ModData local_variable_moddata[MODDATA_MAX_LOCAL_VARIABLE];
 MODVAR ModData global_variable_moddata[MODDATA_MAX_GLOBAL_VARIABLE];
 
+/** By-name lookup hash for findmoddata_byname(), chained via md->hnext */
+#define MODDATA_HASH_SIZE 64
+static ModDataInfo *moddata_hash[MODDATA_HASH_SIZE];
+
+/** Changed whenever moddata is added or removed, see ModDataRef */
+static unsigned int moddata_generation = 1;
+
+static unsigned int moddata_hash_name(const char *name, ModDataType type)
+{
+	unsigned int hash = type;
+
+	for (; *name; name++)
+		hash = (hash * 31) + (unsigned char)*name;
+	return hash % MODDATA_HASH_SIZE;
+}
+
 ModDataInfo *ModDataAdd(Module *module, ModDataInfo req)
 {
 	int slotav = 0; /* highest available slot */
@@ -87,7 +103,13 @@ moddataadd_isok:
 	m->owner = module;
 	
 	if (new_struct)
+	{
+		unsigned int hash = moddata_hash_name(m->name, m->type);
 		AddListItem(m, MDInfo);
+		m->hnext = moddata_hash[hash];
+		moddata_hash[hash] = m;
+	}
+	moddata_generation++;
 
 	if (module)
 	{
@@ -174,6 +196,8 @@ ModDataInfo *md;
 /** Actually free all the ModData from all objects */
 void unload_moddata_commit(ModDataInfo *md)
 {
+	ModDataInfo **p;
+
 	switch(md->type)
 	{
 		case MODDATATYPE_LOCAL_VARIABLE:
@@ -253,6 +277,16 @@ void unload_moddata_commit(ModDataInfo *md)
 		}
 	}
 	
+	for (p = &moddata_hash[moddata_hash_name(md->name, md->type)]; *p; p = &(*p)->hnext)
+	{
+		if (*p == md)
+		{
+			*p = md->hnext;
+			break;
+		}
+	}
+	moddata_generation++;
+
 	DelListItem(md, MDInfo);
 	safe_free(md->name);
 	safe_free(md);
@@ -298,13 +332,82 @@ ModDataInfo *findmoddata_byname(const char *name, ModDataType type)
 {
 ModDataInfo *md;
 
-	for (md = MDInfo; md; md = md->next)
+	for (md = moddata_hash[moddata_hash_name(name, type)]; md; md = md->hnext)
 		if ((md->type == type) && !strcmp(name, md->name))
 			return md;
 
 	return NULL;
 }
 
+/** Resolve a ModDataRef.
+ * @param ref	The reference, see MODDATA_REF()
+ * @returns The moddata, or NULL if no such moddata is registered (at the moment).
+ */
+ModDataInfo *moddata_ref(ModDataRef *ref)
+{
+	if (ref->generation != moddata_generation)
+	{
+		ref->md = findmoddata_byname(ref->name, ref->type);
+		ref->generation = moddata_generation;
+	}
+	return ref->md;
+}
+
+/** Get the raw ModData of a client by reference, no serialization.
+ * @returns The ModData or NULL if the moddata is not registered.
+ */
+ModData *moddata_client_ref(Client *client, ModDataRef *ref)
+{
+	ModDataInfo *md = moddata_ref(ref);
+
+	if (!md)
+		return NULL;
+	return &moddata_client(client, md);
+}
+
+/** Get string ModData of a client by reference.
+ * Only for moddata that stores a string in m->str.
+ * @returns The string, or NULL if not set or not registered.
+ */
+const char *moddata_client_ref_str(Client *client, ModDataRef *ref)
+{
+	ModData *m = moddata_client_ref(client, ref);
+
+	return m ? m->str : NULL;
+}
+
+/** Get integer ModData (m->i) of a client by reference, 0 if not registered. */
+int moddata_client_ref_int(Client *client, ModDataRef *ref)
+{
+	ModData *m = moddata_client_ref(client, ref);
+
+	return m ? m->i : 0;
+}
+
+/** Get long ModData (m->l) of a client by reference, 0 if not registered. */
+long moddata_client_ref_long(Client *client, ModDataRef *ref)
+{
+	ModData *m = moddata_client_ref(client, ref);
+
+	return m ? m->l : 0;
+}
+
+/** Get long long ModData (m->ll) of a client by reference, 0 if not registered. */
+long long moddata_client_ref_ll(Client *client, ModDataRef *ref)
+{
+	ModData *m = moddata_client_ref(client, ref);
+
+	return m ? m->ll : 0;
+}
+
+/** Get pointer ModData (m->ptr) of a client by reference, NULL if not registered. */
+void *moddata_client_ref_ptr(Client *client, ModDataRef *ref)
+{
+	ModData *m = moddata_client_ref(client, ref);
+
+	return m ? m->ptr : NULL;
+}
+
 int module_has_moddata(Module *mod)
 {
 	ModDataInfo *md;
@@ -20,6 +20,9 @@
 
 #include "unrealircd.h"
 #include "crypt_blowfish.h"
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 typedef struct AuthTypeList AuthTypeList;
 struct AuthTypeList {
@@ -358,6 +361,8 @@ static int authcheck_tls_clientcert(Client *client, AuthConfig *as, const char *
 	return 1;
 }
 
+static ModDataRef certfp_ref = MODDATA_REF("certfp", MODDATATYPE_CLIENT);
+
 static int authcheck_tls_clientcert_fingerprint(Client *client, AuthConfig *as, const char *para)
 {
 	int i, k;
@@ -367,7 +372,7 @@ static int authcheck_tls_clientcert_fingerprint(Client *client, AuthConfig *as,
 	if (!client->local->ssl)
 		return 0;
 
-	fp = moddata_client_get(client, "certfp");
+	fp = moddata_client_ref_str(client, &certfp_ref);
 	if (!fp)
 		return 0;
 
@@ -474,6 +479,372 @@ int Auth_Check(Client *client, AuthConfig *as, const char *para)
 	return 0;
 }
 
+/** @defgroup AuthAsync Asynchronous authentication
+ * Verifying an argon2 or bcrypt hash is deliberately expensive.
+ * When done from the main loop it stalls all other clients,
+ * so for those types the verification can be handed off
+ * to a small pool of worker threads via Auth_CheckAsync().
+ * @{
+ */
+
+typedef struct AuthAsyncJob AuthAsyncJob;
+struct AuthAsyncJob {
+	AuthAsyncJob *prev, *next;	/**< In-flight list (main thread only) */
+	AuthAsyncJob *qnext;		/**< Worker queue or done queue (protected by lock) */
+	/* Main thread only: */
+	Client *client;
+	AuthCheckCallback callback;
+	void *data;
+	/* Worker thread only: */
+	AuthConfig as;
+	char *para;
+	int result;
+};
+
+/** Number of worker threads for hashing */
+#define AUTH_ASYNC_THREADS	2
+
+#ifndef _WIN32
+static AuthAsyncJob *auth_async_inflight = NULL;
+static AuthAsyncJob *auth_async_queue_head = NULL, *auth_async_queue_tail = NULL;
+static AuthAsyncJob *auth_async_done = NULL;
+static pthread_mutex_t auth_async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t auth_async_cond = PTHREAD_COND_INITIALIZER;
+static int auth_async_pipe[2] = { -1, -1 };
+static int auth_async_started = 0;
+
+/** Worker thread: take jobs from the queue and verify them */
+static void *auth_async_worker(void *unused)
+{
+	AuthAsyncJob *job;
+	char c = 0;
+
+	while (1)
+	{
+		pthread_mutex_lock(&auth_async_lock);
+		while (!auth_async_queue_head)
+			pthread_cond_wait(&auth_async_cond, &auth_async_lock);
+		job = auth_async_queue_head;
+		auth_async_queue_head = job->qnext;
+		if (!auth_async_queue_head)
+			auth_async_queue_tail = NULL;
+		pthread_mutex_unlock(&auth_async_lock);
+
+		if (job->as.type == AUTHTYPE_ARGON2)
+			job->result = authcheck_argon2(NULL, &job->as, job->para);
+		else
+			job->result = authcheck_bcrypt(NULL, &job->as, job->para);
+
+		pthread_mutex_lock(&auth_async_lock);
+		job->qnext = auth_async_done;
+		auth_async_done = job;
+		pthread_mutex_unlock(&auth_async_lock);
+
+		/* Wake up the main loop. If the pipe is full then
+		 * there is already a wakeup pending, so that is fine.
+		 */
+		if (write(auth_async_pipe[1], &c, 1) < 0) { }
+	}
+	return NULL;
+}
+
+static void auth_async_free_job(AuthAsyncJob *job)
+{
+	if (job->para)
+	{
+		memset(job->para, 0, strlen(job->para));
+		safe_free(job->para);
+	}
+	safe_free(job->as.data);
+	safe_free(job);
+}
+
+/** Main loop: called when one or more jobs have completed */
+static void auth_async_finished(int fd, int revents, void *unused)
+{
+	char buf[64];
+	AuthAsyncJob *job, *next;
+	Client *client;
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+
+	pthread_mutex_lock(&auth_async_lock);
+	job = auth_async_done;
+	auth_async_done = NULL;
+	pthread_mutex_unlock(&auth_async_lock);
+
+	for (; job; job = next)
+	{
+		next = job->qnext;
+		DelListItem(job, auth_async_inflight);
+		client = job->client;
+		if (client)
+		{
+			ClearAuthPending(client);
+			if (IsDead(client))
+				client = NULL;
+		}
+		if (job->callback)
+			job->callback(client, job->result, job->data);
+		auth_async_free_job(job);
+	}
+}
+
+/** Create the notification pipe and the worker threads.
+ * @returns 1 on success, 0 if we should fall back to synchronous checking.
+ */
+static int auth_async_start(void)
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+	sigset_t allsigs, oldsigs;
+	int i, started = 0;
+
+	if (auth_async_started)
+		return auth_async_started > 0;
+
+	auth_async_started = -1;
+
+	if (pipe(auth_async_pipe) < 0)
+	{
+		unreal_log(ULOG_WARNING, "auth", "AUTH_ASYNC_FAILED", NULL,
+		           "Could not create pipe for asynchronous password checking: $system_error",
+		           log_data_string("system_error", strerror(errno)));
+		return 0;
+	}
+	fcntl(auth_async_pipe[0], F_SETFL, fcntl(auth_async_pipe[0], F_GETFL, 0) | O_NONBLOCK);
+	fcntl(auth_async_pipe[1], F_SETFL, fcntl(auth_async_pipe[1], F_GETFL, 0) | O_NONBLOCK);
+	fd_open(auth_async_pipe[0], "Auth worker pipe", FDCLOSE_NONE);
+	fd_setselect(auth_async_pipe[0], FD_SELECT_READ, auth_async_finished, NULL);
+
+	/* Threads inherit the signal mask. Signals are for the main thread. */
+	sigfillset(&allsigs);
+	pthread_sigmask(SIG_SETMASK, &allsigs, &oldsigs);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (i = 0; i < AUTH_ASYNC_THREADS; i++)
+		if (pthread_create(&thread, &attr, auth_async_worker, NULL) == 0)
+			started++;
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+	if (!started)
+	{
+		unreal_log(ULOG_WARNING, "auth", "AUTH_ASYNC_FAILED", NULL,
+		           "Could not create worker threads for asynchronous password checking. "
+		           "Passwords will be checked synchronously.");
+		return 0;
+	}
+
+	auth_async_started = 1;
+	return 1;
+}
+#endif
+
+/** Check authentication without blocking the main loop.
+ * For argon2 and bcrypt the hash is verified in a worker thread,
+ * all other types are checked immediately (and the callback is
+ * called before this function returns).
+ * While the check is in progress the client is marked with
+ * IsAuthPending() and no further commands are read from it.
+ * @param client	The local client
+ * @param as		The authentication config
+ * @param para		The provided parameter (NULL allowed)
+ * @param callback	Called with the client and the result (1 or 0, like Auth_Check(),
+ *			or -1 if cancelled by Auth_CancelAsyncByCallback()).
+ *			The client is NULL if it disconnected in the meantime,
+ *			the callback should still free 'data' in that case.
+ * @param data		Opaque pointer that is passed to the callback
+ * @note The AuthConfig is copied, so it may be freed (eg: by a /REHASH)
+ *       while the check is in progress.
+ */
+void Auth_CheckAsync(Client *client, AuthConfig *as, const char *para, AuthCheckCallback callback, void *data)
+{
+#ifndef _WIN32
+	AuthAsyncJob *job;
+
+	if (!as || !as->data || !para ||
+	    ((as->type != AUTHTYPE_ARGON2) && (as->type != AUTHTYPE_BCRYPT)) ||
+	    !auth_async_start())
+	{
+		callback(client, Auth_Check(client, as, para), data);
+		return;
+	}
+
+	job = safe_alloc(sizeof(AuthAsyncJob));
+	job->client = client;
+	job->callback = callback;
+	job->data = data;
+	job->as.type = as->type;
+	safe_strdup(job->as.data, as->data);
+	safe_strdup(job->para, para);
+	AddListItem(job, auth_async_inflight);
+	SetAuthPending(client);
+
+	pthread_mutex_lock(&auth_async_lock);
+	if (auth_async_queue_tail)
+		auth_async_queue_tail->qnext = job;
+	else
+		auth_async_queue_head = job;
+	auth_async_queue_tail = job;
+	pthread_cond_signal(&auth_async_cond);
+	pthread_mutex_unlock(&auth_async_lock);
+#else
+	callback(client, Auth_Check(client, as, para), data);
+#endif
+}
+
+/** Detach a client from any outstanding asynchronous checks.
+ * Called when the connection is closed. The callbacks will
+ * still be called, but with a NULL client.
+ */
+void Auth_CancelAsync(Client *client)
+{
+#ifndef _WIN32
+	AuthAsyncJob *job;
+
+	if (!IsAuthPending(client))
+		return;
+
+	for (job = auth_async_inflight; job; job = job->next)
+		if (job->client == client)
+			job->client = NULL;
+	ClearAuthPending(client);
+#endif
+}
+
+/** Cancel all outstanding asynchronous checks with this callback.
+ * Modules must call this from MOD_UNLOAD if they use Auth_CheckAsync().
+ * The callback is called right away with a result of -1, so it can
+ * tell the client (if it is still there) and free 'data'.
+ * It will not be called again for these checks, and the client
+ * can send commands again.
+ */
+void Auth_CancelAsyncByCallback(AuthCheckCallback callback)
+{
+#ifndef _WIN32
+	AuthAsyncJob *job;
+	Client *client;
+
+	for (job = auth_async_inflight; job; job = job->next)
+	{
+		if (job->callback != callback)
+			continue;
+		client = job->client;
+		if (client)
+		{
+			ClearAuthPending(client);
+			job->client = NULL;
+			if (IsDead(client))
+				client = NULL;
+		}
+		job->callback = NULL;
+		callback(client, -1, job->data);
+		job->data = NULL;
+	}
+#endif
+}
+
+/** @} */
+
+/** @defgroup AuthCache Verified-credential cache
+ * A short-lived cache of successful password checks, for callers that
+ * see the same credentials over and over again, like the JSON-RPC API
+ * which authenticates every HTTP request.
+ * Only a keyed digest of the credentials is stored, never the password.
+ * @{
+ */
+
+/** Number of cached credentials */
+#define AUTH_CACHE_SIZE		64
+/** How long (in seconds) a successful check is remembered */
+#define AUTH_CACHE_TIME		60
+
+typedef struct AuthCacheEntry AuthCacheEntry;
+struct AuthCacheEntry {
+	char digest[SHA256_DIGEST_LENGTH];
+	time_t expires;
+};
+
+static AuthCacheEntry auth_cache[AUTH_CACHE_SIZE];
+static char auth_cache_key[SHA256_DIGEST_LENGTH];
+static int auth_cache_key_set = 0;
+
+/** Calculate the cache digest for the credentials 'name' and 'para'
+ * verified against 'as'. The stored hash itself is part of the input
+ * so changing the password in the configuration invalidates the entry.
+ */
+static void auth_cache_digest(char *digest, AuthConfig *as, const char *name, const char *para)
+{
+	char *buf, *p;
+	size_t len_data = strlen(as->data), len_name = strlen(name), len_para = strlen(para);
+	size_t len = sizeof(auth_cache_key) + len_data + 1 + len_name + 1 + len_para;
+	int i;
+
+	if (!auth_cache_key_set)
+	{
+		for (i = 0; i < sizeof(auth_cache_key); i++)
+			auth_cache_key[i] = getrandom8();
+		auth_cache_key_set = 1;
+	}
+
+	p = buf = safe_alloc(len);
+	memcpy(p, auth_cache_key, sizeof(auth_cache_key));
+	p += sizeof(auth_cache_key);
+	memcpy(p, as->data, len_data + 1);
+	p += len_data + 1;
+	memcpy(p, name, len_name + 1);
+	p += len_name + 1;
+	memcpy(p, para, len_para);
+	sha256hash_binary(digest, buf, len);
+	memset(buf, 0, len);
+	safe_free(buf);
+}
+
+/** Check authentication, remembering successful checks for a short while.
+ * This is the same as Auth_Check() but for hashed passwords a successful
+ * check of the same name/password combination is cached for AUTH_CACHE_TIME
+ * seconds, so repeated logins do not each cost a full argon2/bcrypt run.
+ * @param client	The client
+ * @param as		The authentication config
+ * @param name		The name the credentials belong to (eg: the rpc-user)
+ * @param para		The provided parameter (NULL allowed)
+ * @returns 1 if passed, 0 if incorrect
+ */
+int Auth_CheckCached(Client *client, AuthConfig *as, const char *name, const char *para)
+{
+	char digest[SHA256_DIGEST_LENGTH];
+	AuthCacheEntry *e, *slot = NULL;
+	int i;
+
+	if (!as || !as->data || !para ||
+	    ((as->type != AUTHTYPE_ARGON2) && (as->type != AUTHTYPE_BCRYPT) && (as->type != AUTHTYPE_UNIXCRYPT)))
+	{
+		return Auth_Check(client, as, para);
+	}
+
+	auth_cache_digest(digest, as, name, para);
+
+	for (i = 0; i < AUTH_CACHE_SIZE; i++)
+	{
+		e = &auth_cache[i];
+		if ((e->expires > TStime()) && !memcmp(e->digest, digest, sizeof(digest)))
+			return 1; /* recently verified */
+		if (!slot || (e->expires < slot->expires))
+			slot = e; /* oldest (or free) entry */
+	}
+
+	if (!Auth_Check(client, as, para))
+		return 0;
+
+	memcpy(slot->digest, digest, sizeof(digest));
+	slot->expires = TStime() + AUTH_CACHE_TIME;
+	return 1;
+}
+
+/** @} */
+
 #define UNREALIRCD_ARGON2_DEFAULT_TIME_COST             3
 #define UNREALIRCD_ARGON2_DEFAULT_MEMORY_COST           8192
 #define UNREALIRCD_ARGON2_DEFAULT_PARALLELISM_COST      2
@@ -239,6 +239,211 @@ int identical_ban(const char *one, const char *two)
 	return 0;
 }
 
+/** Key for hashing list mode masks (see ListModeIndex) */
+static char listmode_hash_key[16];
+static int listmode_hash_key_set = 0;
+
+/** Initial number of buckets of a ListModeIndex */
+#define LISTMODE_INDEX_INITIAL_SIZE	16
+
+/** Return the index slot of a channel list, or NULL if 'list'
+ * is not one of the +b/+e/+I lists of the channel.
+ */
+static ListModeIndex **listmode_index_slot(Channel *channel, Ban **list)
+{
+	if (!channel)
+		return NULL;
+	if (list == &channel->banlist)
+		return &channel->listmode_index[0];
+	if (list == &channel->exlist)
+		return &channel->listmode_index[1];
+	if (list == &channel->invexlist)
+		return &channel->listmode_index[2];
+	return NULL;
+}
+
+static unsigned int listmode_hash(ListModeIndex *idx, const char *banid)
+{
+	if (!listmode_hash_key_set)
+	{
+		siphash_generate_key(listmode_hash_key);
+		listmode_hash_key_set = 1;
+	}
+	/* Same case folding as identical_ban() */
+	return siphash_nocase(banid, listmode_hash_key) & (idx->size - 1);
+}
+
+static void listmode_index_insert(ListModeIndex *idx, Ban *ban)
+{
+	unsigned int h = listmode_hash(idx, ban->banstr);
+
+	ban->hnext = idx->table[h];
+	idx->table[h] = ban;
+}
+
+static void listmode_index_remove(ListModeIndex *idx, Ban *ban)
+{
+	Ban **p;
+
+	for (p = &idx->table[listmode_hash(idx, ban->banstr)]; *p; p = &(*p)->hnext)
+	{
+		if (*p == ban)
+		{
+			*p = ban->hnext;
+			ban->hnext = NULL;
+			return;
+		}
+	}
+}
+
+/** Double the number of buckets once the load factor exceeds 1 */
+static void listmode_index_grow(ListModeIndex *idx, Ban *list)
+{
+	Ban *ban;
+
+	if (idx->count < idx->size)
+		return;
+
+	safe_free(idx->table);
+	idx->size *= 2;
+	idx->table = safe_alloc(sizeof(Ban *) * idx->size);
+	for (ban = list; ban; ban = ban->next)
+		listmode_index_insert(idx, ban);
+}
+
+/** Get (or create) the index for a channel list.
+ * @returns The index, or NULL if 'list' is not a channel list.
+ */
+static ListModeIndex *get_listmode_index(Channel *channel, Ban **list, int create)
+{
+	ListModeIndex **slot = listmode_index_slot(channel, list);
+	ListModeIndex *idx;
+	Ban *ban;
+
+	if (!slot)
+		return NULL;
+	if (*slot || !create)
+		return *slot;
+
+	idx = *slot = safe_alloc(sizeof(ListModeIndex));
+	idx->size = LISTMODE_INDEX_INITIAL_SIZE;
+	idx->table = safe_alloc(sizeof(Ban *) * idx->size);
+	/* Index whatever is already there (normally nothing) */
+	for (ban = *list; ban; ban = ban->next)
+	{
+		idx->count++;
+		listmode_index_insert(idx, ban);
+	}
+	listmode_index_grow(idx, *list);
+	return idx;
+}
+
+/** Find a listmode (+beI) entry in a channel list.
+ * @param channel	The channel
+ * @param list		The list, eg &channel->banlist
+ * @param banid		The mask to look for
+ * @returns The entry (an identical_ban() match) or NULL if not found.
+ * @note This is a hash lookup for the lists of a channel,
+ *       for any other list it falls back to walking the list.
+ */
+Ban *find_listmode(Channel *channel, Ban **list, const char *banid)
+{
+	ListModeIndex *idx = get_listmode_index(channel, list, 0);
+	Ban *ban;
+
+	if (!idx)
+	{
+		if (listmode_index_slot(channel, list))
+			return NULL; /* no index means the list is empty */
+		for (ban = *list; ban; ban = ban->next)
+			if (identical_ban(ban->banstr, banid))
+				return ban;
+		return NULL;
+	}
+
+	for (ban = idx->table[listmode_hash(idx, banid)]; ban; ban = ban->hnext)
+		if (identical_ban(ban->banstr, banid))
+			return ban;
+	return NULL;
+}
+
+/** Add an already allocated Ban entry to the front of a list,
+ * updating the index. The caller must have checked for duplicates
+ * with find_listmode(). This is for code that builds Ban entries
+ * itself (eg: when reading them from a database), anything else
+ * should use add_listmode() or add_listmode_ex().
+ */
+void link_listmode(Channel *channel, Ban **list, Ban *ban)
+{
+	ListModeIndex *idx = get_listmode_index(channel, list, 1);
+
+	ban->prev = NULL;
+	ban->next = *list;
+	if (*list)
+		(*list)->prev = ban;
+	*list = ban;
+
+	if (idx)
+	{
+		idx->count++;
+		listmode_index_insert(idx, ban);
+		listmode_index_grow(idx, *list);
+	}
+}
+
+/** Remove an entry from a list (and the index) and free it */
+static void unlink_listmode(Channel *channel, Ban **list, Ban *ban)
+{
+	ListModeIndex **slot = listmode_index_slot(channel, list);
+	ListModeIndex *idx = slot ? *slot : NULL;
+
+	if (idx)
+	{
+		listmode_index_remove(idx, ban);
+		idx->count--;
+	}
+
+	if (ban->prev)
+		ban->prev->next = ban->next;
+	else
+		*list = ban->next;
+	if (ban->next)
+		ban->next->prev = ban->prev;
+
+	safe_free(ban->banstr);
+	safe_free(ban->who);
+	free_ban(ban);
+
+	if (idx && !*list)
+	{
+		/* List is empty, no need to keep the index around */
+		safe_free(idx->table);
+		safe_free(*slot);
+	}
+}
+
+/** Free all entries of a listmode (+beI) list of a channel, and its index. */
+void free_listmode_list(Channel *channel, Ban **list)
+{
+	ListModeIndex **slot = listmode_index_slot(channel, list);
+	Ban *ban;
+
+	while (*list)
+	{
+		ban = *list;
+		*list = ban->next;
+		safe_free(ban->banstr);
+		safe_free(ban->who);
+		free_ban(ban);
+	}
+
+	if (slot && *slot)
+	{
+		safe_free((*slot)->table);
+		safe_free(*slot);
+	}
+}
+
 /** Add a listmode (+beI) with the specified banid to
  *  the specified channel. (Extended version with
  *  set by nick and set on timestamp)
@@ -248,6 +453,7 @@ int identical_ban(const char *one, const char *two)
  */
 int add_listmode_ex(Ban **list, Client *client, Channel *channel, const char *banid, const char *setby, time_t seton)
 {
+	ListModeIndex *idx;
 	Ban *ban;
 	int cnt = 0;
 	int do_not_add = 0;
@@ -265,16 +471,23 @@ int add_listmode_ex(Ban **list, Client *client, Channel *channel, const char *ba
 		}
 		do_not_add = 1;
 	}
-	for (ban = *list; ban; ban = ban->next)
+
+	/* Check MAXBANS only for local clients and 'me' (for +b's set during +f).
+	 */
+	if (MyUser(client) || IsMe(client))
 	{
-		/* Check MAXBANS only for local clients and 'me' (for +b's set during +f).
-		 */
-		if ((MyUser(client) || IsMe(client)) && (++cnt >= MAXBANS))
+		if ((idx = get_listmode_index(channel, list, 0)))
+			cnt = idx->count;
+		else
+			for (ban = *list; ban; ban = ban->next)
+				cnt++;
+		if (cnt >= MAXBANS)
 			do_not_add = 1;
-		if (identical_ban(ban->banstr, banid))
-			break; /* update existing ban (potentially) */
 	}
 
+	/* update existing ban (potentially) */
+	ban = find_listmode(channel, list, banid);
+
 	/* Create a new ban if needed */
 	if (!ban)
 	{
@@ -291,8 +504,8 @@ int add_listmode_ex(Ban **list, Client *client, Channel *channel, const char *ba
 			return -1;
 		}
 		ban = make_ban();
-		ban->next = *list;
-		*list = ban;
+		safe_strdup(ban->banstr, banid);
+		link_listmode(channel, list, ban);
 		isnew = 1;
 	}
 
@@ -304,7 +517,9 @@ int add_listmode_ex(Ban **list, Client *client, Channel *channel, const char *ba
 		return -1;
 	}
 
-	/* Update/set if this ban is new or older than existing one */
+	/* Update/set if this ban is new or older than existing one.
+	 * The index stays valid: the old and new mask only differ in case.
+	 */
 	safe_strdup(ban->banstr, banid); /* cAsE may differ, use oldest version of it */
 	safe_strdup(ban->who, setby);
 	ban->when = seton;
@@ -329,24 +544,15 @@ int add_listmode(Ban **list, Client *client, Channel *channel, const char *banid
  */
 int del_listmode(Ban **list, Channel *channel, const char *banid)
 {
-	Ban **ban;
-	Ban *tmp;
+	Ban *ban;
 
 	if (!banid)
 		return -1;
-	for (ban = list; *ban; ban = &((*ban)->next))
-	{
-		if (identical_ban(banid, (*ban)->banstr))
-		{
-			tmp = *ban;
-			*ban = tmp->next;
-			safe_free(tmp->banstr);
-			safe_free(tmp->who);
-			free_ban(tmp);
-			return 0;
-		}
-	}
-	return -1;
+	ban = find_listmode(channel, list, banid);
+	if (!ban)
+		return -1;
+	unlink_listmode(channel, list, ban);
+	return 0;
 }
 
 /** is_banned - Check if a user is banned on a channel.
@@ -532,6 +738,20 @@ void add_user_to_channel(Channel *channel, Client *client, const char *modes)
 	m->next = channel->members;
 	channel->members = m;
 	channel->users++;
+	channel->member_serial++;
+
+	if (MyConnect(client))
+	{
+		if (channel->local_member_count == channel->local_member_size)
+		{
+			channel->local_member_size = channel->local_member_size ? channel->local_member_size * 2 : 8;
+			channel->local_members = realloc(channel->local_members, sizeof(Member *) * channel->local_member_size);
+			if (!channel->local_members)
+				outofmemory(sizeof(Member *) * channel->local_member_size);
+		}
+		m->local_index = channel->local_member_count;
+		channel->local_members[channel->local_member_count++] = m;
+	}
 
 	mb = make_membership();
 	mb->channel = channel;
@@ -545,6 +765,17 @@ void add_user_to_channel(Channel *channel, Client *client, const char *modes)
 	RunHook(HOOKTYPE_JOIN_DATA, client, channel);
 }
 
+/** Remove 'm' from channel->local_members */
+static void del_local_member(Channel *channel, Member *m)
+{
+	Member *last;
+
+	/* Order does not matter, so move the last one in its place */
+	last = channel->local_members[--channel->local_member_count];
+	channel->local_members[m->local_index] = last;
+	last->local_index = m->local_index;
+}
+
 /** Remove the user from the channel.
  * This frees the memberships, decreases the user counts,
  * destroys the channel if needed, etc.
@@ -567,7 +798,10 @@ int remove_user_from_channel(Client *client, Channel *channel, int dont_log)
 		if (m2->client == client)
 		{
 			*m = m2->next;
+			if (MyConnect(client))
+				del_local_member(channel, m2);
 			free_member(m2);
+			channel->member_serial++;
 			break;
 		}
 	}
@@ -1037,7 +1271,6 @@ int is_invited(Client *client, Channel *channel)
  */
 int sub1_from_channel(Channel *channel)
 {
-	Ban *ban;
 	Link *lp;
 	int should_destroy = 1;
 
@@ -1059,35 +1292,15 @@ int sub1_from_channel(Channel *channel)
 
 	moddata_free_channel(channel);
 
-	while (channel->banlist)
-	{
-		ban = channel->banlist;
-		channel->banlist = ban->next;
-		safe_free(ban->banstr);
-		safe_free(ban->who);
-		free_ban(ban);
-	}
-	while (channel->exlist)
-	{
-		ban = channel->exlist;
-		channel->exlist = ban->next;
-		safe_free(ban->banstr);
-		safe_free(ban->who);
-		free_ban(ban);
-	}
-	while (channel->invexlist)
-	{
-		ban = channel->invexlist;
-		channel->invexlist = ban->next;
-		safe_free(ban->banstr);
-		safe_free(ban->who);
-		free_ban(ban);
-	}
+	free_listmode_list(channel, &channel->banlist);
+	free_listmode_list(channel, &channel->exlist);
+	free_listmode_list(channel, &channel->invexlist);
 
 	/* free extcmode params */
 	extcmode_free_paramlist(channel->mode.mode_params);
 
 	safe_free(channel->mode_lock);
+	safe_free(channel->local_members);
 	safe_free(channel->topic);
 	safe_free(channel->topic_nick);
 
@@ -1332,16 +1545,19 @@ int user_can_see_member(Client *user, Client *target, Channel *channel)
 	return user_can_see_member_fast(user, target, channel, target_member, user_member ? user_member->member_modes : NULL);
 }
 
-/** Returns 1 if user 'target' is invisible in channel 'channel'.
+/** Returns 1 if user 'target' is invisible in channel 'channel' - fast version.
  * This may return 0 if the user is 'invisible' due to mode +D rules.
+ * @param target		The user
+ * @param channel		The channel
+ * @param target_member		The Member * struct of 'target' (may be NULL if not in channel)
+ * @note This is computed once per channel by the send functions, after which
+ *       they only need to check the member modes of each recipient.
  */
-int invisible_user_in_channel(Client *target, Channel *channel)
+int invisible_user_in_channel_fast(Client *target, Channel *channel, Member *target_member)
 {
 	Hook *h;
-	Member *target_member;
 	int j = 0;
 
-	target_member = find_member_link(channel->members, target); // SLOW!
 	if (!target_member)
 		return 0; /* not in channel */
 
@@ -1353,13 +1569,20 @@ int invisible_user_in_channel(Client *target, Channel *channel)
 	}
 
 	/* We must ensure that user is allowed to "see" target */
-	// SLOW !!!
-	if (j != 0 && !(check_channel_access(target, channel, "hoaq") || check_channel_access(target,channel, "v")))
+	if (j != 0 && !check_channel_access_member(target_member, "vhoaq"))
 		return 1;
 
 	return 0;
 }
 
+/** Returns 1 if user 'target' is invisible in channel 'channel'.
+ * This may return 0 if the user is 'invisible' due to mode +D rules.
+ */
+int invisible_user_in_channel(Client *target, Channel *channel)
+{
+	return invisible_user_in_channel_fast(target, channel, find_member_link(channel->members, target));
+}
+
 /** Send a message to the user that (s)he is using an invalid channel name.
  * This is usually called after an if (MyUser(client) && !valid_channelname(name)).
  * @param client      The client to send the message to.
@@ -156,6 +156,7 @@ static NameValue _LinkFlags[] = {
 static NameValue _TLSFlags[] = {
 	{ TLSFLAG_FAILIFNOCERT, "fail-if-no-clientcert" },
 	{ TLSFLAG_DISABLECLIENTCERT, "no-client-certificate" },
+	{ TLSFLAG_NORELEASEBUFFERS, "no-release-buffers" },
 	{ TLSFLAG_NOSTARTTLS, "no-starttls" },
 };
 
@@ -1689,6 +1690,7 @@ void config_setdefaultsettings(Configuration *i)
 	nicklengths.min = i->min_nick_length = 0; /* 0 means no minimum required */
 	nicklengths.max = i->nick_length = NICKLEN;
 	i->topic_length = 360;
+	i->whowas_history_length = NICKNAMEHISTORYLENGTH;
 	i->away_length = 307;
 	i->kick_length = 307;
 	i->quit_length = 307;
@@ -1701,6 +1703,7 @@ void config_setdefaultsettings(Configuration *i)
 	i->handshake_timeout = 30;
 	i->sasl_timeout = 15;
 	i->handshake_delay = -1;
+	i->slow_loop_threshold = 100;
 	i->broadcast_channel_messages = BROADCAST_CHANNEL_MESSAGES_AUTO;
 
 	/* Flood options */
@@ -2123,6 +2126,7 @@ int config_test(void)
 	}
 
 	applymeblock();
+	whowas_resize(WHOWAS_HISTORY_LENGTH);
 
 	if (old_pid_file && strcmp(old_pid_file, conf_files->pid_file))
 	{
@@ -7974,6 +7978,9 @@ int	_conf_set(ConfigFile *conf, ConfigEntry *ce)
 			int v = atoi(cep->value);
 			tempiConf.quit_length = v;
 		}
+		else if (!strcmp(cep->name, "whowas-history-length")) {
+			tempiConf.whowas_history_length = atoi(cep->value);
+		}
 		else if (!strcmp(cep->name, "ssl") || !strcmp(cep->name, "tls")) {
 			/* no need to alloc tempiConf.tls_options since config_defaults() already ensures it exists */
 			conf_tlsblock(conf, cep, tempiConf.tls_options);
@@ -8044,6 +8051,10 @@ int	_conf_set(ConfigFile *conf, ConfigEntry *ce)
 		{
 			tempiConf.handshake_boot_delay = config_checkval(cep->value, CFG_TIME);
 		}
+		else if (!strcmp(cep->name, "slow-loop-threshold"))
+		{
+			tempiConf.slow_loop_threshold = atol(cep->value);
+		}
 		else if (!strcmp(cep->name, "automatic-ban-target"))
 		{
 			tempiConf.automatic_ban_target = ban_target_strtoval(cep->value);
@@ -9128,6 +9139,17 @@ int	_test_set(ConfigFile *conf, ConfigEntry *ce)
 				errors++;
 			}
 		}
+		else if (!strcmp(cep->name, "whowas-history-length")) {
+			int v;
+			CheckNull(cep);
+			v = atoi(cep->value);
+			if ((v < 100) || (v > 10000000))
+			{
+				config_error("%s:%i: set::whowas-history-length: value '%d' out of range (should be 100-10000000)",
+					cep->file->filename, cep->line_number, v);
+				errors++;
+			}
+		}
 		else if (!strcmp(cep->name, "away-length")) {
 			int v;
 			CheckNull(cep);
@@ -9321,6 +9343,16 @@ int	_test_set(ConfigFile *conf, ConfigEntry *ce)
 				errors++;
 			}
 		}
+		else if (!strcmp(cep->name, "slow-loop-threshold"))
+		{
+			CheckNull(cep);
+			if (atol(cep->value) < 0)
+			{
+				config_error("%s:%i: set::slow-loop-threshold: value should be a number of milliseconds, or 0 to disable.",
+					cep->file->filename, cep->line_number);
+				errors++;
+			}
+		}
 		else if (!strcmp(cep->name, "ban-include-username"))
 		{
 			config_error("%s:%i: set::ban-include-username is no longer supported. "
@@ -20,6 +20,7 @@
 #include "unrealircd.h"
 
 static mp_pool_t *dbuf_bufpool = NULL;
+MODVAR DBufStats dbufstats;
 
 void dbuf_init(void)
 {
@@ -38,6 +39,7 @@ static dbufbuf *dbuf_alloc(dbuf *dbuf_p)
 
 	ptr = mp_pool_get(dbuf_bufpool);
 	memset(ptr, 0, sizeof(dbufbuf));
+	dbufstats.blocks++;
 
 	INIT_LIST_HEAD(&ptr->dbuf_node);
 	list_add_tail(&ptr->dbuf_node, &dbuf_p->dbuf_list);
@@ -54,6 +56,7 @@ static void dbuf_free(dbufbuf *ptr)
 
 	list_del(&ptr->dbuf_node);
 	mp_pool_release(ptr);
+	dbufstats.blocks--;
 }
 
 void dbuf_queue_init(dbuf *dyn)
@@ -62,6 +65,15 @@ void dbuf_queue_init(dbuf *dyn)
 	INIT_LIST_HEAD(&dyn->dbuf_list);
 }
 
+/** Initialize a dbuf whose length is also accounted in 'total',
+ * such as &dbufstats.sendq_bytes.
+ */
+void dbuf_queue_init_ex(dbuf *dyn, long long *total)
+{
+	dbuf_queue_init(dyn);
+	dyn->total = total;
+}
+
 void dbuf_put(dbuf *dyn, const char *buf, size_t length)
 {
 	struct dbufbuf *block;
@@ -70,6 +82,8 @@ void dbuf_put(dbuf *dyn, const char *buf, size_t length)
 	assert(length > 0);
 	if (list_empty(&dyn->dbuf_list))
 		dbuf_alloc(dyn);
+	if (dyn->total)
+		*dyn->total += length;
 
 	while (length > 0)
 	{
@@ -100,6 +114,8 @@ void dbuf_delete(dbuf *dyn, size_t length)
 	assert(dyn->length >= length);
 	if (length == 0)
 		return;
+	if (dyn->total)
+		*dyn->total -= length;
 
 	for (;;)
 	{
@@ -134,6 +150,7 @@ int  dbuf_getmsg(dbuf *dyn, char *buf)
 	dbufbuf *block;
 	int line_bytes = 0, empty_bytes = 0, phase = 0;
 	unsigned int idx;
+	size_t n;
 	char c;
 	char *p = buf;
 
@@ -165,6 +182,17 @@ int  dbuf_getmsg(dbuf *dyn, char *buf)
 				case 0: phase = 1; /* FALLTHROUGH */
 				case 1: if (line_bytes++ < READBUFSIZE - 2)
 						*p++ = c;
+					/* Copy the rest of the line in this block in one go */
+					n = text_eol_span(block->data + idx + 1, block->size - idx - 1);
+					if (n > 0)
+					{
+						int room = MAX(0, READBUFSIZE - 2 - line_bytes);
+						int copy = MIN((int)n, room);
+						memcpy(p, block->data + idx + 1, copy);
+						p += copy;
+						line_bytes += n;
+						idx += n;
+					}
 					break;
 				case 2: *p = '\0';
 					dbuf_delete(dyn, line_bytes + empty_bytes);
@@ -96,6 +96,17 @@ void fd_setselect(int fd, int flags, IOCallbackFunc iocb, void *data)
 		fd_refresh(fd);
 }
 
+/** Call an I/O callback and account the time spent in it,
+ * so slow callbacks show up in the slow loop iteration tracer.
+ */
+static void fd_callback(IOCallbackFunc iocb, FDEntry *fde, int fd, int evflags)
+{
+	long long start = loop_time_usec();
+
+	iocb(fd, evflags, fde->data);
+	loop_trace_record(LOOP_TRACE_IO, fde->desc, NULL, start);
+}
+
 /***************************************************************************************
  * select() backend.                                                                   *
  ***************************************************************************************/
@@ -204,6 +215,8 @@ void fd_select(int delay)
 	if (num <= 0)
 		return;
 
+	loop_io_ready();
+
 	for (fd = 0; fd <= highest_fd && num > 0; fd++)
 	{
 		FDEntry *fde;
@@ -234,7 +247,7 @@ void fd_select(int delay)
 			iocb = fde->read_callback;
 
 			if (iocb != NULL)
-				iocb(fd, evflags, fde->data);
+				fd_callback(iocb, fde, fd, evflags);
 		}
 
 		if (evflags & FD_SELECT_WRITE)
@@ -242,7 +255,7 @@ void fd_select(int delay)
 			iocb = fde->write_callback;
 
 			if (iocb != NULL)
-				iocb(fd, evflags, fde->data);
+				fd_callback(iocb, fde, fd, evflags);
 		}
 
 		num--;
@@ -380,6 +393,8 @@ void fd_select(int delay)
 	if (num <= 0)
 		return;
 
+	loop_io_ready();
+
 	for (p = 0; p < num; p++)
 	{
 		FDEntry *fde;
@@ -396,7 +411,7 @@ void fd_select(int delay)
 			iocb = fde->read_callback;
 
 			if (iocb != NULL)
-				iocb(fd, FD_SELECT_READ, fde->data);
+				fd_callback(iocb, fde, fd, FD_SELECT_READ);
 		}
 
 		if (revents == EVFILT_WRITE)
@@ -404,7 +419,7 @@ void fd_select(int delay)
 			iocb = fde->write_callback;
 
 			if (iocb != NULL)
-				iocb(fd, FD_SELECT_WRITE, fde->data);
+				fd_callback(iocb, fde, fd, FD_SELECT_WRITE);
 		}
 	}
 }
@@ -485,6 +500,8 @@ void fd_select(int delay)
 	if (num <= 0)
 		return;
 
+	loop_io_ready();
+
 #ifdef DETECT_HIGH_CPU
 	gettimeofday(&oldt, NULL);
 #endif
@@ -515,7 +532,7 @@ void fd_select(int delay)
 			iocb = fde->read_callback;
 
 			if (iocb != NULL)
-				iocb(fd, evflags, fde->data);
+				fd_callback(iocb, fde, fd, evflags);
 
 #ifdef DETECT_HIGH_CPU
 			read_callbacks++;
@@ -527,7 +544,7 @@ void fd_select(int delay)
 			iocb = fde->write_callback;
 
 			if (iocb != NULL)
-				iocb(fd, evflags, fde->data);
+				fd_callback(iocb, fde, fd, evflags);
 
 #ifdef DETECT_HIGH_CPU
 			write_callbacks++;
@@ -614,6 +631,8 @@ void fd_select(int delay)
 	if (num <= 0)
 		return;
 
+	loop_io_ready();
+
 	for (p = 0; p < (nfds + 1); p++)
 	{
 		FDEntry *fde;
@@ -640,14 +659,14 @@ void fd_select(int delay)
 			iocb = fde->read_callback;
 
 			if (iocb != NULL)
-				iocb(fd, evflags, fde->data);
+				fd_callback(iocb, fde, fd, evflags);
 		}
 
 		if (evflags & FD_SELECT_WRITE)
 		{
 			iocb = fde->write_callback;
 			if (iocb != NULL)
-				iocb(fd, evflags, fde->data);
+				fd_callback(iocb, fde, fd, evflags);
 		}
 	}
 }
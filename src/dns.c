@@ -53,11 +53,12 @@ extern void proceed_normal_client_handshake(Client *client, struct hostent *he);
 
 ares_channel resolver_channel; /**< The resolver channel. */
 
-DNSStats dnsstats;
+MODVAR DNSStats dnsstats;
 
 static DNSReq *requests = NULL; /**< Linked list of requests (pending responses). */
 
 static DNSCache *cache_list = NULL; /**< Linked list of cache */
+static ExpiryHeap cache_expiry_heap; /**< Cache records by expiry time */
 static DNSCache *cache_hashtbl[DNS_HASH_SIZE]; /**< Hash table of cache */
 
 static unsigned int unrealdns_num_cache = 0; /**< # of cache entries in memory */
@@ -444,12 +445,9 @@ static void unrealdns_addtocache(const char *name, const char *ip)
 		if (!strcmp(ip, c->ip))
 			return; /* already present in cache */
 
-	/* Remove last item, if we got too many entries.. */
+	/* Remove the record that expires first, if we got too many entries.. */
 	if (unrealdns_num_cache >= DNS_MAX_ENTRIES)
-	{
-		for (c = cache_list; c->next; c = c->next);
-		unrealdns_removecacherecord(c);
-	}
+		unrealdns_removecacherecord(container_of(expiry_heap_first(&cache_expiry_heap), DNSCache, expiry));
 
 	/* Create record */
 	c = safe_alloc(sizeof(DNSCache));
@@ -459,6 +457,7 @@ static void unrealdns_addtocache(const char *name, const char *ip)
 		c->expires = TStime() + DNS_NEGCACHE_TTL;
 	else
 		c->expires = TStime() + DNS_CACHE_TTL;
+	expiry_heap_add(&cache_expiry_heap, &c->expiry, c->expires);
 	
 	/* Add to hash table */
 	if (cache_hashtbl[hashv])
@@ -538,6 +537,8 @@ unsigned int hashv;
 	
 	if (c->hnext)
 		c->hnext->hprev = c->hprev;
+
+	expiry_heap_del(&cache_expiry_heap, &c->expiry);
 	
 	safe_free(c->name);
 	safe_free(c->ip);
@@ -549,14 +550,10 @@ unsigned int hashv;
 /** This regulary removes old dns records from the cache */
 EVENT(unrealdns_removeoldrecords)
 {
-DNSCache *c, *next;
+ExpiryHeapNode *n;
 
-	for (c = cache_list; c; c = next)
-	{
-		next = c->next;
-		if (c->expires < TStime())
-			unrealdns_removecacherecord(c);
-	}
+	while ((n = expiry_heap_pop(&cache_expiry_heap, TStime() - 1)))
+		unrealdns_removecacherecord(container_of(n, DNSCache, expiry));
 }
 
 struct hostent *unreal_create_hostent(const char *name, const char *ip)
@@ -669,6 +666,7 @@ CMD_FUNC(cmd_dns)
 		unreal_log(ULOG_INFO, "dns", "DNS_CACHE_CLEARED", client,
 		            "DNS cache cleared by $client");
 		
+		expiry_heap_free(&cache_expiry_heap);
 		while (cache_list)
 		{
 			c = cache_list->next;
@@ -0,0 +1,158 @@
+/************************************************************************
+ *   UnrealIRCd - Unreal Internet Relay Chat Daemon - src/expiryheap.c
+ *   (C) 2026 The UnrealIRCd Team
+ *
+ *   See file AUTHORS in IRC package for additional names of
+ *   the programmers.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** @file
+ * @brief Min-heap of items ordered by expiry time.
+ *
+ * An expiry event that walks all items to find the few that expired
+ * costs O(n) each time it runs. With an ExpiryHeap the event only
+ * looks at the top of the heap, so the cost is O(expired * log n).
+ *
+ * The ExpiryHeapNode is embedded in the item, use container_of()
+ * to get from a node back to the item. A node remembers its position
+ * in the heap, so an item can be removed or get a new expiry time
+ * in O(log n) as well.
+ */
+
+#include "unrealircd.h"
+
+#define HEAP_PARENT(i)	(((i) - 1) / 2)
+#define HEAP_LEFT(i)	((i) * 2 + 1)
+
+static void expiry_heap_set(ExpiryHeap *h, int i, ExpiryHeapNode *n)
+{
+	h->node[i] = n;
+	n->index = i + 1;
+}
+
+static void expiry_heap_up(ExpiryHeap *h, int i)
+{
+	ExpiryHeapNode *n = h->node[i];
+
+	while ((i > 0) && (h->node[HEAP_PARENT(i)]->expire_at > n->expire_at))
+	{
+		expiry_heap_set(h, i, h->node[HEAP_PARENT(i)]);
+		i = HEAP_PARENT(i);
+	}
+	expiry_heap_set(h, i, n);
+}
+
+static void expiry_heap_down(ExpiryHeap *h, int i)
+{
+	ExpiryHeapNode *n = h->node[i];
+	int child;
+
+	while ((child = HEAP_LEFT(i)) < h->num)
+	{
+		if ((child + 1 < h->num) && (h->node[child + 1]->expire_at < h->node[child]->expire_at))
+			child++;
+		if (h->node[child]->expire_at >= n->expire_at)
+			break;
+		expiry_heap_set(h, i, h->node[child]);
+		i = child;
+	}
+	expiry_heap_set(h, i, n);
+}
+
+/** Add an item to the heap, or change the expiry time if it is already in there.
+ * @param h		The heap
+ * @param n		The node, embedded in the item
+ * @param expire_at	When the item expires
+ */
+void expiry_heap_add(ExpiryHeap *h, ExpiryHeapNode *n, time_t expire_at)
+{
+	n->expire_at = expire_at;
+
+	if (n->index)
+	{
+		/* Already in the heap, just move it */
+		expiry_heap_up(h, n->index - 1);
+		expiry_heap_down(h, n->index - 1);
+		return;
+	}
+
+	if (h->num == h->max)
+	{
+		h->max = h->max ? h->max * 2 : 64;
+		h->node = realloc(h->node, sizeof(ExpiryHeapNode *) * h->max);
+		if (!h->node)
+			outofmemory(sizeof(ExpiryHeapNode *) * h->max);
+	}
+	expiry_heap_set(h, h->num++, n);
+	expiry_heap_up(h, h->num - 1);
+}
+
+/** Remove an item from the heap. It is ok to call this for items that are not in the heap. */
+void expiry_heap_del(ExpiryHeap *h, ExpiryHeapNode *n)
+{
+	int i = n->index - 1;
+	ExpiryHeapNode *last;
+
+	if (!n->index)
+		return;
+
+	n->index = 0;
+	last = h->node[--h->num];
+	if (last == n)
+		return;
+
+	expiry_heap_set(h, i, last);
+	expiry_heap_up(h, i);
+	expiry_heap_down(h, last->index - 1);
+}
+
+/** Return the item that expires first, or NULL if the heap is empty.
+ * The item stays in the heap.
+ */
+ExpiryHeapNode *expiry_heap_first(ExpiryHeap *h)
+{
+	return h->num ? h->node[0] : NULL;
+}
+
+/** Remove and return the next item that expired, that is: with an
+ * expiry time of 'now' or earlier. Call this in a loop from the
+ * expiry event, until it returns NULL.
+ */
+ExpiryHeapNode *expiry_heap_pop(ExpiryHeap *h, time_t now)
+{
+	ExpiryHeapNode *n;
+
+	if (!h->num || (h->node[0]->expire_at > now))
+		return NULL;
+
+	n = h->node[0];
+	expiry_heap_del(h, n);
+	return n;
+}
+
+/** Empty the heap and free its memory. The items themselves are not touched,
+ * other than that they are marked as not being in the heap.
+ */
+void expiry_heap_free(ExpiryHeap *h)
+{
+	int i;
+
+	for (i = 0; i < h->num; i++)
+		h->node[i]->index = 0;
+	safe_free(h->node);
+	h->num = h->max = 0;
+}
@@ -58,15 +58,8 @@
      ((uint64_t)((p)[4]) << 32) | ((uint64_t)((p)[5]) << 40) |                 \
      ((uint64_t)((p)[6]) << 48) | ((uint64_t)((p)[7]) << 56))
 
-#define U8TO64_LE_NOCASE(p)                                                    \
-    (((uint64_t)(tolower((p)[0]))) |                                           \
-     ((uint64_t)(tolower((p)[1])) << 8) |                                      \
-     ((uint64_t)(tolower((p)[2])) << 16) |                                     \
-     ((uint64_t)(tolower((p)[3])) << 24) |                                     \
-     ((uint64_t)(tolower((p)[4])) << 32) |                                              \
-     ((uint64_t)(tolower((p)[5])) << 40) |                                              \
-     ((uint64_t)(tolower((p)[6])) << 48) |                                              \
-     ((uint64_t)(tolower((p)[7])) << 56))
+/* Same as U8TO64_LE() but lowercased, does all 8 bytes at once */
+#define U8TO64_LE_NOCASE(p) text_tolower64(U8TO64_LE(p))
 
 #define SIPROUND                                                               \
     do {                                                                       \
@@ -264,8 +257,6 @@ static Channel *channelTable[CHAN_HASH_TABLE_SIZE];
 static char siphashkey_nick[SIPHASH_KEY_LENGTH];
 static char siphashkey_chan[SIPHASH_KEY_LENGTH];
 static char siphashkey_whowas[SIPHASH_KEY_LENGTH];
-static char siphashkey_throttling[SIPHASH_KEY_LENGTH];
-static char siphashkey_ipusers[SIPHASH_KEY_LENGTH];
 
 extern char unreallogo[];
 
@@ -277,8 +268,6 @@ void init_hash(void)
 	siphash_generate_key(siphashkey_nick);
 	siphash_generate_key(siphashkey_chan);
 	siphash_generate_key(siphashkey_whowas);
-	siphash_generate_key(siphashkey_throttling);
-	siphash_generate_key(siphashkey_ipusers);
 
 	for (i = 0; i < NICK_HASH_TABLE_SIZE; i++)
 		INIT_LIST_HEAD(&clientTable[i]);
@@ -288,10 +277,8 @@ void init_hash(void)
 
 	memset(channelTable, 0, sizeof(channelTable));
 
-	memset(ThrottlingHash, 0, sizeof(ThrottlingHash));
 	/* do not call init_throttling() here, as
 	 * config file has not been read yet.
-	 * The hash table is ready, anyway.
 	 */
 
 	//if (strcmp(BASE_VERSION, &unreallogo[337]))
@@ -308,9 +295,19 @@ uint64_t hash_channel_name(const char *name)
 	return siphash_nocase(name, siphashkey_chan) % CHAN_HASH_TABLE_SIZE;
 }
 
+/** Hash a nick (or IP or account) for the WHOWAS indexes.
+ * Unlike the other hash functions this returns the full hash value,
+ * since the WHOWAS tables grow with set::whowas-history-length.
+ */
 uint64_t hash_whowas_name(const char *name)
 {
-	return siphash_nocase(name, siphashkey_whowas) % WHOWAS_HASH_TABLE_SIZE;
+	return siphash_nocase(name, siphashkey_whowas);
+}
+
+/** Case-sensitive variant of hash_whowas_name(), for whowas_intern() */
+uint64_t hash_whowas_string(const char *str)
+{
+	return siphash(str, siphashkey_whowas);
 }
 
 /*
@@ -612,7 +609,10 @@ Client *find_server_by_uid(const char *uid)
 
 /* Note that we call this set::anti-flood::connect-flood nowadays */
 
-struct MODVAR ThrottlingBucket *ThrottlingHash[THROTTLING_HASH_TABLE_SIZE];
+/** All throttling buckets, for expiry */
+MODVAR struct ThrottlingBucket *ThrottlingList = NULL;
+/** Throttling buckets by IP address */
+static IPIndex throttling_index;
 
 void update_throttling_timer_settings(void)
 {
@@ -637,43 +637,24 @@ void update_throttling_timer_settings(void)
 	EventMod(EventFind("throttling_check_expire"), &eInfo);
 }
 
-uint64_t hash_throttling(const char *ip)
-{
-	return siphash(ip, siphashkey_throttling) % THROTTLING_HASH_TABLE_SIZE;
-}
-
 struct ThrottlingBucket *find_throttling_bucket(Client *client)
 {
-	int hash = 0;
-	struct ThrottlingBucket *p;
-	hash = hash_throttling(client->ip);
-	
-	for (p = ThrottlingHash[hash]; p; p = p->next)
-	{
-		if (!strcmp(p->ip, client->ip))
-			return p;
-	}
-	
-	return NULL;
+	return ipindex_find(&throttling_index, client->rawip, IPINDEX_KEYLEN*8);
 }
 
 EVENT(throttling_check_expire)
 {
 	struct ThrottlingBucket *n, *n_next;
-	int	i;
 	static time_t t = 0;
 		
-	for (i = 0; i < THROTTLING_HASH_TABLE_SIZE; i++)
+	for (n = ThrottlingList; n; n = n_next)
 	{
-		for (n = ThrottlingHash[i]; n; n = n_next)
+		n_next = n->next;
+		if ((TStime() - n->since) > (THROTTLING_PERIOD ? THROTTLING_PERIOD : 15))
 		{
-			n_next = n->next;
-			if ((TStime() - n->since) > (THROTTLING_PERIOD ? THROTTLING_PERIOD : 15))
-			{
-				DelListItem(n, ThrottlingHash[i]);
-				safe_free(n->ip);
-				safe_free(n);
-			}
+			ipindex_del(&throttling_index, n->rawip, IPINDEX_KEYLEN*8);
+			DelListItem(n, ThrottlingList);
+			safe_free(n);
 		}
 	}
 
@@ -702,16 +683,18 @@ EVENT(throttling_check_expire)
 
 void add_throttling_bucket(Client *client)
 {
-	int hash;
 	struct ThrottlingBucket *n;
 
 	n = safe_alloc(sizeof(struct ThrottlingBucket));
-	n->next = n->prev = NULL; 
-	safe_strdup(n->ip, client->ip);
+	memcpy(n->rawip, client->rawip, IPINDEX_KEYLEN);
 	n->since = TStime();
 	n->count = 1;
-	hash = hash_throttling(client->ip);
-	AddListItem(n, ThrottlingHash[hash]);
+	if (!ipindex_add(&throttling_index, n->rawip, IPINDEX_KEYLEN*8, n))
+	{
+		safe_free(n);
+		return;
+	}
+	AddListItem(n, ThrottlingList);
 	return;
 }
 
@@ -743,85 +726,34 @@ int throttle_can_connect(Client *client)
 
 /**** IP users hash table *****/
 
-MODVAR IpUsersBucket *IpUsersHash_ipv4[IPUSERS_HASH_TABLE_SIZE];
-MODVAR IpUsersBucket *IpUsersHash_ipv6[IPUSERS_HASH_TABLE_SIZE];
-
-uint64_t hash_ipusers(const char *ip)
-{
-	return siphash(ip, siphashkey_ipusers) % IPUSERS_HASH_TABLE_SIZE;
-}
+/** IP users buckets by IP address, for allow::maxperip */
+MODVAR IPIndex ipusers_index;
 
 IpUsersBucket *find_ipusers_bucket(Client *client)
 {
-	int hash = 0;
-	IpUsersBucket *p;
-	struct sockaddr *addr;
-
-	addr = raw_client_ip(client);
-	hash = hash_ipusers(client->ip);
-
-	if (addr->sa_family == AF_INET6)
-	{
-		for (p = IpUsersHash_ipv6[hash]; p; p = p->next)
-			if (memcmp(p->rawip, &((struct sockaddr_in6 *)addr)->sin6_addr.s6_addr, 16) == 0)
-				return p;
-	} else {
-		for (p = IpUsersHash_ipv4[hash]; p; p = p->next)
-			if (memcmp(p->rawip, &((struct sockaddr_in *)addr)->sin_addr.s_addr, 4) == 0)
-				return p;
-	}
-
-	return NULL;
+	return ipindex_find(&ipusers_index, client->rawip, IPINDEX_KEYLEN*8);
 }
 
 IpUsersBucket *add_ipusers_bucket(Client *client)
 {
-	int hash;
 	IpUsersBucket *n;
-	struct sockaddr *addr;
-
-	addr = raw_client_ip(client);
-	hash = hash_ipusers(client->ip);
 
 	n = safe_alloc(sizeof(IpUsersBucket));
-	if (addr->sa_family == AF_INET6)
-	{
-		memcpy(n->rawip, &((struct sockaddr_in6 *)addr)->sin6_addr.s6_addr, 16);
-		AddListItem(n, IpUsersHash_ipv6[hash]);
-	} else {
-		memcpy(n->rawip, &((struct sockaddr_in *)addr)->sin_addr.s_addr, 4);
-		AddListItem(n, IpUsersHash_ipv4[hash]);
-	}
+	memcpy(n->rawip, client->rawip, IPINDEX_KEYLEN);
+	ipindex_add(&ipusers_index, n->rawip, IPINDEX_KEYLEN*8, n);
 	return n;
 }
 
 void decrease_ipusers_bucket(Client *client)
 {
-	int hash = 0;
 	IpUsersBucket *p;
-	struct sockaddr *addr;
-	char ipv6 = 0;
 
 	if (!(client->flags & CLIENT_FLAG_IPUSERS_BUMPED))
 		return; /* nothing to do */
 
 	client->flags &= ~CLIENT_FLAG_IPUSERS_BUMPED;
 
-	addr = raw_client_ip(client);
-	hash = hash_ipusers(client->ip);
-
-	ipv6 = addr->sa_family == AF_INET6 ? 1 : 0;
-
-	if (ipv6)
-	{
-		for (p = IpUsersHash_ipv6[hash]; p; p = p->next)
-			if (memcmp(p->rawip, &((struct sockaddr_in6 *)addr)->sin6_addr.s6_addr, 16) == 0)
-				break;
-	} else {
-		for (p = IpUsersHash_ipv4[hash]; p; p = p->next)
-			if (memcmp(p->rawip, &((struct sockaddr_in *)addr)->sin_addr.s_addr, 4) == 0)
-				break;
-	}
+	p = ipindex_find(&ipusers_index, client->rawip, IPINDEX_KEYLEN*8);
 
 	if (!p)
 	{
@@ -836,10 +768,7 @@ void decrease_ipusers_bucket(Client *client)
 
 	if ((p->global_clients == 0) && (p->local_clients == 0))
 	{
-		if (ipv6)
-			DelListItem(p, IpUsersHash_ipv6[hash]);
-		else
-			DelListItem(p, IpUsersHash_ipv4[hash]);
+		ipindex_del(&ipusers_index, p->rawip, IPINDEX_KEYLEN*8);
 		safe_free(p);
 	}
 	return;
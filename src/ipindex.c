@@ -0,0 +1,377 @@
+/************************************************************************
+ *   UnrealIRCd - Unreal Internet Relay Chat Daemon - src/ipindex.c
+ *   (C) 2026 The UnrealIRCd Team
+ *
+ *   See file AUTHORS in IRC package for additional names of
+ *   the programmers.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** @file
+ * @brief Index of IP addresses and IP ranges (CIDR).
+ *
+ * The key is the IP address in binary form: 16 bytes, with IPv4
+ * addresses stored as IPv4-mapped IPv6 addresses (::ffff:a.b.c.d).
+ * An entry is a key plus a prefix length in bits, so 1.2.3.4 is
+ * stored as 128 bits and 1.2.3.0/24 as 120 bits.
+ *
+ * The index is a path-compressed binary trie. Besides exact lookups
+ * it can find the longest prefix that matches an IP address
+ * (ipindex_match) and walk all entries within a range (ipindex_walk).
+ *
+ * Clients have their IP address in this form in client->rawip,
+ * see set_client_ip(), so lookups need no parsing of the IP string.
+ */
+
+#include "unrealircd.h"
+
+struct IPIndexNode {
+	IPIndexNode *child[2];
+	void *value; /**< NULL for nodes that only join two branches */
+	char key[IPINDEX_KEYLEN]; /**< Key, bits beyond 'bits' are zero */
+	unsigned char bits; /**< Prefix length */
+};
+
+static const char ipv4_mapped_prefix[12] = { 0,0,0,0,0,0,0,0,0,0,(char)0xff,(char)0xff };
+
+/** Convert an IP address to a key for the IP index.
+ * @param ip	The IP address, eg "1.2.3.4" or "2001:db8::1"
+ * @param key	The key, IPINDEX_KEYLEN bytes
+ * @returns 1 on success, 0 if 'ip' is not an IP address (key is zeroed).
+ */
+int ipindex_key(const char *ip, char *key)
+{
+	if (ip)
+	{
+		if (strchr(ip, ':'))
+		{
+			if (inet_pton(AF_INET6, ip, key) == 1)
+				return 1;
+		} else {
+			memcpy(key, ipv4_mapped_prefix, sizeof(ipv4_mapped_prefix));
+			if (inet_pton(AF_INET, ip, key + 12) == 1)
+				return 1;
+		}
+	}
+	memset(key, 0, IPINDEX_KEYLEN);
+	return 0;
+}
+
+/** Is this key an IPv4 address? */
+int ipindex_key_is_ipv4(const char *key)
+{
+	return !memcmp(key, ipv4_mapped_prefix, sizeof(ipv4_mapped_prefix));
+}
+
+/** Zero the bits of a key beyond the prefix length */
+static void ipindex_key_mask(char *key, int bits)
+{
+	int i = bits / 8;
+
+	if (i >= IPINDEX_KEYLEN)
+		return;
+	if (bits % 8)
+		key[i++] &= (char)(0xff << (8 - (bits % 8)));
+	memset(key + i, 0, IPINDEX_KEYLEN - i);
+}
+
+/** Convert an IP address or CIDR mask to a key and prefix length.
+ * @param mask	The mask, eg "1.2.3.0/24", "2001:db8::/32" or "1.2.3.4"
+ * @param key	The key, IPINDEX_KEYLEN bytes
+ * @param bits	The prefix length (for IPv4 this includes the 96 bits of
+ *		the IPv4-mapped prefix, so /24 becomes 120)
+ * @returns 1 on success, 0 if the mask is not an IP address or CIDR mask.
+ */
+int ipindex_mask_key(const char *mask, char *key, int *bits)
+{
+	char ip[64];
+	const char *p = strchr(mask, '/');
+	int maxbits;
+
+	if (p)
+	{
+		if ((size_t)(p - mask) >= sizeof(ip))
+			return 0;
+		strlncpy(ip, mask, sizeof(ip), p - mask);
+	} else {
+		strlcpy(ip, mask, sizeof(ip));
+	}
+	if (!ipindex_key(ip, key))
+		return 0;
+	maxbits = ipindex_key_is_ipv4(key) ? 32 : 128;
+	*bits = maxbits;
+	if (p)
+	{
+		p++;
+		if (!*p || (strlen(p) > 3) || strspn(p, "0123456789") != strlen(p))
+			return 0;
+		*bits = atoi(p);
+		if (*bits > maxbits)
+			return 0;
+	}
+	if (maxbits == 32)
+		*bits += 96;
+	ipindex_key_mask(key, *bits);
+	return 1;
+}
+
+/** Convert a key back to an IP address string */
+const char *ipindex_key_to_ip(const char *key, char *buf, size_t buflen)
+{
+	const char *ret;
+
+	if (ipindex_key_is_ipv4(key))
+		ret = inetntop(AF_INET, key + 12, buf, buflen);
+	else
+		ret = inetntop(AF_INET6, key, buf, buflen);
+	return ret ? ret : "<invalid>";
+}
+
+/** Get bit 'n' of a key (0 is the most significant bit) */
+static inline int ipindex_bit(const char *key, int n)
+{
+	return ((unsigned char)key[n / 8] >> (7 - (n % 8))) & 1;
+}
+
+/** Number of leading bits that two keys have in common, up to 'max' */
+static int ipindex_common_bits(const char *a, const char *b, int max)
+{
+	int i, n = 0;
+	unsigned char x;
+
+	for (i = 0; n < max; i++, n += 8)
+	{
+		x = (unsigned char)a[i] ^ (unsigned char)b[i];
+		if (x)
+		{
+			while (!(x & 0x80))
+			{
+				x <<= 1;
+				n++;
+			}
+			break;
+		}
+	}
+	return MIN(n, max);
+}
+
+static IPIndexNode *ipindex_node(const char *key, int bits, void *value)
+{
+	IPIndexNode *n = safe_alloc(sizeof(IPIndexNode));
+
+	memcpy(n->key, key, IPINDEX_KEYLEN);
+	ipindex_key_mask(n->key, bits);
+	n->bits = bits;
+	n->value = value;
+	return n;
+}
+
+/** Add an entry to the index.
+ * @param idx	The index
+ * @param key	The key, see ipindex_key() and ipindex_mask_key()
+ * @param bits	The prefix length, 128 for a single IP address
+ * @param value	The value to store, must not be NULL
+ * @returns 1 if added, 0 if an entry with this key and length already exists.
+ */
+int ipindex_add(IPIndex *idx, const char *key, int bits, void *value)
+{
+	IPIndexNode **p = &idx->root;
+	IPIndexNode *n, *glue, *add;
+	int common;
+
+	while ((n = *p))
+	{
+		common = ipindex_common_bits(n->key, key, MIN(n->bits, bits));
+		if (common < n->bits)
+		{
+			/* The new entry goes above this node */
+			add = ipindex_node(key, bits, value);
+			if (common == bits)
+			{
+				add->child[ipindex_bit(n->key, bits)] = n;
+				*p = add;
+			} else {
+				glue = ipindex_node(key, common, NULL);
+				glue->child[ipindex_bit(n->key, common)] = n;
+				glue->child[ipindex_bit(key, common)] = add;
+				*p = glue;
+			}
+			idx->count++;
+			return 1;
+		}
+		if (n->bits == bits)
+		{
+			if (n->value)
+				return 0;
+			n->value = value;
+			idx->count++;
+			return 1;
+		}
+		p = &n->child[ipindex_bit(key, n->bits)];
+	}
+	*p = ipindex_node(key, bits, value);
+	idx->count++;
+	return 1;
+}
+
+/** Find the entry with exactly this key and prefix length.
+ * @returns The value, or NULL if not found.
+ */
+void *ipindex_find(IPIndex *idx, const char *key, int bits)
+{
+	IPIndexNode *n = idx->root;
+
+	while (n && (n->bits <= bits))
+	{
+		if (ipindex_common_bits(n->key, key, n->bits) < n->bits)
+			return NULL;
+		if (n->bits == bits)
+			return n->value;
+		n = n->child[ipindex_bit(key, n->bits)];
+	}
+	return NULL;
+}
+
+/** Find the entry with the longest prefix that contains this IP address.
+ * @param idx	The index
+ * @param key	The IP address, see ipindex_key()
+ * @param bits	If not NULL, set to the prefix length of the entry found
+ * @returns The value, or NULL if no entry contains this IP address.
+ */
+void *ipindex_match(IPIndex *idx, const char *key, int *bits)
+{
+	IPIndexNode *n = idx->root, *best = NULL;
+
+	while (n)
+	{
+		if (ipindex_common_bits(n->key, key, n->bits) < n->bits)
+			break;
+		if (n->value)
+			best = n;
+		if (n->bits == IPINDEX_KEYLEN * 8)
+			break;
+		n = n->child[ipindex_bit(key, n->bits)];
+	}
+	if (!best)
+		return NULL;
+	if (bits)
+		*bits = best->bits;
+	return best->value;
+}
+
+/** Delete the entry with exactly this key and prefix length.
+ * @returns The value of the entry, or NULL if not found.
+ */
+void *ipindex_del(IPIndex *idx, const char *key, int bits)
+{
+	IPIndexNode **p = &idx->root, **parent = NULL;
+	IPIndexNode *n, *up;
+	void *value;
+
+	while ((n = *p))
+	{
+		if ((n->bits > bits) || (ipindex_common_bits(n->key, key, n->bits) < n->bits))
+			return NULL;
+		if (n->bits == bits)
+			break;
+		parent = p;
+		p = &n->child[ipindex_bit(key, n->bits)];
+	}
+	if (!n || !n->value)
+		return NULL;
+
+	value = n->value;
+	n->value = NULL;
+	idx->count--;
+
+	if (n->child[0] && n->child[1])
+		return value; /* still needed to join the two branches */
+
+	*p = n->child[0] ? n->child[0] : n->child[1];
+	safe_free(n);
+
+	/* A node without a value that is left with one branch is not needed either */
+	if (parent)
+	{
+		up = *parent;
+		if (!up->value && !(up->child[0] && up->child[1]))
+		{
+			*parent = up->child[0] ? up->child[0] : up->child[1];
+			safe_free(up);
+		}
+	}
+	return value;
+}
+
+static void ipindex_walk_node(IPIndexNode *n, void (*callback)(const char *key, int bits, void *value, void *data), void *data)
+{
+	if (n->child[0])
+		ipindex_walk_node(n->child[0], callback, data);
+	if (n->value)
+		callback(n->key, n->bits, n->value, data);
+	if (n->child[1])
+		ipindex_walk_node(n->child[1], callback, data);
+}
+
+/** Call a function for all entries within a range, in key order.
+ * The index must not be changed from within the callback.
+ * @param idx		The index
+ * @param key		The range, see ipindex_mask_key(), or NULL for all entries
+ * @param bits		The prefix length of the range
+ * @param callback	The function to call
+ * @param data		Passed to the callback
+ */
+void ipindex_walk(IPIndex *idx, const char *key, int bits, void (*callback)(const char *key, int bits, void *value, void *data), void *data)
+{
+	IPIndexNode *n = idx->root;
+
+	if (key)
+	{
+		while (n && (n->bits < bits))
+		{
+			if (ipindex_common_bits(n->key, key, n->bits) < n->bits)
+				return;
+			n = n->child[ipindex_bit(key, n->bits)];
+		}
+		if (!n || (ipindex_common_bits(n->key, key, bits) < bits))
+			return;
+	}
+	if (n)
+		ipindex_walk_node(n, callback, data);
+}
+
+static void ipindex_free_node(IPIndexNode *n, void (*freefunc)(void *value))
+{
+	if (n->child[0])
+		ipindex_free_node(n->child[0], freefunc);
+	if (n->child[1])
+		ipindex_free_node(n->child[1], freefunc);
+	if (n->value && freefunc)
+		freefunc(n->value);
+	safe_free(n);
+}
+
+/** Remove all entries from the index.
+ * @param idx		The index
+ * @param freefunc	Function to free the values with, or NULL
+ */
+void ipindex_free(IPIndex *idx, void (*freefunc)(void *value))
+{
+	if (idx->root)
+		ipindex_free_node(idx->root, freefunc);
+	idx->root = NULL;
+	idx->count = 0;
+}
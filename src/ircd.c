@@ -70,13 +70,19 @@ int match_tkls(Client *client)
 	ConfigItem_ban *bconf = NULL;
 	char banbuf[1024];
 
-	/* Process dynamic *LINES */
-	if (find_tkline_match(client, 0))
-		return 1; /* user killed */
+	/* Newly added server bans are checked by the tkl module, only
+	 * a full check (eg after a rehash) goes through all of them here.
+	 */
+	if (loop.do_bancheck)
+	{
+		/* Process dynamic *LINES */
+		if (find_tkline_match(client, 0))
+			return 1; /* user killed */
 
-	find_shun(client); /* check for shunned and take action, if so */
+		find_shun(client); /* check for shunned and take action, if so */
+	}
 
-	if (IsUser(client))
+	if (loop.do_bancheck && IsUser(client))
 	{
 		/* Check ban realname { } */
 		if (!ValidatePermissionsForPath("immune",client,NULL,NULL,NULL) && (bconf = find_ban(NULL, client->info, CONF_BAN_REALNAME)))
@@ -219,7 +225,8 @@ EVENT(check_pings)
 	list_for_each_entry_safe(client, next, &lclient_list, lclient_node)
 	{
 		/* Check TKLs for this user */
-		if (loop.do_bancheck && match_tkls(client))
+		if ((loop.do_bancheck || loop.do_bancheck_spamf_user || loop.do_bancheck_spamf_away) &&
+		    match_tkls(client))
 			continue;
 		check_ping(client);
 		/* don't touch 'client' after this as it may have been killed */
@@ -316,7 +323,7 @@ extern MODVAR Event *events;
  */
 void fix_timers(void)
 {
-	int i, cnt;
+	int cnt;
 	Client *client;
 	Event *e;
 	struct ThrottlingBucket *thr;
@@ -358,13 +365,10 @@ void fix_timers(void)
 	 * sonner than we should.
 	 */
 	cnt = 0;
-	for (i = 0; i < THROTTLING_HASH_TABLE_SIZE; i++)
+	for (thr = ThrottlingList; thr; thr = thr->next)
 	{
-		for (thr = ThrottlingHash[i]; thr; thr = thr->next)
-		{
-			if (thr->since > TStime())
-				thr->since = TStime();
-		}
+		if (thr->since > TStime())
+			thr->since = TStime();
 	}
 
 	/* Make sure autoconnect for servers still works (lnk->hold) */
@@ -606,6 +610,7 @@ int InitUnrealIRCd(int argc, char *argv[])
 
 	mp_pool_init();
 	dbuf_init();
+	text_kernels_init();
 	initlists();
 	initlist_channels();
 
@@ -615,6 +620,7 @@ int InitUnrealIRCd(int argc, char *argv[])
 	umode_init();
 	extcmode_init();
 	efunctions_init();
+	history_backend_init();
 	clear_scache_hash_table();
 #ifndef _WIN32
 	/* Make it so we can dump core */
@@ -951,6 +957,7 @@ int InitUnrealIRCd(int argc, char *argv[])
 void SocketLoop(void *dummy)
 {
 	struct timeval doevents_tv, process_clients_tv;
+	long long start;
 
 	memset(&doevents_tv, 0, sizeof(doevents_tv));
 	memset(&process_clients_tv, 0, sizeof(process_clients_tv));
@@ -962,8 +969,14 @@ void SocketLoop(void *dummy)
 
 		detect_timeshift_and_warn();
 
+		loop_iteration_start();
+
 		if (minimum_msec_since_last_run(&doevents_tv, 250))
+		{
+			start = loop_time_usec();
 			DoEvents();
+			loop_phase_record(LOOP_PHASE_EVENTS, start);
+		}
 
 		/* Update statistics */
 		if (irccounts.clients > irccounts.global_max)
@@ -972,10 +985,16 @@ void SocketLoop(void *dummy)
 			irccounts.me_max = irccounts.me_clients;
 
 		/* Process I/O */
+		loop_io_start();
 		fd_select(SOCKETLOOP_MAX_DELAY);
+		loop_io_end();
 
 		if (minimum_msec_since_last_run(&process_clients_tv, 200))
+		{
+			start = loop_time_usec();
 			process_clients();
+			loop_phase_record(LOOP_PHASE_CLIENTS, start);
+		}
 
 		/* Check if there are pending "actions".
 		 * These are actions that should be done outside of
@@ -1000,6 +1019,8 @@ void SocketLoop(void *dummy)
 		/* If rehashing, check if we are done. */
 		if (loop.rehashing && is_config_read_finished())
 			rehash_internal(loop.rehash_save_client);
+
+		loop_iteration_end();
 	}
 }
 
@@ -136,8 +136,8 @@ Client *make_client(Client *from, Client *servr)
 		client->local->authfd = -1;
 		client->local->fd = -1;
 
-		dbuf_queue_init(&client->local->recvQ);
-		dbuf_queue_init(&client->local->sendQ);
+		dbuf_queue_init_ex(&client->local->recvQ, &dbufstats.recvq_bytes);
+		dbuf_queue_init_ex(&client->local->sendQ, &dbufstats.sendq_bytes);
 
 		while (hash_find_id((id = uid_get()), NULL) != NULL)
 			;
@@ -192,7 +192,9 @@ void free_client(Client *client)
 			safe_free(client->local->error_str);
 			if (client->local->hostp)
 				unreal_free_hostent(client->local->hostp);
-			
+			DBufClear(&client->local->sendQ);
+			DBufClear(&client->local->recvQ);
+
 			mp_pool_release(client->local);
 		}
 		if (*client->id)
@@ -0,0 +1,300 @@
+/************************************************************************
+ *   UnrealIRCd - Unreal Internet Relay Chat Daemon - src/loopstats.c
+ *   (C) 2026 The UnrealIRCd Team
+ *
+ *   See file AUTHORS in IRC package for additional names of
+ *   the programmers.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** @file
+ * @brief Main loop latency statistics.
+ *
+ * SocketLoop() reports how long each of its phases took: running
+ * events, dispatching I/O callbacks and process_clients(). These are
+ * kept in histograms (always on, the cost is a few clock reads per
+ * iteration). In addition, every event, I/O callback and command is
+ * timed and the costliest ones of the current iteration are kept.
+ * If the iteration turns out to be slower than set::slow-loop-threshold
+ * then these are saved, so an oper can see what caused a lag spike
+ * through STATS loop, the stats.loop RPC call or './unrealircd loop-stats'.
+ */
+
+#include "unrealircd.h"
+
+MODVAR LoopHistogram loop_histogram[LOOP_PHASES];
+MODVAR LoopSlowIteration loop_slow_iterations[LOOP_SLOW_HISTORY];
+MODVAR long long loop_slow_iterations_total = 0;
+
+/* State of the current loop iteration */
+static long long iteration_start = 0;
+static long long io_start = 0;
+static long long io_ready = 0;
+static long long io_wait = 0;
+static long long phase_usec[LOOP_PHASES];
+static LoopTraceItem trace_item[LOOP_TRACE_TOP];
+static int trace_items = 0;
+static time_t last_slow_log = 0;
+
+/** Current time in microseconds, from a monotonic clock.
+ * Only useful for measuring durations.
+ */
+long long loop_time_usec(void)
+{
+#ifndef _WIN32
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((long long)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+#else
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (now.QuadPart / freq.QuadPart) * 1000000 +
+	       ((now.QuadPart % freq.QuadPart) * 1000000) / freq.QuadPart;
+#endif
+}
+
+/** Return the histogram bucket for a value */
+static int loop_histogram_index(long long v)
+{
+	int msb;
+
+	if (v < (1 << LOOP_HISTOGRAM_SUB_BITS))
+		return (v < 0) ? 0 : v;
+	if (v > 0xffffffffLL)
+		v = 0xffffffffLL;
+	for (msb = LOOP_HISTOGRAM_SUB_BITS; v >> (msb + 1); msb++);
+	return ((msb - LOOP_HISTOGRAM_SUB_BITS + 1) << LOOP_HISTOGRAM_SUB_BITS) +
+	       ((v >> (msb - LOOP_HISTOGRAM_SUB_BITS)) & ((1 << LOOP_HISTOGRAM_SUB_BITS) - 1));
+}
+
+/** Return the highest value that falls in a histogram bucket */
+long long loop_histogram_bucket_value(int bucket)
+{
+	int shift;
+	long long sub;
+
+	if (bucket < (1 << LOOP_HISTOGRAM_SUB_BITS))
+		return bucket;
+	shift = (bucket >> LOOP_HISTOGRAM_SUB_BITS) - 1;
+	sub = bucket & ((1 << LOOP_HISTOGRAM_SUB_BITS) - 1);
+	return (((1LL << LOOP_HISTOGRAM_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+static void loop_histogram_add(LoopHistogram *h, long long usec)
+{
+	h->count++;
+	h->total += usec;
+	if (usec > h->max)
+		h->max = usec;
+	h->bucket[loop_histogram_index(usec)]++;
+}
+
+/** Return the value below which 'percentile' percent of the samples fall.
+ * @param h		The histogram
+ * @param percentile	Percentile, eg 99.9
+ * @returns The value in microseconds, accurate to within 12.5%.
+ */
+long long loop_histogram_percentile(LoopHistogram *h, double percentile)
+{
+	double exact;
+	long long want, seen = 0, v;
+	int i;
+
+	if (h->count == 0)
+		return 0;
+	exact = (h->count * percentile) / 100.0;
+	want = (long long)exact;
+	if ((want < exact) || (want < 1))
+		want++;
+	for (i = 0; i < LOOP_HISTOGRAM_BUCKETS; i++)
+	{
+		seen += h->bucket[i];
+		if (seen >= want)
+		{
+			v = loop_histogram_bucket_value(i);
+			return (v > h->max) ? h->max : v;
+		}
+	}
+	return h->max;
+}
+
+const char *loop_phase_name(LoopPhase phase)
+{
+	switch (phase)
+	{
+		case LOOP_PHASE_EVENTS:
+			return "events";
+		case LOOP_PHASE_IO:
+			return "io";
+		case LOOP_PHASE_CLIENTS:
+			return "clients";
+		case LOOP_PHASE_ITERATION:
+			return "iteration";
+	}
+	return "unknown";
+}
+
+const char *loop_trace_type_name(LoopTraceType type)
+{
+	switch (type)
+	{
+		case LOOP_TRACE_EVENT:
+			return "event";
+		case LOOP_TRACE_IO:
+			return "io";
+		case LOOP_TRACE_COMMAND:
+			return "command";
+	}
+	return "unknown";
+}
+
+/** Called by SocketLoop() at the start of each iteration */
+void loop_iteration_start(void)
+{
+	iteration_start = loop_time_usec();
+	io_wait = 0;
+	memset(phase_usec, 0, sizeof(phase_usec));
+	trace_items = 0;
+}
+
+/** Record the duration of a loop phase.
+ * @param phase		The phase (not LOOP_PHASE_ITERATION)
+ * @param start		Time the phase started, from loop_time_usec()
+ */
+void loop_phase_record(LoopPhase phase, long long start)
+{
+	long long usec = loop_time_usec() - start;
+
+	phase_usec[phase] += usec;
+	loop_histogram_add(&loop_histogram[phase], usec);
+}
+
+/** Called by SocketLoop() right before fd_select() */
+void loop_io_start(void)
+{
+	io_start = loop_time_usec();
+	io_ready = 0;
+}
+
+/** Called by the fd_select() backends when waiting is over
+ * and they are about to call the I/O callbacks.
+ */
+void loop_io_ready(void)
+{
+	io_ready = loop_time_usec();
+}
+
+/** Called by SocketLoop() right after fd_select() */
+void loop_io_end(void)
+{
+	if (io_ready)
+	{
+		io_wait += io_ready - io_start;
+		loop_phase_record(LOOP_PHASE_IO, io_ready);
+	} else {
+		io_wait += loop_time_usec() - io_start;
+	}
+}
+
+/** Remember an event, I/O callback or command if it is one of
+ * the most expensive ones of this loop iteration.
+ * @param type		The type of item
+ * @param name		Name of the event, fd description or command
+ * @param client	The client that sent the command, or NULL
+ * @param start		Time the item started, from loop_time_usec()
+ */
+void loop_trace_record(LoopTraceType type, const char *name, const char *client, long long start)
+{
+	long long usec;
+	int i;
+
+	if (!iConf.slow_loop_threshold)
+		return;
+
+	usec = loop_time_usec() - start;
+	if ((trace_items == LOOP_TRACE_TOP) && (usec <= trace_item[LOOP_TRACE_TOP-1].usec))
+		return;
+
+	/* Insertion sort, costliest first. If full, the last one falls off. */
+	i = (trace_items < LOOP_TRACE_TOP) ? trace_items : LOOP_TRACE_TOP - 1;
+	for (; (i > 0) && (trace_item[i-1].usec < usec); i--)
+		trace_item[i] = trace_item[i-1];
+	trace_item[i].type = type;
+	trace_item[i].usec = usec;
+	strlcpy(trace_item[i].name, !BadPtr(name) ? name : "-", sizeof(trace_item[i].name));
+	strlcpy(trace_item[i].client, client ? client : "", sizeof(trace_item[i].client));
+	if (trace_items < LOOP_TRACE_TOP)
+		trace_items++;
+}
+
+/** Called by SocketLoop() at the end of each iteration */
+void loop_iteration_end(void)
+{
+	long long usec = loop_time_usec() - iteration_start - io_wait;
+	LoopSlowIteration *e;
+	int i;
+
+	phase_usec[LOOP_PHASE_ITERATION] = usec;
+	loop_histogram_add(&loop_histogram[LOOP_PHASE_ITERATION], usec);
+
+	if (!iConf.slow_loop_threshold || (usec < iConf.slow_loop_threshold * 1000))
+		return;
+
+	e = &loop_slow_iterations[loop_slow_iterations_total % LOOP_SLOW_HISTORY];
+	loop_slow_iterations_total++;
+	e->when = TStime();
+	e->usec = usec;
+	memcpy(e->phase_usec, phase_usec, sizeof(e->phase_usec));
+	e->num_items = trace_items;
+	for (i = 0; i < trace_items; i++)
+		e->item[i] = trace_item[i];
+
+	/* Log it, but not too often, as a server under stress may
+	 * have many slow iterations in a row.
+	 */
+	if (TStime() - last_slow_log >= 60)
+	{
+		last_slow_log = TStime();
+		unreal_log(ULOG_WARNING, "io", "SLOW_LOOP_ITERATION", NULL,
+		           "Main loop iteration took $time_msec msec "
+		           "(events: $events_msec, io: $io_msec, clients: $clients_msec). "
+		           "Costliest: $top_type $top_name $top_client ($top_msec msec). "
+		           "See STATS loop for details.",
+		           log_data_integer("time_msec", usec / 1000),
+		           log_data_integer("events_msec", phase_usec[LOOP_PHASE_EVENTS] / 1000),
+		           log_data_integer("io_msec", phase_usec[LOOP_PHASE_IO] / 1000),
+		           log_data_integer("clients_msec", phase_usec[LOOP_PHASE_CLIENTS] / 1000),
+		           log_data_string("top_type", trace_items ? loop_trace_type_name(trace_item[0].type) : "none"),
+		           log_data_string("top_name", trace_items ? trace_item[0].name : "-"),
+		           log_data_string("top_client", trace_items ? trace_item[0].client : ""),
+		           log_data_integer("top_msec", trace_items ? trace_item[0].usec / 1000 : 0));
+	}
+}
+
+/** Return the n-th most recent slow loop iteration, or NULL if there is none.
+ * @param n	0 for the most recent one, up to LOOP_SLOW_HISTORY-1
+ */
+LoopSlowIteration *loop_slow_iteration(int n)
+{
+	if ((n < 0) || (n >= LOOP_SLOW_HISTORY) || (n >= loop_slow_iterations_total))
+		return NULL;
+	return &loop_slow_iterations[(loop_slow_iterations_total - 1 - n) % LOOP_SLOW_HISTORY];
+}
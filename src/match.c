@@ -615,6 +615,113 @@ int fast_badword_replace(ConfigItem_badword *badword, const char *line, char *bu
 	return cleaned;
 }
 
+/** Apply a single badword to 'cleanstr', the one-word-at-a-time method.
+ * This is used by stripbadwords() for all words, and by stripbadwords_matcher()
+ * for the words that cannot be handled by the Aho-Corasick automaton (regexes).
+ * @param this_word	The badword
+ * @param cleanstr	The text, will be updated in-place (4096 bytes)
+ * @param cleaned	Set to 1 if anything was replaced
+ * @param matchlen	Total length of regex replacements so far
+ * @param stringlen	Length of the original text
+ * @returns 1 if the text must be blocked, 2 if the whole text has been
+ *          replaced (no need to check further words), 0 otherwise.
+ */
+static int stripbadwords_word(ConfigItem_badword *this_word, char *cleanstr, int *cleaned, int *matchlen, int stringlen)
+{
+	char buf[4096];
+	char *ptr;
+	int m;
+
+	buf[0] = '\0';
+
+	if (this_word->type & BADW_TYPE_FAST)
+	{
+		if (this_word->action == BADWORD_BLOCK)
+		{
+			if (fast_badword_match(this_word, cleanstr))
+				return 1;
+		}
+		else
+		{
+			int n;
+			/* fast_badword_replace() does size checking so we can use 512 here instead of 4096 */
+			n = fast_badword_replace(this_word, cleanstr, buf, 512);
+			if (!*cleaned && n)
+				*cleaned = n;
+			strcpy(cleanstr, buf);
+		}
+	} else
+	if (this_word->type & BADW_TYPE_REGEX)
+	{
+		if (this_word->action == BADWORD_BLOCK)
+		{
+			pcre2_match_data *md = pcre2_match_data_create(9, NULL);
+			int ret;
+
+			ret = pcre2_match(this_word->pcre2_expr, cleanstr, PCRE2_ZERO_TERMINATED, 0, 0, md, NULL); /* run the regex */
+			pcre2_match_data_free(md); /* yeah, we never use it. unfortunately argument must be non-NULL for pcre2_match() */
+			if (ret > 0)
+				return 1;
+		}
+		else
+		{
+			pcre2_match_data *md;
+			int ret;
+			PCRE2_SIZE *dd;
+			int start, end;
+
+			ptr = cleanstr; /* set pointer to start of string */
+			while(1) {
+				md = pcre2_match_data_create(9, NULL);
+				/* ^^ we need to free 'md' in ALL circumstances.
+				 * remember this if you break or continue in this loop!
+				 */
+				ret = pcre2_match(this_word->pcre2_expr, ptr, PCRE2_ZERO_TERMINATED, 0, 0, md, NULL); /* run the regex */
+				if (ret > 0)
+				{
+					dd = pcre2_get_ovector_pointer(md);
+					start = (int)dd[0];
+					end = (int)dd[1];
+					if ((start < 0) || (end < 0) || (start > strlen(ptr)) || (end > strlen(ptr)+1))
+					{
+						unreal_log(ULOG_FATAL, "main", "BUG_STRIPBADWORDS_PCRE2_MATCH_OOB", NULL,
+						           "[BUG] pcre2_match() returned an ovector with OOB start/end: $start/$end, len $length: '$buf'",
+						           log_data_integer("start", start),
+						           log_data_integer("end", end),
+						           log_data_integer("length", strlen(ptr)),
+						           log_data_string("buf", ptr));
+						abort();
+					}
+					m = end - start;
+					if (m == 0)
+					{
+						pcre2_match_data_free(md);
+						break; /* anti-loop */
+					}
+					*cleaned = 1;
+					*matchlen += m;
+					strlncat(buf, ptr, sizeof buf, start);
+					if (this_word->replace)
+						strlcat(buf, this_word->replace, sizeof buf); 
+					else
+						strlcat(buf, REPLACEWORD, sizeof buf);
+					ptr += end; /* Set pointer after the match pos */
+					pcre2_match_data_free(md);
+					continue; /* next! */
+				}
+				pcre2_match_data_free(md);
+				break; /* NOMATCH: we are done! */
+			}
+			/* All the better to eat you with! */
+			strlcat(buf, ptr, sizeof buf);	
+			memcpy(cleanstr, buf, sizeof buf);
+			if (*matchlen == stringlen)
+				return 2;
+		}
+	}
+	return 0;
+}
+
 /*
  * Returns a string, which has been filtered by the words loaded via
  * the loadbadwords() function.  It's primary use is to filter swearing
@@ -623,9 +730,7 @@ int fast_badword_replace(ConfigItem_badword *badword, const char *line, char *bu
 const char *stripbadwords(const char *str, ConfigItem_badword *start_bw, int *blocked)
 {
 	static char cleanstr[4096];
-	char buf[4096];
-	char *ptr;
-	int matchlen, m, stringlen, cleaned;
+	int matchlen, stringlen, cleaned;
 	ConfigItem_badword *this_word;
 
 	*blocked = 0;
@@ -636,107 +741,355 @@ const char *stripbadwords(const char *str, ConfigItem_badword *start_bw, int *bl
 	/*
 	 * work on a copy
 	 */
-	stringlen = strlcpy(cleanstr, StripControlCodes(str), sizeof cleanstr);
+	stringlen = strlcpy(cleanstr, text_context_stripped(str), sizeof cleanstr);
 	matchlen = 0;
-	buf[0] = '\0';
 	cleaned = 0;
 
 	for (this_word = start_bw; this_word; this_word = this_word->next)
 	{
-		if (this_word->type & BADW_TYPE_FAST)
+		int ret = stripbadwords_word(this_word, cleanstr, &cleaned, &matchlen, stringlen);
+		if (ret == 1)
 		{
-			if (this_word->action == BADWORD_BLOCK)
+			*blocked = 1;
+			return NULL;
+		}
+		if (ret == 2)
+			break;
+	}
+
+	cleanstr[511] = '\0'; /* cutoff, just to be sure */
+
+	return (cleaned) ? cleanstr : str;
+}
+
+/** Compiled list of badwords, see badword_matcher_compile().
+ * All the fast badwords ("word", "*word", "word*", "*word*") are put
+ * in a case-insensitive Aho-Corasick automaton, so the text only needs
+ * to be scanned once, no matter how many words there are.
+ * Regex badwords are kept in a residual list and are handled the
+ * old way, one at a time.
+ */
+struct BadwordMatcher {
+	int num_states; /**< Number of states in the automaton */
+	int num_classes; /**< Number of character classes (columns in 'next') */
+	unsigned char charclass[256]; /**< Character to class, 0 is for characters not in any word */
+	int *next; /**< Transitions: num_states * num_classes */
+	int *out; /**< Per state: first word that ends here, or -1 */
+	int *dict; /**< Per state: next state in the fail chain that has output, or -1 */
+	int num_words; /**< Number of words in the automaton */
+	ConfigItem_badword **words; /**< The words in the automaton, in list order */
+	int *wordlen; /**< Length of each word */
+	int *out_next; /**< Per word: next word that ends in the same state, or -1 */
+	int num_residual; /**< Number of residual words */
+	ConfigItem_badword **residual; /**< Words not in the automaton, in list order */
+};
+
+/** Compile a list of badwords into a BadwordMatcher.
+ * Call this after the configuration has been loaded, and use
+ * stripbadwords_matcher() instead of stripbadwords().
+ * The matcher refers to the items in the list, so free it
+ * (with badword_matcher_free()) before freeing the list.
+ * @param start_bw	The list of badwords
+ * @returns The matcher, or NULL if the list is empty.
+ */
+BadwordMatcher *badword_matcher_compile(ConfigItem_badword *start_bw)
+{
+	BadwordMatcher *m;
+	ConfigItem_badword *e;
+	int total_len = 0;
+	int max_words = 0;
+	int *fail, *queue;
+	int qhead = 0, qtail = 0;
+	int i, c, s;
+
+	if (!start_bw)
+		return NULL;
+
+	m = safe_alloc(sizeof(BadwordMatcher));
+
+	/* Count and split into automaton words and residual words */
+	for (e = start_bw; e; e = e->next)
+		max_words++;
+	m->words = safe_alloc(sizeof(ConfigItem_badword *) * max_words);
+	m->wordlen = safe_alloc(sizeof(int) * max_words);
+	m->out_next = safe_alloc(sizeof(int) * max_words);
+	m->residual = safe_alloc(sizeof(ConfigItem_badword *) * max_words);
+	for (e = start_bw; e; e = e->next)
+	{
+		if ((e->type & BADW_TYPE_FAST) && !BadPtr(e->word))
+		{
+			m->wordlen[m->num_words] = strlen(e->word);
+			total_len += m->wordlen[m->num_words];
+			m->words[m->num_words++] = e;
+		} else {
+			m->residual[m->num_residual++] = e;
+		}
+	}
+
+	/* Character classes. Upper and lower case share the same class. */
+	m->num_classes = 1;
+	for (i = 0; i < m->num_words; i++)
+	{
+		const unsigned char *p;
+		for (p = (const unsigned char *)m->words[i]->word; *p; p++)
+		{
+			c = tolower(*p);
+			if (!m->charclass[c])
 			{
-				if (fast_badword_match(this_word, cleanstr))
-				{
-					*blocked = 1;
-					return NULL;
-				}
+				m->charclass[c] = m->num_classes;
+				m->charclass[toupper(c)] = m->num_classes;
+				m->num_classes++;
 			}
-			else
+		}
+	}
+
+	/* Build the trie. State 0 is the root. */
+	m->next = safe_alloc(sizeof(int) * (total_len + 1) * m->num_classes);
+	m->out = safe_alloc(sizeof(int) * (total_len + 1));
+	m->dict = safe_alloc(sizeof(int) * (total_len + 1));
+	fail = safe_alloc(sizeof(int) * (total_len + 1));
+	queue = safe_alloc(sizeof(int) * (total_len + 1));
+	for (i = 0; i <= total_len; i++)
+		m->out[i] = m->dict[i] = -1;
+	m->num_states = 1;
+	/* In reverse, so the earliest word in the list ends up first in the out list */
+	for (i = m->num_words - 1; i >= 0; i--)
+	{
+		const unsigned char *p;
+		s = 0;
+		for (p = (const unsigned char *)m->words[i]->word; *p; p++)
+		{
+			int *t = &m->next[s * m->num_classes + m->charclass[*p]];
+			if (!*t)
+				*t = m->num_states++;
+			s = *t;
+		}
+		m->out_next[i] = m->out[s];
+		m->out[s] = i;
+	}
+
+	/* Breadth-first: set fail links and complete the transitions,
+	 * so matching never needs to follow fail links.
+	 */
+	for (c = 0; c < m->num_classes; c++)
+	{
+		s = m->next[c];
+		if (s)
+		{
+			fail[s] = 0;
+			queue[qtail++] = s;
+		}
+	}
+	while (qhead < qtail)
+	{
+		int r = queue[qhead++];
+		m->dict[r] = (m->out[fail[r]] != -1) ? fail[r] : m->dict[fail[r]];
+		for (c = 0; c < m->num_classes; c++)
+		{
+			s = m->next[r * m->num_classes + c];
+			if (s)
 			{
-				int n;
-				/* fast_badword_replace() does size checking so we can use 512 here instead of 4096 */
-				n = fast_badword_replace(this_word, cleanstr, buf, 512);
-				if (!cleaned && n)
-					cleaned = n;
-				strcpy(cleanstr, buf);
-				memset(buf, 0, sizeof(buf)); /* regexp likes this somehow */
+				fail[s] = m->next[fail[r] * m->num_classes + c];
+				queue[qtail++] = s;
+			} else {
+				m->next[r * m->num_classes + c] = m->next[fail[r] * m->num_classes + c];
 			}
-		} else
-		if (this_word->type & BADW_TYPE_REGEX)
+		}
+	}
+
+	safe_free(fail);
+	safe_free(queue);
+	return m;
+}
+
+/** Free a BadwordMatcher, created by badword_matcher_compile() */
+void badword_matcher_free(BadwordMatcher *m)
+{
+	if (!m)
+		return;
+	safe_free(m->next);
+	safe_free(m->out);
+	safe_free(m->dict);
+	safe_free(m->words);
+	safe_free(m->wordlen);
+	safe_free(m->out_next);
+	safe_free(m->residual);
+	safe_free(m);
+}
+
+/** A word in the text that is to be replaced, used by stripbadwords_matcher() */
+typedef struct BadwordSpan {
+	int start; /**< Start of the word in the text */
+	int end; /**< End of the word in the text (exclusive) */
+	int word; /**< Index in BadwordMatcher.words */
+} BadwordSpan;
+
+/** Run the text through the automaton of a BadwordMatcher.
+ * @param m		The matcher
+ * @param text		The text
+ * @param spans		If not NULL, the words to be replaced are stored here
+ *			(allocated, to be freed by the caller).
+ * @param num_spans	Number of items in 'spans'
+ * @returns 1 if a badword with the block action matched, 0 otherwise.
+ * @note If 'spans' is NULL then only the block words are checked.
+ */
+static int badword_matcher_scan(BadwordMatcher *m, const char *text, BadwordSpan **spans, int *num_spans)
+{
+	int blocked = 0;
+	int state = 0;
+	int i;
+
+	for (i = 0; text[i]; i++)
+	{
+		int s;
+
+		state = m->next[state * m->num_classes + m->charclass[(unsigned char)text[i]]];
+		s = (m->out[state] != -1) ? state : m->dict[state];
+		for (; s != -1; s = m->dict[s])
 		{
-			if (this_word->action == BADWORD_BLOCK)
+			int w;
+			for (w = m->out[s]; w != -1; w = m->out_next[w])
 			{
-				pcre2_match_data *md = pcre2_match_data_create(9, NULL);
-				int ret;
+				ConfigItem_badword *bw = m->words[w];
+				int pos = i - m->wordlen[w] + 1;
+				int start, end;
 
-				ret = pcre2_match(this_word->pcre2_expr, cleanstr, PCRE2_ZERO_TERMINATED, 0, 0, md, NULL); /* run the regex */
-				pcre2_match_data_free(md); /* yeah, we never use it. unfortunately argument must be non-NULL for pcre2_match() */
-				if (ret > 0)
+				/* Check the word boundaries */
+				if (!(bw->type & BADW_TYPE_FAST_L) && (pos > 0) && !iswseperator(text[pos - 1]))
+					continue; /* aaBLA but no *BLA */
+				if (!(bw->type & BADW_TYPE_FAST_R) && !iswseperator(text[i + 1]))
+					continue; /* BLAaa but no BLA* */
+
+				if (bw->action == BADWORD_BLOCK)
 				{
-					*blocked = 1;
-					return NULL;
+					if (!spans)
+						return 1;
+					blocked = 1;
+					continue;
 				}
-			}
-			else
-			{
-				pcre2_match_data *md;
-				int ret;
-				PCRE2_SIZE *dd;
-				int start, end;
+				if (!spans)
+					continue;
 
-				ptr = cleanstr; /* set pointer to start of string */
-				while(1) {
-					md = pcre2_match_data_create(9, NULL);
-					/* ^^ we need to free 'md' in ALL circumstances.
-					 * remember this if you break or continue in this loop!
-					 */
-					ret = pcre2_match(this_word->pcre2_expr, ptr, PCRE2_ZERO_TERMINATED, 0, 0, md, NULL); /* run the regex */
-					if (ret > 0)
-					{
-						dd = pcre2_get_ovector_pointer(md);
-						start = (int)dd[0];
-						end = (int)dd[1];
-						if ((start < 0) || (end < 0) || (start > strlen(ptr)) || (end > strlen(ptr)+1))
-						{
-							unreal_log(ULOG_FATAL, "main", "BUG_STRIPBADWORDS_PCRE2_MATCH_OOB", NULL,
-							           "[BUG] pcre2_match() returned an ovector with OOB start/end: $start/$end, len $length: '$buf'",
-							           log_data_integer("start", start),
-							           log_data_integer("end", end),
-							           log_data_integer("length", strlen(ptr)),
-							           log_data_string("buf", ptr));
-							abort();
-						}
-						m = end - start;
-						if (m == 0)
-						{
-							pcre2_match_data_free(md);
-							break; /* anti-loop */
-						}
-						cleaned = 1;
-						matchlen += m;
-						strlncat(buf, ptr, sizeof buf, start);
-						if (this_word->replace)
-							strlcat(buf, this_word->replace, sizeof buf); 
-						else
-							strlcat(buf, REPLACEWORD, sizeof buf);
-						ptr += end; /* Set pointer after the match pos */
-						pcre2_match_data_free(md);
-						continue; /* next! */
-					}
-					pcre2_match_data_free(md);
-					break; /* NOMATCH: we are done! */
+				/* We replace the entire word that contains the match */
+				for (start = pos; (start > 0) && !iswseperator(text[start - 1]); start--);
+				for (end = i + 1; text[end] && !iswseperator(text[end]); end++);
+
+				/* Matches are found in order of their end position, so
+				 * all matches in the same word are next to each other.
+				 * The earliest word in the list decides the replacement.
+				 */
+				if (*num_spans && ((*spans)[*num_spans - 1].start == start))
+				{
+					if (w < (*spans)[*num_spans - 1].word)
+						(*spans)[*num_spans - 1].word = w;
+					continue;
 				}
-				/* All the better to eat you with! */
-				strlcat(buf, ptr, sizeof buf);	
-				memcpy(cleanstr, buf, sizeof cleanstr);
-				memset(buf, 0, sizeof(buf));
-				if (matchlen == stringlen)
-					break;
+				if (!*spans)
+					*spans = safe_alloc(sizeof(BadwordSpan) * (strlen(text) + 1));
+				(*spans)[*num_spans].start = start;
+				(*spans)[*num_spans].end = end;
+				(*spans)[*num_spans].word = w;
+				(*num_spans)++;
 			}
 		}
 	}
+	return blocked;
+}
+
+/** Same as stripbadwords() but using a compiled matcher.
+ * The fast badwords are all handled in one pass over the text,
+ * after which the residual (regex) badwords are applied.
+ * Like in stripbadwords(), the block words are matched against the
+ * text with the replacements done. If any word was replaced then a
+ * second pass over the new text is done for the block words.
+ * One difference: stripbadwords() applies the words in list order, so
+ * a block word only sees the replacements of the words before it.
+ * Here the block words see all replacements, the order does not matter.
+ * @param str		The text
+ * @param m		The matcher, from badword_matcher_compile(). May be NULL.
+ * @param blocked	Set to 1 if the text should be blocked.
+ * @returns The new text, or NULL if blocked.
+ */
+const char *stripbadwords_matcher(const char *str, BadwordMatcher *m, int *blocked)
+{
+	static char cleanstr[4096];
+	char buf[512];
+	BadwordSpan *spans = NULL;
+	int num_spans = 0;
+	int matchlen = 0, stringlen, cleaned = 0;
+	int i;
+
+	*blocked = 0;
+
+	if (!m)
+		return str;
+
+	/*
+	 * work on a copy
+	 */
+	stringlen = strlcpy(cleanstr, text_context_stripped(str), sizeof cleanstr);
+	if (stringlen >= sizeof(cleanstr))
+		stringlen = sizeof(cleanstr) - 1;
+
+	if (m->num_words && badword_matcher_scan(m, cleanstr, &spans, &num_spans) && !num_spans)
+	{
+		/* Nothing replaced, so the block decision stands */
+		*blocked = 1;
+		return NULL;
+	}
+
+	if (num_spans)
+	{
+		/* Build the new text, with the same size restriction as fast_badword_replace() */
+		char *o = buf;
+		char *c_eol = buf + sizeof(buf) - 1;
+		int prev = 0;
+
+		for (i = 0; (i < num_spans) && (o < c_eol); i++)
+		{
+			ConfigItem_badword *bw = m->words[spans[i].word];
+			const char *replacew = bw->replace ? bw->replace : REPLACEWORD;
+			int n;
+
+			n = MIN(spans[i].start - prev, c_eol - o);
+			memcpy(o, cleanstr + prev, n);
+			o += n;
+			n = MIN((int)strlen(replacew), c_eol - o);
+			memcpy(o, replacew, n);
+			o += n;
+			prev = spans[i].end;
+		}
+		if (o < c_eol)
+		{
+			int n = MIN((int)strlen(cleanstr + prev), c_eol - o);
+			memcpy(o, cleanstr + prev, n);
+			o += n;
+		}
+		*o = '\0';
+		strlcpy(cleanstr, buf, sizeof(cleanstr));
+		cleaned = 1;
+		safe_free(spans);
+
+		/* Check the block words against the new text */
+		if (badword_matcher_scan(m, cleanstr, NULL, NULL))
+		{
+			*blocked = 1;
+			return NULL;
+		}
+	}
+
+	/* And now the residual words, the old way */
+	for (i = 0; i < m->num_residual; i++)
+	{
+		int ret = stripbadwords_word(m->residual[i], cleanstr, &cleaned, &matchlen, stringlen);
+		if (ret == 1)
+		{
+			*blocked = 1;
+			return NULL;
+		}
+		if (ret == 2)
+			break;
+	}
 
 	cleanstr[511] = '\0'; /* cutoff, just to be sure */
 
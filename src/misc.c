@@ -615,7 +615,7 @@ void exit_client_ex(Client *client, Client *origin, MessageTag *recv_mtags, cons
 
 		if (client->local->fd >= 0 && !IsConnecting(client))
 		{
-			if (!IsControl(client) && !IsRPC(client))
+			if (!IsControl(client) && !IsRPC(client) && !IsNoErrorMsg(client))
 				sendto_one(client, NULL, "ERROR :Closing Link: %s (%s)", get_client_name(client, FALSE), comment);
 		}
 		close_connection(client);
@@ -1112,10 +1112,10 @@ int swhois_delete(Client *client, const char *tag, const char *swhois, Client *f
 /** Is this user using a websocket? (LOCAL USERS ONLY) */
 int IsWebsocket(Client *client)
 {
-	ModDataInfo *md = findmoddata_byname("websocket", MODDATATYPE_CLIENT);
-	if (!md)
-		return 0; /* websocket module not loaded */
-	return (MyConnect(client) && moddata_client(client, md).ptr) ? 1 : 0;
+	static ModDataRef websocket_ref = MODDATA_REF("websocket", MODDATATYPE_CLIENT);
+
+	/* NULL if the websocket module is not loaded */
+	return (MyConnect(client) && moddata_client_ref_ptr(client, &websocket_ref)) ? 1 : 0;
 }
 
 /** Generic function to inform the user he/she has been banned.
@@ -2610,6 +2610,26 @@ const char *StripControlCodesEx(const char *text, char *output, size_t outputlen
 
 	while (len > 0) 
 	{
+		if (!col && !rgb)
+		{
+			/* Copy everything up to the next (possible) control code in one go */
+			size_t n = text_plain_span(text, len);
+			if (n > 0)
+			{
+				if (n >= outputlen)
+				{
+					memcpy(o, text, outputlen);
+					o[outputlen] = '\0';
+					return output;
+				}
+				memcpy(o, text, n);
+				o += n;
+				outputlen -= n;
+				text += n;
+				len -= n;
+				continue;
+			}
+		}
 		if ((col && isdigit(*text) && nc < 2) ||
 		    ((col == 1) && (*text == ',') && isdigit(text[1]) && (nc > 0) && (nc < 3)))
 		{
@@ -2722,6 +2742,195 @@ const char *StripControlCodes(const char *text)
 	return StripControlCodesEx(text, new_str, sizeof(new_str), 0);
 }
 
+/** The current (innermost) text context, see text_context_begin() */
+static TextContext *current_text_context = NULL;
+
+/** Begin a text context for a message text.
+ * While the context is active, the text_context_*() functions
+ * remember what they calculated for this text, so the next caller
+ * that asks for the same thing about the same text gets it for free.
+ * This is used by cmd_message() so that all the modules that look at
+ * a message (floodprot, censor, spamfilter, antimixedutf8, ..) share
+ * the work of stripping and normalizing it.
+ * If a context for the same text is already active then that one is
+ * reused, so nesting (eg: from a command override) is fine.
+ * @param text	The message text, must stay valid until text_context_end()
+ * @returns The context, which must be passed to text_context_end() later.
+ */
+TextContext *text_context_begin(const char *text)
+{
+	TextContext *ctx = current_text_context;
+
+	if (ctx && ((ctx->text == text) || !strcmp(ctx->text, text)))
+	{
+		ctx->refcnt++;
+		return ctx;
+	}
+
+	ctx = safe_alloc(sizeof(TextContext));
+	ctx->text = text;
+	ctx->refcnt = 1;
+	ctx->is_ascii = -1;
+	ctx->prev = current_text_context;
+	current_text_context = ctx;
+	return ctx;
+}
+
+/** End a text context, started by text_context_begin() */
+void text_context_end(TextContext *ctx)
+{
+	if (--ctx->refcnt > 0)
+		return;
+	if (current_text_context == ctx)
+		current_text_context = ctx->prev;
+	safe_free(ctx->stripped);
+	safe_free(ctx->casefolded);
+	safe_free(ctx);
+}
+
+/** Return the active text context if it is for this text, otherwise NULL.
+ * Note that hooks may have replaced the text (eg: censor), in which
+ * case the pointer differs and the contents usually too.
+ */
+static TextContext *text_context_find(const char *text)
+{
+	TextContext *ctx = current_text_context;
+
+	if (ctx && ((ctx->text == text) || !strcmp(ctx->text, text)))
+		return ctx;
+	return NULL;
+}
+
+/** Like StripControlCodes() but uses the text context, if any.
+ * @returns The stripped text, which stays valid until the context
+ *          ends, or until the next StripControlCodes() call if no
+ *          context is active for this text.
+ */
+const char *text_context_stripped(const char *text)
+{
+	TextContext *ctx = text_context_find(text);
+
+	if (!ctx)
+		return StripControlCodes(text);
+	if (!ctx->stripped)
+		safe_strdup(ctx->stripped, StripControlCodes(text));
+	return ctx->stripped;
+}
+
+static void text_casefold(char *p)
+{
+	for (; *p; p++)
+	{
+		/* Don't need to bother with non-printables and various symbols and numbers */
+		if (*p > 64)
+			*p = tolower(*p);
+	}
+}
+
+/** Return the text with control codes stripped, in lowercase.
+ * @returns The casefolded text, same lifetime rules as with text_context_stripped().
+ */
+const char *text_context_casefolded(const char *text)
+{
+	static char buf[4096];
+	TextContext *ctx = text_context_find(text);
+
+	if (!ctx)
+	{
+		strlcpy(buf, StripControlCodes(text), sizeof(buf));
+		text_casefold(buf);
+		return buf;
+	}
+	if (!ctx->casefolded)
+	{
+		safe_strdup(ctx->casefolded, text_context_stripped(text));
+		text_casefold(ctx->casefolded);
+	}
+	return ctx->casefolded;
+}
+
+/** Returns 1 if the text consists of ASCII characters only, 0 if not. */
+int text_context_is_ascii(const char *text)
+{
+	TextContext *ctx = text_context_find(text);
+	const unsigned char *p;
+	int is_ascii = 1;
+
+	if (ctx && (ctx->is_ascii != -1))
+		return ctx->is_ascii;
+
+	for (p = (const unsigned char *)text; *p; p++)
+	{
+		if (*p & 0x80)
+		{
+			is_ascii = 0;
+			break;
+		}
+	}
+
+	if (ctx)
+		ctx->is_ascii = is_ascii;
+	return is_ascii;
+}
+
+/** Return a hash of the message text, for detecting repeated messages.
+ * The hash is calculated over the casefolded text, so color codes and
+ * case do not matter. For CTCP ACTION and other CTCPs the \001 wrapping
+ * (and the "ACTION " prefix) is ignored.
+ * The key is random, so the hash is only meaningful within this process.
+ */
+uint64_t text_context_hash(const char *text)
+{
+	static char key[SIPHASH_KEY_LENGTH];
+	static int have_key = 0;
+	TextContext *ctx = text_context_find(text);
+	char buf[4096];
+	int is_ctcp = 0, is_action = 0;
+	size_t len;
+	char *p;
+	uint64_t hash;
+
+	if (ctx && ctx->have_hash)
+		return ctx->hash;
+
+	if (!have_key)
+	{
+		siphash_generate_key(key);
+		have_key = 1;
+	}
+
+	if (text[0] == '\001')
+	{
+		if (!strncmp(text + 1, "ACTION ", 7))
+			is_action = 1;
+		else
+			is_ctcp = 1;
+	}
+
+	strlcpy(buf, text_context_casefolded(text), sizeof(buf));
+	p = buf;
+	if (is_ctcp || is_action)
+	{
+		/* Remove the \001 chars around the message */
+		if ((len = strlen(p)) && p[len - 1] == '\001')
+			p[--len] = '\0';
+		if (*p == '\001')
+		{
+			p++;
+			if (is_action && !strncmp(p, "action ", 7))
+				p += 7;
+		}
+	}
+
+	hash = siphash(p, key);
+	if (ctx)
+	{
+		ctx->hash = hash;
+		ctx->have_hash = 1;
+	}
+	return hash;
+}
+
 const char *command_issued_by_rpc(MessageTag *mtags)
 {
 	MessageTag *m = find_mtag(mtags, "unrealircd.org/issued-by");
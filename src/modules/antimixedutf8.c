@@ -195,21 +195,16 @@ int lookalikespam_score(const char *text)
 	return points;
 }
 
-CMD_OVERRIDE_FUNC(override_msg)
+/** Returns 1 if the message should be blocked, 0 if not */
+static int antimixedutf8_check(Client *client, const char *text)
 {
-	int score, ret;
-	
-	if (!MyUser(client) || (parc < 3) || BadPtr(parv[2]) ||
-	    user_allowed_by_security_group(client, cfg.except))
-	{
-		/* Short circuit for: remote clients, insufficient parameters,
-		 * antimixedutf8::except.
-		 */
-		CALL_NEXT_COMMAND_OVERRIDE();
-		return;
-	}
+	int score;
 
-	score = lookalikespam_score(StripControlCodes(parv[2]));
+	/* Pure ASCII text can only contain Latin script, so skip the scoring */
+	if (text_context_is_ascii(text))
+		return 0;
+
+	score = lookalikespam_score(text_context_stripped(text));
 	if ((score >= cfg.score) && !find_tkl_exception(TKL_ANTIMIXEDUTF8, client))
 	{
 		unreal_log(ULOG_INFO, "antimixedutf8", "ANTIMIXEDUTF8_HIT", client,
@@ -219,15 +214,37 @@ CMD_OVERRIDE_FUNC(override_msg)
 		    ((cfg.ban_action == BAN_ACT_SOFT_BLOCK) && !IsLoggedIn(client)))
 		{
 			sendnotice(client, "%s", cfg.ban_reason);
-			return;
+			return 1;
 		} else {
 			if (place_host_ban(client, cfg.ban_action, cfg.ban_reason, cfg.ban_time))
-				return;
+				return 1;
 			/* a return value of 0 means the user is exempted, so fallthrough.. */
 		}
 	}
+	return 0;
+}
+
+CMD_OVERRIDE_FUNC(override_msg)
+{
+	TextContext *ctx;
+
+	if (!MyUser(client) || (parc < 3) || BadPtr(parv[2]) ||
+	    user_allowed_by_security_group(client, cfg.except))
+	{
+		/* Short circuit for: remote clients, insufficient parameters,
+		 * antimixedutf8::except.
+		 */
+		CALL_NEXT_COMMAND_OVERRIDE();
+		return;
+	}
 
-	CALL_NEXT_COMMAND_OVERRIDE();
+	/* We run before cmd_message(), so start the text context here.
+	 * cmd_message() will pick it up, so the stripped text is shared.
+	 */
+	ctx = text_context_begin(parv[2]);
+	if (!antimixedutf8_check(client, parv[2]))
+		CALL_NEXT_COMMAND_OVERRIDE();
+	text_context_end(ctx);
 }
 
 /*** rest is module and config stuff ****/
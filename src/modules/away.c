@@ -34,7 +34,7 @@ long CAP_AWAY_NOTIFY = 0L;
 ModuleHeader MOD_HEADER
   = {
 	"away",
-	"5.0",
+	"5.1",
 	"command /away", 
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -68,18 +68,22 @@ int away_join(Client *client, Channel *channel, MessageTag *mtags)
 {
 	Member *lp;
 	Client *acptr;
-	int invisible = invisible_user_in_channel(client, channel);
-	for (lp = channel->members; lp; lp = lp->next)
+	int invisible;
+	int i;
+
+	if (!client->user->away)
+		return 0;
+
+	invisible = invisible_user_in_channel(client, channel);
+	for (i = 0; i < channel->local_member_count; i++)
 	{
+		lp = channel->local_members[i]; /* only locally connected clients */
 		acptr = lp->client;
 
-		if (!MyConnect(acptr))
-			continue; /* only locally connected clients */
-
 		if (invisible && !check_channel_access_member(lp, "hoaq") && (client != acptr))
 			continue; /* skip non-ops if requested to (used for mode +D), but always send to 'client' */
 
-		if (client->user->away && HasCapabilityFast(acptr, CAP_AWAY_NOTIFY))
+		if (HasCapabilityFast(acptr, CAP_AWAY_NOTIFY))
 		{
 			MessageTag *mtags_away = NULL;
 			new_message(client, NULL, &mtags_away);
@@ -30,6 +30,7 @@ int censor_config_run(ConfigFile *, ConfigEntry *, int);
 ModuleInfo *ModInfo = NULL;
 
 ConfigItem_badword *conf_badword_channel = NULL;
+BadwordMatcher *badword_matcher_channel = NULL;
 
 
 MOD_TEST()
@@ -62,6 +63,8 @@ MOD_INIT()
 
 MOD_LOAD()
 {
+	/* All badwords are known now (config run is done) */
+	badword_matcher_channel = badword_matcher_compile(conf_badword_channel);
 	return MOD_SUCCESS;
 }
 
@@ -70,6 +73,9 @@ MOD_UNLOAD()
 {
 	ConfigItem_badword *badword, *next;
 
+	badword_matcher_free(badword_matcher_channel);
+	badword_matcher_channel = NULL;
+
 	for (badword = conf_badword_channel; badword; badword = next)
 	{
 		next = badword->next;
@@ -251,7 +257,7 @@ int censor_config_run(ConfigFile *cf, ConfigEntry *ce, int type)
 
 const char *stripbadwords_channel(const char *str, int *blocked)
 {
-	return stripbadwords(str, conf_badword_channel, blocked);
+	return stripbadwords_matcher(str, badword_matcher_channel, blocked);
 }
 
 int censor_can_send_to_channel(Client *client, Channel *channel, Membership *lp, const char **msg, const char **errmsg, SendType sendtype)
@@ -8,7 +8,7 @@
 ModuleHeader MOD_HEADER
   = {
 	"chanmodes/delayjoin",   /* Name of module */
-	"5.0", /* Version */
+	"5.0.1", /* Version */
 	"delayed join (+D,+d)", /* Short description of module */
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -186,6 +186,8 @@ void clear_user_invisible(Channel *channel, Client *client)
 			if (md)
 				memset(&moddata_member(i, md), 0, sizeof(ModData));
 
+			/* Visibility changed, let caches (eg: NAMES) know */
+			channel->member_serial++;
 			found_member = true;
 
 			if (!should_clear)
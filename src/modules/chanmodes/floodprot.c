@@ -128,7 +128,6 @@ Cmode_t EXTMODE_FLOOD_PROFILE = 0L;
 static int timedban_available = 1; /**< Set to 1 if extbans/timedban module is loaded. Assumed 1 during config load due to set::modes-on-join race. */
 RemoveChannelModeTimer *removechannelmodetimer_list = NULL;
 ChannelFloodProfile *channel_flood_profiles = NULL;
-char *floodprot_msghash_key = NULL;
 long long floodprot_splittime = 0;
 
 #define IsFloodLimit(x)	(((x)->mode.mode & EXTMODE_FLOODLIMIT) || ((x)->mode.mode & EXTMODE_FLOOD_PROFILE) || (cfg.default_profile && GETPARASTRUCT(channel, 'F')))
@@ -173,7 +172,6 @@ int floodprot_chanmode_del(Channel *channel, int m);
 void memberflood_free(ModData *md);
 int floodprot_stats(Client *client, const char *flag);
 void floodprot_free_removechannelmodetimer_list(ModData *m);
-void floodprot_free_msghash_key(ModData *m);
 CMD_OVERRIDE_FUNC(floodprot_override_mode);
 ChannelFloodProtection *get_channel_flood_profile(const char *name);
 int parse_channel_mode_flood(const char *param, ChannelFloodProtection *fld, int strict, Client *client, const char **error_out);
@@ -226,7 +224,6 @@ MOD_INIT()
 	init_config();
 
 	LoadPersistentPointer(modinfo, removechannelmodetimer_list, floodprot_free_removechannelmodetimer_list);
-	LoadPersistentPointer(modinfo, floodprot_msghash_key, floodprot_free_msghash_key);
 
 	memset(&mreq, 0, sizeof(mreq));
 	mreq.name = "floodprot";
@@ -235,11 +232,6 @@ MOD_INIT()
 	mdflood = ModDataAdd(modinfo->handle, mreq);
 	if (!mdflood)
 	        abort();
-	if (!floodprot_msghash_key)
-	{
-		floodprot_msghash_key = safe_alloc(16);
-		siphash_generate_key(floodprot_msghash_key);
-	}
 
 	HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN, 0, floodprot_config_run_set_block);
 	HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN, 0, floodprot_config_run_antiflood_block);
@@ -289,7 +281,6 @@ void free_channel_flood_profiles(void)
 MOD_UNLOAD()
 {
 	SavePersistentPointer(modinfo, removechannelmodetimer_list);
-	SavePersistentPointer(modinfo, floodprot_msghash_key);
 	SavePersistentLongLong(modinfo, floodprot_splittime);
 
 	free_channel_flood_profiles();
@@ -1866,40 +1857,14 @@ void do_floodprot_action(Channel *channel, int what)
 	do_floodprot_action_standard(channel, what, floodtype, extmode, m);
 }
 
+/** Hash of the message, used for the anti-repeat check ('r').
+ * Control codes, case and CTCP wrapping are ignored.
+ * This uses the per-message text context, so the normalization
+ * is shared with the other modules that look at the message.
+ */
 uint64_t gen_floodprot_msghash(const char *text)
 {
-	int i;
-	int is_ctcp, is_action;
-	char *plaintext;
-	size_t len;
-
-	is_ctcp = is_action = 0;
-	// Remove any control chars (colours/bold/CTCP/etc) and convert it to lowercase before hashing it
-	if (text[0] == '\001')
-	{
-		if (!strncmp(text + 1, "ACTION ", 7))
-			is_action = 1;
-		else
-			is_ctcp = 1;
-	}
-	plaintext = (char *)StripControlCodes(text);
-	for (i = 0; plaintext[i]; i++)
-	{
-		// Don't need to bother with non-printables and various symbols and numbers
-		if (plaintext[i] > 64)
-			plaintext[i] = tolower(plaintext[i]);
-	}
-	if (is_ctcp || is_action)
-	{
-		// Remove the \001 chars around the message
-		if ((len = strlen(plaintext)) && plaintext[len - 1] == '\001')
-			plaintext[len - 1] = '\0';
-		plaintext++;
-		if (is_action)
-			plaintext += 7;
-	}
-
-	return siphash(text, floodprot_msghash_key);
+	return text_context_hash(text);
 }
 
 // FIXME: REMARK: make sure you can only do a +f/-f once (latest in line wins).
@@ -1947,11 +1912,6 @@ void floodprot_free_removechannelmodetimer_list(ModData *m)
 	}
 }
 
-void floodprot_free_msghash_key(ModData *m)
-{
-	safe_free(floodprot_msghash_key);
-}
-
 CMD_OVERRIDE_FUNC(floodprot_override_mode)
 {
 	if (MyUser(client) && (parc == 3) &&
@@ -694,17 +694,12 @@ int history_join(Client *client, Channel *channel, MessageTag *mtags)
 	if (MyUser(client) && can_receive_history(client))
 	{
 		HistoryFilter filter;
-		HistoryResult *r;
 		memset(&filter, 0, sizeof(filter));
 		filter.cmd = HFC_SIMPLE;
 		filter.last_lines = cfg.playback_on_join.lines;
 		filter.last_seconds = cfg.playback_on_join.time;
-		r = history_request(channel->name, &filter);
-		if (r)
-		{
-			history_send_result(client, r);
-			free_history_result(r);
-		}
+		/* This uses the playback cache, so mass (re)joins are cheap */
+		history_send_playback(client, channel->name, &filter);
 	}
 
 	return 0;
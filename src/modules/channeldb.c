@@ -8,7 +8,7 @@
 
 ModuleHeader MOD_HEADER = {
 	"channeldb",
-	"1.0",
+	"1.0.1",
 	"Stores and retrieves channel settings for persistent (+P) channels",
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -373,7 +373,7 @@ int write_channel_entry(UnrealDB *db, const char *tmpfname, Channel *channel)
 		} \
 	} while(0)
 
-int read_listmode(UnrealDB *db, Ban **lst)
+int read_listmode(UnrealDB *db, Channel *channel, Ban **lst)
 {
 	uint32_t total;
 	uint64_t when;
@@ -401,7 +401,7 @@ int read_listmode(UnrealDB *db, Ban **lst)
 		}
 		safe_strdup(e->banstr, str);
 
-		if (ban_exists(*lst, e->banstr))
+		if (find_listmode(channel, lst, e->banstr))
 		{
 			/* Free again - duplicate item */
 			safe_free(e->banstr);
@@ -410,8 +410,7 @@ int read_listmode(UnrealDB *db, Ban **lst)
 		} else {
 			/* Add to list */
 			e->when = when;
-			e->next = *lst;
-			*lst = e;
+			link_listmode(channel, lst, e);
 		}
 	}
 
@@ -538,9 +537,9 @@ int read_channeldb(void)
 		channel->topic_time = topic_time;
 		safe_strdup(channel->mode_lock, mode_lock);
 		set_channel_mode(channel, NULL, modes1, modes2);
-		R_SAFE(read_listmode(db, &channel->banlist));
-		R_SAFE(read_listmode(db, &channel->exlist));
-		R_SAFE(read_listmode(db, &channel->invexlist));
+		R_SAFE(read_listmode(db, channel, &channel->banlist));
+		R_SAFE(read_listmode(db, channel, &channel->exlist));
+		R_SAFE(read_listmode(db, channel, &channel->invexlist));
 		R_SAFE(unrealdb_read_int32(db, &magic));
 		FreeChannelEntry();
 		added++;
@@ -19,7 +19,6 @@ ModuleHeader MOD_HEADER
 /* Structs */
 typedef struct ChatHistoryTarget ChatHistoryTarget;
 struct ChatHistoryTarget {
-	ChatHistoryTarget *prev, *next;
 	char *datetime;
 	char *object;
 };
@@ -78,62 +77,13 @@ int chathistory_token(const char *str, char *token, char **store)
 	return 0;
 }
 
-static void add_chathistory_target_list(ChatHistoryTarget *new, ChatHistoryTarget **list)
+/** Sort targets by datetime, most recent first */
+static int chathistory_target_cmp(const void *a, const void *b)
 {
-	ChatHistoryTarget *x, *last = NULL;
+	const ChatHistoryTarget *x = a;
+	const ChatHistoryTarget *y = b;
 
-	if (!*list)
-	{
-		/* We are the only item. Easy. */
-		*list = new;
-		return;
-	}
-
-	for (x = *list; x; x = x->next)
-	{
-		last = x;
-		if (strcmp(new->datetime, x->datetime) >= 0)
-			break;
-	}
-
-	if (x)
-	{
-		if (x->prev)
-		{
-			/* We will insert ourselves just before this item */
-			new->prev = x->prev;
-			new->next = x;
-			x->prev->next = new;
-			x->prev = new;
-		} else {
-			/* We are the new head */
-			*list = new;
-			new->next = x;
-			x->prev = new;
-		}
-	} else
-	{
-		/* We are the last item */
-		last->next = new;
-		new->prev = last;
-	}
-}
-
-static void add_chathistory_target(ChatHistoryTarget **list, HistoryResult *r)
-{
-	MessageTag *m;
-	time_t ts;
-	char *datetime;
-	ChatHistoryTarget *e;
-
-	if (!r->log || !((m = find_mtag(r->log->mtags, "time"))) || !m->value)
-		return;
-	datetime = m->value;
-
-	e = safe_alloc(sizeof(ChatHistoryTarget));
-	safe_strdup(e->datetime, datetime);
-	safe_strdup(e->object, r->object);
-	add_chathistory_target_list(e, list);
+	return strcmp(y->datetime, x->datetime);
 }
 
 static void chathistory_targets_send_line(Client *client, ChatHistoryTarget *r, char *batchid)
@@ -159,9 +109,12 @@ void chathistory_targets(Client *client, HistoryFilter *filter, int limit)
 {
 	Membership *mp;
 	HistoryResult *r;
+	MessageTag *m;
 	char batch[BATCHLEN+1];
+	const char *last;
 	int sent = 0;
-	ChatHistoryTarget *targets = NULL, *targets_next;
+	ChatHistoryTarget *targets;
+	int num_targets = 0, i;
 
 	/* 1. Grab all information we need */
 
@@ -175,17 +128,51 @@ void chathistory_targets(Client *client, HistoryFilter *filter, int limit)
 	}
 	filter->limit = 1;
 
+	for (mp = client->user->channel; mp; mp = mp->next)
+		num_targets++;
+	targets = safe_alloc(sizeof(ChatHistoryTarget) * (num_targets + 1));
+	num_targets = 0;
+
 	for (mp = client->user->channel; mp; mp = mp->next)
 	{
 		Channel *channel = mp->channel;
+
+		last = history_last_activity(channel->name);
+		if (!last)
+			continue; /* No history */
+
+		if (strcmp(last, filter->timestamp_a) < 0)
+		{
+			/* The usual case: the most recent line is the one we are
+			 * looking for, if it is within the requested range at all.
+			 */
+			if (strcmp(last, filter->timestamp_b) >= 0)
+			{
+				safe_strdup(targets[num_targets].datetime, last);
+				safe_strdup(targets[num_targets].object, channel->name);
+				num_targets++;
+			}
+			continue;
+		}
+
+		/* The channel was active after the requested range,
+		 * so we need to ask the history backend after all.
+		 */
 		r = history_request(channel->name, filter);
 		if (r)
 		{
-			add_chathistory_target(&targets, r);
+			if (r->log && ((m = find_mtag(r->log->line->mtags, "time"))) && m->value)
+			{
+				safe_strdup(targets[num_targets].datetime, m->value);
+				safe_strdup(targets[num_targets].object, channel->name);
+				num_targets++;
+			}
 			free_history_result(r);
 		}
 	}
 
+	qsort(targets, num_targets, sizeof(ChatHistoryTarget), chathistory_target_cmp);
+
 	/* 2. Now send it to the client */
 
 	batch[0] = '\0';
@@ -196,15 +183,14 @@ void chathistory_targets(Client *client, HistoryFilter *filter, int limit)
 		sendto_one(client, NULL, ":%s BATCH +%s draft/chathistory-targets", me.name, batch);
 	}
 
-	for (; targets; targets = targets_next)
+	for (i = 0; i < num_targets; i++)
 	{
-		targets_next = targets->next;
 		if (++sent < limit)
-			chathistory_targets_send_line(client, targets, batch);
-		safe_free(targets->datetime);
-		safe_free(targets->object);
-		safe_free(targets);
+			chathistory_targets_send_line(client, &targets[i], batch);
+		safe_free(targets[i].datetime);
+		safe_free(targets[i].object);
 	}
+	safe_free(targets);
 
 	/* End of batch */
 	if (*batch)
@@ -21,7 +21,7 @@
 ModuleHeader MOD_HEADER
 = {
 	"extbans/certfp",
-	"4.2",
+	"4.2.1",
 	"ExtBan ~S - Ban/exempt by SHA256 TLS certificate fingerprint",
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -128,9 +128,11 @@ const char *extban_certfp_conv_param(BanContext *b, Extban *extban)
 	return retbuf;
 }
 
+static ModDataRef certfp_ref = MODDATA_REF("certfp", MODDATATYPE_CLIENT);
+
 int extban_certfp_is_banned(BanContext *b)
 {
-	const char *fp = moddata_client_get(b->client, "certfp");
+	const char *fp = moddata_client_ref_str(b->client, &certfp_ref);
 
 	if (!fp)
 		return 0; /* not using TLS */
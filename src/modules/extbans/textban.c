@@ -441,7 +441,7 @@ int textban_check_ban(Client *client, Channel *channel, const char *ban, const c
 #ifdef UHOSTFEATURE
 	ircsprintf(uhost, "%s@%s", client->user->username, GetHost(client));
 #endif
-	strlcpy(filtered, StripControlCodes(*msg), sizeof(filtered));
+	strlcpy(filtered, text_context_stripped(*msg), sizeof(filtered));
 
 	p = strchr(ban, ':');
 	if (!p)
@@ -28,7 +28,7 @@ int extended_monitor_away(Client *client, MessageTag *mtags, const char *reason,
 int extended_monitor_account_login(Client *client, MessageTag *mtags);
 int extended_monitor_userhost_change(Client *client, const char *olduser, const char *oldhost);
 int extended_monitor_realname_change(Client *client, const char *oldinfo);
-int extended_monitor_notification(Client *client, Watch *watch, Link *lp, int event);
+int extended_monitor_notification(Client *client, Watch *watch, WatchSubscriber *sub, int event, void *data);
 
 ModuleHeader MOD_HEADER
   = {
@@ -78,9 +78,9 @@ MOD_UNLOAD()
 int extended_monitor_away(Client *client, MessageTag *mtags, const char *reason, int already_as_away)
 {
 	if (reason)
-		watch_check(client, WATCH_EVENT_AWAY, extended_monitor_notification);
+		watch_check(client, WATCH_EVENT_AWAY, NULL, extended_monitor_notification);
 	else
-		watch_check(client, WATCH_EVENT_NOTAWAY, extended_monitor_notification);
+		watch_check(client, WATCH_EVENT_NOTAWAY, NULL, extended_monitor_notification);
 
 	return 0;
 }
@@ -88,61 +88,61 @@ int extended_monitor_away(Client *client, MessageTag *mtags, const char *reason,
 int extended_monitor_account_login(Client *client, MessageTag *mtags)
 {
 	if (IsLoggedIn(client))
-		watch_check(client, WATCH_EVENT_LOGGEDIN, extended_monitor_notification);
+		watch_check(client, WATCH_EVENT_LOGGEDIN, NULL, extended_monitor_notification);
 	else
-		watch_check(client, WATCH_EVENT_LOGGEDOUT, extended_monitor_notification);
+		watch_check(client, WATCH_EVENT_LOGGEDOUT, NULL, extended_monitor_notification);
 
 	return 0;
 }
 
 int extended_monitor_userhost_change(Client *client, const char *olduser, const char *oldhost)
 {
-	watch_check(client, WATCH_EVENT_USERHOST, extended_monitor_notification);
+	watch_check(client, WATCH_EVENT_USERHOST, NULL, extended_monitor_notification);
 	return 0;
 }
 
 int extended_monitor_realname_change(Client *client, const char *oldinfo)
 {
-	watch_check(client, WATCH_EVENT_REALNAME, extended_monitor_notification);
+	watch_check(client, WATCH_EVENT_REALNAME, NULL, extended_monitor_notification);
 	return 0;
 }
 
-int extended_monitor_notification(Client *client, Watch *watch, Link *lp, int event)
+int extended_monitor_notification(Client *client, Watch *watch, WatchSubscriber *sub, int event, void *data)
 {
-	if (!(lp->flags & WATCH_FLAG_TYPE_MONITOR))
+	if (!(sub->flags & WATCH_FLAG_TYPE_MONITOR))
 		return 0;
 
-	if (!HasCapabilityFast(lp->value.client, CAP_EXTENDED_MONITOR))
+	if (!HasCapabilityFast(sub->client, CAP_EXTENDED_MONITOR))
 		return 0; /* this client does not support our notifications */
 
-	if (has_common_channels(client, lp->value.client))
+	if (has_common_channels(client, sub->client))
 		return 0; /* will be notified anyway */
 
 	switch (event)
 	{
 		case WATCH_EVENT_AWAY:
-			if (HasCapability(lp->value.client, "away-notify"))
-				sendto_prefix_one(lp->value.client, client, NULL, ":%s AWAY :%s", client->name, client->user->away);
+			if (HasCapability(sub->client, "away-notify"))
+				sendto_prefix_one(sub->client, client, NULL, ":%s AWAY :%s", client->name, client->user->away);
 			break;
 		case WATCH_EVENT_NOTAWAY:
-			if (HasCapability(lp->value.client, "away-notify"))
-				sendto_prefix_one(lp->value.client, client, NULL, ":%s AWAY", client->name);
+			if (HasCapability(sub->client, "away-notify"))
+				sendto_prefix_one(sub->client, client, NULL, ":%s AWAY", client->name);
 			break;
 		case WATCH_EVENT_LOGGEDIN:
-			if (HasCapability(lp->value.client, "account-notify"))
-				sendto_prefix_one(lp->value.client, client, NULL, ":%s ACCOUNT :%s", client->name, client->user->account);
+			if (HasCapability(sub->client, "account-notify"))
+				sendto_prefix_one(sub->client, client, NULL, ":%s ACCOUNT :%s", client->name, client->user->account);
 			break;
 		case WATCH_EVENT_LOGGEDOUT:
-			if (HasCapability(lp->value.client, "account-notify"))
-				sendto_prefix_one(lp->value.client, client, NULL, ":%s ACCOUNT :*", client->name);
+			if (HasCapability(sub->client, "account-notify"))
+				sendto_prefix_one(sub->client, client, NULL, ":%s ACCOUNT :*", client->name);
 			break;
 		case WATCH_EVENT_USERHOST:
-			if (HasCapability(lp->value.client, "chghost"))
-				sendto_prefix_one(lp->value.client, client, NULL, ":%s CHGHOST %s %s", client->name, client->user->username, GetHost(client));
+			if (HasCapability(sub->client, "chghost"))
+				sendto_prefix_one(sub->client, client, NULL, ":%s CHGHOST %s %s", client->name, client->user->username, GetHost(client));
 			break;
 		case WATCH_EVENT_REALNAME:
-			if (HasCapability(lp->value.client, "setname"))
-				sendto_prefix_one(lp->value.client, client, NULL, ":%s SETNAME :%s", client->name, client->info);
+			if (HasCapability(sub->client, "setname"))
+				sendto_prefix_one(sub->client, client, NULL, ":%s SETNAME :%s", client->name, client->info);
 			break;
 		default:
 			break;
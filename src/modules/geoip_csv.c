@@ -42,20 +42,6 @@ struct geoip_csv_config_s {
 	int have_countries;
 };
 
-struct geoip_csv_ip_range {
-	uint32_t addr;
-	uint32_t mask;
-	int geoid;
-	struct geoip_csv_ip_range *next;
-};
-
-struct geoip_csv_ip6_range {
-	uint16_t addr[8];
-	uint16_t mask[8];
-	int geoid;
-	struct geoip_csv_ip6_range *next;
-};
-
 struct geoip_csv_country {
 	char code[10];
 	char name[100];
@@ -66,23 +52,17 @@ struct geoip_csv_country {
 
 /* Variables */
 struct geoip_csv_config_s geoip_csv_config;
-struct geoip_csv_ip_range *geoip_csv_ip_range_list[256]; // we are keeping a separate list for each possible first octet to speed up searching
-struct geoip_csv_ip6_range *geoip_csv_ip6_range_list = NULL; // for ipv6 there would be too many separate lists so just use a single one
+static IPIndex geoip_csv_index; // IPv4 and IPv6 ranges, the value is the geoid
 struct geoip_csv_country *geoip_csv_country_list = NULL;
 
 /* Forward declarations */
-static void geoip_csv_free_ipv4(void);
-static void geoip_csv_free_ipv6(void);
-static void geoip_csv_free_ipv6(void);
 static void geoip_csv_free_countries(void);
 static void geoip_csv_free(void);
 static int geoip_csv_read_ipv4(char *file);
-static int geoip_csv_ip6_convert(char *ip, uint16_t out[8]);
 static int geoip_csv_read_ipv6(char *file);
 static int geoip_csv_read_countries(char *file);
 static struct geoip_csv_country *geoip_csv_get_country(int id);
-static int geoip_csv_get_v4_geoid(char *iip);
-static int geoip_csv_get_v6_geoid(char *iip);
+static int geoip_csv_get_geoid(char *iip);
 int geoip_csv_configtest(ConfigFile *cf, ConfigEntry *ce, int type, int *errs);
 int geoip_csv_configposttest(int *errs);
 int geoip_csv_configrun(ConfigFile *cf, ConfigEntry *ce, int type);
@@ -324,36 +304,6 @@ MOD_UNLOAD()
 	return MOD_SUCCESS;
 }
 
-static void geoip_csv_free_ipv4(void)
-{
-	struct geoip_csv_ip_range *ptr, *oldptr;
-	int i;
-	for (i=0; i<256; i++)
-	{
-		ptr = geoip_csv_ip_range_list[i];
-		geoip_csv_ip_range_list[i] = NULL;
-		while (ptr)
-		{
-			oldptr = ptr;
-			ptr = ptr->next;
-			safe_free(oldptr);
-		}
-	}
-}
-
-static void geoip_csv_free_ipv6(void)
-{
-	struct geoip_csv_ip6_range *ptr, *oldptr;
-	ptr = geoip_csv_ip6_range_list;
-	geoip_csv_ip6_range_list = NULL;
-	while (ptr)
-	{
-		oldptr = ptr;
-		ptr = ptr->next;
-		safe_free(oldptr);
-	}
-}
-
 static void geoip_csv_free_countries(void)
 {
 	struct geoip_csv_country *ptr, *oldptr;
@@ -369,8 +319,7 @@ static void geoip_csv_free_countries(void)
 
 static void geoip_csv_free(void)
 {
-	geoip_csv_free_ipv4();
-	geoip_csv_free_ipv6();
+	ipindex_free(&geoip_csv_index, NULL);
 	geoip_csv_free_countries();
 }
 
@@ -386,13 +335,7 @@ static int geoip_csv_read_ipv4(char *file)
 	char buf[BUFLEN+1];
 	int cidr, geoid;
 	char ip[24];
-	char netmask[24];
-	uint32_t addr;
-	uint32_t mask;
-	struct geoip_csv_ip_range *curr[256];
-	struct geoip_csv_ip_range *ptr;
-	memset(curr, 0, sizeof(curr));
-	int i;
+	char key[IPINDEX_KEYLEN];
 	char *filename = NULL;
 	
 	safe_strdup(filename, file);
@@ -426,60 +369,19 @@ static int geoip_csv_read_ipv4(char *file)
 			continue;
 		}
 
-		if (inet_pton(AF_INET, ip, &addr) < 1)
+		if (!ipindex_key(ip, key) || !ipindex_key_is_ipv4(key))
 		{
 			config_warn("[geoip_csv] Invalid IP found! \"%s\" Bad CSV file?", ip);
 			continue;
 		}
-		addr = htonl(addr);
-		
-		mask = 0;
-		while (cidr)
-		{ /* calculate netmask */
-			mask >>= 1;
-			mask |= (1<<31);
-			cidr--;
-		}
-		
-		i=0;
-		do
-		{ /* multiple iterations in case CIDR is <8 and we have multiple first octets matching */
-			uint8_t index = addr>>24;
-			if (!curr[index])
-			{
-				geoip_csv_ip_range_list[index] = safe_alloc(sizeof(struct geoip_csv_ip_range));
-				curr[index] = geoip_csv_ip_range_list[index];
-			} else
-			{
-				curr[index]->next = safe_alloc(sizeof(struct geoip_csv_ip_range));
-				curr[index] = curr[index]->next;
-			}
-			ptr = curr[index];
-			ptr->next = NULL;
-			ptr->addr = addr;
-			ptr->mask = mask;
-			ptr->geoid = geoid;
-			i++;
-			index++;
-		} while (i<=((~mask)>>24));
+
+		if (geoid > 0)
+			ipindex_add(&geoip_csv_index, key, 96 + cidr, (void *)(intptr_t)geoid);
 	}
 	fclose(u);
 	return 0;
 }
 
-static int geoip_csv_ip6_convert(char *ip, uint16_t out[8])
-{ /* convert text to binary form */
-	uint16_t tmp[8];
-	int i;
-	if (inet_pton(AF_INET6, ip, out) < 1)
-		return 0;
-	for (i=0; i<8; i++)
-	{
-		out[i] = htons(out[i]);
-	}
-	return 1;
-}
-
 #define IPV6_STRING_SIZE	40
 
 static int geoip_csv_read_ipv6(char *file)
@@ -489,10 +391,7 @@ static int geoip_csv_read_ipv6(char *file)
 	char *bptr, *optr;
 	int cidr, geoid;
 	char ip[IPV6_STRING_SIZE];
-	uint16_t addr[8];
-	uint16_t mask[8];
-	struct geoip_csv_ip6_range *curr = NULL;
-	struct geoip_csv_ip6_range *ptr;
+	char key[IPINDEX_KEYLEN];
 	int error;
 	int length;
 	char *filename = NULL;
@@ -538,7 +437,7 @@ static int geoip_csv_read_ipv6(char *file)
 			continue;
 		*optr = '\0';
 		bptr++;
-		if (!geoip_csv_ip6_convert(ip, addr))
+		if (!strchr(ip, ':') || !ipindex_key(ip, key))
 		{
 			config_warn("[geoip_csv] Invalid IP found! \"%s\" Bad CSV file?", ip);
 			continue;
@@ -550,30 +449,11 @@ static int geoip_csv_read_ipv6(char *file)
 			continue;
 		}
 
-		memset(mask, 0, 16);
-		
-		int mask_bit = 0;
-		while (cidr)
-		{ /* calculate netmask */
-			mask[mask_bit/16] |= 1<<(15-(mask_bit%16));
-			mask_bit++;
-			cidr--;
-		}
+		if (ipindex_key_is_ipv4(key))
+			continue; /* IPv4-mapped, these come from the IPv4 file */
 
-		if (!curr)
-		{
-			geoip_csv_ip6_range_list = safe_alloc(sizeof(struct geoip_csv_ip6_range));
-			curr = geoip_csv_ip6_range_list;
-		} else
-		{
-			curr->next = safe_alloc(sizeof(struct geoip_csv_ip6_range));
-			curr = curr->next;
-		}
-		ptr = curr;
-		ptr->next = NULL;
-		memcpy(ptr->addr, addr, 16);
-		memcpy(ptr->mask, mask, 16);
-		ptr->geoid = geoid;
+		if (geoid > 0)
+			ipindex_add(&geoip_csv_index, key, cidr, (void *)(intptr_t)geoid);
 	}
 	fclose(u);
 	return 0;
@@ -737,72 +617,24 @@ static struct geoip_csv_country *geoip_csv_get_country(int id)
 	return NULL;
 }
 
-static int geoip_csv_get_v4_geoid(char *iip)
+static int geoip_csv_get_geoid(char *iip)
 {
-	uint32_t addr, tmp_addr;
-	struct geoip_csv_ip_range *curr;
-	int i;
-	int found = 0;
-	if (inet_pton(AF_INET, iip, &addr) < 1)
-	{
-		unreal_log(ULOG_WARNING, "geoip_csv", "UNSUPPORTED_IP", NULL, "Invalid or unsupported client IP $ip", log_data_string("ip", iip));
-		return 0;
-	}
-	addr = htonl(addr);
-	curr = geoip_csv_ip_range_list[addr>>24];
-	if (curr)
-	{
-		i = 0;
-		for (;curr;curr = curr->next)
-		{
-			tmp_addr = addr;
-			tmp_addr &= curr->mask; /* mask the address to filter out net prefix only */
-			if (tmp_addr == curr->addr)
-			{ /* ... and match it to the loaded data */
-				found = 1;
-				break;
-			}
-			i++;
-		}
-	}
-	if (found)
-		return curr->geoid;
-	return 0;
-}
+	char key[IPINDEX_KEYLEN];
+	void *value;
+	int bits;
 
-static int geoip_csv_get_v6_geoid(char *iip)
-{
-	uint16_t addr[8];
-	struct geoip_csv_ip6_range *curr;
-	int i;
-	int found = 0;
-	
-	if (!geoip_csv_ip6_convert(iip, addr))
+	if (!ipindex_key(iip, key))
 	{
 		unreal_log(ULOG_WARNING, "geoip_csv", "UNSUPPORTED_IP", NULL, "Invalid or unsupported client IP $ip", log_data_string("ip", iip));
 		return 0;
 	}
-	curr = geoip_csv_ip6_range_list;
-	if (curr)
-	{
-		for (;curr;curr = curr->next)
-		{
-			found = 1;
-			for (i=0; i<8; i++)
-			{
-				if (curr->addr[i] != (addr[i] & curr->mask[i]))
-				{ /* compare net address to loaded data */
-					found = 0;
-					break;
-				}
-			}
-			if(found)
-				break;
-		}
-	}
-	if (found)
-		return curr->geoid;
-	return 0;
+	/* Longest prefix match. For IPv4, ranges from the IPv6 file
+	 * that cover all of ::ffff:0:0/96 are not used.
+	 */
+	value = ipindex_match(&geoip_csv_index, key, &bits);
+	if (!value || (ipindex_key_is_ipv4(key) && (bits < 96)))
+		return 0;
+	return (int)(intptr_t)value;
 }
 
 GeoIPResult *geoip_lookup_csv(char *ip)
@@ -814,13 +646,7 @@ GeoIPResult *geoip_lookup_csv(char *ip)
 	if (!ip)
 		return NULL;
 
-	if (strchr(ip, ':'))
-	{
-		geoid = geoip_csv_get_v6_geoid(ip);
-	} else
-	{
-		geoid = geoip_csv_get_v4_geoid(ip);
-	}
+	geoid = geoip_csv_get_geoid(ip);
 
 	if (geoid == 0)
 		return NULL;
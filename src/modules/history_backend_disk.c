@@ -0,0 +1,2533 @@
+/* src/modules/history_backend_disk.c - History Backend: disk (tiered)
+ * (C) Copyright 2019-2026 Bram Matthys (Syzop) and the UnrealIRCd team
+ * License: GPLv2 or later
+ */
+#include "unrealircd.h"
+
+/* This is the tiered disk backend. For every history object only the
+ * most recent lines (the "hot tail") are kept in memory. Older lines
+ * are spilled to append-only, encrypted segment files, each holding
+ * a batch of lines. Segments are never modified after they have been
+ * written (except when lines are deleted explicitly), they are simply
+ * dropped as a whole when they expire.
+ *
+ * Per object we keep a small index of the segments with the time range
+ * they cover, so CHATHISTORY requests for old ranges only need to read
+ * the segments they touch. Segments that are read are kept in an LRU
+ * page cache, bounded by set::history::channel::disk-storage::page-cache-size.
+ *
+ * This allows keeping weeks of history for thousands of channels
+ * without needing all of it in RAM, like history_backend_mem does.
+ */
+
+ModuleHeader MOD_HEADER
+= {
+	"history_backend_disk",
+	"1.0",
+	"History backend: disk (memory-resident hot tail)",
+	"UnrealIRCd Team",
+	"unrealircd-6",
+};
+
+/* Defines */
+#define OBJECTLEN	((NICKLEN > CHANNELLEN) ? NICKLEN : CHANNELLEN)
+#define HISTORY_BACKEND_DISK_HASH_TABLE_SIZE 1019
+
+/* Cleaning is spread out, just like in history_backend_mem */
+#define HISTORY_SPREAD	60
+#define HISTORY_MAX_OFF_SECS	300
+#define HISTORY_CLEAN_PER_LOOP	(HISTORY_BACKEND_DISK_HASH_TABLE_SIZE/HISTORY_SPREAD)
+#define HISTORY_TIMER_EVERY	(HISTORY_MAX_OFF_SECS/HISTORY_SPREAD)
+
+/* Some magic numbers used in the database format */
+#define HISTORYDB_MAGIC_FILE_START	0xFEFEFEFE
+#define HISTORYDB_MAGIC_FILE_END	0xEFEFEFEF
+#define HISTORYDB_MAGIC_ENTRY_START	0xFFFFFFFF
+#define HISTORYDB_MAGIC_ENTRY_END	0xEEEEEEEE
+#define HISTORYDB_MAGIC_INDEX_START	0xFDFDFDFD
+#define HISTORYDB_MAGIC_SEGMENT_START	0xFCFCFCFC
+
+#define HISTORYDB_DISK_VERSION		6000
+
+/* Definitions (structs, etc.) */
+struct cfgstruct {
+	char *directory;
+	char *masterdb; /* Autogenerated for convenience, not a real config item */
+	char *db_secret;
+	int hot_lines; /**< Number of lines to always keep in memory */
+	int segment_lines; /**< Number of lines per segment file */
+	long page_cache_size; /**< Maximum size of the page cache, in bytes */
+};
+
+typedef struct HistoryPage HistoryPage;
+
+/** A segment file on disk, referenced from the index of a HistoryDiskObject */
+typedef struct HistorySegment HistorySegment;
+struct HistorySegment {
+	uint32_t seq; /**< Sequence number, used in the filename */
+	time_t first_t; /**< Time of the first line in the segment */
+	time_t last_t; /**< Time of the last line in the segment */
+	int num_lines; /**< Number of lines in the segment */
+	HistoryPage *page; /**< Loaded page, if it is in the page cache */
+};
+
+typedef struct HistoryDiskObject HistoryDiskObject;
+struct HistoryDiskObject {
+	HistoryDiskObject *prev, *next;
+	HistoryLogLine *head; /**< Start of the hot tail (the earliest entry in memory) */
+	HistoryLogLine *tail; /**< End of the hot tail (the latest entry) */
+	int num_hot_lines; /**< Number of lines in the hot tail */
+	HistorySegment *segments; /**< Segments on disk, oldest first */
+	int num_segments; /**< Number of entries in 'segments' */
+	int num_disk_lines; /**< Number of (non-skipped) lines in all segments */
+	int skip_lines; /**< Lines at the start of segments[0] that are logically deleted */
+	uint32_t next_seq; /**< Next segment sequence number */
+	int max_lines; /**< Maximum number of lines permitted */
+	long max_time; /**< Maximum number of seconds to retain history */
+	int dirty; /**< Index needs to be written */
+	int tail_dirty; /**< Hot tail changed since it was last written to the tail file */
+	int tail_on_disk; /**< The hot tail has been written to a tail file */
+	char name[OBJECTLEN+1];
+};
+
+/** A segment loaded from disk, in the page cache */
+struct HistoryPage {
+	HistoryPage *prev, *next; /**< LRU list, most recently used first */
+	HistoryDiskObject *h; /**< Object this page belongs to */
+	uint32_t seq; /**< Sequence number of the segment */
+	int num_lines; /**< Number of lines in 'lines' */
+	HistoryLogLine **lines; /**< The lines, oldest first */
+	long bytes; /**< Approximate memory usage */
+	int refcnt; /**< Pages in use (by a cursor) are never evicted */
+};
+
+/** Cursor for walking through all lines of an object, disk and memory */
+typedef struct HistoryCursor HistoryCursor;
+struct HistoryCursor {
+	HistoryDiskObject *h;
+	int seg; /**< Index in h->segments, h->num_segments means: the hot tail */
+	int pos; /**< Position in the page */
+	HistoryPage *page; /**< Page of the current segment (referenced) */
+	HistoryLogLine *hot; /**< Current line if we are in the hot tail */
+	long redline; /**< Lines older than this are expired: skipped when walking forward, the end when walking backward */
+};
+
+/* Global variables */
+struct cfgstruct cfg;
+struct cfgstruct test;
+static char *siphashkey_history_backend_disk = NULL;
+HistoryDiskObject **history_disk_hash_table;
+static long already_loaded = 0;
+static char *hbd_prehash = NULL;
+static char *hbd_posthash = NULL;
+static HistoryPage *page_cache_head = NULL;
+static HistoryPage *page_cache_tail = NULL;
+static long page_cache_bytes = 0;
+
+/* Forward declarations */
+int hbd_config_test(ConfigFile *cf, ConfigEntry *ce, int type, int *errs);
+int hbd_config_posttest(int *errs);
+int hbd_config_run(ConfigFile *cf, ConfigEntry *ce, int type);
+int hbd_rehash(void);
+static void setcfg(struct cfgstruct *cfg);
+static void freecfg(struct cfgstruct *cfg);
+static void hbd_init_hashes(ModuleInfo *m);
+static void init_history_storage(ModuleInfo *modinfo);
+int hbd_modechar_del(Channel *channel, int modechar);
+int hbd_history_add(const char *object, MessageTag *mtags, const char *line);
+int hbd_history_cleanup(HistoryDiskObject *h);
+HistoryResult *hbd_history_request(const char *object, HistoryFilter *filter);
+int hbd_history_destroy(const char *object);
+int hbd_history_delete(const char *object, HistoryFilter *filter, int *rejected_deletes);
+int hbd_history_set_limit(const char *object, int max_lines, long max_time);
+EVENT(history_disk_clean);
+EVENT(history_disk_init);
+static int hbd_read_masterdb(void);
+static int hbd_write_masterdb(void);
+static int hbd_read_index(HistoryDiskObject *h);
+static int hbd_write_index(HistoryDiskObject *h);
+static void hbd_delete_stale_indexes(void);
+static void hbd_flush(void);
+static int hbd_write_tail(HistoryDiskObject *h);
+static void hbd_read_tail(HistoryDiskObject *h);
+static void hbd_page_cache_free_all(void);
+void hbd_generic_free(ModData *m);
+void hbd_free_all_history(ModData *m);
+
+MOD_TEST()
+{
+	hbd_init_hashes(modinfo);
+	memset(&cfg, 0, sizeof(cfg));
+	memset(&test, 0, sizeof(test));
+	setcfg(&test);
+	HookAdd(modinfo->handle, HOOKTYPE_CONFIGTEST, 0, hbd_config_test);
+	HookAdd(modinfo->handle, HOOKTYPE_CONFIGPOSTTEST, 0, hbd_config_posttest);
+
+	return MOD_SUCCESS;
+}
+
+MOD_INIT()
+{
+	HistoryBackendInfo hbi;
+
+	MARK_AS_OFFICIAL_MODULE(modinfo);
+	/* We must unload early, when all channel modes and such are still in place: */
+	ModuleSetOptions(modinfo->handle, MOD_OPT_PRIORITY, -99999999);
+
+	setcfg(&cfg);
+
+	LoadPersistentLong(modinfo, already_loaded);
+	LoadPersistentPointer(modinfo, siphashkey_history_backend_disk, hbd_generic_free);
+	LoadPersistentPointer(modinfo, history_disk_hash_table, hbd_free_all_history);
+	if (history_disk_hash_table == NULL)
+		history_disk_hash_table = safe_alloc(sizeof(HistoryDiskObject *) * HISTORY_BACKEND_DISK_HASH_TABLE_SIZE);
+
+	HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN, 0, hbd_config_run);
+	HookAdd(modinfo->handle, HOOKTYPE_MODECHAR_DEL, 0, hbd_modechar_del);
+	HookAdd(modinfo->handle, HOOKTYPE_REHASH, 0, hbd_rehash);
+
+	if (siphashkey_history_backend_disk == NULL)
+	{
+		siphashkey_history_backend_disk = safe_alloc(SIPHASH_KEY_LENGTH);
+		siphash_generate_key(siphashkey_history_backend_disk);
+	}
+
+	memset(&hbi, 0, sizeof(hbi));
+	hbi.name = "disk";
+	hbi.history_add = hbd_history_add;
+	hbi.history_request = hbd_history_request;
+	hbi.history_destroy = hbd_history_destroy;
+	hbi.history_delete = hbd_history_delete;
+	hbi.history_set_limit = hbd_history_set_limit;
+	if (!HistoryBackendAdd(modinfo->handle, &hbi))
+		return MOD_FAILED;
+
+	return MOD_SUCCESS;
+}
+
+MOD_LOAD()
+{
+	SavePersistentPointer(modinfo, hbd_prehash);
+	SavePersistentPointer(modinfo, hbd_posthash);
+
+	EventAdd(modinfo->handle, "history_disk_init", history_disk_init, NULL, 1, 1);
+	EventAdd(modinfo->handle, "history_disk_clean", history_disk_clean, NULL, HISTORY_TIMER_EVERY*1000, 0);
+	init_history_storage(modinfo);
+	return MOD_SUCCESS;
+}
+
+/** Remove the history of objects that no longer exist (eg: channels
+ * that lost +H while we were down). Same trick as history_backend_mem:
+ * channeldb must have restored the channels first.
+ */
+EVENT(history_disk_init)
+{
+	if (!already_loaded)
+	{
+		already_loaded = 1;
+		hbd_delete_stale_indexes();
+	}
+}
+
+MOD_UNLOAD()
+{
+	if (loop.terminating)
+		hbd_flush();
+	/* Lines are refcounted, so anything still referencing them is fine */
+	hbd_page_cache_free_all();
+	freecfg(&test);
+	freecfg(&cfg);
+	SavePersistentPointer(modinfo, hbd_prehash);
+	SavePersistentPointer(modinfo, hbd_posthash);
+	SavePersistentPointer(modinfo, history_disk_hash_table);
+	SavePersistentPointer(modinfo, siphashkey_history_backend_disk);
+	SavePersistentLong(modinfo, already_loaded);
+	return MOD_SUCCESS;
+}
+
+/** Set cfg->masterdb based on cfg->directory, for convenience */
+static void hbd_set_masterdb_filename(struct cfgstruct *cfg)
+{
+	char buf[512];
+
+	safe_free(cfg->masterdb);
+	if (cfg->directory)
+	{
+		snprintf(buf, sizeof(buf), "%s/master.db", cfg->directory);
+		safe_strdup(cfg->masterdb, buf);
+	}
+}
+
+/** Default configuration for set::history::channel::disk-storage */
+static void setcfg(struct cfgstruct *cfg)
+{
+	safe_strdup(cfg->directory, "history-disk");
+	convert_to_absolute_path(&cfg->directory, PERMDATADIR);
+	hbd_set_masterdb_filename(cfg);
+	cfg->hot_lines = 100;
+	cfg->segment_lines = 500;
+	cfg->page_cache_size = 32*1024*1024;
+}
+
+static void freecfg(struct cfgstruct *cfg)
+{
+	safe_free(cfg->masterdb);
+	safe_free(cfg->directory);
+	safe_free(cfg->db_secret);
+}
+
+static void hbd_init_hashes(ModuleInfo *modinfo)
+{
+	char buf[256];
+
+	LoadPersistentPointer(modinfo, hbd_prehash, hbd_generic_free);
+	LoadPersistentPointer(modinfo, hbd_posthash, hbd_generic_free);
+
+	if (!hbd_prehash)
+	{
+		gen_random_alnum(buf, 128);
+		safe_strdup(hbd_prehash, buf);
+	}
+
+	if (!hbd_posthash)
+	{
+		gen_random_alnum(buf, 128);
+		safe_strdup(hbd_posthash, buf);
+	}
+}
+
+/** Test the set::history::channel::disk-storage configuration */
+int hbd_config_test(ConfigFile *cf, ConfigEntry *ce, int type, int *errs)
+{
+	int errors = 0;
+	ConfigEntry *cep;
+
+	if ((type != CONFIG_SET_HISTORY_CHANNEL) || !ce || !ce->name)
+		return 0;
+
+	if (strcmp(ce->name, "disk-storage"))
+		return 0; /* unknown option to us, let another module handle it */
+
+	for (cep = ce->items; cep; cep = cep->next)
+	{
+		if (!cep->value)
+		{
+			config_error_empty(cep->file->filename, cep->line_number,
+				"set::history::channel::disk-storage", cep->name);
+			errors++;
+			continue;
+		}
+		if (!strcmp(cep->name, "db-secret"))
+		{
+			const char *err;
+			if ((err = unrealdb_test_secret(cep->value)))
+			{
+				config_error("%s:%i: set::history::channel::disk-storage::db-secret: %s",
+					cep->file->filename, cep->line_number, err);
+				errors++;
+			}
+			safe_strdup(test.db_secret, cep->value);
+		} else
+		if (!strcmp(cep->name, "directory"))
+		{
+			safe_strdup(test.directory, cep->value);
+			convert_to_absolute_path(&test.directory, PERMDATADIR);
+			hbd_set_masterdb_filename(&test);
+		} else
+		if (!strcmp(cep->name, "hot-lines"))
+		{
+			int v = atoi(cep->value);
+			if ((v < 1) || (v > 100000))
+			{
+				config_error("%s:%i: set::history::channel::disk-storage::hot-lines must be between 1 and 100000",
+					cep->file->filename, cep->line_number);
+				errors++;
+			}
+		} else
+		if (!strcmp(cep->name, "segment-lines"))
+		{
+			int v = atoi(cep->value);
+			if ((v < 10) || (v > 100000))
+			{
+				config_error("%s:%i: set::history::channel::disk-storage::segment-lines must be between 10 and 100000",
+					cep->file->filename, cep->line_number);
+				errors++;
+			}
+		} else
+		if (!strcmp(cep->name, "page-cache-size"))
+		{
+			long v = config_checkval(cep->value, CFG_SIZE);
+			if (v < 65536)
+			{
+				config_error("%s:%i: set::history::channel::disk-storage::page-cache-size must be at least 64K",
+					cep->file->filename, cep->line_number);
+				errors++;
+			}
+		} else
+		{
+			config_error_unknown(cep->file->filename, cep->line_number,
+				"set::history::channel::disk-storage", cep->name);
+			errors++;
+		}
+	}
+
+	*errs = errors;
+	return errors ? -1 : 1;
+}
+
+/** Post-configuration test on set::history::channel::disk-storage */
+int hbd_config_posttest(int *errs)
+{
+	int errors = 0;
+	char *errstr = NULL;
+
+	if (!test.db_secret)
+	{
+		config_error("set::history::channel::disk-storage::db-secret needs to be set "
+		             "when the history_backend_disk module is loaded.");
+		errors++;
+		goto hbd_config_posttest_end;
+	}
+
+	/* Configuration is good, now check if the password is correct
+	 * (if we can check at all, that is)...
+	 */
+	if (test.masterdb && ((errstr = unrealdb_test_db(test.masterdb, test.db_secret))))
+	{
+		config_error("[history] %s", errstr);
+		errors++;
+		goto hbd_config_posttest_end;
+	}
+
+	/* Ensure directory exists and is writable */
+#ifdef _WIN32
+	(void)mkdir(test.directory); /* (errors ignored) */
+#else
+	(void)mkdir(test.directory, S_IRUSR|S_IWUSR|S_IXUSR); /* (errors ignored) */
+#endif
+	if (!file_exists(test.directory))
+	{
+		config_error("[history] Directory %s does not exist and could not be created",
+			test.directory);
+		errors++;
+	} else
+	{
+		/* Only do this if directory actually exists, hence in the 'else' block */
+		if (!hbd_read_masterdb())
+			errors++;
+	}
+
+hbd_config_posttest_end:
+	freecfg(&test);
+	setcfg(&test);
+	*errs = errors;
+	return errors ? -1 : 1;
+}
+
+/** Configure ourselves based on the set::history::channel::disk-storage settings */
+int hbd_config_run(ConfigFile *cf, ConfigEntry *ce, int type)
+{
+	ConfigEntry *cep;
+
+	if ((type != CONFIG_SET_HISTORY_CHANNEL) || !ce || !ce->name)
+		return 0;
+
+	if (strcmp(ce->name, "disk-storage"))
+		return 0; /* unknown option to us, let another module handle it */
+
+	for (cep = ce->items; cep; cep = cep->next)
+	{
+		if (!strcmp(cep->name, "db-secret"))
+		{
+			safe_strdup(cfg.db_secret, cep->value);
+		} else
+		if (!strcmp(cep->name, "directory"))
+		{
+			safe_strdup(cfg.directory, cep->value);
+			convert_to_absolute_path(&cfg.directory, PERMDATADIR);
+			hbd_set_masterdb_filename(&cfg);
+		} else
+		if (!strcmp(cep->name, "hot-lines"))
+		{
+			cfg.hot_lines = atoi(cep->value);
+		} else
+		if (!strcmp(cep->name, "segment-lines"))
+		{
+			cfg.segment_lines = atoi(cep->value);
+		} else
+		if (!strcmp(cep->name, "page-cache-size"))
+		{
+			cfg.page_cache_size = config_checkval(cep->value, CFG_SIZE);
+		}
+	}
+
+	return 1; /* handled by us */
+}
+
+int hbd_rehash(void)
+{
+	freecfg(&cfg);
+	setcfg(&cfg);
+	return 0;
+}
+
+const char *hbd_history_storage_capability_parameter(Client *client)
+{
+	return "memory,disk=encrypted";
+}
+
+static void init_history_storage(ModuleInfo *modinfo)
+{
+	ClientCapabilityInfo cap;
+
+	memset(&cap, 0, sizeof(cap));
+	cap.name = "unrealircd.org/history-storage";
+	cap.flags = CLICAP_FLAGS_ADVERTISE_ONLY;
+	cap.parameter = hbd_history_storage_capability_parameter;
+	ClientCapabilityAdd(modinfo->handle, &cap, NULL);
+}
+
+/*** Objects and filenames ***/
+
+uint64_t hbd_hash(const char *object)
+{
+	return siphash_nocase(object, siphashkey_history_backend_disk) % HISTORY_BACKEND_DISK_HASH_TABLE_SIZE;
+}
+
+HistoryDiskObject *hbd_find_object(const char *object)
+{
+	int hashv = hbd_hash(object);
+	HistoryDiskObject *h;
+
+	for (h = history_disk_hash_table[hashv]; h; h = h->next)
+	{
+		if (!strcasecmp(object, h->name))
+			return h;
+	}
+	return NULL;
+}
+
+HistoryDiskObject *hbd_find_or_add_object(const char *object)
+{
+	int hashv = hbd_hash(object);
+	HistoryDiskObject *h;
+
+	for (h = history_disk_hash_table[hashv]; h; h = h->next)
+	{
+		if (!strcasecmp(object, h->name))
+			return h;
+	}
+	/* Create new one */
+	h = safe_alloc(sizeof(HistoryDiskObject));
+	strlcpy(h->name, object, sizeof(h->name));
+	AddListItem(h, history_disk_hash_table[hashv]);
+	/* We may have segments on disk from a previous run */
+	hbd_read_index(h);
+	hbd_read_tail(h);
+	return h;
+}
+
+/** Returns the base filename for the object, without suffix */
+static const char *hbd_object_basename(const char *name)
+{
+	static char fname[512];
+	char oname[OBJECTLEN+1];
+	char hashdata[512];
+	char hash[128];
+
+	if (!hbd_prehash || !hbd_posthash)
+		abort(); /* impossible */
+
+	strtolower_safe(oname, name, sizeof(oname));
+	snprintf(hashdata, sizeof(hashdata), "%s %s %s", hbd_prehash, oname, hbd_posthash);
+	sha256hash(hash, hashdata, strlen(hashdata));
+
+	snprintf(fname, sizeof(fname), "%s/%s", cfg.directory, hash);
+	return fname;
+}
+
+static const char *hbd_index_filename(HistoryDiskObject *h)
+{
+	static char fname[512];
+
+	snprintf(fname, sizeof(fname), "%s.idx", hbd_object_basename(h->name));
+	return fname;
+}
+
+static const char *hbd_segment_filename(HistoryDiskObject *h, uint32_t seq)
+{
+	static char fname[512];
+
+	snprintf(fname, sizeof(fname), "%s.%u.seg", hbd_object_basename(h->name), (unsigned int)seq);
+	return fname;
+}
+
+static const char *hbd_tail_filename(HistoryDiskObject *h)
+{
+	static char fname[512];
+
+	snprintf(fname, sizeof(fname), "%s.tail", hbd_object_basename(h->name));
+	return fname;
+}
+
+/*** Page cache ***/
+
+static void hbd_page_lru_unlink(HistoryPage *p)
+{
+	if (p->prev)
+		p->prev->next = p->next;
+	else
+		page_cache_head = p->next;
+	if (p->next)
+		p->next->prev = p->prev;
+	else
+		page_cache_tail = p->prev;
+	p->prev = p->next = NULL;
+}
+
+static void hbd_page_lru_push_front(HistoryPage *p)
+{
+	p->prev = NULL;
+	p->next = page_cache_head;
+	if (page_cache_head)
+		page_cache_head->prev = p;
+	page_cache_head = p;
+	if (!page_cache_tail)
+		page_cache_tail = p;
+}
+
+static HistorySegment *hbd_find_segment(HistoryDiskObject *h, uint32_t seq)
+{
+	int lo = 0, hi = h->num_segments - 1;
+
+	/* Segments are ordered by sequence number */
+	while (lo <= hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (h->segments[mid].seq == seq)
+			return &h->segments[mid];
+		if (h->segments[mid].seq < seq)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return NULL;
+}
+
+/** Free a page. It must be unreferenced. */
+static void hbd_page_free(HistoryPage *p)
+{
+	HistorySegment *seg;
+	int i;
+
+	if (p->h && ((seg = hbd_find_segment(p->h, p->seq))) && (seg->page == p))
+		seg->page = NULL;
+	hbd_page_lru_unlink(p);
+	page_cache_bytes -= p->bytes;
+	for (i = 0; i < p->num_lines; i++)
+		history_log_line_unref(p->lines[i]);
+	safe_free(p->lines);
+	safe_free(p);
+}
+
+/** Evict unreferenced pages until we are within the configured size */
+static void hbd_page_cache_trim(void)
+{
+	HistoryPage *p, *p_prev;
+
+	for (p = page_cache_tail; p && (page_cache_bytes > cfg.page_cache_size); p = p_prev)
+	{
+		p_prev = p->prev;
+		if (p->refcnt == 0)
+			hbd_page_free(p);
+	}
+}
+
+/** Detach a page from its segment, eg because the segment was deleted.
+ * If the page is still in use by a cursor, it will be freed later.
+ */
+static void hbd_page_detach(HistorySegment *seg)
+{
+	HistoryPage *p = seg->page;
+
+	if (!p)
+		return;
+	seg->page = NULL;
+	p->h = NULL;
+	if (p->refcnt == 0)
+		hbd_page_free(p);
+}
+
+static void hbd_page_cache_free_all(void)
+{
+	HistoryPage *p, *p_next;
+
+	for (p = page_cache_head; p; p = p_next)
+	{
+		p_next = p->next;
+		p->refcnt = 0;
+		hbd_page_free(p);
+	}
+}
+
+static void hbd_page_release(HistoryPage *p)
+{
+	if (!p)
+		return;
+	p->refcnt--;
+	if (!p->h && (p->refcnt == 0))
+		hbd_page_free(p); /* detached while in use */
+	else
+		hbd_page_cache_trim();
+}
+
+/*** Reading and writing of segments ***/
+
+#define WARN_WRITE_ERROR(fname) \
+	do { \
+		unreal_log(ULOG_ERROR, "history", "HISTORYDB_FILE_WRITE_ERROR", NULL, \
+			   "[historydb] Error writing to temporary database file $filename: $system_error", \
+			   log_data_string("filename", fname), \
+			   log_data_string("system_error", unrealdb_get_error_string())); \
+	} while(0)
+
+#define W_SAFE(x) \
+	do { \
+		if (!(x)) { \
+			WARN_WRITE_ERROR(tmpfname); \
+			unrealdb_close(db); \
+			return 0; \
+		} \
+	} while(0)
+
+static int hbd_rename_tmpfile(const char *tmpfname, const char *realfname)
+{
+#ifdef _WIN32
+	/* The rename operation cannot be atomic on Windows as it will cause a "file exists" error */
+	unlink(realfname);
+#endif
+	if (rename(tmpfname, realfname) < 0)
+	{
+		unreal_log(ULOG_ERROR, "history", "HISTORYDB_FILE_RENAME_ERROR", NULL,
+			   "[historydb] Error renaming $tmpfilename to $filename: $system_error (HISTORY NOT SAVED)",
+			   log_data_string("tmpfilename", tmpfname),
+			   log_data_string("filename", realfname),
+			   log_data_string("system_error", strerror(errno)));
+		return 0;
+	}
+	return 1;
+}
+
+/** Write lines to a file in the segment format.
+ * This is used for segment files and for the tail file.
+ * @param h		The history object
+ * @param fname		The filename
+ * @param lines		The lines to write, oldest first
+ * @param num_lines	Number of lines
+ * @returns 1 on success, 0 on failure
+ */
+static int hbd_write_lines(HistoryDiskObject *h, const char *fname, HistoryLogLine **lines, int num_lines)
+{
+	UnrealDB *db;
+	char realfname[512];
+	char tmpfname[512];
+	MessageTag *m;
+	int i;
+
+	strlcpy(realfname, fname, sizeof(realfname));
+	snprintf(tmpfname, sizeof(tmpfname), "%s.tmp", realfname);
+
+	db = unrealdb_open(tmpfname, UNREALDB_MODE_WRITE, cfg.db_secret);
+	if (!db)
+	{
+		WARN_WRITE_ERROR(tmpfname);
+		return 0;
+	}
+
+	W_SAFE(unrealdb_write_int32(db, HISTORYDB_MAGIC_SEGMENT_START));
+	W_SAFE(unrealdb_write_int32(db, HISTORYDB_DISK_VERSION));
+	W_SAFE(unrealdb_write_str(db, hbd_prehash));
+	W_SAFE(unrealdb_write_str(db, hbd_posthash));
+	W_SAFE(unrealdb_write_str(db, h->name));
+	W_SAFE(unrealdb_write_int32(db, num_lines));
+
+	for (i = 0; i < num_lines; i++)
+	{
+		HistoryLogLine *l = lines[i];
+		W_SAFE(unrealdb_write_int32(db, HISTORYDB_MAGIC_ENTRY_START));
+		W_SAFE(unrealdb_write_int64(db, l->t));
+		for (m = l->mtags; m; m = m->next)
+		{
+			W_SAFE(unrealdb_write_str(db, m->name));
+			W_SAFE(unrealdb_write_str(db, m->value)); /* can be NULL */
+		}
+		W_SAFE(unrealdb_write_str(db, NULL));
+		W_SAFE(unrealdb_write_str(db, NULL));
+		W_SAFE(unrealdb_write_str(db, l->line));
+		W_SAFE(unrealdb_write_int32(db, HISTORYDB_MAGIC_ENTRY_END));
+	}
+	W_SAFE(unrealdb_write_int32(db, HISTORYDB_MAGIC_FILE_END));
+
+	if (!unrealdb_close(db))
+	{
+		WARN_WRITE_ERROR(tmpfname);
+		return 0;
+	}
+
+	if (!hbd_rename_tmpfile(tmpfname, realfname))
+		return 0;
+
+	return 1;
+}
+
+/** Write a new segment file.
+ * @param h		The history object
+ * @param lines		The lines to write, oldest first
+ * @param num_lines	Number of lines
+ * @param seg		The segment to fill in (seq is set by the caller)
+ * @returns 1 on success, 0 on failure
+ */
+static int hbd_write_segment(HistoryDiskObject *h, HistoryLogLine **lines, int num_lines, HistorySegment *seg)
+{
+	if (!hbd_write_lines(h, hbd_segment_filename(h, seg->seq), lines, num_lines))
+		return 0;
+
+	seg->num_lines = num_lines;
+	seg->first_t = num_lines ? lines[0]->t : 0;
+	seg->last_t = num_lines ? lines[num_lines-1]->t : 0;
+	seg->page = NULL;
+	return 1;
+}
+
+#define RESET_VALUES_LOOP()	do { \
+					safe_free(mtag_name); \
+					safe_free(mtag_value); \
+					safe_free(line); \
+					free_message_tags(mtags); \
+					mtags = NULL; \
+					magic = 0; \
+					line_ts = 0; \
+				} while(0)
+
+#define R_SAFE_CLEANUP()	do { \
+					unrealdb_close(db); \
+					RESET_VALUES_LOOP(); \
+					safe_free(prehash); \
+					safe_free(posthash); \
+					safe_free(object); \
+					for (i = 0; i < p->num_lines; i++) \
+						history_log_line_unref(p->lines[i]); \
+					safe_free(p->lines); \
+					safe_free(p); \
+				} while(0)
+#define R_SAFE(x) \
+	do { \
+		if (!(x)) { \
+			unreal_log(ULOG_WARNING, "history", "HISTORYDB_SEGMENT_READ_ERROR", NULL, \
+			           "[history] Read error from segment file $filename (possible corruption): $system_error", \
+			           log_data_string("filename", fname), \
+			           log_data_string("system_error", unrealdb_get_error_string())); \
+			R_SAFE_CLEANUP(); \
+			return NULL; \
+		} \
+	} while(0)
+
+/** Read a file in the segment format into a new (unreferenced) page.
+ * @param h		The history object
+ * @param fname		The filename
+ * @param seq		The sequence number for the page
+ */
+static HistoryPage *hbd_read_lines(HistoryDiskObject *h, const char *fname, uint32_t seq)
+{
+	UnrealDB *db = NULL;
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	uint32_t num_lines = 0;
+	char *prehash = NULL;
+	char *posthash = NULL;
+	char *object = NULL;
+	uint64_t line_ts;
+	char *mtag_name = NULL;
+	char *mtag_value = NULL;
+	MessageTag *mtags = NULL, *m;
+	char *line = NULL;
+	HistoryLogLine *l;
+	HistoryPage *p;
+	int i;
+
+	p = safe_alloc(sizeof(HistoryPage));
+	p->h = h;
+	p->seq = seq;
+	p->bytes = sizeof(HistoryPage);
+
+	db = unrealdb_open(fname, UNREALDB_MODE_READ, cfg.db_secret);
+	if (!db)
+	{
+		unreal_log(ULOG_WARNING, "history", "HISTORYDB_SEGMENT_READ_ERROR", NULL,
+		           "[history] Unable to open segment file $filename for reading: $system_error",
+		           log_data_string("filename", fname),
+		           log_data_string("system_error", unrealdb_get_error_string()));
+		safe_free(p);
+		return NULL;
+	}
+
+	R_SAFE(unrealdb_read_int32(db, &magic));
+	R_SAFE(magic == HISTORYDB_MAGIC_SEGMENT_START);
+	R_SAFE(unrealdb_read_int32(db, &version));
+	R_SAFE(version == HISTORYDB_DISK_VERSION);
+	R_SAFE(unrealdb_read_str(db, &prehash));
+	R_SAFE(unrealdb_read_str(db, &posthash));
+	R_SAFE(prehash && posthash && !strcmp(prehash, hbd_prehash) && !strcmp(posthash, hbd_posthash));
+	R_SAFE(unrealdb_read_str(db, &object));
+	R_SAFE(unrealdb_read_int32(db, &num_lines));
+	R_SAFE(num_lines < 1000000);
+
+	p->lines = safe_alloc(sizeof(HistoryLogLine *) * (num_lines ? num_lines : 1));
+	while (p->num_lines < num_lines)
+	{
+		RESET_VALUES_LOOP();
+		R_SAFE(unrealdb_read_int32(db, &magic));
+		R_SAFE(magic == HISTORYDB_MAGIC_ENTRY_START);
+		R_SAFE(unrealdb_read_int64(db, &line_ts));
+		while(1)
+		{
+			R_SAFE(unrealdb_read_str(db, &mtag_name));
+			R_SAFE(unrealdb_read_str(db, &mtag_value));
+			if (!mtag_name && !mtag_value)
+				break; /* We're done reading mtags for this particular line */
+			m = safe_alloc(sizeof(MessageTag));
+			m->name = mtag_name;
+			m->value = mtag_value;
+			mtag_name = mtag_value = NULL;
+			AppendListItem(m, mtags);
+			p->bytes += sizeof(MessageTag) + strlen(m->name) + (m->value ? strlen(m->value) : 0);
+		}
+		R_SAFE(unrealdb_read_str(db, &line));
+		R_SAFE(line);
+		R_SAFE(unrealdb_read_int32(db, &magic));
+		R_SAFE(magic == HISTORYDB_MAGIC_ENTRY_END);
+
+		l = safe_alloc(sizeof(HistoryLogLine) + strlen(line));
+		strcpy(l->line, line); /* safe, see memory allocation above ^ */
+		l->refcnt = 1; /* the page's reference */
+		l->t = line_ts;
+		l->mtags = mtags;
+		mtags = NULL;
+		p->lines[p->num_lines++] = l;
+		p->bytes += sizeof(HistoryLogLine) + strlen(line);
+	}
+
+	RESET_VALUES_LOOP();
+	unrealdb_close(db);
+	safe_free(prehash);
+	safe_free(posthash);
+	safe_free(object);
+	return p;
+}
+
+/** Read a segment file into a new (unreferenced) page */
+static HistoryPage *hbd_read_segment(HistoryDiskObject *h, HistorySegment *seg)
+{
+	return hbd_read_lines(h, hbd_segment_filename(h, seg->seq), seg->seq);
+}
+
+/** Get the page of segment 'seg' of object 'h', loading it if needed.
+ * The page is referenced, use hbd_page_release() when done.
+ */
+static HistoryPage *hbd_page_get(HistoryDiskObject *h, HistorySegment *seg)
+{
+	HistoryPage *p = seg->page;
+
+	if (p)
+	{
+		/* Move to the front of the LRU list */
+		hbd_page_lru_unlink(p);
+		hbd_page_lru_push_front(p);
+		p->refcnt++;
+		return p;
+	}
+
+	p = hbd_read_segment(h, seg);
+	if (!p)
+		return NULL;
+	seg->page = p;
+	hbd_page_lru_push_front(p);
+	page_cache_bytes += p->bytes;
+	p->refcnt++;
+	return p;
+}
+
+/*** Index ***/
+
+/** Write the index of a history object. Called after a segment was added or removed. */
+static int hbd_write_index(HistoryDiskObject *h)
+{
+	UnrealDB *db;
+	char realfname[512];
+	char tmpfname[512];
+	int i;
+
+	if (!h->num_segments && !h->tail_on_disk)
+	{
+		/* Nothing on disk, so no index needed either */
+		unlink(hbd_index_filename(h));
+		h->dirty = 0;
+		return 1;
+	}
+
+	strlcpy(realfname, hbd_index_filename(h), sizeof(realfname));
+	snprintf(tmpfname, sizeof(tmpfname), "%s.tmp", realfname);
+
+	db = unrealdb_open(tmpfname, UNREALDB_MODE_WRITE, cfg.db_secret);
+	if (!db)
+	{
+		WARN_WRITE_ERROR(tmpfname);
+		return 0;
+	}
+
+	W_SAFE(unrealdb_write_int32(db, HISTORYDB_MAGIC_INDEX_START));
+	W_SAFE(unrealdb_write_int32(db, HISTORYDB_DISK_VERSION));
+	W_SAFE(unrealdb_write_str(db, hbd_prehash));
+	W_SAFE(unrealdb_write_str(db, hbd_posthash));
+	W_SAFE(unrealdb_write_str(db, h->name));
+	W_SAFE(unrealdb_write_int32(db, h->next_seq));
+	W_SAFE(unrealdb_write_int32(db, h->skip_lines));
+	W_SAFE(unrealdb_write_int32(db, h->num_segments));
+	for (i = 0; i < h->num_segments; i++)
+	{
+		W_SAFE(unrealdb_write_int32(db, h->segments[i].seq));
+		W_SAFE(unrealdb_write_int64(db, h->segments[i].first_t));
+		W_SAFE(unrealdb_write_int64(db, h->segments[i].last_t));
+		W_SAFE(unrealdb_write_int32(db, h->segments[i].num_lines));
+	}
+	W_SAFE(unrealdb_write_int32(db, HISTORYDB_MAGIC_FILE_END));
+
+	if (!unrealdb_close(db))
+	{
+		WARN_WRITE_ERROR(tmpfname);
+		return 0;
+	}
+
+	if (!hbd_rename_tmpfile(tmpfname, realfname))
+		return 0;
+
+	h->dirty = 0;
+	return 1;
+}
+
+/** Read the header of an index file.
+ * @param fname		The filename
+ * @param object	Will be set to the object name (must be freed by caller)
+ * @returns The opened database, or NULL on error.
+ */
+static UnrealDB *hbd_open_index(const char *fname, char **object)
+{
+	UnrealDB *db;
+	uint32_t magic = 0, version = 0;
+	char *prehash = NULL, *posthash = NULL;
+
+	*object = NULL;
+	db = unrealdb_open(fname, UNREALDB_MODE_READ, cfg.db_secret);
+	if (!db)
+		return NULL;
+
+	if (!unrealdb_read_int32(db, &magic) || (magic != HISTORYDB_MAGIC_INDEX_START) ||
+	    !unrealdb_read_int32(db, &version) || (version != HISTORYDB_DISK_VERSION) ||
+	    !unrealdb_read_str(db, &prehash) || !unrealdb_read_str(db, &posthash) ||
+	    !prehash || !posthash || strcmp(prehash, hbd_prehash) || strcmp(posthash, hbd_posthash) ||
+	    !unrealdb_read_str(db, object) || !*object)
+	{
+		safe_free(prehash);
+		safe_free(posthash);
+		safe_free(*object);
+		unrealdb_close(db);
+		return NULL;
+	}
+	safe_free(prehash);
+	safe_free(posthash);
+	return db;
+}
+
+/** Read the index of a history object, if there is one on disk */
+static int hbd_read_index(HistoryDiskObject *h)
+{
+	const char *fname = hbd_index_filename(h);
+	UnrealDB *db;
+	char *object = NULL;
+	uint32_t next_seq, skip_lines, num_segments, v32;
+	uint64_t v64;
+	int i;
+
+	if (!cfg.db_secret || !file_exists(fname))
+		return 0;
+
+	db = hbd_open_index(fname, &object);
+	if (!db)
+	{
+		unreal_log(ULOG_WARNING, "history", "HISTORYDB_INDEX_READ_ERROR", NULL,
+		           "[history] Unable to read index file $filename of $object: $system_error",
+		           log_data_string("filename", fname),
+		           log_data_string("object", h->name),
+		           log_data_string("system_error", unrealdb_get_error_string()));
+		return 0;
+	}
+	safe_free(object);
+
+	if (!unrealdb_read_int32(db, &next_seq) ||
+	    !unrealdb_read_int32(db, &skip_lines) ||
+	    !unrealdb_read_int32(db, &num_segments) ||
+	    (num_segments > 1000000))
+	{
+		unrealdb_close(db);
+		return 0;
+	}
+
+	h->segments = safe_alloc(sizeof(HistorySegment) * (num_segments ? num_segments : 1));
+	for (i = 0; i < num_segments; i++)
+	{
+		HistorySegment *seg = &h->segments[i];
+		if (!unrealdb_read_int32(db, &v32))
+			break;
+		seg->seq = v32;
+		if (!unrealdb_read_int64(db, &v64))
+			break;
+		seg->first_t = v64;
+		if (!unrealdb_read_int64(db, &v64))
+			break;
+		seg->last_t = v64;
+		if (!unrealdb_read_int32(db, &v32))
+			break;
+		seg->num_lines = v32;
+		h->num_disk_lines += seg->num_lines;
+	}
+	unrealdb_close(db);
+
+	if (i < num_segments)
+	{
+		/* Read error: start from scratch for this object */
+		safe_free(h->segments);
+		h->num_disk_lines = 0;
+		return 0;
+	}
+
+	h->num_segments = num_segments;
+	h->next_seq = next_seq;
+	h->skip_lines = num_segments ? skip_lines : 0;
+	h->num_disk_lines -= h->skip_lines;
+	return 1;
+}
+
+/** Delete index and segment files of objects we don't know about */
+static void hbd_delete_stale_indexes(void)
+{
+	char buf[512];
+	char *object;
+	UnrealDB *db;
+#ifndef _WIN32
+	struct dirent *dir;
+	DIR *fd = opendir(cfg.directory);
+
+	if (!cfg.db_secret || !fd)
+	{
+		if (fd)
+			closedir(fd);
+		return;
+	}
+
+	while ((dir = readdir(fd)))
+	{
+		char *fname = dir->d_name;
+#else
+	/* Windows */
+	WIN32_FIND_DATA hData;
+	HANDLE hFile;
+	char xbuf[512];
+
+	if (!cfg.db_secret)
+		return;
+
+	snprintf(xbuf, sizeof(xbuf), "%s/*.idx", cfg.directory);
+
+	hFile = FindFirstFile(xbuf, &hData);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		char *fname = hData.cFileName;
+#endif
+
+		/* Common section for both *NIX and Windows */
+
+		snprintf(buf, sizeof(buf), "%s/%s", cfg.directory, fname);
+		if (filename_has_suffix(fname, ".idx"))
+		{
+			db = hbd_open_index(buf, &object);
+			if (db)
+			{
+				unrealdb_close(db);
+				if (!hbd_find_object(object))
+				{
+					HistoryDiskObject *h = hbd_find_or_add_object(object);
+					unreal_log(ULOG_INFO, "history", "HISTORYDB_STALE", NULL,
+					           "[history] $object does not have +H set, deleting history",
+					           log_data_string("object", object));
+					hbd_history_destroy(h->name);
+				}
+				safe_free(object);
+			}
+		}
+
+		/* End of common section */
+#ifndef _WIN32
+	}
+	closedir(fd);
+#else
+	} while (FindNextFile(hFile, &hData));
+	FindClose(hFile);
+#endif
+}
+
+/*** Adding and removing lines ***/
+
+void hbd_duplicate_mtags(HistoryLogLine *l, MessageTag *m)
+{
+	MessageTag *n;
+
+	/* Duplicate all message tags */
+	for (; m; m = m->next)
+	{
+		n = duplicate_mtag(m);
+		AppendListItem(n, l->mtags);
+	}
+	n = find_mtag(l->mtags, "time");
+	if (!n)
+	{
+		struct timeval t;
+		struct tm *tm;
+		time_t sec;
+		char buf[64];
+
+		gettimeofday(&t, NULL);
+		sec = t.tv_sec;
+		tm = gmtime(&sec);
+		snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
+			tm->tm_year + 1900,
+			tm->tm_mon + 1,
+			tm->tm_mday,
+			tm->tm_hour,
+			tm->tm_min,
+			tm->tm_sec,
+			(int)(t.tv_usec / 1000));
+
+		n = safe_alloc(sizeof(MessageTag));
+		safe_strdup(n->name, "time");
+		safe_strdup(n->value, buf);
+		AddListItem(n, l->mtags);
+	}
+	/* Now convert the "time" message tag to something we can use in l->t */
+	l->t = server_time_to_unix_time(n->value);
+}
+
+/** Delete a line from the hot tail */
+static void hbd_hot_del_line(HistoryDiskObject *h, HistoryLogLine *l)
+{
+	if (l->prev)
+		l->prev->next = l->next;
+	if (l->next)
+		l->next->prev = l->prev;
+	if (h->head == l)
+		h->head = l->next;
+	if (h->tail == l)
+		h->tail = l->prev; /* could be NULL now */
+	l->prev = l->next = NULL;
+	history_log_line_unref(l);
+	h->num_hot_lines--;
+	h->tail_dirty = 1;
+}
+
+/** Remove segment 'i' from the index, including the file on disk */
+static void hbd_remove_segment(HistoryDiskObject *h, int i)
+{
+	HistorySegment *seg = &h->segments[i];
+
+	hbd_page_detach(seg);
+	unlink(hbd_segment_filename(h, seg->seq));
+	if (i == 0)
+	{
+		h->num_disk_lines -= seg->num_lines - h->skip_lines;
+		h->skip_lines = 0;
+	} else {
+		h->num_disk_lines -= seg->num_lines;
+	}
+	h->num_segments--;
+	if (i < h->num_segments)
+		memmove(&h->segments[i], &h->segments[i+1], sizeof(HistorySegment) * (h->num_segments - i));
+	/* Pages refer to segments by seq, so nothing else to update */
+	h->dirty = 1;
+}
+
+/** Drop the oldest line of the object */
+static void hbd_drop_oldest(HistoryDiskObject *h)
+{
+	if (h->num_segments)
+	{
+		h->skip_lines++;
+		h->num_disk_lines--;
+		h->dirty = 1;
+		if (h->skip_lines >= h->segments[0].num_lines)
+			hbd_remove_segment(h, 0);
+	} else
+	if (h->head)
+	{
+		hbd_hot_del_line(h, h->head);
+	}
+}
+
+/** Spill the oldest lines of the hot tail to a new segment on disk */
+static void hbd_spill(HistoryDiskObject *h, int count)
+{
+	HistoryLogLine **lines;
+	HistoryLogLine *l;
+	HistorySegment seg;
+	int i;
+
+	if (count > h->num_hot_lines)
+		count = h->num_hot_lines;
+	if (count <= 0)
+		return;
+
+	lines = safe_alloc(sizeof(HistoryLogLine *) * count);
+	for (l = h->head, i = 0; l && (i < count); l = l->next, i++)
+		lines[i] = l;
+
+	memset(&seg, 0, sizeof(seg));
+	seg.seq = h->next_seq;
+	if (!hbd_write_segment(h, lines, count, &seg))
+	{
+		/* Unable to write to disk. Keep memory usage bounded,
+		 * even if this means we lose these lines.
+		 */
+		for (i = 0; i < count; i++)
+			hbd_hot_del_line(h, lines[i]);
+		safe_free(lines);
+		return;
+	}
+	h->next_seq++;
+
+	h->segments = realloc(h->segments, sizeof(HistorySegment) * (h->num_segments + 1));
+	if (!h->segments)
+		outofmemory(sizeof(HistorySegment) * (h->num_segments + 1));
+	h->segments[h->num_segments++] = seg;
+	h->num_disk_lines += count;
+
+	for (i = 0; i < count; i++)
+		hbd_hot_del_line(h, lines[i]);
+	safe_free(lines);
+
+	hbd_write_index(h);
+	/* The spilled lines must not be in the tail file anymore */
+	if (h->tail_on_disk)
+		hbd_write_tail(h);
+}
+
+/** Write the hot tail to the tail file, so it survives a crash.
+ * This is done from time to time by history_disk_clean().
+ * On a clean shutdown the hot tail is spilled to a segment instead.
+ */
+static int hbd_write_tail(HistoryDiskObject *h)
+{
+	HistoryLogLine **lines;
+	HistoryLogLine *l;
+	int was_on_disk = h->tail_on_disk;
+	int i, ret;
+
+	if (!h->num_hot_lines)
+	{
+		unlink(hbd_tail_filename(h));
+		h->tail_on_disk = 0;
+		h->tail_dirty = 0;
+		if (was_on_disk)
+			hbd_write_index(h);
+		return 1;
+	}
+
+	lines = safe_alloc(sizeof(HistoryLogLine *) * h->num_hot_lines);
+	for (l = h->head, i = 0; l && (i < h->num_hot_lines); l = l->next, i++)
+		lines[i] = l;
+	ret = hbd_write_lines(h, hbd_tail_filename(h), lines, i);
+	safe_free(lines);
+	if (!ret)
+		return 0;
+
+	h->tail_on_disk = 1;
+	h->tail_dirty = 0;
+	/* The index must exist, see hbd_delete_stale_indexes() */
+	if (!was_on_disk)
+		hbd_write_index(h);
+	return 1;
+}
+
+/** Read the tail file of a previous run (after a crash) into the hot tail */
+static void hbd_read_tail(HistoryDiskObject *h)
+{
+	const char *fname = hbd_tail_filename(h);
+	HistoryPage *p;
+	HistoryLogLine *l;
+	int i;
+
+	if (!cfg.db_secret || !file_exists(fname))
+		return;
+
+	p = hbd_read_lines(h, fname, 0);
+	if (!p)
+		return;
+
+	/* Take over the references of the page */
+	for (i = 0; i < p->num_lines; i++)
+	{
+		l = p->lines[i];
+		if (h->tail)
+		{
+			h->tail->next = l;
+			l->prev = h->tail;
+			h->tail = l;
+		} else {
+			h->head = h->tail = l;
+		}
+		h->num_hot_lines++;
+	}
+	safe_free(p->lines);
+	safe_free(p);
+	h->tail_on_disk = 1;
+}
+
+/** Add a line to the hot tail of a history object */
+static void hbd_history_add_line(HistoryDiskObject *h, MessageTag *mtags, const char *line)
+{
+	HistoryLogLine *l = safe_alloc(sizeof(HistoryLogLine) + strlen(line));
+	strcpy(l->line, line); /* safe, see memory allocation above ^ */
+	l->refcnt = 1; /* our reference */
+	hbd_duplicate_mtags(l, mtags);
+	if (h->tail)
+	{
+		/* append to tail */
+		h->tail->next = l;
+		l->prev = h->tail;
+		h->tail = l;
+	} else {
+		/* no tail, no head */
+		h->head = h->tail = l;
+	}
+	h->num_hot_lines++;
+	h->tail_dirty = 1;
+}
+
+/** Add history entry */
+int hbd_history_add(const char *object, MessageTag *mtags, const char *line)
+{
+	HistoryDiskObject *h = hbd_find_or_add_object(object);
+	if (!h->max_lines)
+	{
+		unreal_log(ULOG_WARNING, "history", "BUG_HISTORY_ADD_NO_LIMIT", NULL,
+		           "[BUG] hbd_history_add() called for $object, which has no limit set",
+		           log_data_string("object", h->name));
+#ifdef DEBUGMODE
+		abort();
+#else
+		h->max_lines = 50;
+		h->max_time = 86400;
+#endif
+	}
+	while (h->num_disk_lines + h->num_hot_lines >= h->max_lines)
+		hbd_drop_oldest(h);
+	hbd_history_add_line(h, mtags, line);
+	if (h->num_hot_lines >= cfg.hot_lines + cfg.segment_lines)
+		hbd_spill(h, cfg.segment_lines);
+	return 0;
+}
+
+/*** Cursor ***/
+
+/** Position the cursor at the start (or end) of segment 'seg' */
+static int hbd_cursor_set_segment(HistoryCursor *c, int seg, int at_end)
+{
+	hbd_page_release(c->page);
+	c->page = NULL;
+	c->hot = NULL;
+	c->seg = seg;
+
+	if (seg < 0)
+		return 0;
+
+	if (seg >= c->h->num_segments)
+	{
+		c->seg = c->h->num_segments;
+		c->hot = at_end ? c->h->tail : c->h->head;
+		if (!c->hot && at_end)
+			return hbd_cursor_set_segment(c, c->h->num_segments - 1, 1); /* empty hot tail */
+		return c->hot ? 1 : 0;
+	}
+
+	/* Don't bother loading a segment that only has expired lines */
+	if (c->h->segments[seg].last_t < c->redline)
+		return at_end ? 0 : hbd_cursor_set_segment(c, seg + 1, 0);
+
+	c->page = hbd_page_get(c->h, &c->h->segments[seg]);
+	if (!c->page || !c->page->num_lines)
+	{
+		/* Unreadable segment, skip it */
+		return at_end ? hbd_cursor_set_segment(c, seg - 1, 1) : hbd_cursor_set_segment(c, seg + 1, 0);
+	}
+	c->pos = at_end ? c->page->num_lines - 1 : 0;
+	if ((seg == 0) && (c->pos < c->h->skip_lines))
+	{
+		if (at_end)
+			return 0; /* everything in this segment is deleted */
+		c->pos = c->h->skip_lines;
+	}
+	return 1;
+}
+
+static HistoryLogLine *hbd_cursor_line_raw(HistoryCursor *c)
+{
+	if (c->seg == c->h->num_segments)
+		return c->hot;
+	if (!c->page || (c->pos < 0) || (c->pos >= c->page->num_lines))
+		return NULL;
+	return c->page->lines[c->pos];
+}
+
+static HistoryLogLine *hbd_cursor_next(HistoryCursor *c);
+static HistoryLogLine *hbd_cursor_prev(HistoryCursor *c);
+
+/** Current line of the cursor, skipping expired lines in direction 'dir'.
+ * Walking backward, an expired line means all older lines are expired too.
+ */
+static HistoryLogLine *hbd_cursor_line(HistoryCursor *c, int dir)
+{
+	HistoryLogLine *l = hbd_cursor_line_raw(c);
+
+	if (l && (l->t < c->redline))
+		return (dir > 0) ? hbd_cursor_next(c) : NULL;
+	return l;
+}
+
+static HistoryLogLine *hbd_cursor_next(HistoryCursor *c)
+{
+	HistoryLogLine *l;
+
+	do {
+		if (c->seg == c->h->num_segments)
+		{
+			if (!c->hot)
+				return NULL;
+			c->hot = c->hot->next;
+		} else
+		if (++c->pos >= c->page->num_lines)
+		{
+			if (!hbd_cursor_set_segment(c, c->seg + 1, 0))
+				return NULL;
+		}
+		l = hbd_cursor_line_raw(c);
+	} while (l && (l->t < c->redline));
+	return l;
+}
+
+/** Move the cursor to the previous (older) line and return it.
+ * This stops at the first expired line, since all lines before
+ * it are expired as well, so no older segments are loaded.
+ */
+static HistoryLogLine *hbd_cursor_prev(HistoryCursor *c)
+{
+	HistoryLogLine *l;
+
+	if (c->seg == c->h->num_segments)
+	{
+		if (!c->hot)
+			return NULL;
+		c->hot = c->hot->prev;
+		if (!c->hot && !hbd_cursor_set_segment(c, c->seg - 1, 1))
+			return NULL;
+	} else
+	if ((--c->pos < 0) || ((c->seg == 0) && (c->pos < c->h->skip_lines)))
+	{
+		if (!hbd_cursor_set_segment(c, c->seg - 1, 1))
+			return NULL;
+	}
+	l = hbd_cursor_line_raw(c);
+	if (l && (l->t < c->redline))
+		return NULL;
+	return l;
+}
+
+static void hbd_cursor_init(HistoryCursor *c, HistoryDiskObject *h)
+{
+	memset(c, 0, sizeof(HistoryCursor));
+	c->h = h;
+	c->redline = TStime() - h->max_time;
+}
+
+/** Position at the first line and return it */
+static HistoryLogLine *hbd_cursor_first(HistoryCursor *c)
+{
+	if (!hbd_cursor_set_segment(c, 0, 0))
+		return NULL;
+	return hbd_cursor_line(c, 1);
+}
+
+/** Position at the last line and return it */
+static HistoryLogLine *hbd_cursor_last(HistoryCursor *c)
+{
+	if (!hbd_cursor_set_segment(c, c->h->num_segments, 1))
+		return NULL;
+	return hbd_cursor_line(c, -1);
+}
+
+/** Position at the first segment that may contain lines at or after 't' */
+static HistoryLogLine *hbd_cursor_seek_forward(HistoryCursor *c, time_t t)
+{
+	int i;
+
+	for (i = 0; i < c->h->num_segments; i++)
+		if (c->h->segments[i].last_t >= t)
+			break;
+	if (!hbd_cursor_set_segment(c, i, 0))
+		return NULL;
+	return hbd_cursor_line(c, 1);
+}
+
+/** Position at the end of the last segment that may contain lines at or before 't' */
+static HistoryLogLine *hbd_cursor_seek_backward(HistoryCursor *c, time_t t)
+{
+	int i;
+
+	if (c->h->head && (c->h->head->t <= t))
+		return hbd_cursor_last(c);
+	for (i = c->h->num_segments - 1; i >= 0; i--)
+		if (c->h->segments[i].first_t <= t)
+			break;
+	if (i < 0)
+		return hbd_cursor_last(c); /* fall back to a full scan */
+	if (!hbd_cursor_set_segment(c, i, 1))
+		return NULL;
+	return hbd_cursor_line(c, -1);
+}
+
+static void hbd_cursor_copy(HistoryCursor *dst, HistoryCursor *src)
+{
+	*dst = *src;
+	if (dst->page)
+		dst->page->refcnt++;
+}
+
+static void hbd_cursor_done(HistoryCursor *c)
+{
+	hbd_page_release(c->page);
+	c->page = NULL;
+}
+
+/*** Requests ***/
+
+/** Put lines in HistoryResult that are after a certain msgid or
+ *  timestamp (excluding said msgid/timestamp).
+ *  Also stops at the other given msgid/timestamp (if any); so this can also be
+ *  used by hbd_return_between.
+ * @param r		The history result set that we will use
+ * @param h		The history object
+ * @param filter	The filter that applies
+ * @returns Number of lines written, note that this could be zero,
+ *          which is a perfectly valid result.
+ */
+static int hbd_return_after(HistoryResult *r, HistoryDiskObject *h, HistoryFilter *filter)
+{
+	HistoryCursor c;
+	HistoryLogLine *l;
+	int written = 0;
+	int started = 0;
+	MessageTag *m;
+
+	hbd_cursor_init(&c, h);
+	if (filter->timestamp_a)
+		l = hbd_cursor_seek_forward(&c, server_time_to_unix_time(filter->timestamp_a));
+	else
+		l = hbd_cursor_first(&c);
+
+	for (; l; l = hbd_cursor_next(&c))
+	{
+		/* Not started yet? Check if this is the starting point... */
+		if (!started)
+		{
+			if (filter->timestamp_a && ((m = find_mtag(l->mtags, "time"))) && (strcmp(m->value, filter->timestamp_a) > 0))
+			{
+				started = 1;
+			} else
+			if (filter->msgid_a && ((m = find_mtag(l->mtags, "msgid"))) && !strcmp(m->value, filter->msgid_a))
+			{
+				started = 1;
+				continue;
+			}
+		}
+		if (started)
+		{
+			/* Check if we need to stop */
+			if (filter->timestamp_b && ((m = find_mtag(l->mtags, "time"))) && (strcmp(m->value, filter->timestamp_b) >= 0))
+			{
+				break;
+			} else
+			if (filter->msgid_b && ((m = find_mtag(l->mtags, "msgid"))) && !strcmp(m->value, filter->msgid_b))
+			{
+				break;
+			}
+
+			/* Add line to the return buffer */
+			history_result_append_line(r, l);
+			if (++written >= filter->limit)
+				break;
+		}
+	}
+
+	hbd_cursor_done(&c);
+	return written;
+}
+
+/** Put lines in HistoryResult that are before a certain msgid or
+ *  timestamp (excluding said msgid/timestamp).
+ * @param r		The history result set that we will use
+ * @param h		The history object
+ * @param filter	The filter that applies
+ * @returns Number of lines written, note that this could be zero,
+ *          which is a perfectly valid result.
+ */
+static int hbd_return_before(HistoryResult *r, HistoryDiskObject *h, HistoryFilter *filter)
+{
+	HistoryCursor c;
+	HistoryLogLine *l;
+	int written = 0;
+	int started = 0;
+	MessageTag *m;
+
+	hbd_cursor_init(&c, h);
+	if (filter->timestamp_a)
+		l = hbd_cursor_seek_backward(&c, server_time_to_unix_time(filter->timestamp_a));
+	else
+		l = hbd_cursor_last(&c);
+
+	for (; l; l = hbd_cursor_prev(&c))
+	{
+		/* Not started yet? Check if this is the starting point... */
+		if (!started)
+		{
+			if (filter->timestamp_a && ((m = find_mtag(l->mtags, "time"))) && (strcmp(m->value, filter->timestamp_a) < 0))
+			{
+				started = 1;
+			} else
+			if (filter->msgid_a && ((m = find_mtag(l->mtags, "msgid"))) && !strcmp(m->value, filter->msgid_a))
+			{
+				started = 1;
+				continue;
+			}
+		}
+		if (started)
+		{
+			/* Check if we need to stop */
+			if (filter->timestamp_b && ((m = find_mtag(l->mtags, "time"))) && (strcmp(m->value, filter->timestamp_b) < 0))
+			{
+				break;
+			} else
+			if (filter->msgid_b && ((m = find_mtag(l->mtags, "msgid"))) && !strcmp(m->value, filter->msgid_b))
+			{
+				break;
+			}
+
+			/* Add line to the return buffer */
+			history_result_prepend_line(r, l);
+			if (++written >= filter->limit)
+				break;
+		}
+	}
+
+	hbd_cursor_done(&c);
+	return written;
+}
+
+/** Put lines in HistoryResult that are 'latest'
+ * @param r		The history result set that we will use
+ * @param h		The history object
+ * @param filter	The filter that applies
+ * @returns Number of lines written, note that this could be zero,
+ *          which is a perfectly valid result.
+ */
+static int hbd_return_latest(HistoryResult *r, HistoryDiskObject *h, HistoryFilter *filter)
+{
+	HistoryCursor c;
+	HistoryLogLine *l;
+	int written = 0;
+	MessageTag *m;
+
+	hbd_cursor_init(&c, h);
+	for (l = hbd_cursor_last(&c); l; l = hbd_cursor_prev(&c))
+	{
+		if (filter->timestamp_a && ((m = find_mtag(l->mtags, "time"))) && (strcmp(m->value, filter->timestamp_a) <= 0))
+			break; /* Stop now */
+		else
+		if (filter->msgid_a && ((m = find_mtag(l->mtags, "msgid"))) && !strcmp(m->value, filter->msgid_a))
+			break; /* Stop now */
+
+		history_result_prepend_line(r, l);
+		if (++written >= filter->limit)
+			break;
+	}
+
+	hbd_cursor_done(&c);
+	return written;
+}
+
+/** Put lines in HistoryResult based on a 'simple' request, that is: maximum lines or time
+ * @param r		The history result set that we will use
+ * @param h		The history object
+ * @param filter	The filter that applies
+ * @returns Number of lines written, note that this could be zero,
+ *          which is a perfectly valid result.
+ */
+static int hbd_return_simple(HistoryResult *r, HistoryDiskObject *h, HistoryFilter *filter)
+{
+	HistoryCursor c;
+	HistoryLogLine *l;
+	long redline;
+	int written = 0;
+
+	/* Decide on red line, under this the history is too old.
+	 * Filter can be more strict than history object (but not the other way around):
+	 */
+	if (filter && filter->last_seconds && (filter->last_seconds < h->max_time))
+		redline = TStime() - filter->last_seconds;
+	else
+		redline = TStime() - h->max_time;
+
+	/* Walk backwards, so we only touch disk if the hot tail is not enough */
+	hbd_cursor_init(&c, h);
+	c.redline = redline;
+	for (l = hbd_cursor_last(&c); l; l = hbd_cursor_prev(&c))
+	{
+		if (filter && (written >= filter->last_lines))
+			break;
+		history_result_prepend_line(r, l);
+		written++;
+	}
+
+	hbd_cursor_done(&c);
+	return written;
+}
+
+/** Put lines in HistoryResult that are 'around' a certain point.
+ * @param r		The history result set that we will use
+ * @param h		The history object
+ * @param filter	The filter that applies
+ * @returns Number of lines written, note that this could be zero,
+ *          which is a perfectly valid result.
+ */
+static int hbd_return_around(HistoryResult *r, HistoryDiskObject *h, HistoryFilter *filter)
+{
+	HistoryCursor c, started;
+	HistoryLogLine *l;
+	int have_started = 0;
+	int started_is_last = 0;
+	int written = 0;
+	MessageTag *m;
+
+	hbd_cursor_init(&c, h);
+	memset(&started, 0, sizeof(started));
+	if (filter->timestamp_a)
+		l = hbd_cursor_seek_backward(&c, server_time_to_unix_time(filter->timestamp_a));
+	else
+		l = hbd_cursor_last(&c);
+
+	for (; l; l = hbd_cursor_prev(&c))
+	{
+		/* Not started yet? Check if this is the starting point... */
+		if (!have_started)
+		{
+			if (filter->timestamp_a && ((m = find_mtag(l->mtags, "time"))) && (strcmp(m->value, filter->timestamp_a) < 0))
+			{
+				/* Start at the line after this one */
+				hbd_cursor_copy(&started, &c);
+				if (!hbd_cursor_next(&started))
+				{
+					/* No such line */
+					hbd_cursor_done(&started);
+					break;
+				}
+				have_started = 1;
+				started_is_last = 0;
+				{
+					HistoryCursor t;
+					hbd_cursor_copy(&t, &started);
+					started_is_last = hbd_cursor_next(&t) ? 0 : 1;
+					hbd_cursor_done(&t);
+				}
+			} else
+			if (filter->msgid_a && ((m = find_mtag(l->mtags, "msgid"))) && !strcmp(m->value, filter->msgid_a))
+			{
+				HistoryCursor t;
+				hbd_cursor_copy(&started, &c);
+				have_started = 1;
+				hbd_cursor_copy(&t, &started);
+				started_is_last = hbd_cursor_next(&t) ? 0 : 1;
+				hbd_cursor_done(&t);
+				continue;
+			}
+		}
+		if (have_started)
+		{
+			/* Check if we need to stop */
+			if (filter->timestamp_b && ((m = find_mtag(l->mtags, "time"))) && (strcmp(m->value, filter->timestamp_b) < 0))
+			{
+				break;
+			} else
+			if (filter->msgid_b && ((m = find_mtag(l->mtags, "msgid"))) && !strcmp(m->value, filter->msgid_b))
+			{
+				break;
+			}
+
+			/* Add line to the return buffer */
+			history_result_prepend_line(r, l);
+			if (!started_is_last)
+			{
+				/* Normal case */
+				if (++written >= filter->limit / 2)
+					break;
+			} else {
+				/* Special case: if started is the end of the buffer,
+				 * fill just /under/ the limit
+				 */
+				if (++written >= filter->limit - 1)
+					break;
+			}
+		}
+	}
+	hbd_cursor_done(&c);
+
+	/* Special case:
+	 * The timestamp= was not found (or it matched the very top),
+	 * now what to do?
+	 * - If it is only <some time> before/at our oldest message timestamp,
+	 *   then we will just print the oldest X messages.
+	 * - If it's older than <some time> we don't, resulting in an empty batch.
+	 */
+	if ((written == 0) && filter->timestamp_a && !have_started)
+	{
+		HistoryCursor t;
+		hbd_cursor_init(&t, h);
+		if ((l = hbd_cursor_first(&t)) && ((m = find_mtag(l->mtags, "time"))) && m->value)
+		{
+			time_t requested_ts = server_time_to_unix_time(filter->timestamp_a);
+			time_t oldest_we_have_ts = server_time_to_unix_time(m->value);
+			if (oldest_we_have_ts - requested_ts < 3600)
+			{
+				/* Just return the oldest # messages */
+				hbd_cursor_init(&started, h);
+				if (hbd_cursor_first(&started))
+					have_started = 1;
+			}
+		}
+		hbd_cursor_done(&t);
+	}
+
+	/* In the code at the beginning of this function we added the messages
+	 * before the mid-point. Below we add the message at the mid-point and
+	 * the messages after the mid-point.
+	 */
+	if (have_started)
+	{
+		for (l = hbd_cursor_line_raw(&started); l; l = hbd_cursor_next(&started))
+		{
+			/* Add line to the return buffer */
+			history_result_append_line(r, l);
+			if (++written >= filter->limit)
+				break;
+		}
+		hbd_cursor_done(&started);
+	}
+
+	return written;
+}
+
+/** Figure out the direction (forwards or backwards) for CHATHISTORY BETWEEN request
+ * @param h		The history object
+ * @param filter	The filter that applies
+ * @returns 0 for backward searching, 1 for forward searching, -1 for invalid / not found
+ */
+static int hbd_return_between_figure_out_direction(HistoryDiskObject *h, HistoryFilter *filter)
+{
+	HistoryCursor c;
+	HistoryLogLine *l;
+	int found_a = 0;
+	int found_b = 0;
+	int ret = -1;
+	MessageTag *m;
+
+	/* Two timestamps? Then we can easily tell the direction. */
+	if (filter->timestamp_a && filter->timestamp_b)
+		return (strcmp(filter->timestamp_a, filter->timestamp_b) <= 0) ? 1 : 0;
+
+	hbd_cursor_init(&c, h);
+	for (l = hbd_cursor_first(&c); l; l = hbd_cursor_next(&c))
+	{
+		if (!found_a)
+		{
+			if (filter->timestamp_a && ((m = find_mtag(l->mtags, "time"))) && (strcmp(m->value, filter->timestamp_a) >= 0))
+			{
+				found_a = 1;
+			} else
+			if (filter->msgid_a && ((m = find_mtag(l->mtags, "msgid"))) && !strcmp(m->value, filter->msgid_a))
+			{
+				found_a = 1;
+			}
+			if (found_a)
+			{
+				if (found_b)
+				{
+					/* B was found before A? Then the result is: backwards */
+					ret = 0;
+					break;
+				}
+				if (filter->timestamp_b && (m = find_mtag(l->mtags, "time")) && m->value)
+				{
+					/* We can already resolve the direction now: */
+					ret = (strcmp(m->value, filter->timestamp_b) <= 0) ? 1 : 0;
+					break;
+				}
+			}
+		}
+		if (!found_b)
+		{
+			if (filter->timestamp_b && ((m = find_mtag(l->mtags, "time"))) && (strcmp(m->value, filter->timestamp_b) >= 0))
+			{
+				found_b = 1;
+			} else
+			if (filter->msgid_b && ((m = find_mtag(l->mtags, "msgid"))) && !strcmp(m->value, filter->msgid_b))
+			{
+				found_b = 1;
+			}
+			if (found_b)
+			{
+				if (found_a)
+				{
+					/* A was found before B? Then the result is: forwards */
+					ret = 1;
+					break;
+				}
+				if (filter->timestamp_a && (m = find_mtag(l->mtags, "time")) && m->value)
+				{
+					/* We can already resolve the direction now: */
+					ret = (strcmp(filter->timestamp_a, m->value) <= 0) ? 1 : 0;
+					break;
+				}
+			}
+		}
+	}
+
+	hbd_cursor_done(&c);
+	return ret;
+}
+
+/** Put lines in HistoryResult that are 'between' two points.
+ * @param r		The history result set that we will use
+ * @param h		The history object
+ * @param filter	The filter that applies
+ * @returns Number of lines written, note that this could be zero,
+ *          which is a perfectly valid result.
+ */
+static int hbd_return_between(HistoryResult *r, HistoryDiskObject *h, HistoryFilter *filter)
+{
+	int direction;
+
+	direction = hbd_return_between_figure_out_direction(h, filter);
+
+	if (direction == 1)
+	{
+		return hbd_return_after(r, h, filter);
+	} else
+	if (direction == 0)
+	{
+		/* Create a temporary filter, swapping directions */
+		HistoryFilter f;
+		memset(&f, 0, sizeof(f));
+		f.cmd = HFC_BEFORE;
+		f.limit = filter->limit;
+		f.timestamp_a = filter->timestamp_b;
+		f.timestamp_b = filter->timestamp_a;
+		f.msgid_a = filter->msgid_b;
+		f.msgid_b = filter->msgid_a;
+		return hbd_return_after(r, h, &f);
+	}
+	/* else direction is -1 which means not found / invalid */
+
+	return 0;
+}
+
+HistoryResult *hbd_history_request(const char *object, HistoryFilter *filter)
+{
+	HistoryResult *r;
+	HistoryDiskObject *h = hbd_find_object(object);
+
+	if (!h)
+		return NULL; /* nothing found */
+
+	r = safe_alloc(sizeof(HistoryResult));
+	safe_strdup(r->object, object);
+
+	switch(filter->cmd)
+	{
+		case HFC_BEFORE:
+			hbd_return_before(r, h, filter);
+			break;
+		case HFC_AFTER:
+			hbd_return_after(r, h, filter);
+			break;
+		case HFC_LATEST:
+			hbd_return_latest(r, h, filter);
+			break;
+		case HFC_AROUND:
+			hbd_return_around(r, h, filter);
+			break;
+		case HFC_BETWEEN:
+			hbd_return_between(r, h, filter);
+			break;
+		case HFC_SIMPLE:
+			hbd_return_simple(r, h, filter);
+			break;
+		default:
+			// unhandled
+			break;
+	}
+
+	hbd_page_cache_trim();
+	return r;
+}
+
+/** Rewrite segment 'i' without the lines at positions 'del' (sorted) */
+static void hbd_rewrite_segment(HistoryDiskObject *h, int i, int *del, int num_del)
+{
+	HistorySegment *seg = &h->segments[i];
+	HistorySegment newseg;
+	HistoryPage *p;
+	HistoryLogLine **keep;
+	int num_keep = 0, j, k, start;
+
+	p = hbd_page_get(h, seg);
+	if (!p)
+		return;
+
+	keep = safe_alloc(sizeof(HistoryLogLine *) * (p->num_lines ? p->num_lines : 1));
+	start = (i == 0) ? h->skip_lines : 0;
+	for (j = start, k = 0; j < p->num_lines; j++)
+	{
+		if ((k < num_del) && (del[k] == j))
+		{
+			k++;
+			continue;
+		}
+		keep[num_keep++] = p->lines[j];
+	}
+
+	if (num_keep == 0)
+	{
+		hbd_page_release(p);
+		safe_free(keep);
+		hbd_remove_segment(h, i);
+		return;
+	}
+
+	/* The new segment keeps the sequence number (and thus the position
+	 * in the ordered segments array), the file is replaced by the rename.
+	 */
+	memset(&newseg, 0, sizeof(newseg));
+	newseg.seq = seg->seq;
+	if (hbd_write_segment(h, keep, num_keep, &newseg))
+	{
+		/* The old page is stale now */
+		hbd_page_release(p);
+		hbd_page_detach(seg);
+		h->num_disk_lines -= (seg->num_lines - start) - num_keep;
+		if (i == 0)
+			h->skip_lines = 0;
+		*seg = newseg;
+		h->dirty = 1;
+	} else {
+		hbd_page_release(p);
+	}
+	safe_free(keep);
+}
+
+/** Remove lines from the history
+ * @param h		The history object
+ * @param filter	The filter that applies
+ * @param rejected_deletes    If not NULL, this is set to the number of messages which
+ *                            don't match the 'account' but match other filters.
+ * @returns Number of lines deleted, note that this could be zero,
+ *          which is a perfectly valid result.
+ */
+int hbd_history_delete(const char *object, HistoryFilter *filter, int *rejected_deletes)
+{
+	HistoryCursor c;
+	HistoryLogLine *l;
+	HistoryDiskObject *h = hbd_find_object(object);
+	HistoryLogLine **del_hot = NULL;
+	int *del_disk_pos = NULL;
+	int *del_disk_seg = NULL;
+	int num_del_hot = 0, num_del_disk = 0;
+	int deleted = 0;
+	int started = 0;
+	int i, j;
+	MessageTag *m;
+
+	if (rejected_deletes)
+		*rejected_deletes = 0;
+
+	if (!h || (filter->limit <= 0))
+		return 0;
+
+	/* First collect the lines, since deleting changes the segments.
+	 * Lines on disk are remembered by position, as their page may be
+	 * evicted from the page cache while we walk.
+	 */
+	del_hot = safe_alloc(sizeof(HistoryLogLine *) * filter->limit);
+	del_disk_pos = safe_alloc(sizeof(int) * filter->limit);
+	del_disk_seg = safe_alloc(sizeof(int) * filter->limit);
+
+	hbd_cursor_init(&c, h);
+	for (l = hbd_cursor_first(&c); l; l = hbd_cursor_next(&c))
+	{
+		/* Not started yet? Check if this is the starting point... */
+		if (!started)
+		{
+			if (filter->timestamp_a && ((m = find_mtag(l->mtags, "time"))) && (strcmp(m->value, filter->timestamp_a) > 0))
+			{
+				started = 1;
+			} else
+			if (filter->msgid_a && ((m = find_mtag(l->mtags, "msgid"))) && !strcmp(m->value, filter->msgid_a))
+			{
+				started = 1;
+			}
+		}
+		if (started)
+		{
+			/* Check if we need to stop */
+			if (filter->timestamp_b && ((m = find_mtag(l->mtags, "time"))) && (strcmp(m->value, filter->timestamp_b) >= 0))
+			{
+				break;
+			} else
+			if (filter->msgid_b && ((m = find_mtag(l->mtags, "msgid"))) && !strcmp(m->value, filter->msgid_b))
+			{
+				break;
+			}
+
+			/* See comment in hbm_history_delete() on case-sensitivity */
+			if (filter->account) {
+				m = find_mtag(l->mtags, "account");
+				if (!m || strcmp(m->value, filter->account)) {
+					if (rejected_deletes)
+						(*rejected_deletes)++;
+					continue;
+				}
+			}
+
+			if (c.seg == h->num_segments)
+			{
+				del_hot[num_del_hot++] = l;
+			} else {
+				del_disk_seg[num_del_disk] = c.seg;
+				del_disk_pos[num_del_disk++] = c.pos;
+			}
+			if (++deleted >= filter->limit)
+				break;
+		}
+	}
+	hbd_cursor_done(&c);
+
+	for (i = 0; i < num_del_hot; i++)
+		hbd_hot_del_line(h, del_hot[i]);
+
+	/* Rewrite affected segments, newest first so indexes stay valid */
+	for (i = num_del_disk - 1; i >= 0; i = j)
+	{
+		for (j = i; (j >= 0) && (del_disk_seg[j] == del_disk_seg[i]); j--)
+			;
+		hbd_rewrite_segment(h, del_disk_seg[i], &del_disk_pos[j+1], i - j);
+	}
+	if (h->dirty)
+		hbd_write_index(h);
+
+	safe_free(del_hot);
+	safe_free(del_disk_pos);
+	safe_free(del_disk_seg);
+	return deleted;
+}
+
+/** Clean up expired entries */
+int hbd_history_cleanup(HistoryDiskObject *h)
+{
+	long redline = TStime() - h->max_time;
+
+	/* First enforce 'h->max_time', after that enforce 'h->max_lines' */
+
+	/* Whole segments that have expired go, partially expired
+	 * segments are filtered when reading (see HistoryCursor).
+	 */
+	while (h->num_segments && (h->segments[0].last_t < redline))
+		hbd_remove_segment(h, 0);
+	if (!h->num_segments)
+	{
+		while (h->head && (h->head->t < redline))
+			hbd_hot_del_line(h, h->head);
+	}
+
+	while (h->num_disk_lines + h->num_hot_lines > h->max_lines)
+		hbd_drop_oldest(h);
+
+	if (h->dirty)
+		hbd_write_index(h);
+
+	return 1;
+}
+
+int hbd_history_destroy(const char *object)
+{
+	HistoryDiskObject *h = hbd_find_object(object);
+	HistoryLogLine *l, *l_next;
+	int i;
+
+	if (!h)
+		return 0;
+
+	for (l = h->head; l; l = l_next)
+	{
+		l_next = l->next;
+		l->prev = l->next = NULL;
+		history_log_line_unref(l);
+	}
+
+	for (i = 0; i < h->num_segments; i++)
+	{
+		hbd_page_detach(&h->segments[i]);
+		unlink(hbd_segment_filename(h, h->segments[i].seq));
+	}
+	safe_free(h->segments);
+	unlink(hbd_index_filename(h));
+	unlink(hbd_tail_filename(h));
+
+	DelListItem(h, history_disk_hash_table[hbd_hash(h->name)]);
+	safe_free(h);
+	return 1;
+}
+
+/** Set new limit on history object */
+int hbd_history_set_limit(const char *object, int max_lines, long max_time)
+{
+	HistoryDiskObject *h = hbd_find_or_add_object(object);
+	h->max_lines = max_lines;
+	h->max_time = max_time;
+	hbd_history_cleanup(h); /* impose new restrictions */
+	return 1;
+}
+
+/** Channel mode 'H' was removed or the channel lost 'P' */
+int hbd_modechar_del(Channel *channel, int modechar)
+{
+	if (modechar == 'H')
+		hbd_history_destroy(channel->name);
+	return 0;
+}
+
+/*** Master db ***/
+
+/** Read the master.db file, this is done at the INIT stage so we can still
+ * reject the configuration / boot attempt.
+ *
+ * IMPORTANT: Because we run at INIT you must use test.xyz values and not cfg.xyz!
+ */
+static int hbd_read_masterdb(void)
+{
+	UnrealDB *db;
+	uint32_t mdb_version;
+	char *prehash = NULL;
+	char *posthash = NULL;
+
+	db = unrealdb_open(test.masterdb, UNREALDB_MODE_READ, test.db_secret);
+
+	if (!db)
+	{
+		if (unrealdb_get_error_code() == UNREALDB_ERROR_FILENOTFOUND)
+		{
+			/* Database does not exist. Could be first boot */
+			config_warn("[history] No database present at '%s', will start a new one", test.masterdb);
+			if (!hbd_write_masterdb())
+				return 0; /* fatal error */
+			return 1;
+		} else
+		{
+			config_warn("[history] Unable to open the database file '%s' for reading: %s", test.masterdb, unrealdb_get_error_string());
+			return 0;
+		}
+	}
+
+	if (!unrealdb_read_int32(db, &mdb_version) ||
+	    !unrealdb_read_str(db, &prehash) ||
+	    !unrealdb_read_str(db, &posthash))
+	{
+		config_error("[history] Read error from database file '%s': %s",
+			test.masterdb, unrealdb_get_error_string());
+		safe_free(prehash);
+		safe_free(posthash);
+		unrealdb_close(db);
+		return 0;
+	}
+	unrealdb_close(db);
+
+	if (!prehash || !posthash)
+	{
+		config_error("[history] Read error from database file '%s': unexpected values encountered",
+			test.masterdb);
+		safe_free(prehash);
+		safe_free(posthash);
+		return 0;
+	}
+
+	/* Now, safely switch over.. */
+	if (hbd_prehash && !strcmp(hbd_prehash, prehash) && hbd_posthash && !strcmp(hbd_posthash, posthash))
+	{
+		/* Identical sets */
+		safe_free(prehash);
+		safe_free(posthash);
+	} else {
+		/* Diffferent */
+		safe_free(hbd_prehash);
+		safe_free(hbd_posthash);
+		hbd_prehash = prehash;
+		hbd_posthash = posthash;
+	}
+
+	return 1;
+}
+
+/** Write the master.db file. Only call this if it does not exist yet! */
+static int hbd_write_masterdb(void)
+{
+	UnrealDB *db;
+
+	if (!test.db_secret)
+		abort();
+
+	db = unrealdb_open(test.masterdb, UNREALDB_MODE_WRITE, test.db_secret);
+	if (!db)
+	{
+		config_error("[history] Unable to write to '%s': %s",
+			test.masterdb, unrealdb_get_error_string());
+		return 0;
+	}
+
+	if (!hbd_prehash || !hbd_posthash)
+		abort(); /* impossible */
+
+	if (!unrealdb_write_int32(db, HISTORYDB_DISK_VERSION) ||
+	    !unrealdb_write_str(db, hbd_prehash) ||
+	    !unrealdb_write_str(db, hbd_posthash))
+	{
+		config_error("[history] Unable to write to '%s': %s",
+			test.masterdb, unrealdb_get_error_string());
+		unrealdb_close(db);
+		return 0;
+	}
+	unrealdb_close(db);
+	return 1;
+}
+
+/** On terminate, spill all hot tails to disk so nothing is lost */
+static void hbd_flush(void)
+{
+	int hashnum;
+	HistoryDiskObject *h;
+
+	for (hashnum = 0; hashnum < HISTORY_BACKEND_DISK_HASH_TABLE_SIZE; hashnum++)
+	{
+		for (h = history_disk_hash_table[hashnum]; h; h = h->next)
+		{
+			hbd_history_cleanup(h);
+			if (h->num_hot_lines)
+				hbd_spill(h, h->num_hot_lines);
+			if (h->tail_on_disk)
+				hbd_write_tail(h);
+			if (h->dirty)
+				hbd_write_index(h);
+		}
+	}
+}
+
+/** Free all history (in memory, not on disk).
+ * This is only called when the module is unloaded for good, so
+ * when UnrealIRCd is terminating or someone comments the module out
+ * and/or switches history backends.
+ */
+void hbd_free_all_history(ModData *m)
+{
+	int hashnum, i;
+	HistoryDiskObject *h, *h_next;
+	HistoryLogLine *l, *l_next;
+
+	for (hashnum = 0; hashnum < HISTORY_BACKEND_DISK_HASH_TABLE_SIZE; hashnum++)
+	{
+		for (h = history_disk_hash_table[hashnum]; h; h = h_next)
+		{
+			h_next = h->next;
+			for (l = h->head; l; l = l_next)
+			{
+				l_next = l->next;
+				l->prev = l->next = NULL;
+				history_log_line_unref(l);
+			}
+			for (i = 0; i < h->num_segments; i++)
+				hbd_page_detach(&h->segments[i]);
+			safe_free(h->segments);
+			safe_free(h);
+		}
+	}
+
+	/* And free the hash table pointer */
+	safe_free(m->ptr);
+}
+
+/** Periodically clean the history.
+ * Instead of doing all channels in 1 go, we do a limited number
+ * of channels each call, hence the 'static int' and the do { } while
+ * rather than a regular for loop.
+ */
+EVENT(history_disk_clean)
+{
+	static int hashnum = 0;
+	int loopcnt = 0;
+	HistoryDiskObject *h;
+
+	do
+	{
+		for (h = history_disk_hash_table[hashnum]; h; h = h->next)
+		{
+			hbd_history_cleanup(h);
+			if (h->tail_dirty)
+				hbd_write_tail(h);
+		}
+
+		hashnum++;
+
+		if (hashnum >= HISTORY_BACKEND_DISK_HASH_TABLE_SIZE)
+			hashnum = 0;
+	} while(loopcnt++ < HISTORY_CLEAN_PER_LOOP);
+
+	hbd_page_cache_trim();
+}
+
+void hbd_generic_free(ModData *m)
+{
+	safe_free(m->ptr);
+}
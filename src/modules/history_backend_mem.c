@@ -545,6 +545,7 @@ void hbm_history_add_line(HistoryLogObject *h, MessageTag *mtags, const char *li
 {
 	HistoryLogLine *l = safe_alloc(sizeof(HistoryLogLine) + strlen(line));
 	strcpy(l->line, line); /* safe, see memory allocation above ^ */
+	l->refcnt = 1; /* our reference */
 	hbm_duplicate_mtags(l, mtags);
 	if (h->tail)
 	{
@@ -580,8 +581,9 @@ void hbm_history_del_line(HistoryLogObject *h, HistoryLogLine *l)
 		h->tail = l->prev; /* could be NULL now */
 	}
 
-	free_message_tags(l->mtags);
-	safe_free(l);
+	/* The line may still be referenced by a HistoryResult */
+	l->prev = l->next = NULL;
+	history_log_line_unref(l);
 
 	h->dirty = 1;
 	h->num_lines--;
@@ -616,38 +618,6 @@ int hbm_history_add(const char *object, MessageTag *mtags, const char *line)
 	return 0;
 }
 
-HistoryLogLine *duplicate_log_line(HistoryLogLine *l)
-{
-	HistoryLogLine *n = safe_alloc(sizeof(HistoryLogLine) + strlen(l->line));
-	strcpy(n->line, l->line); /* safe, see memory allocation above ^ */
-	hbm_duplicate_mtags(n, l->mtags);
-	return n;
-}
-
-/** Quickly append a new line 'n' to result 'r' */
-static void hbm_result_append_line(HistoryResult *r, HistoryLogLine *n)
-{
-	if (!r->log)
-	{
-		/* First item */
-		r->log = r->log_tail = n;
-	} else
-	{
-		/* Quick append to tail */
-		r->log_tail->next = n;
-		n->prev = r->log_tail;
-		r->log_tail = n; /* we are the new tail */
-	}
-}
-
-/** Quickly prepend a new line 'n' to result 'r' */
-static void hbm_result_prepend_line(HistoryResult *r, HistoryLogLine *n)
-{
-	if (!r->log)
-		r->log_tail = n;
-	AddListItem(n, r->log);
-}
-
 /** Put lines in HistoryResult that are after a certain msgid or
  *  timestamp (excluding said msgid/timestamp).
  *  Also stops at the other given msgid/timestamp (if any); so this can also be
@@ -660,7 +630,7 @@ static void hbm_result_prepend_line(HistoryResult *r, HistoryLogLine *n)
  */
 static int hbm_return_after(HistoryResult *r, HistoryLogObject *h, HistoryFilter *filter)
 {
-	HistoryLogLine *l, *n;
+	HistoryLogLine *l;
 	int written = 0;
 	int started = 0;
 	MessageTag *m;
@@ -693,8 +663,7 @@ static int hbm_return_after(HistoryResult *r, HistoryLogObject *h, HistoryFilter
 			}
 
 			/* Add line to the return buffer */
-			n = duplicate_log_line(l);
-			hbm_result_append_line(r, n);
+			history_result_append_line(r, l);
 			if (++written >= filter->limit)
 				break;
 		}
@@ -713,7 +682,7 @@ static int hbm_return_after(HistoryResult *r, HistoryLogObject *h, HistoryFilter
  */
 static int hbm_return_before(HistoryResult *r, HistoryLogObject *h, HistoryFilter *filter)
 {
-	HistoryLogLine *l, *n;
+	HistoryLogLine *l;
 	int written = 0;
 	int started = 0;
 	MessageTag *m;
@@ -746,8 +715,7 @@ static int hbm_return_before(HistoryResult *r, HistoryLogObject *h, HistoryFilte
 			}
 
 			/* Add line to the return buffer */
-			n = duplicate_log_line(l);
-			hbm_result_prepend_line(r, n);
+			history_result_prepend_line(r, l);
 			if (++written >= filter->limit)
 				break;
 		}
@@ -765,7 +733,7 @@ static int hbm_return_before(HistoryResult *r, HistoryLogObject *h, HistoryFilte
  */
 static int hbm_return_latest(HistoryResult *r, HistoryLogObject *h, HistoryFilter *filter)
 {
-	HistoryLogLine *l, *n;
+	HistoryLogLine *l;
 	int written = 0;
 	MessageTag *m;
 
@@ -777,8 +745,7 @@ static int hbm_return_latest(HistoryResult *r, HistoryLogObject *h, HistoryFilte
 		if (filter->msgid_a && ((m = find_mtag(l->mtags, "msgid"))) && !strcmp(m->value, filter->msgid_a))
 			break; /* Stop now */
 
-		n = duplicate_log_line(l);
-		hbm_result_prepend_line(r, n);
+		history_result_prepend_line(r, l);
 		if (++written >= filter->limit)
 			break;
 	}
@@ -827,8 +794,7 @@ static int hbm_return_simple(HistoryResult *r, HistoryLogObject *h, HistoryFilte
 		if (l->t >= redline && (++cnt > lines_to_skip))
 		{
 			/* Add to result */
-			HistoryLogLine *n = duplicate_log_line(l);
-			hbm_result_append_line(r, n);
+			history_result_append_line(r, l);
 			written++;
 		}
 	}
@@ -845,7 +811,7 @@ static int hbm_return_simple(HistoryResult *r, HistoryLogObject *h, HistoryFilte
  */
 static int hbm_return_around(HistoryResult *r, HistoryLogObject *h, HistoryFilter *filter)
 {
-	HistoryLogLine *l, *n, *started = NULL;
+	HistoryLogLine *l, *started = NULL;
 	int written = 0;
 	MessageTag *m;
 
@@ -877,8 +843,7 @@ static int hbm_return_around(HistoryResult *r, HistoryLogObject *h, HistoryFilte
 			}
 
 			/* Add line to the return buffer */
-			n = duplicate_log_line(l);
-			hbm_result_prepend_line(r, n);
+			history_result_prepend_line(r, l);
 			if (started->next)
 			{
 				/* Normal case */
@@ -928,8 +893,7 @@ static int hbm_return_around(HistoryResult *r, HistoryLogObject *h, HistoryFilte
 	for (l = started; l; l = l->next)
 	{
 		/* Add line to the return buffer */
-		n = duplicate_log_line(l);
-		hbm_result_append_line(r, n);
+		history_result_append_line(r, l);
 		if (++written >= filter->limit)
 			break;
 	}
@@ -1108,7 +1072,7 @@ HistoryResult *hbm_history_request(const char *object, HistoryFilter *filter)
  */
 int hbm_history_delete(const char *object, HistoryFilter *filter, int *rejected_deletes)
 {
-	HistoryLogLine *l;
+	HistoryLogLine *l, *l_next;
 	HistoryLogObject *h = hbm_find_object(object);
 	int deleted = 0;
 	int started = 0;
@@ -1120,8 +1084,9 @@ int hbm_history_delete(const char *object, HistoryFilter *filter, int *rejected_
 	if (!h)
 		return 0;
 
-	for (l = h->head; l; l = l->next)
+	for (l = h->head; l; l = l_next)
 	{
+		l_next = l->next;
 		/* Not started yet? Check if this is the starting point... */
 		if (!started)
 		{
@@ -1236,8 +1201,8 @@ int hbm_history_destroy(const char *object)
 		 * The only danger is that we may forget to free some
 		 * fields that are added later there but not here.
 		 */
-		free_message_tags(l->mtags);
-		safe_free(l);
+		l->prev = l->next = NULL;
+		history_log_line_unref(l);
 	}
 
 	hbm_delete_object_hlo(h);
@@ -10,7 +10,7 @@
 ModuleHeader MOD_HEADER
   = {
 	"issued-by-tag",
-	"6.0",
+	"6.0.1",
 	"unrealircd.org/issued-by message tag",
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -138,7 +138,7 @@ void _mtag_add_issued_by(MessageTag **mtags, Client *client, MessageTag *recv_mt
 	} else
 	if (IsOper(client))
 	{
-		const char *operlogin = moddata_client_get(client, "operlogin");
+		const char *operlogin = get_operlogin(client);
 		if (operlogin)
 			snprintf(buf, sizeof(buf), "OPER:%s@%s:%s", client->name, client->uplink->name, operlogin);
 		else
@@ -27,6 +27,7 @@ CMD_FUNC(cmd_private);
 CMD_FUNC(cmd_notice);
 CMD_FUNC(cmd_tagmsg);
 void cmd_message(Client *client, MessageTag *recv_mtags, int parc, const char *parv[], SendType sendtype);
+static void cmd_message_targets(Client *client, MessageTag *recv_mtags, int parc, const char *parv[], SendType sendtype);
 int _can_send_to_channel(Client *client, Channel *channel, const char **msgtext, const char **errmsg, SendType sendtype);
 int can_send_to_user(Client *client, Client *target, const char **msgtext, const char **errmsg, SendType sendtype);
 
@@ -200,6 +201,25 @@ int has_client_mtags(MessageTag *mtags)
 /* General message handler to users and channels. Used by PRIVMSG, NOTICE, etc.
  */
 void cmd_message(Client *client, MessageTag *recv_mtags, int parc, const char *parv[], SendType sendtype)
+{
+	TextContext *ctx;
+
+	if (!MyUser(client) || (parc < 3) || BadPtr(parv[2]))
+	{
+		cmd_message_targets(client, recv_mtags, parc, parv, sendtype);
+		return;
+	}
+
+	/* The text context is shared by all modules that inspect the
+	 * message, for all targets, see text_context_begin().
+	 */
+	ctx = text_context_begin(parv[2]);
+	cmd_message_targets(client, recv_mtags, parc, parv, sendtype);
+	text_context_end(ctx);
+}
+
+/** Deliver the message to all targets, called from cmd_message() */
+static void cmd_message_targets(Client *client, MessageTag *recv_mtags, int parc, const char *parv[], SendType sendtype)
 {
 	Client *target;
 	Channel *channel;
@@ -537,6 +557,19 @@ const char *_StripColors(const char *text)
 
 	while (len > 0) 
 	{
+		if (!col && !rgb)
+		{
+			/* Copy everything up to the next (possible) color code in one go */
+			size_t n = text_plain_span(text, len);
+			if (n > 0)
+			{
+				memcpy(new_str + i, text, n);
+				i += n;
+				text += n;
+				len -= n;
+				continue;
+			}
+		}
 		if ((col && isdigit(*text) && nc < 2) ||
 		    ((col == 1) && (*text == ',') && isdigit(text[1]) && (nc > 0) && (nc < 3)))
 		{
@@ -0,0 +1,382 @@
+/*
+ * Prometheus / OpenMetrics exporter on /metrics
+ * (C) Copyright 2026 The UnrealIRCd team
+ * License: GPLv2 or later
+ *
+ * All values come from counters that are kept up to date by the
+ * core as things happen (irccounts, ircstats, dbufstats, dnsstats,
+ * command counts, main loop histograms). Nothing here walks the
+ * client or channel lists, so a scrape costs the same on a server
+ * with 10 users as on one with 100,000 users.
+ */
+
+#include "unrealircd.h"
+#include "dns.h"
+
+ModuleHeader MOD_HEADER
+  = {
+	"metrics",
+	"1.0.0",
+	"Prometheus metrics on /metrics of the built-in webserver",
+	"UnrealIRCd Team",
+	"unrealircd-6",
+    };
+
+/* The text exposition format, understood by all Prometheus versions */
+#define METRICS_CONTENT_TYPE "text/plain; version=0.0.4; charset=utf-8"
+
+/* Configuration */
+struct {
+	SecurityGroup *match;
+} cfg;
+
+/* Macros */
+#define WEB(client)	((WebRequest *)moddata_client(client, webserver_md).ptr)
+
+/* Forward declarations */
+int metrics_config_test_listen(ConfigFile *cf, ConfigEntry *ce, int type, int *errs);
+int metrics_config_run_ex_listen(ConfigFile *cf, ConfigEntry *ce, int type, void *ptr);
+int metrics_config_test_set(ConfigFile *cf, ConfigEntry *ce, int type, int *errs);
+int metrics_config_run_set(ConfigFile *cf, ConfigEntry *ce, int type);
+int metrics_config_posttest(int *errs);
+int metrics_config_listener(ConfigItem_listen *listener);
+int metrics_local_spamfilter(Client *client, const char *str, const char *str_in, int type, const char *target, TKL *tkl);
+void metrics_client_handshake(Client *client);
+int metrics_handle_request(Client *client, WebRequest *web);
+int metrics_handle_body(Client *client, WebRequest *web, const char *buf, int length);
+
+/* Global variables */
+ModDataInfo *webserver_md = NULL; /* (imported) */
+static char metrics_listener_configured = 0;
+long long spamfilter_hits = 0;
+
+MOD_TEST()
+{
+	MARK_AS_OFFICIAL_MODULE(modinfo);
+	HookAdd(modinfo->handle, HOOKTYPE_CONFIGTEST, 0, metrics_config_test_listen);
+	HookAdd(modinfo->handle, HOOKTYPE_CONFIGTEST, 0, metrics_config_test_set);
+	HookAdd(modinfo->handle, HOOKTYPE_CONFIGPOSTTEST, 0, metrics_config_posttest);
+	return MOD_SUCCESS;
+}
+
+MOD_INIT()
+{
+	MARK_AS_OFFICIAL_MODULE(modinfo);
+
+	LoadPersistentLongLong(modinfo, spamfilter_hits);
+
+	memset(&cfg, 0, sizeof(cfg));
+
+	HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN_EX, 0, metrics_config_run_ex_listen);
+	HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN, 0, metrics_config_run_set);
+	HookAdd(modinfo->handle, HOOKTYPE_CONFIG_LISTENER, 0, metrics_config_listener);
+	HookAdd(modinfo->handle, HOOKTYPE_LOCAL_SPAMFILTER, 0, metrics_local_spamfilter);
+	return MOD_SUCCESS;
+}
+
+MOD_LOAD()
+{
+	webserver_md = findmoddata_byname("web", MODDATATYPE_CLIENT); /* can be NULL */
+	return MOD_SUCCESS;
+}
+
+MOD_UNLOAD()
+{
+	free_security_group(cfg.match);
+	SavePersistentLongLong(modinfo, spamfilter_hits);
+	return MOD_SUCCESS;
+}
+
+int metrics_config_test_listen(ConfigFile *cf, ConfigEntry *ce, int type, int *errs)
+{
+	if (type != CONFIG_LISTEN_OPTIONS)
+		return 0;
+
+	/* We are only interested in listen::options::metrics.. */
+	if (!ce || !ce->name || strcmp(ce->name, "metrics"))
+		return 0;
+
+	metrics_listener_configured = 1;
+	return 1;
+}
+
+int metrics_config_run_ex_listen(ConfigFile *cf, ConfigEntry *ce, int type, void *ptr)
+{
+	ConfigItem_listen *l;
+
+	if (type != CONFIG_LISTEN_OPTIONS)
+		return 0;
+
+	/* We are only interested in listen::options::metrics.. */
+	if (!ce || !ce->name || strcmp(ce->name, "metrics"))
+		return 0;
+
+	l = (ConfigItem_listen *)ptr;
+	/* A scraper connects every few seconds, that is not a flood */
+	l->options |= LISTENER_NO_CHECK_CONNECT_FLOOD;
+	l->metrics_options = 1;
+	return 1;
+}
+
+int metrics_config_test_set(ConfigFile *cf, ConfigEntry *ce, int type, int *errs)
+{
+	int errors = 0;
+	ConfigEntry *cep;
+
+	if (type != CONFIG_SET)
+		return 0;
+
+	/* We are only interested in set::metrics.. */
+	if (!ce || !ce->name || strcmp(ce->name, "metrics"))
+		return 0;
+
+	for (cep = ce->items; cep; cep = cep->next)
+	{
+		if (!strcmp(cep->name, "match"))
+		{
+			test_match_block(cf, cep, &errors);
+		} else
+		{
+			config_error_unknown(cep->file->filename, cep->line_number, "set::metrics", cep->name);
+			errors++;
+		}
+	}
+
+	*errs = errors;
+	return errors ? -1 : 1;
+}
+
+int metrics_config_run_set(ConfigFile *cf, ConfigEntry *ce, int type)
+{
+	ConfigEntry *cep;
+
+	if (type != CONFIG_SET)
+		return 0;
+
+	/* We are only interested in set::metrics.. */
+	if (!ce || !ce->name || strcmp(ce->name, "metrics"))
+		return 0;
+
+	for (cep = ce->items; cep; cep = cep->next)
+	{
+		if (!strcmp(cep->name, "match"))
+		{
+			free_security_group(cfg.match);
+			cfg.match = NULL;
+			conf_match_block(cf, cep, &cfg.match);
+		}
+	}
+	return 1;
+}
+
+int metrics_config_posttest(int *errs)
+{
+	int errors = 0;
+
+	if (metrics_listener_configured && !is_module_loaded("webserver"))
+	{
+		config_error("You have a listen block with options { metrics; } but the 'webserver' module is not loaded. "
+		             "Add: loadmodule \"webserver\";");
+		errors++;
+	}
+	metrics_listener_configured = 0;
+
+	*errs = errors;
+	return errors ? -1 : 1;
+}
+
+int metrics_config_listener(ConfigItem_listen *listener)
+{
+	if (listener->metrics_options)
+	{
+		listener->start_handshake = metrics_client_handshake;
+		if (!listener->webserver)
+			listener->webserver = safe_alloc(sizeof(WebServer));
+		listener->webserver->handle_request = metrics_handle_request;
+		listener->webserver->handle_body = metrics_handle_body;
+	}
+	return 0;
+}
+
+int metrics_local_spamfilter(Client *client, const char *str, const char *str_in, int type, const char *target, TKL *tkl)
+{
+	spamfilter_hits++;
+	return 0;
+}
+
+/** New connection on a metrics port.
+ * Without a set::metrics::match only connections from localhost are accepted.
+ */
+void metrics_client_handshake(Client *client)
+{
+	if (cfg.match ? !user_allowed_by_security_group(client, cfg.match) : !IsLocalhost(client))
+	{
+		webserver_send_response(client, 403, "Access denied");
+		return;
+	}
+
+	/* Allow incoming data to be read from now on.. */
+	fd_setselect(client->local->fd, FD_SELECT_READ, read_packet, client);
+}
+
+/** Add a line to the response body */
+static void metrics_send(Client *client, FORMAT_STRING(const char *pattern), ...) __attribute__((format(printf,2,3)));
+static void metrics_send(Client *client, const char *pattern, ...)
+{
+	char buf[512];
+	va_list vl;
+	int len;
+
+	va_start(vl, pattern);
+	len = vsnprintf(buf, sizeof(buf), pattern, vl);
+	va_end(vl);
+	if (len >= sizeof(buf))
+		len = sizeof(buf) - 1;
+
+	if (WEB(client)->response_deferred)
+		dbuf_put(&WEB(client)->response, buf, len);
+	else
+		dbuf_put(&client->local->sendQ, buf, len);
+}
+
+static void metrics_header(Client *client, const char *name, const char *type, const char *help)
+{
+	metrics_send(client, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void metrics_loop_latency(Client *client)
+{
+	static const double quantiles[] = { 50.0, 90.0, 99.0, 99.9 };
+	LoopHistogram *h;
+	int i, q;
+
+	metrics_header(client, "unrealircd_loop_latency_seconds", "summary",
+	               "Time spent in each phase of the main loop");
+	for (i = 0; i < LOOP_PHASES; i++)
+	{
+		h = &loop_histogram[i];
+		for (q = 0; q < ARRAY_SIZEOF(quantiles); q++)
+		{
+			metrics_send(client, "unrealircd_loop_latency_seconds{phase=\"%s\",quantile=\"%g\"} %.6f\n",
+			             loop_phase_name(i), quantiles[q] / 100.0,
+			             loop_histogram_percentile(h, quantiles[q]) / 1000000.0);
+		}
+		metrics_send(client, "unrealircd_loop_latency_seconds_sum{phase=\"%s\"} %.6f\n",
+		             loop_phase_name(i), h->total / 1000000.0);
+		metrics_send(client, "unrealircd_loop_latency_seconds_count{phase=\"%s\"} %lld\n",
+		             loop_phase_name(i), h->count);
+	}
+	metrics_header(client, "unrealircd_loop_slow_iterations_total", "counter",
+	               "Main loop iterations that took longer than set::slow-loop-threshold");
+	metrics_send(client, "unrealircd_loop_slow_iterations_total %lld\n", loop_slow_iterations_total);
+}
+
+static void metrics_commands(Client *client)
+{
+	RealCommand *c;
+	int i;
+
+	metrics_header(client, "unrealircd_commands_total", "counter", "Number of times each command was used");
+	for (i = 0; i < 256; i++)
+	{
+		for (c = CommandHash[i]; c; c = c->next)
+		{
+			if (c->count)
+				metrics_send(client, "unrealircd_commands_total{command=\"%s\"} %u\n", c->cmd, c->count);
+		}
+	}
+}
+
+/** Write all metrics */
+static void metrics_write_all(Client *client)
+{
+	metrics_header(client, "unrealircd_info", "gauge", "Server name and version");
+	metrics_send(client, "unrealircd_info{server=\"%s\",version=\"%s\"} 1\n", me.name, version);
+	metrics_header(client, "unrealircd_start_time_seconds", "gauge", "Time the server was started");
+	metrics_send(client, "unrealircd_start_time_seconds %lld\n", (long long)me.server->boottime);
+
+	/* Clients, by type */
+	metrics_header(client, "unrealircd_users", "gauge", "Number of users");
+	metrics_send(client, "unrealircd_users{scope=\"global\"} %d\n", irccounts.clients);
+	metrics_send(client, "unrealircd_users{scope=\"local\"} %d\n", irccounts.me_clients);
+	metrics_header(client, "unrealircd_users_max", "gauge", "Highest number of users seen");
+	metrics_send(client, "unrealircd_users_max{scope=\"global\"} %d\n", irccounts.global_max);
+	metrics_send(client, "unrealircd_users_max{scope=\"local\"} %d\n", irccounts.me_max);
+	metrics_header(client, "unrealircd_users_invisible", "gauge", "Number of users with user mode +i");
+	metrics_send(client, "unrealircd_users_invisible %d\n", irccounts.invisible);
+	metrics_header(client, "unrealircd_operators", "gauge", "Number of IRC operators");
+	metrics_send(client, "unrealircd_operators %d\n", irccounts.operators);
+	metrics_header(client, "unrealircd_servers", "gauge", "Number of servers");
+	metrics_send(client, "unrealircd_servers{scope=\"global\"} %d\n", irccounts.servers);
+	metrics_send(client, "unrealircd_servers{scope=\"local\"} %d\n", irccounts.me_servers);
+	metrics_header(client, "unrealircd_unknown_connections", "gauge", "Local connections that are not registered (yet)");
+	metrics_send(client, "unrealircd_unknown_connections %d\n", irccounts.unknown);
+	metrics_header(client, "unrealircd_channels", "gauge", "Number of channels");
+	metrics_send(client, "unrealircd_channels %d\n", irccounts.channels);
+
+	/* Connections */
+	metrics_header(client, "unrealircd_connections_total", "counter", "Incoming connections");
+	metrics_send(client, "unrealircd_connections_total{result=\"accepted\"} %u\n", ircstats.is_ac);
+	metrics_send(client, "unrealircd_connections_total{result=\"refused\"} %u\n", ircstats.is_ref);
+	metrics_header(client, "unrealircd_tls_handshakes_total", "counter", "TLS handshakes, incoming and outgoing");
+	metrics_send(client, "unrealircd_tls_handshakes_total{result=\"success\"} %u\n", ircstats.is_tls);
+	metrics_send(client, "unrealircd_tls_handshakes_total{result=\"failure\"} %u\n", ircstats.is_tlsbad);
+
+	/* Traffic and buffers */
+	metrics_header(client, "unrealircd_messages_total", "counter", "IRC messages (lines)");
+	metrics_send(client, "unrealircd_messages_total{direction=\"received\"} %lld\n", me.local->traffic.messages_received);
+	metrics_send(client, "unrealircd_messages_total{direction=\"sent\"} %lld\n", me.local->traffic.messages_sent);
+	metrics_header(client, "unrealircd_traffic_bytes_total", "counter", "Bytes of IRC traffic");
+	metrics_send(client, "unrealircd_traffic_bytes_total{direction=\"received\"} %lld\n", me.local->traffic.bytes_received);
+	metrics_send(client, "unrealircd_traffic_bytes_total{direction=\"sent\"} %lld\n", me.local->traffic.bytes_sent);
+	metrics_header(client, "unrealircd_queue_bytes", "gauge", "Bytes waiting in the send and receive queues of local clients");
+	metrics_send(client, "unrealircd_queue_bytes{queue=\"sendq\"} %lld\n", dbufstats.sendq_bytes);
+	metrics_send(client, "unrealircd_queue_bytes{queue=\"recvq\"} %lld\n", dbufstats.recvq_bytes);
+	metrics_header(client, "unrealircd_dbuf_blocks", "gauge", "Buffer blocks in use");
+	metrics_send(client, "unrealircd_dbuf_blocks %lld\n", dbufstats.blocks);
+	metrics_header(client, "unrealircd_dbuf_bytes", "gauge", "Memory used by buffer blocks");
+	metrics_send(client, "unrealircd_dbuf_bytes %lld\n", dbufstats.blocks * (long long)sizeof(dbufbuf));
+
+	/* DNS */
+	metrics_header(client, "unrealircd_dns_cache_lookups_total", "counter", "DNS cache lookups");
+	metrics_send(client, "unrealircd_dns_cache_lookups_total{result=\"hit\"} %u\n", dnsstats.cache_hits);
+	metrics_send(client, "unrealircd_dns_cache_lookups_total{result=\"miss\"} %u\n", dnsstats.cache_misses);
+	metrics_header(client, "unrealircd_dns_cache_adds_total", "counter", "Records added to the DNS cache");
+	metrics_send(client, "unrealircd_dns_cache_adds_total %u\n", dnsstats.cache_adds);
+
+	/* Spamfilter */
+	metrics_header(client, "unrealircd_spamfilter_hits_total", "counter", "Spamfilter matches by local users");
+	metrics_send(client, "unrealircd_spamfilter_hits_total %lld\n", spamfilter_hits);
+
+	metrics_commands(client);
+	metrics_loop_latency(client);
+}
+
+/** Incoming HTTP request */
+int metrics_handle_request(Client *client, WebRequest *web)
+{
+	if (strcmp(web->uri, "/metrics") && strncmp(web->uri, "/metrics?", 9))
+	{
+		webserver_send_response(client, 404, "Page not found.\n");
+		return 0;
+	}
+
+	if ((web->method != HTTP_METHOD_GET) && (web->method != HTTP_METHOD_HEAD))
+	{
+		webserver_send_response(client, 405, "Use a GET request to fetch the metrics.\n");
+		return 0;
+	}
+
+	web->response_content_type = METRICS_CONTENT_TYPE;
+	webserver_send_response(client, 200, NULL);
+	if (web->method == HTTP_METHOD_GET)
+		metrics_write_all(client);
+	webserver_close_client(client);
+	return 0;
+}
+
+/** A body after a GET request? Ignore it. */
+int metrics_handle_body(Client *client, WebRequest *web, const char *buf, int length)
+{
+	return 0;
+}
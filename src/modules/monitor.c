@@ -33,12 +33,35 @@ int monitor_nickchange(Client *client, MessageTag *mtags, const char *newnick);
 int monitor_post_nickchange(Client *client, MessageTag *mtags, const char *oldnick);
 int monitor_quit(Client *client, MessageTag *mtags, const char *comment);
 int monitor_connect(Client *client);
-int monitor_notification(Client *client, Watch *watch, Link *lp, int event);
+int monitor_notification(Client *client, Watch *watch, WatchSubscriber *sub, int event, void *data);
+
+/** State of a single notification event (user went online or offline).
+ * The text is only built once, and not again for every client
+ * that is watching the nick.
+ */
+typedef struct MonitorNotification MonitorNotification;
+struct MonitorNotification {
+	int numeric;				/**< RPL_MONONLINE or RPL_MONOFFLINE, or 0 if not built yet */
+	char text[NICKLEN+USERLEN+HOSTLEN+3];	/**< nick!user@host (online) or nick (offline) */
+};
+
+/** Collects targets for a numeric that permits a comma separated list
+ * (RPL_MONONLINE, RPL_MONOFFLINE, RPL_MONLIST, ERR_MONLISTFULL),
+ * so we can send one line for many nicks.
+ */
+typedef struct MonitorReply MonitorReply;
+struct MonitorReply {
+	Client *client;
+	MessageTag *mtags;
+	int numeric;
+	int len;
+	char buf[BUFSIZE];
+};
 
 ModuleHeader MOD_HEADER
   = {
 	"monitor",
-	"5.0",
+	"5.1",
 	"command /monitor", 
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -78,12 +101,20 @@ char *monitor_isupport_param(void)
 	return STR(MAXWATCH);
 }
 
+static void monitor_check(Client *client, int event)
+{
+	MonitorNotification n;
+
+	memset(&n, 0, sizeof(n));
+	watch_check(client, event, &n, monitor_notification);
+}
+
 int monitor_nickchange(Client *client, MessageTag *mtags, const char *newnick)
 {
 	if (!smycmp(client->name, newnick)) // new nick is same as old one, maybe the case changed
 		return 0;
 
-	watch_check(client, WATCH_EVENT_OFFLINE, monitor_notification);
+	monitor_check(client, WATCH_EVENT_OFFLINE);
 	return 0;
 }
 
@@ -92,54 +123,102 @@ int monitor_post_nickchange(Client *client, MessageTag *mtags, const char *oldni
 	if (!smycmp(client->name, oldnick)) // new nick is same as old one, maybe the case changed
 		return 0;
 
-	watch_check(client, WATCH_EVENT_ONLINE, monitor_notification);
+	monitor_check(client, WATCH_EVENT_ONLINE);
 	return 0;
 }
 
 int monitor_quit(Client *client, MessageTag *mtags, const char *comment)
 {
-	watch_check(client, WATCH_EVENT_OFFLINE, monitor_notification);
+	monitor_check(client, WATCH_EVENT_OFFLINE);
 	return 0;
 }
 
 int monitor_connect(Client *client)
 {
-	watch_check(client, WATCH_EVENT_ONLINE, monitor_notification);
+	monitor_check(client, WATCH_EVENT_ONLINE);
 	return 0;
 }
 
-int monitor_notification(Client *client, Watch *watch, Link *lp, int event)
+int monitor_notification(Client *client, Watch *watch, WatchSubscriber *sub, int event, void *data)
 {
-	if (!(lp->flags & WATCH_FLAG_TYPE_MONITOR))
+	MonitorNotification *n = data;
+
+	if (!(sub->flags & WATCH_FLAG_TYPE_MONITOR))
 		return 0;
 
-	switch (event)
+	if (!n->numeric)
 	{
-		case WATCH_EVENT_ONLINE:
-			sendnumeric(lp->value.client, RPL_MONONLINE, client->name, client->user->username, GetHost(client));
-			break;
-		case WATCH_EVENT_OFFLINE:
-			sendnumeric(lp->value.client, RPL_MONOFFLINE, client->name);
-			break;
-		default:
-			break; /* may be handled by other modules */
+		switch (event)
+		{
+			case WATCH_EVENT_ONLINE:
+				n->numeric = RPL_MONONLINE;
+				snprintf(n->text, sizeof(n->text), "%s!%s@%s", client->name, client->user->username, GetHost(client));
+				break;
+			case WATCH_EVENT_OFFLINE:
+				n->numeric = RPL_MONOFFLINE;
+				strlcpy(n->text, client->name, sizeof(n->text));
+				break;
+			default:
+				return 0; /* may be handled by other modules */
+		}
 	}
-	
+
+	sendnumericfmt(sub->client, n->numeric, ":%s", n->text);
+
 	return 0;
 }
 
-void send_status(Client *client, MessageTag *recv_mtags, const char *nick)
+static void monitor_reply_init(MonitorReply *r, Client *client, MessageTag *mtags, int numeric)
 {
-	MessageTag *mtags = NULL;
+	r->client = client;
+	r->mtags = mtags;
+	r->numeric = numeric;
+	r->len = 0;
+	*r->buf = '\0';
+}
+
+static void monitor_reply_flush(MonitorReply *r)
+{
+	if (!r->len)
+		return;
+
+	if (r->numeric == ERR_MONLISTFULL)
+		sendtaggednumeric(r->client, r->mtags, ERR_MONLISTFULL, MAXWATCH, r->buf);
+	else
+		sendtaggednumericfmt(r->client, r->mtags, r->numeric, ":%s", r->buf);
+	r->len = 0;
+	*r->buf = '\0';
+}
+
+static void monitor_reply_add(MonitorReply *r, const char *target)
+{
+	/* Room for ":server 730 nick :" (or ERR_MONLISTFULL's trailer) and the CRLF */
+	int max = 510 - strlen(me.name) - strlen(r->client->name) - 40;
+	int len = strlen(target);
+
+	if (r->len && (r->len + 1 + len > max))
+		monitor_reply_flush(r);
+
+	if (r->len)
+		r->buf[r->len++] = ',';
+	strlcpy(r->buf + r->len, target, sizeof(r->buf) - r->len);
+	r->len += len;
+}
+
+/** Add the status of 'nick' to either the online or offline reply */
+static void monitor_status_add(MonitorReply *online, MonitorReply *offline, const char *nick)
+{
+	char buf[NICKLEN+USERLEN+HOSTLEN+3];
 	Client *user;
+
 	user = find_user(nick, NULL);
-	new_message(client, recv_mtags, &mtags);
-	if (!user){
-		sendnumeric(client, RPL_MONOFFLINE, nick);
+	if (!user)
+	{
+		monitor_reply_add(offline, nick);
 	} else {
-		sendnumeric(client, RPL_MONONLINE, user->name, user->user->username, GetHost(user));
+		snprintf(buf, sizeof(buf), "%s!%s@%s", user->name, user->user->username, GetHost(user));
+		monitor_reply_add(online, buf);
 	}
-	free_message_tags(mtags);
 }
 
 #define WATCHES(client) (moddata_local_client(client, watchCounterMD).i)
@@ -150,9 +229,11 @@ CMD_FUNC(cmd_monitor)
 	char request[BUFSIZE];
 	char cmd;
 	char *s, *p = NULL;
-	int i;
-	int toomany = 0;
-	Link *lp;
+	const char *nicks[BUFSIZE/2];
+	int num_nicks = 0, added, i;
+	MonitorReply online, offline, full;
+	WatchList *wl;
+	MessageTag *mtags = NULL;
 
 	if (!MyUser(client))
 		return;
@@ -172,61 +253,72 @@ CMD_FUNC(cmd_monitor)
 		sendnotice(client, "MONITOR command is not available at this moment. Please try again later.");
 		return;
 	}
-	
+
+	new_message(&me, recv_mtags, &mtags);
+	monitor_reply_init(&online, client, mtags, RPL_MONONLINE);
+	monitor_reply_init(&offline, client, mtags, RPL_MONOFFLINE);
+
 	switch(cmd)
 	{
 		case 'c':
 			watch_del_list(client, WATCH_FLAG_TYPE_MONITOR);
 			break;
 		case 'l':
-			lp = WATCH(client);
-			while (lp)
+			monitor_reply_init(&online, client, mtags, RPL_MONLIST);
+			wl = WATCH(client);
+			for (i = 0; wl && (i < wl->num_entries); i++)
 			{
-				if (!(lp->flags & WATCH_FLAG_TYPE_MONITOR))
-				{
-					lp = lp->next;
+				if (!(wl->entries[i].flags & WATCH_FLAG_TYPE_MONITOR))
 					continue; /* this one is not ours */
-				}
-				sendnumeric(client, RPL_MONLIST, lp->value.wptr->nick);
-				lp = lp->next;
+				monitor_reply_add(&online, wl->entries[i].watch->nick);
 			}
+			monitor_reply_flush(&online);
 
-			sendnumeric(client, RPL_ENDOFMONLIST);
+			sendtaggednumeric(client, mtags, RPL_ENDOFMONLIST);
 			break;
 		case 's':
-			lp = WATCH(client);
-			while (lp)
+			wl = WATCH(client);
+			for (i = 0; wl && (i < wl->num_entries); i++)
 			{
-				if (!(lp->flags & WATCH_FLAG_TYPE_MONITOR))
-				{
-					lp = lp->next;
+				if (!(wl->entries[i].flags & WATCH_FLAG_TYPE_MONITOR))
 					continue; /* this one is not ours */
-				}
-				send_status(client, recv_mtags, lp->value.wptr->nick);
-				lp = lp->next;
+				monitor_status_add(&online, &offline, wl->entries[i].watch->nick);
 			}
+			monitor_reply_flush(&online);
+			monitor_reply_flush(&offline);
 			break;
 		case '-':
 		case '+':
 			if (parc < 3 || BadPtr(parv[2]))
-				return;
+				break;
 			strlcpy(request, parv[2], sizeof(request));
-			for (s = strtoken(&p, request, ","); s; s = strtoken(&p, NULL, ","))
+			for (s = strtoken(&p, request, ","); s && (num_nicks < ARRAY_SIZEOF(nicks)); s = strtoken(&p, NULL, ","))
+			{
+				if ((cmd == '-') || do_nick_name(s))
+					nicks[num_nicks++] = s;
+				else
+					monitor_reply_add(&offline, s); /* invalid nick, can never be online */
+			}
+
+			if (cmd == '-')
 			{
-				if (cmd == '-') {
-					watch_del(s, client, WATCH_FLAG_TYPE_MONITOR);
-				} else {
-					if (WATCHES(client) >= MAXWATCH)
-					{
-						sendnumeric(client, ERR_MONLISTFULL, MAXWATCH, s);
-						continue;
-					}
-					if (do_nick_name(s))
-						watch_add(s, client, WATCH_FLAG_TYPE_MONITOR);
-					send_status(client, recv_mtags, s);
-				}
+				watch_del_many(client, nicks, num_nicks, WATCH_FLAG_TYPE_MONITOR);
+				break;
 			}
+
+			added = watch_add_many(client, nicks, num_nicks, WATCH_FLAG_TYPE_MONITOR, MAXWATCH);
+			for (i = 0; i < added; i++)
+				monitor_status_add(&online, &offline, nicks[i]);
+			monitor_reply_flush(&online);
+			monitor_reply_flush(&offline);
+
+			/* The rest did not fit */
+			monitor_reply_init(&full, client, mtags, ERR_MONLISTFULL);
+			for (; i < num_nicks; i++)
+				monitor_reply_add(&full, nicks[i]);
+			monitor_reply_flush(&full);
 			break;
 	}
-}
 
+	free_message_tags(mtags);
+}
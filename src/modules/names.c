@@ -23,16 +23,52 @@
 #include "unrealircd.h"
 
 CMD_FUNC(cmd_names);
+void names_cache_free(ModData *m);
+int names_nickchange(Client *client, MessageTag *mtags, const char *oldnick);
+int names_userhost_change(Client *client, const char *olduser, const char *oldhost);
+int names_umode_change(Client *client, long setflags, long newflags);
 
 long CAP_MULTI_PREFIX = 0L;
 long CAP_USERHOST_IN_NAMES = 0L;
 
+ModDataInfo *names_cache_md = NULL;
+
 #define MSG_NAMES 	"NAMES"
 
+/** The RPL_NAMREPLY lines of a channel, see names_build() */
+typedef struct NamesLines NamesLines;
+struct NamesLines {
+	int num_lines;
+	int size;
+	char **lines;
+};
+
+/* Which members a cached NAMES reply includes, see names_cache_view() */
+#define NAMES_VIEW_ALL		0	/**< Everyone: for members that can see all members */
+#define NAMES_VIEW_VISIBLE	1	/**< Everyone except hidden (eg: delayjoin) members */
+#define NAMES_VIEW_PUBLIC	2	/**< As above, and also without +i users: for non-members */
+#define NAMES_VIEWS		3
+
+/** Cached NAMES reply of a channel.
+ * This way a JOIN (which sends NAMES) to a big channel does not have
+ * to format all the members again and again.
+ * Each variant is built on first use. The cache is thrown away on
+ * nick, user@host and +i changes, and it is not used anymore once
+ * channel->member_serial (joins, parts, member mode changes) or the
+ * channel modes (+s/+p symbol, delayjoin) change.
+ */
+typedef struct NamesCache NamesCache;
+struct NamesCache {
+	unsigned int member_serial;	/**< channel->member_serial when this was built */
+	Cmode_t mode;			/**< channel->mode.mode when this was built */
+	int hidden;			/**< Number of members that not everyone can see (eg: delayjoin) */
+	NamesLines *variant[NAMES_VIEWS][2][2]; /**< By view, multi-prefix and userhost-in-names */
+};
+
 ModuleHeader MOD_HEADER
   = {
 	"names",
-	"5.0",
+	"5.2",
 	"command /names", 
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -41,6 +77,8 @@ ModuleHeader MOD_HEADER
 MOD_INIT()
 {
 	ClientCapabilityInfo c;
+	ModDataInfo mreq;
+
 	memset(&c, 0, sizeof(c));
 	c.name = "multi-prefix";
 	ClientCapabilityAdd(modinfo->handle, &c, &CAP_MULTI_PREFIX);
@@ -48,6 +86,22 @@ MOD_INIT()
 	c.name = "userhost-in-names";
 	ClientCapabilityAdd(modinfo->handle, &c, &CAP_USERHOST_IN_NAMES);
 
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.name = "names_cache";
+	mreq.type = MODDATATYPE_CHANNEL;
+	mreq.free = names_cache_free;
+	names_cache_md = ModDataAdd(modinfo->handle, mreq);
+	if (!names_cache_md)
+	{
+		config_error("[%s] Failed to request names_cache moddata: %s", MOD_HEADER.name, ModuleGetErrorStr(modinfo->handle));
+		return MOD_FAILED;
+	}
+
+	HookAdd(modinfo->handle, HOOKTYPE_POST_LOCAL_NICKCHANGE, 0, names_nickchange);
+	HookAdd(modinfo->handle, HOOKTYPE_POST_REMOTE_NICKCHANGE, 0, names_nickchange);
+	HookAdd(modinfo->handle, HOOKTYPE_USERHOST_CHANGE, 0, names_userhost_change);
+	HookAdd(modinfo->handle, HOOKTYPE_UMODE_CHANGE, 0, names_umode_change);
+
 	CommandAdd(modinfo->handle, MSG_NAMES, cmd_names, MAXPARA, CMD_USER|CMD_SERVER);
 	MARK_AS_OFFICIAL_MODULE(modinfo);
 	return MOD_SUCCESS;
@@ -63,58 +117,110 @@ MOD_UNLOAD()
 	return MOD_SUCCESS;
 }
 
-/************************************************************************
- * cmd_names() - Added by Jto 27 Apr 1989
- * 12 Feb 2000 - geesh, time for a rewrite -lucas
- ************************************************************************/
+static void names_lines_add(NamesLines *n, const char *line)
+{
+	if (n->num_lines == n->size)
+	{
+		char **lines;
 
-/*
-** cmd_names
-**	parv[1] = channel
-*/
-#define TRUNCATED_NAMES 64
-CMD_FUNC(cmd_names)
+		n->size = n->size ? n->size * 2 : 4;
+		lines = safe_alloc(sizeof(char *) * n->size);
+		if (n->num_lines)
+			memcpy(lines, n->lines, sizeof(char *) * n->num_lines);
+		safe_free(n->lines);
+		n->lines = lines;
+	}
+	safe_strdup(n->lines[n->num_lines], line);
+	n->num_lines++;
+}
+
+static void names_lines_free(NamesLines *n)
 {
-	int multiprefix = (MyConnect(client) && HasCapabilityFast(client, CAP_MULTI_PREFIX));
-	int uhnames = (MyConnect(client) && HasCapabilityFast(client, CAP_USERHOST_IN_NAMES)); // cache UHNAMES support
-	int bufLen = NICKLEN + (!uhnames ? 0 : (1 + USERLEN + 1 + HOSTLEN));
-	int mlen = strlen(me.name) + bufLen + 7;
-	Channel *channel;
-	Client *acptr;
-	Membership *us = NULL;
-	Member *cm;
-	int idx, flag = 1, spos;
-	const char *para = parv[1], *s;
-	char nuhBuffer[NICKLEN+USERLEN+HOSTLEN+3];
-	char buf[BUFSIZE];
-	char can_see_invisible;
+	int i;
 
-	if (parc < 2 || !MyConnect(client))
-	{
-		sendnumeric(client, RPL_ENDOFNAMES, "*");
+	if (!n)
 		return;
-	}
+	for (i = 0; i < n->num_lines; i++)
+		safe_free(n->lines[i]);
+	safe_free(n->lines);
+	safe_free(n);
+}
 
-	for (s = para; *s; s++)
-	{
-		if (*s == ',')
-		{
-			sendnumeric(client, ERR_TOOMANYTARGETS, s+1, 1, "NAMES");
-			return;
-		}
-	}
+static void names_cache_destroy(NamesCache *cache)
+{
+	int view, multiprefix, uhnames;
 
-	channel = find_channel(para);
+	for (view = 0; view < NAMES_VIEWS; view++)
+		for (multiprefix = 0; multiprefix < 2; multiprefix++)
+			for (uhnames = 0; uhnames < 2; uhnames++)
+				names_lines_free(cache->variant[view][multiprefix][uhnames]);
+	safe_free(cache);
+}
 
-	if (!channel || (!ShowChannel(client, channel) && !ValidatePermissionsForPath("channel:see:names:secret",client,NULL,channel,NULL)))
+void names_cache_free(ModData *m)
+{
+	if (m->ptr)
 	{
-		sendnumeric(client, RPL_ENDOFNAMES, para);
-		return;
+		names_cache_destroy(m->ptr);
+		m->ptr = NULL;
 	}
+}
 
-	/* cache whether this user is a member of this channel or not */
-	if (IsUser(client))
-		us = find_membership_link(client->user->channel, channel);
+/** Throw away the cached NAMES of all channels that 'client' is in */
+static void names_cache_invalidate_user(Client *client)
+{
+	Membership *mb;
+
+	for (mb = client->user->channel; mb; mb = mb->next)
+		names_cache_free(&moddata_channel(mb->channel, names_cache_md));
+}
+
+int names_nickchange(Client *client, MessageTag *mtags, const char *oldnick)
+{
+	names_cache_invalidate_user(client);
+	return 0;
+}
+
+int names_userhost_change(Client *client, const char *olduser, const char *oldhost)
+{
+	/* Affects the userhost-in-names variants */
+	names_cache_invalidate_user(client);
+	return 0;
+}
+
+int names_umode_change(Client *client, long setflags, long newflags)
+{
+	/* Affects the NAMES_VIEW_PUBLIC variants */
+	if (IsUser(client) && ((setflags ^ newflags) & UMODE_INVISIBLE))
+		names_cache_invalidate_user(client);
+	return 0;
+}
+
+/** Build the RPL_NAMREPLY lines for 'channel'.
+ * @param client		The client that requested the NAMES,
+ *				or NULL to build a variant for the cache.
+ * @param channel		The channel
+ * @param us			Membership of 'client' in the channel (or NULL)
+ * @param multiprefix		Show all prefixes (multi-prefix)
+ * @param uhnames		Show nick!user@host (userhost-in-names)
+ * @param can_see_invisible	Client may see +i users even if not in the channel
+ * @param view			Which members to include if 'client' is NULL,
+ *				one of NAMES_VIEW_*.
+ * @returns The lines, free with names_lines_free().
+ */
+static NamesLines *names_build(Client *client, Channel *channel, Membership *us,
+                               int multiprefix, int uhnames, char can_see_invisible,
+                               int view)
+{
+	int bufLen = NICKLEN + (!uhnames ? 0 : (1 + USERLEN + 1 + HOSTLEN));
+	int mlen = strlen(me.name) + bufLen + 7;
+	NamesLines *n = safe_alloc(sizeof(NamesLines));
+	Client *acptr;
+	Member *cm;
+	int idx, flag = 1, spos;
+	const char *s;
+	char nuhBuffer[NICKLEN+USERLEN+HOSTLEN+3];
+	char buf[BUFSIZE];
 
 	// FIXME: consider rewriting this whole thing to get rid of pointer juggling and stuff.
 
@@ -139,16 +245,23 @@ CMD_FUNC(cmd_names)
 
 	spos = idx;		/* starting point in buffer for names! */
 
-	can_see_invisible = ValidatePermissionsForPath("channel:see:names:invisible",client,NULL,channel,NULL);
-
 	for (cm = channel->members; cm; cm = cm->next)
 	{
 		acptr = cm->client;
-		if (IsInvisible(acptr) && !us && !can_see_invisible)
-			continue;
+		if (client)
+		{
+			if (IsInvisible(acptr) && !us && !can_see_invisible)
+				continue;
 
-		if (!user_can_see_member_fast(client, acptr, channel, cm, us ? us->member_modes : NULL))
-			continue; /* invisible (eg: due to delayjoin) */
+			if (!user_can_see_member_fast(client, acptr, channel, cm, us ? us->member_modes : NULL))
+				continue; /* invisible (eg: due to delayjoin) */
+		} else {
+			/* Building for the cache */
+			if ((view != NAMES_VIEW_ALL) && !user_can_see_member_fast(&me, acptr, channel, cm, NULL))
+				continue;
+			if ((view == NAMES_VIEW_PUBLIC) && IsInvisible(acptr))
+				continue;
+		}
 
 		if (!multiprefix)
 		{
@@ -181,14 +294,133 @@ CMD_FUNC(cmd_names)
 		flag = 1;
 		if (mlen + idx + bufLen + MEMBERMODESLEN >= BUFSIZE - 1)
 		{
-			sendnumeric(client, RPL_NAMREPLY, buf);
+			names_lines_add(n, buf);
 			idx = spos;
 			flag = 0;
 		}
 	}
 
 	if (flag)
-		sendnumeric(client, RPL_NAMREPLY, buf);
+		names_lines_add(n, buf);
+
+	return n;
+}
+
+/** Get the (valid) NAMES cache of a channel, creating it if needed */
+static NamesCache *names_cache_get(Channel *channel)
+{
+	NamesCache *cache = moddata_channel(channel, names_cache_md).ptr;
+	Member *cm;
+
+	if (cache && ((cache->member_serial != channel->member_serial) || (cache->mode != channel->mode.mode)))
+	{
+		/* Outdated */
+		names_cache_destroy(cache);
+		cache = moddata_channel(channel, names_cache_md).ptr = NULL;
+	}
+
+	if (!cache)
+	{
+		cache = safe_alloc(sizeof(NamesCache));
+		cache->member_serial = channel->member_serial;
+		cache->mode = channel->mode.mode;
+		for (cm = channel->members; cm; cm = cm->next)
+			if (!user_can_see_member_fast(&me, cm->client, channel, cm, NULL))
+				cache->hidden++;
+		moddata_channel(channel, names_cache_md).ptr = cache;
+	}
+
+	return cache;
+}
+
+/** Decide which cached view (NAMES_VIEW_*) 'client' gets.
+ * @returns The view, or -1 if the cache can not be used for this client.
+ */
+static int names_cache_view(Client *client, Channel *channel, Membership *us, NamesCache *cache, int can_see_invisible)
+{
+	Member *cm;
+
+	if (!us)
+		return can_see_invisible ? NAMES_VIEW_VISIBLE : NAMES_VIEW_PUBLIC;
+
+	/* Members see everyone, except hidden members unless they are +hoaq */
+	if (!cache->hidden || check_channel_access_string(us->member_modes, "hoaq"))
+		return NAMES_VIEW_ALL;
+
+	/* A hidden member still sees itself, so it needs its own reply */
+	cm = find_member_link(channel->members, client);
+	if (!cm || !user_can_see_member_fast(&me, client, channel, cm, NULL))
+		return -1;
+
+	return NAMES_VIEW_VISIBLE;
+}
+
+/************************************************************************
+ * cmd_names() - Added by Jto 27 Apr 1989
+ * 12 Feb 2000 - geesh, time for a rewrite -lucas
+ ************************************************************************/
+
+/*
+** cmd_names
+**	parv[1] = channel
+*/
+CMD_FUNC(cmd_names)
+{
+	int multiprefix = (MyConnect(client) && HasCapabilityFast(client, CAP_MULTI_PREFIX));
+	int uhnames = (MyConnect(client) && HasCapabilityFast(client, CAP_USERHOST_IN_NAMES)); // cache UHNAMES support
+	Channel *channel;
+	Membership *us = NULL;
+	NamesCache *cache;
+	NamesLines *n;
+	const char *para = parv[1], *s;
+	int can_see_invisible = 0;
+	int view, i;
+
+	if (parc < 2 || !MyConnect(client))
+	{
+		sendnumeric(client, RPL_ENDOFNAMES, "*");
+		return;
+	}
+
+	for (s = para; *s; s++)
+	{
+		if (*s == ',')
+		{
+			sendnumeric(client, ERR_TOOMANYTARGETS, s+1, 1, "NAMES");
+			return;
+		}
+	}
+
+	channel = find_channel(para);
+
+	if (!channel || (!ShowChannel(client, channel) && !ValidatePermissionsForPath("channel:see:names:secret",client,NULL,channel,NULL)))
+	{
+		sendnumeric(client, RPL_ENDOFNAMES, para);
+		return;
+	}
+
+	/* cache whether this user is a member of this channel or not */
+	if (IsUser(client))
+		us = find_membership_link(client->user->channel, channel);
+
+	if (!us)
+		can_see_invisible = ValidatePermissionsForPath("channel:see:names:invisible",client,NULL,channel,NULL);
+
+	cache = names_cache_get(channel);
+	view = names_cache_view(client, channel, us, cache, can_see_invisible);
+	if (view >= 0)
+	{
+		n = cache->variant[view][multiprefix][uhnames];
+		if (!n)
+			n = cache->variant[view][multiprefix][uhnames] = names_build(NULL, channel, NULL, multiprefix, uhnames, 0, view);
+		for (i = 0; i < n->num_lines; i++)
+			sendnumeric(client, RPL_NAMREPLY, n->lines[i]);
+	} else {
+		n = names_build(client, channel, us, multiprefix, uhnames, can_see_invisible, 0);
+		for (i = 0; i < n->num_lines; i++)
+			sendnumeric(client, RPL_NAMREPLY, n->lines[i]);
+		names_lines_free(n);
+	}
 
 	sendnumeric(client, RPL_ENDOFNAMES, para);
 }
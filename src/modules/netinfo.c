@@ -29,7 +29,7 @@ CMD_FUNC(cmd_netinfo);
 ModuleHeader MOD_HEADER
   = {
 	"netinfo",
-	"5.0",
+	"5.0.1",
 	"command /netinfo", 
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -103,10 +103,11 @@ CMD_FUNC(cmd_netinfo)
 
 	unreal_log(ULOG_INFO, "link", "SERVER_SYNCED", client,
 	           "Link $client -> $me is now synced "
-	           "[secs: $synced_after_seconds, recv: $received_bytes, sent: $sent_bytes]",
+	           "[secs: $synced_after_seconds, recv: $received_bytes in $received_reads reads, sent: $sent_bytes]",
 	           log_data_client("me", &me),
 	           log_data_integer("synced_after_seconds", TStime() - endsync),
 	           log_data_integer("received_bytes", client->local->traffic.bytes_received),
+	           log_data_integer("received_reads", client->local->traffic.reads),
 	           log_data_integer("sent_bytes", client->local->traffic.bytes_sent));
 
 	if (!(strcmp(NETWORK_NAME, parv[8]) == 0))
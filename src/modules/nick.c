@@ -668,7 +668,7 @@ nickkill2done:
 	client->user->server = find_or_add(client->uplink->name);
 	strlcpy(client->user->realhost, hostname, sizeof(client->user->realhost));
 	if (ip)
-		safe_strdup(client->ip, ip);
+		set_client_ip(client, ip);
 
 	if (*sstamp != '*')
 		strlcpy(client->user->account, sstamp, sizeof(client->user->account));
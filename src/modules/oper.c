@@ -25,16 +25,26 @@
 ModuleHeader MOD_HEADER
   = {
 	"oper",	/* Name of module */
-	"5.0", /* Version */
+	"5.1", /* Version */
 	"command /oper", /* Short description of module */
 	"UnrealIRCd Team",
 	"unrealircd-6",
     };
 
+/** An /OPER attempt, while the password is being checked */
+typedef struct OperAuthJob OperAuthJob;
+struct OperAuthJob {
+	char *operblock_name;
+	AuthenticationType auth_type; /**< Type of the oper::auth that is checked against */
+	char *auth_data; /**< Data of the oper::auth that is checked against */
+};
+
 /* Forward declarations */
 CMD_FUNC(cmd_oper);
 int _make_oper(Client *client, const char *operblock_name, const char *operclass, ConfigItem_class *clientclass, long modes, const char *snomask, const char *vhost);
 int oper_connect(Client *client);
+void oper_auth_done(Client *client, int result, void *data);
+void oper_login(Client *client, ConfigItem_oper *operblock);
 
 MOD_TEST()
 {
@@ -58,6 +68,7 @@ MOD_LOAD()
 
 MOD_UNLOAD()
 {
+	Auth_CancelAsyncByCallback(oper_auth_done);
 	return MOD_SUCCESS;
 }
 
@@ -260,7 +271,96 @@ CMD_FUNC(cmd_oper)
 		return;
 	}
 
-	if (operblock->auth && !Auth_Check(client, operblock->auth, password))
+	if (operblock->auth)
+	{
+		/* The password check may be done in a worker thread,
+		 * we continue in oper_auth_done() once it is complete.
+		 */
+		OperAuthJob *job = safe_alloc(sizeof(OperAuthJob));
+		safe_strdup(job->operblock_name, operblock->name);
+		job->auth_type = operblock->auth->type;
+		safe_strdup(job->auth_data, operblock->auth->data);
+		Auth_CheckAsync(client, operblock->auth, password, oper_auth_done, job);
+		return;
+	}
+
+	oper_login(client, operblock);
+}
+
+static void free_oper_auth_job(OperAuthJob *job)
+{
+	safe_free(job->operblock_name);
+	safe_free(job->auth_data);
+	safe_free(job);
+}
+
+/** Is the oper::auth of this oper block still the one that the job checked against? */
+static int oper_auth_job_current(OperAuthJob *job, ConfigItem_oper *operblock)
+{
+	if (!operblock->auth || (operblock->auth->type != job->auth_type))
+		return 0;
+	if (!operblock->auth->data || !job->auth_data)
+		return operblock->auth->data == job->auth_data;
+	return !strcmp(operblock->auth->data, job->auth_data);
+}
+
+/** Called when the password check of /OPER has completed */
+void oper_auth_done(Client *client, int result, void *data)
+{
+	OperAuthJob *job = data;
+	ConfigItem_oper *operblock;
+
+	if (!client || IsOper(client))
+	{
+		/* Client is gone or already opered up in the meantime */
+		free_oper_auth_job(job);
+		return;
+	}
+
+	if (result < 0)
+	{
+		/* Cancelled, the module is being unloaded or reloaded */
+		free_oper_auth_job(job);
+		sendnumeric(client, ERR_NOOPERHOST);
+		sendnotice(client, "*** Your /OPER attempt was cancelled because the server is reloading. Please try again.");
+		return;
+	}
+
+	/* The oper block may have been removed or changed by a /REHASH */
+	if (!(operblock = find_oper(job->operblock_name)))
+	{
+		sendnumeric(client, ERR_NOOPERHOST);
+		free_oper_auth_job(job);
+		return;
+	}
+
+	if (!oper_auth_job_current(job, operblock))
+	{
+		/* The password was checked against the old oper::auth */
+		free_oper_auth_job(job);
+		sendnumeric(client, ERR_NOOPERHOST);
+		unreal_log(ULOG_WARNING, "oper", "OPER_FAILED", client,
+		           "Failed OPER attempt by $client.details [reason: $reason] [oper-block: $oper_block]",
+		           log_data_string("reason", "Oper block changed during authentication"),
+		           log_data_string("fail_type", "OPER_BLOCK_CHANGED"),
+		           log_data_string("oper_block", operblock->name));
+		return;
+	}
+	free_oper_auth_job(job);
+
+	if (!user_allowed_by_security_group(client, operblock->match))
+	{
+		sendnumeric(client, ERR_NOOPERHOST);
+		unreal_log(ULOG_ERROR, "oper", "OPER_FAILED", client,
+		           "Failed OPER attempt by $client.details [reason: $reason] [oper-block: $oper_block]",
+		           log_data_string("reason", "Host does not match"),
+		           log_data_string("fail_type", "NO_HOST_MATCH"),
+		           log_data_string("oper_block", operblock->name));
+		add_fake_lag(client, 7000);
+		return;
+	}
+
+	if (!result)
 	{
 		sendnumeric(client, ERR_PASSWDMISMATCH);
 		if (FAILOPER_WARN)
@@ -270,15 +370,21 @@ CMD_FUNC(cmd_oper)
 		           "Failed OPER attempt by $client.details [reason: $reason] [oper-block: $oper_block]",
 		           log_data_string("reason", "Authentication failed"),
 		           log_data_string("fail_type", "AUTHENTICATION_FAILED"),
-		           log_data_string("oper_block", parv[1]));
+		           log_data_string("oper_block", operblock->name));
 		add_fake_lag(client, 7000);
 		return;
 	}
 
-	/* Authentication of the oper succeeded (like, password, ssl cert),
-	 * but we still have some other restrictions to check below as well,
-	 * like 'require-modes' and 'maxlogins'...
-	 */
+	oper_login(client, operblock);
+}
+
+/** Authentication of the oper succeeded (like, password, ssl cert),
+ * but we still have some other restrictions to check below as well,
+ * like 'require-modes' and 'maxlogins'...
+ */
+void oper_login(Client *client, ConfigItem_oper *operblock)
+{
+	const char *operblock_name = operblock->name;
 
 	/* Check oper::require_modes */
 	if (operblock->require_modes & ~client->umodes)
@@ -288,7 +394,7 @@ CMD_FUNC(cmd_oper)
 		           "Failed OPER attempt by $client.details [reason: $reason] [oper-block: $oper_block]",
 		           log_data_string("reason", "Not matching oper::require-modes"),
 		           log_data_string("fail_type", "REQUIRE_MODES_NOT_SATISFIED"),
-		           log_data_string("oper_block", parv[1]));
+		           log_data_string("oper_block", operblock_name));
 		add_fake_lag(client, 7000);
 		return;
 	}
@@ -300,7 +406,7 @@ CMD_FUNC(cmd_oper)
 		           "Failed OPER attempt by $client.details [reason: $reason] [oper-block: $oper_block]",
 		           log_data_string("reason", "Config error: invalid oper::operclass"),
 		           log_data_string("fail_type", "OPER_OPERCLASS_INVALID"),
-		           log_data_string("oper_block", parv[1]));
+		           log_data_string("oper_block", operblock_name));
 		return;
 	}
 
@@ -313,7 +419,7 @@ CMD_FUNC(cmd_oper)
 		           "Failed OPER attempt by $client.details [reason: $reason] [oper-block: $oper_block]",
 		           log_data_string("reason", "oper::maxlogins limit reached"),
 		           log_data_string("fail_type", "OPER_MAXLOGINS_LIMIT"),
-		           log_data_string("oper_block", parv[1]));
+		           log_data_string("oper_block", operblock_name));
 		add_fake_lag(client, 4000);
 		return;
 	}
@@ -339,7 +445,7 @@ CMD_FUNC(cmd_oper)
 		sendnotice_multiline(client, iConf.plaintext_policy_oper_message);
 		unreal_log(ULOG_WARNING, "oper", "OPER_UNSAFE", client,
 			   "Insecure (non-TLS) connection used to OPER up by $client.details [oper-block: $oper_block]",
-			   log_data_string("oper_block", parv[1]),
+			   log_data_string("oper_block", operblock_name),
 		           log_data_string("warn_type", "NO_TLS"));
 	}
 
@@ -349,7 +455,7 @@ CMD_FUNC(cmd_oper)
 		sendnotice(client, "%s", outdated_tls_client_build_string(iConf.outdated_tls_policy_oper_message, client));
 		unreal_log(ULOG_WARNING, "oper", "OPER_UNSAFE", client,
 			   "Outdated TLS protocol/cipher used to OPER up by $client.details [oper-block: $oper_block]",
-			   log_data_string("oper_block", parv[1]),
+			   log_data_string("oper_block", operblock_name),
 		           log_data_string("warn_type", "OUTDATED_TLS_PROTOCOL_OR_CIPHER"));
 	}
 }
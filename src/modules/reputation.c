@@ -17,7 +17,7 @@
 
 #include "unrealircd.h"
 
-#define REPUTATION_VERSION "1.2"
+#define REPUTATION_VERSION "1.2.1"
 
 /* Change to #define to benchmark. Note that this will add random
  * reputation entries so should never be used on production servers!!!
@@ -75,8 +75,6 @@ ModuleHeader MOD_HEADER
 
 #define UPDATE_SCORE_MARGIN 1
 
-#define REPUTATION_HASH_TABLE_SIZE 2048
-
 #define Reputation(client)	moddata_client(client, reputation_md).l
 
 #define WARN_WRITE_ERROR(fname) \
@@ -113,6 +111,8 @@ struct ReputationEntry {
 	unsigned short score; /**< score for the user */
 	long last_seen; /**< user last seen (unix timestamp) */
 	int marker; /**< internal marker, not written to db */
+	ExpiryHeapNode expiry; /**< Position in reputation_expiry_heap */
+	char rawip[IPINDEX_KEYLEN]; /**< ip address in binary form, key in reputation_index */
 	char ip[1]; /*< ip address */
 };
 
@@ -123,8 +123,11 @@ static struct cfgstruct test; /**< Testing configuration (not active yet) */
 long reputation_starttime = 0;
 long reputation_writtentime = 0;
 
-static ReputationEntry *ReputationHashTable[REPUTATION_HASH_TABLE_SIZE];
-static char siphashkey_reputation[SIPHASH_KEY_LENGTH];
+static ReputationEntry *ReputationList = NULL;
+/** Entries by IP address */
+static IPIndex reputation_index;
+/** Entries by (earliest possible) expiry time, see delete_old_records() */
+static ExpiryHeap reputation_expiry_heap;
 
 static ModuleInfo ModInf;
 
@@ -146,9 +149,11 @@ int reputation_connect_extinfo(Client *client, NameValuePrioList **list);
 int reputation_config_test(ConfigFile *cf, ConfigEntry *ce, int type, int *errs);
 int reputation_config_run(ConfigFile *cf, ConfigEntry *ce, int type);
 int reputation_config_posttest(int *errs);
-static uint64_t hash_reputation_entry(const char *ip);
 ReputationEntry *find_reputation_entry(const char *ip);
-void add_reputation_entry(ReputationEntry *e);
+ReputationEntry *find_reputation_entry_client(Client *client);
+int add_reputation_entry(ReputationEntry *e);
+void reputation_expiry_update(ReputationEntry *e);
+int reputation_rehash_complete(void);
 EVENT(delete_old_records);
 EVENT(add_scores);
 EVENT(reputation_save_db_evt);
@@ -175,9 +180,6 @@ MOD_INIT()
 	MARK_AS_OFFICIAL_MODULE(modinfo);
 	ModuleSetOptions(modinfo->handle, MOD_OPT_PERM, 1);
 
-	memset(&ReputationHashTable, 0, sizeof(ReputationHashTable));
-	siphash_generate_key(siphashkey_reputation);
-
 	memset(&mreq, 0, sizeof(mreq));
 	mreq.name = "reputation";
 	mreq.free = reputation_md_free;
@@ -191,6 +193,7 @@ MOD_INIT()
 
 	reputation_config_setdefaults(&cfg);
 	HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN, 0, reputation_config_run);
+	HookAdd(modinfo->handle, HOOKTYPE_REHASH_COMPLETE, 0, reputation_rehash_complete);
 	HookAdd(modinfo->handle, HOOKTYPE_WHOIS, 0, reputation_whois);
 	HookAdd(modinfo->handle, HOOKTYPE_HANDSHAKE, 0, reputation_set_on_connect);
 	HookAdd(modinfo->handle, HOOKTYPE_IP_CHANGE, 0, reputation_ip_change);
@@ -217,12 +220,8 @@ void reputation_benchmark(int entries)
 		snprintf(e->ip, 63, "%d.%d.%d.%d", rand()%255, rand()%255, rand()%255, rand()%255);
 		e->score = rand()%255 + 1;
 		e->last_seen = TStime();
-		if (find_reputation_entry(e->ip))
-		{
+		if (!add_reputation_entry(e))
 			safe_free(e);
-			continue;
-		}
-		add_reputation_entry(e);
 	}
 }
 #endif
@@ -462,7 +461,8 @@ void reputation_load_db_old(void)
 		e->score = atoi(score);
 		e->last_seen = atol(last_seen);
 
-		add_reputation_entry(e);
+		if (!add_reputation_entry(e))
+			safe_free(e); /* duplicate or not an IP address */
 	}
 	fclose(fd);
 
@@ -527,7 +527,8 @@ int reputation_load_db_new(UnrealDB *db)
 		strcpy(e->ip, ip); /* safe, see alloc above */
 		e->score = score;
 		e->last_seen = last_seen;
-		add_reputation_entry(e);
+		if (!add_reputation_entry(e))
+			safe_free(e); /* duplicate or not an IP address */
 		safe_free(ip);
 	}
 	unrealdb_close(db);
@@ -602,7 +603,6 @@ int reputation_save_db_old(void)
 {
 	FILE *fd;
 	char tmpfname[512];
-	int i;
 	ReputationEntry *e;
 #ifdef BENCHMARK
 	struct timeval tv_alpha, tv_beta;
@@ -623,17 +623,14 @@ int reputation_save_db_old(void)
 	if (fprintf(fd, "REPDB 1 %lld %lld\n", (long long)reputation_starttime, (long long)TStime()) < 0)
 		goto write_fail;
 
-	for (i = 0; i < REPUTATION_HASH_TABLE_SIZE; i++)
+	for (e = ReputationList; e; e = e->next)
 	{
-		for (e = ReputationHashTable[i]; e; e = e->next)
+		if (fprintf(fd, "%s %d %lld\n", e->ip, (int)e->score, (long long)e->last_seen) < 0)
 		{
-			if (fprintf(fd, "%s %d %lld\n", e->ip, (int)e->score, (long long)e->last_seen) < 0)
-			{
 write_fail:
-				config_error("ERROR writing to '%s': %s -- DATABASE *NOT* SAVED!!!", tmpfname, strerror(ERRNO));
-				fclose(fd);
-				return 0;
-			}
+			config_error("ERROR writing to '%s': %s -- DATABASE *NOT* SAVED!!!", tmpfname, strerror(ERRNO));
+			fclose(fd);
+			return 0;
 		}
 	}
 
@@ -673,7 +670,6 @@ int reputation_save_db(void)
 {
 	UnrealDB *db;
 	char tmpfname[512];
-	int i;
 	uint64_t count;
 	ReputationEntry *e;
 #ifdef BENCHMARK
@@ -705,22 +701,15 @@ int reputation_save_db(void)
 	W_SAFE(unrealdb_write_int64(db, reputation_starttime)); /* starttime of data gathering */
 	W_SAFE(unrealdb_write_int64(db, TStime())); /* current time */
 
-	/* Count entries */
-	count = 0;
-	for (i = 0; i < REPUTATION_HASH_TABLE_SIZE; i++)
-		for (e = ReputationHashTable[i]; e; e = e->next)
-			count++;
+	count = reputation_index.count;
 	W_SAFE(unrealdb_write_int64(db, count)); /* Number of DB entries */
 
 	/* Now write the actual individual entries: */
-	for (i = 0; i < REPUTATION_HASH_TABLE_SIZE; i++)
+	for (e = ReputationList; e; e = e->next)
 	{
-		for (e = ReputationHashTable[i]; e; e = e->next)
-		{
-			W_SAFE(unrealdb_write_str(db, e->ip));
-			W_SAFE(unrealdb_write_int16(db, e->score));
-			W_SAFE(unrealdb_write_int64(db, e->last_seen));
-		}
+		W_SAFE(unrealdb_write_str(db, e->ip));
+		W_SAFE(unrealdb_write_int16(db, e->score));
+		W_SAFE(unrealdb_write_int64(db, e->last_seen));
 	}
 
 	if (!unrealdb_close(db))
@@ -754,43 +743,48 @@ int reputation_save_db(void)
 	return 1;
 }
 
-static uint64_t hash_reputation_entry(const char *ip)
+/** Add an entry (with e->ip filled in) to the index.
+ * @returns 1 if added, 0 if e->ip is not an IP address or
+ *          an entry for this IP already exists.
+ */
+int add_reputation_entry(ReputationEntry *e)
 {
-	return siphash(ip, siphashkey_reputation) % REPUTATION_HASH_TABLE_SIZE;
+	if (!ipindex_key(e->ip, e->rawip) ||
+	    !ipindex_add(&reputation_index, e->rawip, IPINDEX_KEYLEN*8, e))
+	{
+		return 0;
+	}
+	AddListItem(e, ReputationList);
+	reputation_expiry_update(e);
+	return 1;
 }
 
-void add_reputation_entry(ReputationEntry *e)
+ReputationEntry *find_reputation_entry(const char *ip)
 {
-	int hashv = hash_reputation_entry(e->ip);
+	char key[IPINDEX_KEYLEN];
 
-	AddListItem(e, ReputationHashTable[hashv]);
+	if (!ipindex_key(ip, key))
+		return NULL;
+	return ipindex_find(&reputation_index, key, IPINDEX_KEYLEN*8);
 }
 
-ReputationEntry *find_reputation_entry(const char *ip)
+/** Find the entry for the IP of a client (without parsing client->ip) */
+ReputationEntry *find_reputation_entry_client(Client *client)
 {
-	ReputationEntry *e;
-	int hashv = hash_reputation_entry(ip);
-
-	for (e = ReputationHashTable[hashv]; e; e = e->next)
-		if (!strcmp(e->ip, ip))
-			return e;
-
-	return NULL;
+	if (!HasRawIP(client))
+		return NULL;
+	return ipindex_find(&reputation_index, client->rawip, IPINDEX_KEYLEN*8);
 }
 
 int reputation_lookup_score_and_set(Client *client)
 {
-	char *ip = client->ip;
 	ReputationEntry *e;
 
 	Reputation(client) = 0; /* (re-)set to zero (yes, important!) */
-	if (ip)
+	e = find_reputation_entry_client(client);
+	if (e)
 	{
-		e = find_reputation_entry(ip);
-		if (e)
-		{
-			Reputation(client) = e->score; /* SET MODDATA */
-		}
+		Reputation(client) = e->score; /* SET MODDATA */
 	}
 	return Reputation(client);
 }
@@ -856,17 +850,21 @@ EVENT(add_scores)
 		if (!IsUser(client))
 			continue; /* skip servers, unknowns, etc.. */
 
-		ip = client->ip;
-		if (!ip)
+		if (!HasRawIP(client))
 			continue;
 
-		e = find_reputation_entry(ip);
+		e = find_reputation_entry_client(client);
 		if (!e)
 		{
 			/* Create */
+			ip = client->ip;
 			e = safe_alloc(sizeof(ReputationEntry)+strlen(ip));
 			strcpy(e->ip, ip); /* safe, allocated above */
-			add_reputation_entry(e);
+			if (!add_reputation_entry(e))
+			{
+				safe_free(e);
+				continue;
+			}
 		}
 
 		/* If this is not a duplicate entry, then bump the score.. */
@@ -927,7 +925,7 @@ void reputation_changed_update_users(ReputationEntry *e)
 
 	list_for_each_entry(client, &client_list, client_node)
 	{
-		if (client->ip && !strcmp(e->ip, client->ip))
+		if (HasRawIP(client) && !memcmp(e->rawip, client->rawip, IPINDEX_KEYLEN))
 		{
 			/* With some (possibly unneeded) care to only go forward */
 			if (Reputation(client) < e->score)
@@ -936,35 +934,86 @@ void reputation_changed_update_users(ReputationEntry *e)
 	}
 }
 
-EVENT(delete_old_records)
+/** Calculate the earliest time at which this entry can expire.
+ * @returns The time, or 0 if the entry does not expire at the current score.
+ */
+static time_t reputation_expire_time(ReputationEntry *e)
 {
+	time_t ret = 0, t;
 	int i;
-	ReputationEntry *e, *e_next;
+
+	for (i = 0; i < MAXEXPIRES; i++)
+	{
+		if (cfg.expire_time[i] == 0)
+			break; /* end of all entries */
+		if (e->score <= cfg.expire_score[i])
+		{
+			t = e->last_seen + cfg.expire_time[i] + 1;
+			if (!ret || (t < ret))
+				ret = t;
+		}
+	}
+	return ret;
+}
+
+/** Put the entry in the expiry heap (or remove it from there).
+ * The score and last_seen of an entry only go up, so the expiry
+ * time in the heap is never later than the real one. Entries
+ * are not updated on every change, instead they are checked
+ * again when they reach the top of the heap.
+ */
+void reputation_expiry_update(ReputationEntry *e)
+{
+	time_t expire_at = reputation_expire_time(e);
+
+	if (expire_at)
+		expiry_heap_add(&reputation_expiry_heap, &e->expiry, expire_at);
+	else
+		expiry_heap_del(&reputation_expiry_heap, &e->expiry);
+}
+
+/** The expiry settings may have changed, so recalculate all entries */
+int reputation_rehash_complete(void)
+{
+	ReputationEntry *e;
+
+	expiry_heap_free(&reputation_expiry_heap);
+	for (e = ReputationList; e; e = e->next)
+		reputation_expiry_update(e);
+	return 0;
+}
+
+EVENT(delete_old_records)
+{
+	ExpiryHeapNode *n;
+	ReputationEntry *e;
 #ifdef BENCHMARK
 	struct timeval tv_alpha, tv_beta;
 
 	gettimeofday(&tv_alpha, NULL);
 #endif
 
-	for (i = 0; i < REPUTATION_HASH_TABLE_SIZE; i++)
+	while ((n = expiry_heap_pop(&reputation_expiry_heap, TStime())))
 	{
-		for (e = ReputationHashTable[i]; e; e = e_next)
+		e = container_of(n, ReputationEntry, expiry);
+
+		if (!is_reputation_expired(e))
 		{
-			e_next = e->next;
+			/* Seen or score bumped since it was put in the heap */
+			reputation_expiry_update(e);
+			continue;
+		}
 
-			if (is_reputation_expired(e))
-			{
 #ifdef DEBUGMODE
-				unreal_log(ULOG_DEBUG, "reputation", "REPUTATION_EXPIRY", NULL,
-				           "Deleting expired entry for $ip (score $score, last seen $time_delta seconds ago)",
-				           log_data_string("ip", e->ip),
-				           log_data_integer("score", e->score),
-				           log_data_integer("time_delta", TStime() - e->last_seen));
+		unreal_log(ULOG_DEBUG, "reputation", "REPUTATION_EXPIRY", NULL,
+		           "Deleting expired entry for $ip (score $score, last seen $time_delta seconds ago)",
+		           log_data_string("ip", e->ip),
+		           log_data_integer("score", e->score),
+		           log_data_integer("time_delta", TStime() - e->last_seen));
 #endif
-				DelListItem(e, ReputationHashTable[i]);
-				safe_free(e);
-			}
-		}
+		ipindex_del(&reputation_index, e->rawip, IPINDEX_KEYLEN*8);
+		DelListItem(e, ReputationList);
+		safe_free(e);
 	}
 
 #ifdef BENCHMARK
@@ -1003,15 +1052,7 @@ int reputation_connect_extinfo(Client *client, NameValuePrioList **list)
 
 int count_reputation_records(void)
 {
-	int i;
-	ReputationEntry *e;
-	int total = 0;
-
-	for (i = 0; i < REPUTATION_HASH_TABLE_SIZE; i++)
-		for (e = ReputationHashTable[i]; e; e = e->next)
-			total++;
-
-	return total;
+	return reputation_index.count;
 }
 
 void reputation_channel_query(Client *client, Channel *channel)
@@ -1032,12 +1073,9 @@ void reputation_channel_query(Client *client, Channel *channel)
 	for (m = channel->members; m; m = m->next)
 	{
 		nicks[cnt] = m->client->name;
-		if (m->client->ip)
-		{
-			e = find_reputation_entry(m->client->ip);
-			if (e)
-				scores[cnt] = e->score;
-		}
+		e = find_reputation_entry_client(m->client);
+		if (e)
+			scores[cnt] = e->score;
 		if (++cnt > channel->users)
 		{
 			unreal_log(ULOG_WARNING, "bug", "REPUTATION_CHANNEL_QUERY_BUG", client,
@@ -1103,7 +1141,7 @@ void reputation_list_query(Client *client, int maxscore)
 		if (!IsUser(target) || IsULine(target) || !target->ip)
 			continue;
 
-		e = find_reputation_entry(target->ip);
+		e = find_reputation_entry_client(target);
 		if (e)
 			score = e->score;
 		if (score >= maxscore)
@@ -1118,6 +1156,31 @@ void reputation_list_query(Client *client, int maxscore)
 	sendtxtnumeric(client, "End of list.");
 }
 
+static void reputation_range_query_entry(const char *key, int bits, void *value, void *data)
+{
+	Client *client = (Client *)data;
+	ReputationEntry *e = (ReputationEntry *)value;
+
+	sendtxtnumeric(client, "%s \017(score: %d, last seen: %lld seconds ago)",
+		e->ip, (int)e->score, (long long)(TStime() - e->last_seen));
+}
+
+/** List all reputation records within an IP range, eg 192.168.0.0/16 */
+void reputation_range_query(Client *client, const char *mask)
+{
+	char key[IPINDEX_KEYLEN];
+	int bits;
+
+	if (!ipindex_mask_key(mask, key, &bits))
+	{
+		sendnotice(client, "REPUTATION: Invalid IP range '%s'. Use for example '/REPUTATION 192.168.0.0/16'", mask);
+		return;
+	}
+	sendtxtnumeric(client, "Reputation records within %s:", mask);
+	ipindex_walk(&reputation_index, key, bits, reputation_range_query_entry, client);
+	sendtxtnumeric(client, "End of list.");
+}
+
 CMD_FUNC(reputation_user_cmd)
 {
 	ReputationEntry *e;
@@ -1148,11 +1211,17 @@ CMD_FUNC(reputation_user_cmd)
 		sendnotice(client, "Available commands:");
 		sendnotice(client, "/REPUTATION [nick]     Show reputation info about nick name");
 		sendnotice(client, "/REPUTATION [ip]       Show reputation info about IP address");
+		sendnotice(client, "/REPUTATION [ip/NN]    List reputation records within an IP range (CIDR)");
 		sendnotice(client, "/REPUTATION [channel]  List users in channel along with their reputation score");
 		sendnotice(client, "/REPUTATION <NN        List users with reputation score below value NN");
 		return;
 	}
 
+	if (strchr(parv[1], '/'))
+	{
+		reputation_range_query(client, parv[1]);
+		return;
+	} else
 	if (strchr(parv[1], '.') || strchr(parv[1], ':'))
 	{
 		ip = parv[1];
@@ -1314,8 +1383,10 @@ CMD_FUNC(reputation_server_cmd)
 		strcpy(e->ip, ip); /* safe, see alloc above */
 		e->score = score;
 		e->last_seen = TStime();
-		add_reputation_entry(e);
-		reputation_changed_update_users(e);
+		if (add_reputation_entry(e))
+			reputation_changed_update_users(e);
+		else
+			safe_free(e); /* not an IP address */
 	}
 
 	/* Propagate to the non-client direction (score may be updated) */
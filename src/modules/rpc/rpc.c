@@ -10,7 +10,7 @@
 ModuleHeader MOD_HEADER
   = {
 	"rpc/rpc",
-	"1.0.4",
+	"1.0.6",
 	"RPC module for remote management",
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -27,6 +27,23 @@ ModuleHeader MOD_HEADER
 #define RRPC_PACKET_SMALL	450
 #define RRPC_PACKET_BIGLINES	16000
 
+/** Maximum number of requests in one batch (JSON array) */
+#define RPC_BATCH_MAX		10000
+
+/** Maximum size of an HTTP POST body, after authentication */
+#define RPC_MAX_REQUEST_SIZE	4194304
+
+/** Maximum number of RRPC requests in flight to a single server,
+ * any requests on top of this are queued until responses come in.
+ */
+#define RRPC_WINDOW		100
+
+/** Maximum number of requests that are packed into one RRPC REQ */
+#define RRPC_BATCH_SIZE		25
+
+/** Servers with an rpc module of at least this version accept batched RRPC requests */
+#define RRPC_BATCH_VERSION	"1.0.6"
+
 /* Structs */
 typedef struct RPCUser RPCUser;
 struct RPCUser {
@@ -55,6 +72,24 @@ struct OutstandingRRPC {
 	char *requestid;
 };
 
+typedef struct QueuedRRPC QueuedRRPC;
+struct QueuedRRPC {
+	QueuedRRPC *prev, *next;
+	char source[IDLEN+1];
+	char destination[IDLEN+1];
+	char *requestid;
+	json_t *request;
+};
+
+/** Batch request (JSON array) that is being executed */
+typedef struct RPCBatch RPCBatch;
+struct RPCBatch {
+	Client *client;
+	dbuf *output;		/**< Where the responses go, NULL to drop them */
+	dbuf buffer;		/**< Websocket: whole batch is sent as one message */
+	int responses;		/**< Number of responses so far */
+};
+
 typedef struct RPCTimer RPCTimer;
 struct RPCTimer {
 	RPCTimer *prev, *next;
@@ -83,6 +118,8 @@ int rpc_packet_in_websocket(Client *client, char *readbuf, int length);
 int rpc_packet_in_unix_socket(Client *client, const char *readbuf, int *length);
 void rpc_call_text(Client *client, const char *buf, int len);
 void rpc_call_json(Client *client, json_t *request);
+void rpc_call_batch(Client *client, json_t *requests);
+void rpc_sendto(Client *client, const char *buf, int len);
 void _rpc_response(Client *client, json_t *request, json_t *result);
 void _rpc_error(Client *client, json_t *request, JsonRpcError error_code, const char *error_message);
 void _rpc_error_fmt(Client *client, json_t *request, JsonRpcError error_code, FORMAT_STRING(const char *fmt), ...) __attribute__((format(printf,4,5)));
@@ -103,6 +140,9 @@ EVENT(rpc_do_timers);
 json_t *rrpc_data(RRPC *r);
 void free_rrpc_list(ModData *m);
 void free_outstanding_rrpc_list(ModData *m);
+void free_queued_rrpc_list(ModData *m);
+void rrpc_flush(Client *target);
+void rrpc_flush_all(void);
 void free_rpc_timer(RPCTimer *r);
 void free_rpc_timer_list(ModData *m);
 void rpc_call_remote(RRPC *r);
@@ -118,12 +158,16 @@ int rpc_config_listener(ConfigItem_listen *listener);
 /* Macros */
 #define RPC_PORT(client)  ((client->local && client->local->listener) ? client->local->listener->rpc_options : 0)
 #define WSU(client)     ((WebSocketUser *)moddata_client(client, websocket_md).ptr)
+#define WEB(client)     ((WebRequest *)moddata_client(client, webserver_md).ptr)
 
 /* Global variables */
 ModDataInfo *websocket_md = NULL; /* (imported) */
+ModDataInfo *webserver_md = NULL; /* (imported) */
 RPCUser *rpcusers = NULL;
 RRPC *rrpc_list = NULL;
 OutstandingRRPC *outstanding_rrpc_list = NULL;
+QueuedRRPC *queued_rrpc_list = NULL;
+RPCBatch *current_batch = NULL; /**< Batch request being executed, if any */
 RPCTimer *rpc_timer_list = NULL;
 ModDataInfo *rrpc_md;
 
@@ -222,6 +266,7 @@ MOD_INIT()
 
 	LoadPersistentPointer(modinfo, rrpc_list, free_rrpc_list);
 	LoadPersistentPointer(modinfo, outstanding_rrpc_list, free_outstanding_rrpc_list);
+	LoadPersistentPointer(modinfo, queued_rrpc_list, free_queued_rrpc_list);
 	LoadPersistentPointer(modinfo, rpc_timer_list, free_rpc_timer_list);
 
 	CommandAdd(modinfo->handle, "RRPC", cmd_rrpc, MAXPARA, CMD_SERVER|CMD_BIGLINES);
@@ -252,6 +297,7 @@ void rpc_do_moddata(void)
 
 MOD_LOAD()
 {
+	webserver_md = findmoddata_byname("web", MODDATATYPE_CLIENT); /* can be NULL */
 	rpc_do_moddata();
 	return MOD_SUCCESS;
 }
@@ -275,6 +321,7 @@ MOD_UNLOAD()
 	free_config();
 	SavePersistentPointer(modinfo, rrpc_list);
 	SavePersistentPointer(modinfo, outstanding_rrpc_list);
+	SavePersistentPointer(modinfo, queued_rrpc_list);
 	SavePersistentPointer(modinfo, rpc_timer_list);
 	return MOD_SUCCESS;
 }
@@ -440,6 +487,8 @@ int rpc_handle_webrequest(Client *client, WebRequest *web)
 			webserver_send_response(client, 200, "To use the UnrealIRCd RPC API you need to make a POST request. See https://www.unrealircd.org/docs/RPC\n");
 			return 0;
 		}
+		/* Authenticated, so allow big requests, eg a batch */
+		web->config_max_request_buffer_size = RPC_MAX_REQUEST_SIZE;
 		webserver_send_response(client, 200, NULL); /* continue.. */
 		return 1; /* accept */
 	}
@@ -617,14 +666,107 @@ void rpc_call_text(Client *client, const char *readbuf, int len)
 		rpc_close(client);
 		return;
 	}
-	rpc_call_json(client, request);
+	if (json_is_array(request))
+		rpc_call_batch(client, request);
+	else
+		rpc_call_json(client, request);
 	json_decref(request);
 }
 
+/** Add a response to the batch that is currently being executed */
+static void rpc_batch_add(const char *buf, int len)
+{
+	if (!current_batch->output)
+		return;
+	dbuf_put(current_batch->output, current_batch->responses++ ? "," : "[", 1);
+	dbuf_put(current_batch->output, buf, len);
+	if (current_batch->output == &current_batch->client->local->sendQ)
+		mark_data_to_send(current_batch->client);
+}
+
+/** Handle a batch request: a JSON array of requests.
+ * The requests are executed in order. The responses are written
+ * out as they are generated and together form one JSON array.
+ * Responses to requests that were forwarded to other servers
+ * are not part of that array, they are sent separately later.
+ */
+void rpc_call_batch(Client *client, json_t *requests)
+{
+	RPCBatch batch;
+	size_t index;
+	json_t *request;
+
+	if (json_array_size(requests) == 0)
+	{
+		rpc_error(client, NULL, JSON_RPC_ERROR_INVALID_REQUEST, "Empty batch");
+		return;
+	}
+
+	if (json_array_size(requests) > RPC_BATCH_MAX)
+	{
+		rpc_error_fmt(client, NULL, JSON_RPC_ERROR_INVALID_REQUEST,
+		              "A batch may contain at most %d requests", RPC_BATCH_MAX);
+		return;
+	}
+
+	memset(&batch, 0, sizeof(batch));
+	batch.client = client;
+	dbuf_queue_init(&batch.buffer);
+	if (websocket_md && WSU(client) && WSU(client)->handshake_completed)
+		batch.output = &batch.buffer;
+	else if (webserver_md && WEB(client) && WEB(client)->response_deferred)
+		batch.output = &WEB(client)->response;
+	else if (webserver_md && WEB(client) && WEB(client)->num_requests && !WEB(client)->request_header_parsed)
+		batch.output = NULL;
+	else
+		batch.output = &client->local->sendQ;
+	current_batch = &batch;
+
+	json_array_foreach(requests, index, request)
+	{
+		if (IsDead(client))
+			break;
+		if (!json_is_object(request))
+			rpc_error(client, NULL, JSON_RPC_ERROR_INVALID_REQUEST, "Each request in a batch must be a JSON object");
+		else
+			rpc_call_json(client, request);
+	}
+
+	current_batch = NULL;
+
+	if (batch.responses && batch.output)
+	{
+		if (batch.output == &batch.buffer)
+		{
+			/* Websocket: send the entire array as one message */
+			char *data;
+			int len;
+
+			dbuf_put(&batch.buffer, "]", 1);
+			len = dbuf_get(&batch.buffer, &data);
+			rpc_sendto(client, data, len);
+			safe_free(data);
+		} else {
+			dbuf_put(batch.output, "]\n", 2);
+			if (batch.output == &client->local->sendQ)
+				mark_data_to_send(client);
+		}
+	}
+	DBufClear(&batch.buffer);
+
+	/* Now send out any requests for other servers, as few RRPC's as possible */
+	rrpc_flush_all();
+}
+
 void rpc_sendto(Client *client, const char *buf, int len)
 {
 	if (IsDead(client))
 		return;
+	if (current_batch && (current_batch->client == client))
+	{
+		rpc_batch_add(buf, len);
+		return;
+	}
 	if (MyConnect(client) && IsRPC(client) && WSU(client) && WSU(client)->handshake_completed)
 	{
 		/* Websocket */
@@ -638,6 +780,23 @@ void rpc_sendto(Client *client, const char *buf, int len)
 		dbuf_put(&client->local->sendQ, newbuf, newlen);
 		safe_free(ws_sendbuf);
 		safe_free(utf8buf);
+	} else
+	if (MyConnect(client) && webserver_md && WEB(client) && WEB(client)->response_deferred)
+	{
+		/* HTTP keep-alive: the webserver sends the body together
+		 * with the headers once the request is complete.
+		 */
+		dbuf_put(&WEB(client)->response, buf, len);
+		dbuf_put(&WEB(client)->response, "\n", 1);
+		return;
+	} else
+	if (MyConnect(client) && webserver_md && WEB(client) && WEB(client)->num_requests &&
+	    !WEB(client)->request_header_parsed)
+	{
+		/* HTTP keep-alive connection that is waiting for the next
+		 * request: there is no response to add this to.
+		 */
+		return;
 	} else {
 		/* Unix domain socket or HTTP */
 		dbuf_put(&client->local->sendQ, buf, len);
@@ -1098,7 +1257,7 @@ int rpc_handle_auth(Client *client, WebRequest *web)
 	if (username && password && ((r = find_rpc_user(username))))
 	{
 		if (user_allowed_by_security_group(client, r->match) &&
-		    Auth_Check(client, r->auth, password))
+		    Auth_CheckCached(client, r->auth, r->name, password))
 		{
 			/* Authenticated! */
 			snprintf(client->name, sizeof(client->name), "RPC:%s", r->name);
@@ -1264,6 +1423,26 @@ void free_outstanding_rrpc_list(ModData *m)
 	}
 }
 
+void free_queued_rrpc(QueuedRRPC *r)
+{
+	safe_free(r->requestid);
+	json_decref(r->request);
+	DelListItem(r, queued_rrpc_list);
+	safe_free(r);
+}
+
+/* Admin unloading the RPC module for good (not called on rehash) */
+void free_queued_rrpc_list(ModData *m)
+{
+	QueuedRRPC *r, *r_next;
+
+	for (r = queued_rrpc_list; r; r = r_next)
+	{
+		r_next = r->next;
+		free_queued_rrpc(r);
+	}
+}
+
 /** Remove timer from rpc_timer_list and free it */
 void free_rpc_timer(RPCTimer *r)
 {
@@ -1315,6 +1494,7 @@ int rpc_handle_server_quit(Client *client, MessageTag *mtags)
 {
 	RRPC *r, *r_next;
 	OutstandingRRPC *or, *or_next;
+	QueuedRRPC *q, *q_next;
 
 	for (r = rrpc_list; r; r = r_next)
 	{
@@ -1336,13 +1516,25 @@ int rpc_handle_server_quit(Client *client, MessageTag *mtags)
 			{
 				json_t *j = json_object();
 				json_object_set_new(j, "id", json_string_unreal(or->requestid));
-				rpc_error(client, NULL, JSON_RPC_ERROR_SERVER_GONE, "Remote server disconnected while processing the request");
+				rpc_error(client, j, JSON_RPC_ERROR_SERVER_GONE, "Remote server disconnected while processing the request");
 				json_decref(j);
 			}
 			free_outstanding_rrpc(or);
 		}
 	}
 
+	for (q = queued_rrpc_list; q; q = q_next)
+	{
+		q_next = q->next;
+		if (!strcmp(client->id, q->destination))
+		{
+			Client *client = find_client(q->source, NULL);
+			if (client)
+				rpc_error(client, q->request, JSON_RPC_ERROR_SERVER_GONE, "Remote server disconnected before the request could be sent");
+			free_queued_rrpc(q);
+		}
+	}
+
 	return 0;
 }
 
@@ -1350,6 +1542,7 @@ EVENT(rpc_remote_timeout)
 {
 	OutstandingRRPC *or, *or_next;
 	time_t deadline = TStime() - 15;
+	int expired = 0;
 
 	for (or = outstanding_rrpc_list; or; or = or_next)
 	{
@@ -1365,8 +1558,13 @@ EVENT(rpc_remote_timeout)
 				json_decref(request);
 			}
 			free_outstanding_rrpc(or);
+			expired++;
 		}
 	}
+
+	/* This may have opened up the window for queued requests */
+	if (expired && queued_rrpc_list)
+		rrpc_flush_all();
 }
 
 RRPC *find_rrpc(const char *source, const char *destination, const char *requestid)
@@ -1398,6 +1596,20 @@ OutstandingRRPC *find_outstandingrrpc(const char *source, const char *requestid)
 	return NULL;
 }
 
+QueuedRRPC *find_queuedrrpc(const char *source, const char *requestid)
+{
+	QueuedRRPC *r;
+	for (r = queued_rrpc_list; r; r = r->next)
+	{
+		if (!strcmp(r->source, source) &&
+		    !strcmp(r->requestid, requestid))
+		{
+			return r;
+		}
+	}
+	return NULL;
+}
+
 void rrpc_pass_on_split(Client *client, Client *dest, MessageTag *recv_mtags, const char *parv[])
 {
 	char buf[MAXLINELENGTH];
@@ -1626,7 +1838,18 @@ void rpc_call_remote(RRPC *r)
 	safe_strdup(client->rpc->rpc_user, "<remote>");
 	// Note: NOT added to hash table or id table etc.
 	list_add(&client->client_node, &rpc_remote_list);
-	rpc_call_json(client, request);
+	if (json_is_array(request))
+	{
+		/* Batched RRPC: the responses are sent back one by one */
+		size_t index;
+		json_t *e;
+
+		json_array_foreach(request, index, e)
+			if (json_is_object(e))
+				rpc_call_json(client, e);
+	} else {
+		rpc_call_json(client, request);
+	}
 	json_decref(request);
 
 	/* And free the temporary client, unless it is async... */
@@ -1639,6 +1862,8 @@ void rpc_response_remote(RRPC *r)
 {
 	OutstandingRRPC *or;
 	Client *client = find_client(r->destination, NULL);
+	Client *server;
+	char destination[IDLEN+1];
 	json_t *json, *j;
 
 	if (!client)
@@ -1669,7 +1894,12 @@ void rpc_response_remote(RRPC *r)
 
 	json_decref(json);
 
+	strlcpy(destination, or->destination, sizeof(destination));
 	free_outstanding_rrpc(or);
+
+	/* One less request in flight, send the next one (if any) */
+	if (queued_rrpc_list && (server = find_client(destination, NULL)))
+		rrpc_flush(server);
 }
 
 const char *rpc_id(json_t *request)
@@ -1695,13 +1925,17 @@ const char *rpc_id(json_t *request)
 	return requestid;
 }
 
-/** Send a remote RPC (RRPC) request 'request' to server 'target'. */
-void rpc_send_generic_to_remote(Client *source, Client *target, const char *requesttype, json_t *json)
+/** Send a remote RPC (RRPC) request or response 'json' to server 'target'.
+ * @param source	The source client
+ * @param target	The target server (or client, in case of a response)
+ * @param requesttype	Either "REQ" or "RES"
+ * @param requestid	The request id, used to put the frames together again
+ * @param json		The request or response (can be an array of requests)
+ */
+void rpc_send_generic_to_remote_ex(Client *source, Client *target, const char *requesttype, const char *requestid, json_t *json)
 {
 	char *json_serialized;
-	json_t *j;
 	const char *type;
-	const char *requestid;
 	char *str;
 	int bytes; /* bytes in this frame */
 	int bytes_remaining; /* bytes remaining overall */
@@ -1709,10 +1943,6 @@ void rpc_send_generic_to_remote(Client *source, Client *target, const char *requ
 	int packet_split_size; /* chunk size of outgoing packets (depends on BIGLINES support) */
 	char data[RRPC_PACKET_BIGLINES+1];
 
-	requestid = rpc_id(json);
-	if (!requestid)
-		return;
-
 	json_serialized = json_dumps(json, 0);
 	if (!json_serialized)
 		return;
@@ -1764,6 +1994,40 @@ void rpc_send_generic_to_remote(Client *source, Client *target, const char *requ
 	safe_free(json_serialized);
 }
 
+/** Send a remote RPC (RRPC) request or response 'json' to server 'target'. */
+void rpc_send_generic_to_remote(Client *source, Client *target, const char *requesttype, json_t *json)
+{
+	const char *requestid;
+
+	requestid = rpc_id(json);
+	if (!requestid)
+		return;
+
+	rpc_send_generic_to_remote_ex(source, target, requesttype, requestid, json);
+}
+
+/** Compare two version strings like "1.0.6".
+ * @returns Less than zero, zero or greater than zero, like strcmp().
+ */
+static int rrpc_version_compare(const char *a, const char *b)
+{
+	char *end_a, *end_b;
+	long x, y;
+
+	while (*a || *b)
+	{
+		x = strtol(a, &end_a, 10);
+		y = strtol(b, &end_b, 10);
+		if (x != y)
+			return (x < y) ? -1 : 1;
+		a = (*end_a == '.') ? end_a + 1 : end_a;
+		b = (*end_b == '.') ? end_b + 1 : end_b;
+		if ((a == end_a) && (b == end_b))
+			break; /* garbage, stop here */
+	}
+	return 0;
+}
+
 int _rrpc_supported_simple(Client *target, char **problem_server)
 {
 	if (!moddata_client_get(target, "rrpc"))
@@ -1779,12 +2043,24 @@ int _rrpc_supported_simple(Client *target, char **problem_server)
 
 int _rrpc_supported(Client *target, const char *module, const char *minimum_version, char **problem_server)
 {
+	NameValuePrioList *nv;
+
 	if (!moddata_client_get(target, "rrpc"))
 	{
 		if (problem_server)
 			*problem_server = target->name;
 		return 0;
 	}
+	if (module)
+	{
+		nv = find_nvplist(RRPCMODULES(target), module);
+		if (!nv || (minimum_version && (rrpc_version_compare(nv->value, minimum_version) < 0)))
+		{
+			if (problem_server)
+				*problem_server = target->name;
+			return 0;
+		}
+	}
 	if ((target != target->direction) && !rrpc_supported_simple(target->direction, problem_server))
 		return 0;
 	return 1;
@@ -1793,7 +2069,7 @@ int _rrpc_supported(Client *target, const char *module, const char *minimum_vers
 /** Send a remote RPC (RRPC) request 'request' to server 'target'. */
 void _rpc_send_request_to_remote(Client *source, Client *target, json_t *request)
 {
-	OutstandingRRPC *r;
+	QueuedRRPC *q;
 	const char *requestid = rpc_id(request);
 	char *problem_server = NULL;
 
@@ -1804,7 +2080,7 @@ void _rpc_send_request_to_remote(Client *source, Client *target, json_t *request
 		return;
 	}
 
-	if (find_outstandingrrpc(source->id, requestid))
+	if (find_outstandingrrpc(source->id, requestid) || find_queuedrrpc(source->id, requestid))
 	{
 		rpc_error(source, NULL, JSON_RPC_ERROR_INVALID_REQUEST, "A request with that id is already in progress. Use unique id's!");
 		return;
@@ -1817,16 +2093,120 @@ void _rpc_send_request_to_remote(Client *source, Client *target, json_t *request
 		return;
 	}
 
-	/* Add the request to the "Outstanding RRPC list" */
+	/* Queue the request. It is sent right away, unless there are already
+	 * RRPC_WINDOW requests in flight to that server. While executing a
+	 * batch we wait until the end, so the requests can be packed together.
+	 */
+	q = safe_alloc(sizeof(QueuedRRPC));
+	strlcpy(q->source, source->id, sizeof(q->source));
+	strlcpy(q->destination, target->id, sizeof(q->destination));
+	safe_strdup(q->requestid, requestid);
+	json_incref(request);
+	q->request = request;
+	AppendListItem(q, queued_rrpc_list);
+
+	if (!current_batch)
+		rrpc_flush(target);
+}
+
+/** Move a queued request to the "Outstanding RRPC list" */
+static void rrpc_mark_outstanding(QueuedRRPC *q)
+{
+	OutstandingRRPC *r;
+
 	r = safe_alloc(sizeof(OutstandingRRPC));
 	r->sent = TStime();
-	strlcpy(r->source, source->id, sizeof(r->source));
-	strlcpy(r->destination, target->id, sizeof(r->destination));
-	safe_strdup(r->requestid, requestid);
+	strlcpy(r->source, q->source, sizeof(r->source));
+	strlcpy(r->destination, q->destination, sizeof(r->destination));
+	safe_strdup(r->requestid, q->requestid);
 	AddListItem(r, outstanding_rrpc_list);
+}
+
+/** Send queued requests to server 'target', as far as the window permits.
+ * Consecutive requests from the same client are sent as one RRPC REQ
+ * with a JSON array, if the remote server supports that.
+ */
+void rrpc_flush(Client *target)
+{
+	static unsigned int batch_counter = 0;
+	OutstandingRRPC *or;
+	QueuedRRPC *q, *q_next;
+	Client *source;
+	json_t *requests;
+	int inflight = 0;
+	int batch;
+	char requestid[32];
+
+	for (or = outstanding_rrpc_list; or; or = or->next)
+		if (!strcmp(or->destination, target->id))
+			inflight++;
+
+	batch = rrpc_supported(target, "rpc", RRPC_BATCH_VERSION, NULL);
+
+	/* Wait until there is room for a full batch, rather than
+	 * sending one request for every single response that comes in.
+	 */
+	if (batch && inflight && (inflight > RRPC_WINDOW - RRPC_BATCH_SIZE))
+		return;
+
+	while (inflight < RRPC_WINDOW)
+	{
+		/* Find the oldest queued request for this server */
+		for (q = queued_rrpc_list; q && strcmp(q->destination, target->id); q = q->next);
+		if (!q)
+			break;
+
+		source = find_client(q->source, NULL);
+		if (!source)
+		{
+			/* Client is gone, no need to send it anymore */
+			free_queued_rrpc(q);
+			continue;
+		}
+
+		if (!batch)
+		{
+			rrpc_mark_outstanding(q);
+			rpc_send_generic_to_remote_ex(source, target, "REQ", q->requestid, q->request);
+			free_queued_rrpc(q);
+			inflight++;
+			continue;
+		}
+
+		requests = json_array();
+		for (; q && (inflight < RRPC_WINDOW) && (json_array_size(requests) < RRPC_BATCH_SIZE); q = q_next)
+		{
+			q_next = q->next;
+			if (strcmp(q->destination, target->id) || strcmp(q->source, source->id))
+				continue;
+			rrpc_mark_outstanding(q);
+			json_array_append(requests, q->request);
+			free_queued_rrpc(q);
+			inflight++;
+		}
+
+		if (json_array_size(requests) == 1)
+		{
+			rpc_send_generic_to_remote(source, target, "REQ", json_array_get(requests, 0));
+		} else {
+			/* This id is only used for reassembling the RRPC frames */
+			snprintf(requestid, sizeof(requestid), "*batch%u", ++batch_counter);
+			rpc_send_generic_to_remote_ex(source, target, "REQ", requestid, requests);
+		}
+		json_decref(requests);
+	}
+}
+
+/** Send queued requests to all servers */
+void rrpc_flush_all(void)
+{
+	Client *acptr;
+
+	if (!queued_rrpc_list)
+		return;
 
-	/* And send it! */
-	rpc_send_generic_to_remote(source, target, "REQ", request);
+	list_for_each_entry(acptr, &global_server_list, client_node)
+		rrpc_flush(acptr);
 }
 
 /** Send a remote RPC (RRPC) request 'request' to server 'target'. */
@@ -8,7 +8,7 @@
 ModuleHeader MOD_HEADER
 = {
 	"rpc/server_ban",
-	"1.0.3",
+	"1.1.0",
 	"server_ban.* RPC calls",
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -19,6 +19,7 @@ RPC_CALL_FUNC(rpc_server_ban_list);
 RPC_CALL_FUNC(rpc_server_ban_get);
 RPC_CALL_FUNC(rpc_server_ban_del);
 RPC_CALL_FUNC(rpc_server_ban_add);
+RPC_CALL_FUNC(rpc_server_ban_import);
 
 MOD_INIT()
 {
@@ -57,6 +58,13 @@ MOD_INIT()
 		config_error("[rpc/server_ban] Could not register RPC handler");
 		return MOD_FAILED;
 	}
+	r.method = "server_ban.import";
+	r.call = rpc_server_ban_import;
+	if (!RPCHandlerAdd(modinfo->handle, &r))
+	{
+		config_error("[rpc/server_ban] Could not register RPC handler");
+		return MOD_FAILED;
+	}
 
 	return MOD_SUCCESS;
 }
@@ -113,48 +121,51 @@ RPC_CALL_FUNC(rpc_server_ban_list)
 	json_decref(result);
 }
 
-/** Shared code for selecting a server ban, for .add/.del/.get */
-int server_ban_select_criteria(Client *client, json_t *request, json_t *params,
-                               const char **name,
-                               const char **type_name,
-                               char *tkl_type_char,
-                               int *tkl_type_int,
-                               char **usermask,
-                               char **hostmask,
-                               int *soft)
+/** Parse the criteria of a server ban, for .add/.del/.get/.import.
+ * @returns 1 on success, 0 on error (with the error message in 'errbuf')
+ */
+static int server_ban_parse_criteria(Client *client, json_t *params,
+                                     const char **name,
+                                     const char **type_name,
+                                     char *tkl_type_char,
+                                     int *tkl_type_int,
+                                     char **usermask,
+                                     char **hostmask,
+                                     int *soft,
+                                     char *errbuf, size_t errbuflen)
 {
 	const char *error;
 
 	*name = json_object_get_string(params, "name");
 	if (!*name)
 	{
-		rpc_error(client, request, JSON_RPC_ERROR_INVALID_PARAMS, "Missing parameter: 'name'");
+		strlcpy(errbuf, "Missing parameter: 'name'", errbuflen);
 		return 0;
 	}
 
 	*type_name = json_object_get_string(params, "type");
 	if (!*type_name)
 	{
-		rpc_error(client, request, JSON_RPC_ERROR_INVALID_PARAMS, "Missing parameter: 'type'");
+		strlcpy(errbuf, "Missing parameter: 'type'", errbuflen);
 		return 0;
 	}
 
 	*tkl_type_char = tkl_configtypetochar(*type_name);
 	if (!*tkl_type_char)
 	{
-		rpc_error_fmt(client, request, JSON_RPC_ERROR_INVALID_PARAMS, "Invalid type: '%s'", *type_name);
+		snprintf(errbuf, errbuflen, "Invalid type: '%s'", *type_name);
 		return 0;
 	}
 	*tkl_type_int = tkl_chartotype(*tkl_type_char);
 	if (!TKLIsServerBanType(*tkl_type_int))
 	{
-		rpc_error_fmt(client, request, JSON_RPC_ERROR_INVALID_PARAMS, "Invalid type: '%s' (type exists but is not valid for in server_ban.*)", *type_name);
+		snprintf(errbuf, errbuflen, "Invalid type: '%s' (type exists but is not valid for in server_ban.*)", *type_name);
 		return 0;
 	}
 
 	if (!server_ban_parse_mask(client, 0, *tkl_type_char, *name, usermask, hostmask, soft, &error))
 	{
-		rpc_error_fmt(client, request, JSON_RPC_ERROR_INVALID_PARAMS, "Error: %s", error);
+		snprintf(errbuf, errbuflen, "Error: %s", error);
 		return 0;
 	}
 
@@ -165,6 +176,50 @@ int server_ban_select_criteria(Client *client, json_t *request, json_t *params,
 	return 1;
 }
 
+/** Shared code for selecting a server ban, for .add/.del/.get */
+int server_ban_select_criteria(Client *client, json_t *request, json_t *params,
+                               const char **name,
+                               const char **type_name,
+                               char *tkl_type_char,
+                               int *tkl_type_int,
+                               char **usermask,
+                               char **hostmask,
+                               int *soft)
+{
+	char errbuf[512];
+
+	if (!server_ban_parse_criteria(client, params, name, type_name, tkl_type_char, tkl_type_int,
+	                               usermask, hostmask, soft, errbuf, sizeof(errbuf)))
+	{
+		rpc_error(client, request, JSON_RPC_ERROR_INVALID_PARAMS, errbuf);
+		return 0;
+	}
+	return 1;
+}
+
+/** Parse the expiry time of a server ban, for .add/.import */
+static time_t server_ban_parse_expiry(json_t *params)
+{
+	const char *str;
+	time_t tkl_expire_at;
+
+	if ((str = json_object_get_string(params, "duration_string")))
+	{
+		tkl_expire_at = config_checkval(str, CFG_TIME);
+		if (tkl_expire_at > 0)
+			tkl_expire_at = TStime() + tkl_expire_at;
+	} else
+	if ((str = json_object_get_string(params, "expire_at")))
+	{
+		tkl_expire_at = server_time_to_unix_time(str);
+	} else
+	{
+		/* Never expire */
+		tkl_expire_at = 0;
+	}
+	return tkl_expire_at;
+}
+
 RPC_CALL_FUNC(rpc_server_ban_get)
 {
 	json_t *result, *list, *item;
@@ -274,7 +329,6 @@ RPC_CALL_FUNC(rpc_server_ban_add)
 	int tkl_type_int;
 	char tkl_type_str[2];
 	const char *reason;
-	const char *str;
 	time_t tkl_expire_at;
 	time_t tkl_set_at = TStime();
 
@@ -292,20 +346,7 @@ RPC_CALL_FUNC(rpc_server_ban_add)
 	REQUIRE_PARAM_STRING("reason", reason);
 
 	/* Duration / expiry time */
-	if ((str = json_object_get_string(params, "duration_string")))
-	{
-		tkl_expire_at = config_checkval(str, CFG_TIME);
-		if (tkl_expire_at > 0)
-			tkl_expire_at = TStime() + tkl_expire_at;
-	} else
-	if ((str = json_object_get_string(params, "expire_at")))
-	{
-		tkl_expire_at = server_time_to_unix_time(str);
-	} else
-	{
-		/* Never expire */
-		tkl_expire_at = 0;
-	}
+	tkl_expire_at = server_ban_parse_expiry(params);
 
 	OPTIONAL_PARAM_STRING("set_by", set_by);
 	if (!set_by)
@@ -340,3 +381,92 @@ RPC_CALL_FUNC(rpc_server_ban_add)
 	rpc_response(client, request, result);
 	json_decref(result);
 }
+
+/** Add many server bans at once.
+ * Unlike calling server_ban.add for each one, the bans are
+ * sent to the other servers in batches, and there is one
+ * log message at the end instead of one for each ban.
+ */
+RPC_CALL_FUNC(rpc_server_ban_import)
+{
+	json_t *result, *list, *item, *errors, *e;
+	const char *name, *type_name;
+	const char *set_by;
+	char *usermask, *hostmask;
+	int soft;
+	TKL *tkl;
+	char tkl_type_char;
+	int tkl_type_int;
+	const char *reason;
+	time_t tkl_expire_at;
+	time_t tkl_set_at = TStime();
+	char errbuf[512];
+	size_t i;
+	int existing = 0, added;
+
+	list = json_object_get(params, "list");
+	if (!list || !json_is_array(list))
+	{
+		rpc_error(client, request, JSON_RPC_ERROR_INVALID_PARAMS, "Missing parameter: 'list' (array)");
+		return;
+	}
+
+	errors = json_array();
+	tkl_bulk_begin(client);
+	json_array_foreach(list, i, item)
+	{
+		*errbuf = '\0';
+		if (!json_is_object(item))
+		{
+			strlcpy(errbuf, "Entry is not an object", sizeof(errbuf));
+		} else
+		if (server_ban_parse_criteria(client, item, &name, &type_name,
+		                              &tkl_type_char, &tkl_type_int,
+		                              &usermask, &hostmask, &soft,
+		                              errbuf, sizeof(errbuf)))
+		{
+			reason = json_object_get_string(item, "reason");
+			tkl_expire_at = server_ban_parse_expiry(item);
+			set_by = json_object_get_string(item, "set_by");
+			if (!set_by)
+				set_by = client->name;
+
+			if (!reason)
+			{
+				strlcpy(errbuf, "Missing parameter: 'reason'", sizeof(errbuf));
+			} else
+			if ((tkl_expire_at != 0) && (tkl_expire_at < TStime()))
+			{
+				strlcpy(errbuf, "Error: the specified expiry time is before current time (before now)", sizeof(errbuf));
+			} else
+			if (find_tkl_serverban(tkl_type_int, usermask, hostmask, soft))
+			{
+				existing++;
+			} else
+			{
+				tkl = tkl_add_serverban(tkl_type_int, usermask, hostmask, reason,
+				                        set_by, tkl_expire_at, tkl_set_at,
+				                        soft, 0);
+				if (tkl)
+					tkl_added(client, tkl);
+				else
+					strlcpy(errbuf, "Unable to add item", sizeof(errbuf));
+			}
+		}
+		if (*errbuf)
+		{
+			e = json_object();
+			json_object_set_new(e, "index", json_integer(i));
+			json_object_set_new(e, "error", json_string_unreal(errbuf));
+			json_array_append_new(errors, e);
+		}
+	}
+	added = tkl_bulk_end(client);
+
+	result = json_object();
+	json_object_set_new(result, "added", json_integer(added));
+	json_object_set_new(result, "existing", json_integer(existing));
+	json_object_set_new(result, "errors", errors);
+	rpc_response(client, request, result);
+	json_decref(result);
+}
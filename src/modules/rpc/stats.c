@@ -8,7 +8,7 @@
 ModuleHeader MOD_HEADER
 = {
 	"rpc/stats",
-	"1.0.2",
+	"1.0.3",
 	"stats.* RPC calls",
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -16,6 +16,7 @@ ModuleHeader MOD_HEADER
 
 /* Forward declarations */
 void rpc_stats_get(Client *client, json_t *request, json_t *params);
+void rpc_stats_loop(Client *client, json_t *request, json_t *params);
 
 MOD_INIT()
 {
@@ -33,6 +34,16 @@ MOD_INIT()
 		return MOD_FAILED;
 	}
 
+	memset(&r, 0, sizeof(r));
+	r.method = "stats.loop";
+	r.loglevel = ULOG_DEBUG;
+	r.call = rpc_stats_loop;
+	if (!RPCHandlerAdd(modinfo->handle, &r))
+	{
+		config_error("[rpc/stats] Could not register RPC handler");
+		return MOD_FAILED;
+	}
+
 	return MOD_SUCCESS;
 }
 
@@ -212,3 +223,85 @@ void rpc_stats_get(Client *client, json_t *request, json_t *params)
 	rpc_response(client, request, result);
 	json_decref(result);
 }
+
+void rpc_stats_loop_histogram(json_t *main, LoopHistogram *h, int detail)
+{
+	json_t *buckets;
+	int i;
+
+	json_object_set_new(main, "count", json_integer(h->count));
+	json_object_set_new(main, "avg", json_integer(h->count ? h->total / h->count : 0));
+	json_object_set_new(main, "p50", json_integer(loop_histogram_percentile(h, 50.0)));
+	json_object_set_new(main, "p90", json_integer(loop_histogram_percentile(h, 90.0)));
+	json_object_set_new(main, "p99", json_integer(loop_histogram_percentile(h, 99.0)));
+	json_object_set_new(main, "p999", json_integer(loop_histogram_percentile(h, 99.9)));
+	json_object_set_new(main, "max", json_integer(h->max));
+	if (detail >= 2)
+	{
+		/* The raw histogram: upper bound of each (non-empty) bucket and its count */
+		buckets = json_array();
+		json_object_set_new(main, "buckets", buckets);
+		for (i = 0; i < LOOP_HISTOGRAM_BUCKETS; i++)
+		{
+			if (h->bucket[i])
+			{
+				json_t *item = json_array();
+				json_array_append_new(item, json_integer(loop_histogram_bucket_value(i)));
+				json_array_append_new(item, json_integer(h->bucket[i]));
+				json_array_append_new(buckets, item);
+			}
+		}
+	}
+}
+
+void rpc_stats_loop(Client *client, json_t *request, json_t *params)
+{
+	json_t *result, *child, *list, *item, *items, *phases;
+	LoopSlowIteration *e;
+	int details, i, n;
+
+	OPTIONAL_PARAM_INTEGER("object_detail_level", details, 1);
+
+	result = json_object();
+
+	/* All values are in microseconds */
+	child = json_object();
+	json_object_set_new(result, "latency", child);
+	for (i = 0; i < LOOP_PHASES; i++)
+	{
+		item = json_object();
+		json_object_set_new(child, loop_phase_name(i), item);
+		rpc_stats_loop_histogram(item, &loop_histogram[i], details);
+	}
+
+	json_object_set_new(result, "slow_threshold_msec", json_integer(iConf.slow_loop_threshold));
+	json_object_set_new(result, "slow_total", json_integer(loop_slow_iterations_total));
+	list = json_array();
+	json_object_set_new(result, "slow", list);
+	for (n = 0; (e = loop_slow_iteration(n)); n++)
+	{
+		item = json_object();
+		json_object_set_new(item, "time", json_timestamp(e->when));
+		json_object_set_new(item, "usec", json_integer(e->usec));
+		phases = json_object();
+		json_object_set_new(item, "phases", phases);
+		for (i = 0; i < LOOP_PHASE_ITERATION; i++)
+			json_object_set_new(phases, loop_phase_name(i), json_integer(e->phase_usec[i]));
+		items = json_array();
+		json_object_set_new(item, "top", items);
+		for (i = 0; i < e->num_items; i++)
+		{
+			json_t *top = json_object();
+			json_object_set_new(top, "type", json_string_unreal(loop_trace_type_name(e->item[i].type)));
+			json_object_set_new(top, "name", json_string_unreal(e->item[i].name));
+			if (*e->item[i].client)
+				json_object_set_new(top, "client", json_string_unreal(e->item[i].client));
+			json_object_set_new(top, "usec", json_integer(e->item[i].usec));
+			json_array_append_new(items, top);
+		}
+		json_array_append_new(list, item);
+	}
+
+	rpc_response(client, request, result);
+	json_decref(result);
+}
@@ -8,15 +8,12 @@
 ModuleHeader MOD_HEADER
 = {
 	"rpc/whowas",
-	"1.0.0",
+	"1.0.1",
 	"whowas.* RPC calls",
 	"UnrealIRCd Team",
 	"unrealircd-6",
 };
 
-/* Externals */
-extern WhoWas MODVAR WHOWAS[NICKNAMEHISTORYLENGTH];
-
 /* Forward declarations */
 RPC_CALL_FUNC(rpc_whowas_get);
 
@@ -108,16 +105,37 @@ void json_expand_whowas(json_t *j, const char *key, WhoWas *e, int detail)
 		json_object_set_new(user, "account", json_string_unreal(e->account));
 }
 
+static int has_wildcards(const char *str)
+{
+	return strchr(str, '*') || strchr(str, '?');
+}
+
+static int whowas_entry_matches(WhoWas *e, const char *nick, const char *ip, const char *account)
+{
+	if (nick && !match_simple(nick, e->name))
+		return 0;
+	if (ip && (!e->ip || !match_simple(ip, e->ip)))
+		return 0;
+	if (account && (!e->account || !match_simple(account, e->account)))
+		return 0;
+	return 1;
+}
+
 RPC_CALL_FUNC(rpc_whowas_get)
 {
 	json_t *result, *list, *item;
 	int details;
-	int i;
 	const char *nick;
 	const char *ip;
+	const char *account;
+	WhoWas *e = NULL;
+	WhoWas *(*next_func)(WhoWas *) = NULL;
+	WhoWas **found = NULL;
+	int num_found = 0, found_size = 0;
 
 	OPTIONAL_PARAM_STRING("nick", nick);
 	OPTIONAL_PARAM_STRING("ip", ip);
+	OPTIONAL_PARAM_STRING("account", account);
 	OPTIONAL_PARAM_INTEGER("object_detail_level", details, 2);
 	if (details == 3)
 	{
@@ -129,18 +147,56 @@ RPC_CALL_FUNC(rpc_whowas_get)
 	list = json_array();
 	json_object_set_new(result, "list", list);
 
-	for (i=0; i < NICKNAMEHISTORYLENGTH; i++)
+	/* For an exact nick, IP or account we can use the WHOWAS indexes */
+	if (nick && !has_wildcards(nick))
 	{
-		WhoWas *e = &WHOWAS[i];
-		if (!e->name)
-			continue;
-		if (nick && !match_simple(nick, e->name))
-			continue;
-		if (ip && !match_simple(ip, e->ip))
-			continue;
-		item = json_object();
-		json_expand_whowas(item, NULL, e, details);
-		json_array_append_new(list, item);
+		e = whowas_find_nick(nick);
+		next_func = whowas_next_nick;
+	} else
+	if (ip && !has_wildcards(ip))
+	{
+		e = whowas_find_ip(ip);
+		next_func = whowas_next_ip;
+	} else
+	if (account && !has_wildcards(account))
+	{
+		e = whowas_find_account(account);
+		next_func = whowas_next_account;
+	}
+
+	if (next_func)
+	{
+		/* The index yields the newest entries first.. */
+		for (; e; e = next_func(e))
+		{
+			if (!whowas_entry_matches(e, nick, ip, account))
+				continue;
+			if (num_found == found_size)
+			{
+				found_size = found_size ? found_size * 2 : 16;
+				found = realloc(found, sizeof(WhoWas *) * found_size);
+				if (!found)
+					outofmemory(sizeof(WhoWas *) * found_size);
+			}
+			found[num_found++] = e;
+		}
+		/* ..but the list is in chronological order, like below */
+		while (num_found > 0)
+		{
+			item = json_object();
+			json_expand_whowas(item, NULL, found[--num_found], details);
+			json_array_append_new(list, item);
+		}
+		safe_free(found);
+	} else {
+		for (e = whowas_oldest(); e; e = whowas_newer(e))
+		{
+			if (!whowas_entry_matches(e, nick, ip, account))
+				continue;
+			item = json_object();
+			json_expand_whowas(item, NULL, e, details);
+			json_array_append_new(list, item);
+		}
 	}
 
 	rpc_response(client, request, result);
@@ -2106,7 +2106,7 @@ static int connect_server_helper(ConfigItem_link *aconf, Client *client)
 	else if (strchr(aconf->connect_ip, ':'))
 		SetIPV6(client);
 	
-	safe_strdup(client->ip, aconf->connect_ip ? aconf->connect_ip : "127.0.0.1");
+	set_client_ip(client, aconf->connect_ip ? aconf->connect_ip : "127.0.0.1");
 	
 	snprintf(buf, sizeof buf, "Outgoing connection: %s", get_client_name(client, TRUE));
 	client->local->fd = fd_socket(IsUnixSocket(client) ? AF_UNIX : (IsIPV6(client) ? AF_INET6 : AF_INET), SOCK_STREAM, 0, buf);
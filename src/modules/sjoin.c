@@ -29,7 +29,7 @@ CMD_FUNC(cmd_sjoin);
 ModuleHeader MOD_HEADER
   = {
 	"sjoin",
-	"5.1",
+	"5.1.1",
 	"command /sjoin", 
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -170,6 +170,7 @@ CMD_FUNC(cmd_sjoin)
 	char sj3_parabuf[BUFSIZE]; /**< Prefix for the above SJOIN buffers (":xxx SJOIN #channel +mode :") */
 	char *s = NULL;
 	Channel *channel; /**< Channel */
+	Ban *ban;
 	aParv *ap;
 	int pcount, i;
 	Hook *h;
@@ -262,33 +263,15 @@ CMD_FUNC(cmd_sjoin)
 		modebuf[1] = '\0';
 		parabuf[0] = '\0';
 		b = 1;
-		while(channel->banlist)
-		{
-			Ban *ban = channel->banlist;
+		for (ban = channel->banlist; ban; ban = ban->next)
 			Addit('b', ban->banstr);
-			channel->banlist = ban->next;
-			safe_free(ban->banstr);
-			safe_free(ban->who);
-			free_ban(ban);
-		}
-		while(channel->exlist)
-		{
-			Ban *ban = channel->exlist;
+		free_listmode_list(channel, &channel->banlist);
+		for (ban = channel->exlist; ban; ban = ban->next)
 			Addit('e', ban->banstr);
-			channel->exlist = ban->next;
-			safe_free(ban->banstr);
-			safe_free(ban->who);
-			free_ban(ban);
-		}
-		while(channel->invexlist)
-		{
-			Ban *ban = channel->invexlist;
+		free_listmode_list(channel, &channel->exlist);
+		for (ban = channel->invexlist; ban; ban = ban->next)
 			Addit('I', ban->banstr);
-			channel->invexlist = ban->next;
-			safe_free(ban->banstr);
-			safe_free(ban->who);
-			free_ban(ban);
-		}
+		free_listmode_list(channel, &channel->invexlist);
 		for (lp = channel->members; lp; lp = lp->next)
 		{
 			Membership *lp2 = find_membership_link(lp->client->user->channel, channel);
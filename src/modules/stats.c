@@ -29,7 +29,7 @@ CMD_FUNC(cmd_stats);
 ModuleHeader MOD_HEADER
   = {
 	"stats",
-	"5.0.1",
+	"5.0.5",
 	"command /stats",
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -85,6 +85,8 @@ int stats_spamfilter(Client *, const char *);
 int stats_fdtable(Client *, const char *);
 int stats_linecache(Client *client, const char *para);
 int stats_maxperip(Client *, const char *);
+int stats_memory(Client *, const char *);
+int stats_loop(Client *, const char *);
 
 #define SERVER_AS_PARA 0x1
 #define FLAGS_AS_PARA 0x2
@@ -99,6 +101,8 @@ struct statstab {
 /* Must be listed lexicographically */
 /* Long flags must be lowercase */
 struct statstab StatsTable[] = {
+	{ '8', "maxperip",	stats_maxperip,		FLAGS_AS_PARA	},
+	{ '9', "linecache",	stats_linecache,	0		},
 	{ 'B', "banversion",	stats_banversion,	0		},
 	{ 'C', "link", 		stats_links,		0 		},
 	{ 'G', "gline",		stats_gline,		FLAGS_AS_PARA	},
@@ -128,6 +132,7 @@ struct statstab StatsTable[] = {
 	{ 'm', "command",	stats_command,		0 		},
 	{ 'n', "banrealname",	stats_banrealname,	0 		},
 	{ 'o', "oper",		stats_oper,		0 		},
+	{ 'p', "loop",		stats_loop,		0		},
 	{ 'q', "bannick",	stats_bannick,		FLAGS_AS_PARA	},
 	{ 'r', "chanrestrict",	stats_chanrestrict,	0 		},
 	{ 's', "shun",		stats_shun,		FLAGS_AS_PARA	},
@@ -136,8 +141,7 @@ struct statstab StatsTable[] = {
 	{ 'v', "denyver",	stats_denyver,		0 		},
 	{ 'x', "notlink",	stats_notlink,		0 		},
 	{ 'y', "class",		stats_class,		0 		},
-	{ '8', "maxperip",	stats_maxperip,		0		},
-	{ '9', "linecache",	stats_linecache,	0		},
+	{ 'z', "memory",	stats_memory,		FLAGS_AS_PARA	},
 	{ 0, 	NULL, 		NULL, 			0		}
 };
 
@@ -209,6 +213,7 @@ static inline void stats_help(Client *client)
 	sendnumeric(client, RPL_STATSHELP, "M - command - Send list of how many times each command was used");
 	sendnumeric(client, RPL_STATSHELP, "n - banrealname - Send the ban realname block list");
 	sendnumeric(client, RPL_STATSHELP, "O - oper - Send the oper block list");
+	sendnumeric(client, RPL_STATSHELP, "p - loop - Send main loop latency and recent slow iterations");
 	sendnumeric(client, RPL_STATSHELP, "P - port - Send information about ports");
 	sendnumeric(client, RPL_STATSHELP, "q - bannick - Send the ban nick block list");
 	sendnumeric(client, RPL_STATSHELP, "Q - sqline - Send the global qline list");
@@ -228,6 +233,8 @@ static inline void stats_help(Client *client)
 	sendnumeric(client, RPL_STATSHELP, "W - fdtable - Send the FD table listing");
 	sendnumeric(client, RPL_STATSHELP, "X - notlink - Send the list of servers that are not current linked");
 	sendnumeric(client, RPL_STATSHELP, "Y - class - Send the class block list");
+	sendnumeric(client, RPL_STATSHELP, "z - memory - Send estimated memory usage of local connections");
+	sendnumeric(client, RPL_STATSHELP, "  Optional parameters: <server> [nick-mask] to list individual connections");
 }
 
 static inline int allow_user_stats_short(char c)
@@ -612,12 +619,16 @@ int stats_traffic(Client *client, const char *para)
 	sendnumericfmt(client, RPL_STATSDEBUG, "numerics seen %u mode fakes %u", sp->is_num, sp->is_fake);
 	sendnumericfmt(client, RPL_STATSDEBUG, "auth successes %u fails %u", sp->is_asuc, sp->is_abad);
 	sendnumericfmt(client, RPL_STATSDEBUG, "local connections %u udp packets %u", sp->is_loc, sp->is_udp);
+	sendnumericfmt(client, RPL_STATSDEBUG, "tls handshakes %u fails %u", sp->is_tls, sp->is_tlsbad);
 	sendnumericfmt(client, RPL_STATSDEBUG, "Client Server");
 	sendnumericfmt(client, RPL_STATSDEBUG, "connected %u %u", sp->is_cl, sp->is_sv);
 	sendnumericfmt(client, RPL_STATSDEBUG, "messages sent %lld", me.local->traffic.messages_sent);
 	sendnumericfmt(client, RPL_STATSDEBUG, "messages received %lld", me.local->traffic.messages_received);
 	sendnumericfmt(client, RPL_STATSDEBUG, "bytes sent %lld", me.local->traffic.bytes_sent);
 	sendnumericfmt(client, RPL_STATSDEBUG, "bytes received %lld", me.local->traffic.bytes_received);
+	sendnumericfmt(client, RPL_STATSDEBUG, "socket reads %lld avg %lld bytes",
+	    me.local->traffic.reads,
+	    me.local->traffic.reads ? me.local->traffic.bytes_received / me.local->traffic.reads : 0LL);
 	sendnumericfmt(client, RPL_STATSDEBUG, "time connected %lld %lld",
 	    (long long)sp->is_cti, (long long)sp->is_sti);
 
@@ -1082,12 +1093,23 @@ int stats_linecache(Client *client, const char *para)
 	return 0;
 }
 
-int stats_maxperip(Client *client, const char *para)
+static void stats_maxperip_entry(const char *key, int bits, void *value, void *data)
 {
-	int i;
-	IpUsersBucket *e;
+	Client *client = (Client *)data;
+	IpUsersBucket *e = (IpUsersBucket *)value;
 	char ipbuf[256];
-	const char *ip;
+
+	sendtxtnumeric(client, "%s %s: %d local / %d global",
+		       ipindex_key_is_ipv4(key) ? "IPv4" : "IPv6",
+		       ipindex_key_to_ip(key, ipbuf, sizeof(ipbuf)),
+		       e->local_clients, e->global_clients);
+}
+
+/** STATS maxperip [server] [mask]: list the IP users buckets, optionally only those within a CIDR mask */
+int stats_maxperip(Client *client, const char *para)
+{
+	char key[IPINDEX_KEYLEN];
+	int bits;
 
 	if (!ValidatePermissionsForPath("server:info:stats",client,NULL,NULL,NULL))
 	{
@@ -1095,31 +1117,151 @@ int stats_maxperip(Client *client, const char *para)
 		return 0;
 	}
 
-	sendtxtnumeric(client, "MaxPerIp IPv4 hash table:");
-	for (i=0; i < IPUSERS_HASH_TABLE_SIZE; i++)
+	if (!BadPtr(para))
 	{
-		for (e = IpUsersHash_ipv4[i]; e; e = e->next)
+		if (!ipindex_mask_key(para, key, &bits))
 		{
-			ip = inetntop(AF_INET, e->rawip, ipbuf, sizeof(ipbuf));
-			if (!ip)
-				ip = "<invalid>";
-			sendtxtnumeric(client, "IPv4 #%d %s: %d local / %d global",
-				       i, ip, e->local_clients, e->global_clients);
+			sendnotice(client, "Invalid IP address or CIDR mask: %s", para);
+			return 0;
 		}
+		sendtxtnumeric(client, "MaxPerIp entries within %s:", para);
+		ipindex_walk(&ipusers_index, key, bits, stats_maxperip_entry, client);
+		return 0;
 	}
 
-	sendtxtnumeric(client, "MaxPerIp IPv6 hash table:");
-	for (i=0; i < IPUSERS_HASH_TABLE_SIZE; i++)
+	sendtxtnumeric(client, "MaxPerIp entries (%d):", ipusers_index.count);
+	ipindex_walk(&ipusers_index, NULL, 0, stats_maxperip_entry, client);
+	return 0;
+}
+
+/** Size of the blocks in use by a send or receive queue */
+static long dbuf_memory(dbuf *d)
+{
+	struct list_head *e;
+	long n = 0;
+
+	list_for_each(e, &d->dbuf_list)
+		n += sizeof(dbufbuf);
+	return n;
+}
+
+/** Estimated memory used by a local connection, broken down */
+static void connection_memory(Client *client, long *base, long *queues, long *tls, int *buffered)
+{
+	*base = sizeof(Client) + sizeof(LocalClient);
+	if (client->user)
+		*base += sizeof(User);
+	*queues = dbuf_memory(&client->local->sendQ) + dbuf_memory(&client->local->recvQ);
+	*tls = tls_memory_estimate(client, buffered);
+}
+
+static void stats_memory_list(Client *client, struct list_head *list, const char *mask,
+                              long long *total, int *count, int *tls_count, int *tls_buffered)
+{
+	Client *acptr;
+	long base, queues, tls;
+	int buffered;
+
+	list_for_each_entry(acptr, list, lclient_node)
 	{
-		for (e = IpUsersHash_ipv6[i]; e; e = e->next)
+		connection_memory(acptr, &base, &queues, &tls, &buffered);
+		total[0] += base;
+		total[1] += queues;
+		total[2] += tls;
+		(*count)++;
+		if (acptr->local->ssl)
 		{
-			ip = inetntop(AF_INET6, e->rawip, ipbuf, sizeof(ipbuf));
-			if (!ip)
-				ip = "<invalid>";
-			sendtxtnumeric(client, "IPv6 #%d %s: %d local / %d global",
-				       i, ip, e->local_clients, e->global_clients);
+			(*tls_count)++;
+			if (buffered)
+				(*tls_buffered)++;
 		}
+		if (mask && match_simple(mask, acptr->name))
+		{
+			sendtxtnumeric(client, "%s: %ld bytes [client %ld, queues %ld, tls %ld]",
+			               acptr->name, base+queues+tls, base, queues, tls);
+		}
+	}
+}
+
+int stats_memory(Client *client, const char *para)
+{
+	long long total[3] = { 0, 0, 0 };
+	int count = 0, tls_count = 0, tls_buffered = 0;
+
+	if (!ValidatePermissionsForPath("server:info:stats",client,NULL,NULL,NULL))
+	{
+		sendnumeric(client, ERR_NOPRIVILEGES);
+		return 0;
+	}
+
+	if (para && !*para)
+		para = NULL;
+
+	stats_memory_list(client, &lclient_list, para, total, &count, &tls_count, &tls_buffered);
+	stats_memory_list(client, &unknown_list, para, total, &count, &tls_count, &tls_buffered);
+
+	sendtxtnumeric(client, "Local connections: %d, of which TLS: %d (holding record buffers: %d)",
+	               count, tls_count, tls_buffered);
+	sendtxtnumeric(client, "Estimated memory: client structs %lld, queues %lld, tls %lld, total %lld bytes",
+	               total[0], total[1], total[2], total[0]+total[1]+total[2]);
+	if (count)
+	{
+		sendtxtnumeric(client, "Estimated memory per connection: %lld bytes",
+		               (total[0]+total[1]+total[2]) / count);
 	}
+	return 0;
+}
+
+int stats_loop(Client *client, const char *para)
+{
+	LoopHistogram *h;
+	LoopSlowIteration *e;
+	int i, n;
 
+	if (!ValidatePermissionsForPath("server:info:stats",client,NULL,NULL,NULL))
+	{
+		sendnumeric(client, ERR_NOPRIVILEGES);
+		return 0;
+	}
+
+	sendnumericfmt(client, RPL_STATSDEBUG, "Main loop latency in usec:");
+	for (i = 0; i < LOOP_PHASES; i++)
+	{
+		h = &loop_histogram[i];
+		sendnumericfmt(client, RPL_STATSDEBUG,
+		               "%-9s count %lld avg %lld p50 %lld p90 %lld p99 %lld p99.9 %lld max %lld",
+		               loop_phase_name(i), h->count, h->count ? h->total / h->count : 0,
+		               loop_histogram_percentile(h, 50.0),
+		               loop_histogram_percentile(h, 90.0),
+		               loop_histogram_percentile(h, 99.0),
+		               loop_histogram_percentile(h, 99.9),
+		               h->max);
+	}
+
+	if (!iConf.slow_loop_threshold)
+	{
+		sendnumericfmt(client, RPL_STATSDEBUG, "Slow iteration tracing is disabled (set::slow-loop-threshold)");
+		return 0;
+	}
+	sendnumericfmt(client, RPL_STATSDEBUG, "Slow iterations (over %ld msec): %lld",
+	               iConf.slow_loop_threshold, loop_slow_iterations_total);
+	for (n = 0; (e = loop_slow_iteration(n)); n++)
+	{
+		sendnumericfmt(client, RPL_STATSDEBUG,
+		               "#%d %lld seconds ago: %lld usec (events %lld, io %lld, clients %lld)",
+		               n+1, (long long)(TStime() - e->when), e->usec,
+		               e->phase_usec[LOOP_PHASE_EVENTS],
+		               e->phase_usec[LOOP_PHASE_IO],
+		               e->phase_usec[LOOP_PHASE_CLIENTS]);
+		for (i = 0; i < e->num_items; i++)
+		{
+			sendnumericfmt(client, RPL_STATSDEBUG, "   %s %s%s%s: %lld usec",
+			               loop_trace_type_name(e->item[i].type),
+			               e->item[i].name,
+			               *e->item[i].client ? " from " : "",
+			               e->item[i].client,
+			               e->item[i].usec);
+		}
+	}
 	return 0;
 }
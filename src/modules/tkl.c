@@ -26,7 +26,7 @@
 ModuleHeader MOD_HEADER
 = {
 	"tkl",
-	"5.0",
+	"5.1.0",
 	"Server ban commands such as /GLINE, /SPAMFILTER, etc.",
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -110,6 +110,33 @@ int _server_ban_exception_parse_mask(Client *client, int add, const char *bantyp
 static void add_default_exempts(void);
 int parse_extended_server_ban(const char *mask_in, Client *client, char **error, int skip_checking, char *buf1, size_t buf1len, char *buf2, size_t buf2len);
 void _tkl_added(Client *client, TKL *tkl);
+EVENT(tkl_check_new_bans);
+void tkl_bancheck_queue(TKL *tkl);
+void tkl_bancheck_unqueue(TKL *tkl);
+void tkl_bancheck_pending_clear(void);
+int tkl_ban_client(Client *client, TKL *tkl);
+int find_tkline_match_matcher(Client *client, int skip_soft, TKL *tkl);
+int find_shun_matcher(Client *client, TKL *tkl);
+void tkl_ipusers_add(Client *client);
+int tkl_ipusers_free_client(Client *client);
+void tkl_ipusers_del(Client *client, const char *rawip);
+void tkl_ipusers_free_all(void);
+void tkl_expiry_update(TKL *tkl);
+void _tkl_bulk_begin(Client *client);
+int _tkl_bulk_end(Client *client);
+void tkl_bulk_queue(TKL *tkl);
+void tkl_bulk_unqueue(TKL *tkl);
+void tkl_bulk_flush(Client *sender, Client *skip);
+void tkl_sync_index_add(TKL *tkl);
+void tkl_sync_index_del(TKL *tkl);
+void tkl_sync_md_free(ModData *m);
+EVENT(tkl_sync_continue);
+CMD_FUNC(cmd_tkld);
+const char *tkl_md_serialize(ModData *m);
+void tkl_md_unserialize(const char *str, ModData *m);
+CMD_FUNC(cmd_tklb);
+CMD_FUNC(cmd_tkl_import);
+CMD_FUNC(cmd_tkl_export);
 
 /* Externals (only for us :D) */
 extern int MODVAR spamf_ugly_vchanoverride;
@@ -166,6 +193,87 @@ int mtag_spamfilters_present = 0; /**< Are any spamfilters with type SPAMF_MTAG
 long previous_spamfilter_utf8 = 0;
 static int firstboot = 0;
 
+/* Server bans that were added recently and still need to be
+ * checked against the local users, see tkl_check_new_bans().
+ */
+static TKL **bancheck_pending = NULL;
+static int bancheck_pending_num = 0;
+static int bancheck_pending_max = 0;
+/* The list that tkl_check_new_bans() is working on */
+static TKL **bancheck_running = NULL;
+static int bancheck_running_num = 0;
+
+/* Local clients by IP address, so a new IP or CIDR ban can find the
+ * affected clients directly rather than by going through all clients.
+ * This includes clients that are still registering (added on accept).
+ */
+typedef struct TKLIPUsers TKLIPUsers;
+struct TKLIPUsers {
+	Client **clients;
+	int num_clients;
+	int max_clients;
+};
+static IPIndex tkl_ipusers_index;
+
+/** Level of TKL protocol support, announced to other servers via moddata.
+ * 1: understands TKLB (batched TKL lines)
+ */
+#define TKL_PROTOCOL		"1"
+#define TKL_PROTOCOL_BATCH	1
+
+/** Max length of a TKLB line, leaving room for the source and command */
+#define TKLB_LINE_MAX		(MAXLINELENGTH - 512)
+
+/* State of a bulk operation, see tkl_bulk_begin() */
+static int bulk_depth = 0;
+static TKL **bulk_pending = NULL;
+static int bulk_pending_num = 0;
+static int bulk_pending_max = 0;
+static int bulk_added[4]; /* server bans, ban exceptions, name bans, spamfilters */
+ModDataInfo *tkl_md;
+
+/** A TKLB line that is being built, see tkl_batch_add() */
+typedef struct TKLBatch TKLBatch;
+struct TKLBatch {
+	Client *sender;
+	Client *to;
+	char *buf;
+	int len;
+};
+
+/** State of the TKL sync with a server that is linking in, see tkl_sync().
+ * Global TKL entries are hashed to one of TKL_SYNC_LEAVES leaves by their
+ * type and mask (tkl_sync_leaf[]). The digest of a leaf is the XOR of the
+ * hashes of the entries in TKL line format, so it differs between two
+ * servers if either side has an entry that the other lacks, or has it
+ * with a different set_at, expiry, setter or reason.
+ */
+typedef struct TKLSync TKLSync;
+struct TKLSync {
+	uint64_t *leaf_hash; /**< Digest of our leaves, until the other side is done comparing */
+	unsigned char send_leaf[TKL_SYNC_LEAVES/8]; /**< Leaves to send (bitmap) */
+	int leaves; /**< Number of leaves to send */
+	int next_leaf; /**< Next leaf to send, or -1 if not sending (yet) */
+	int digest; /**< Compared digests with the other side (TKLD) */
+	int sent; /**< Number of entries sent */
+	time_t last_progress; /**< Last time we could send entries, see TKL_SYNC_STALL_TIME */
+};
+ModDataInfo *tklsync_md;
+#define TKLSYNC(x)	((TKLSync *)moddata_local_client(x, tklsync_md).ptr)
+
+/** The key for hashing TKL entries in the digest. This must be the
+ * same on all servers, so unlike elsewhere this is not a random key.
+ */
+static const char tkl_sync_hashkey[SIPHASH_KEY_LENGTH] = "UnrealIRCd TKLD";
+
+/** Stop sending TKL entries when the sendQ of the server is above this */
+#define TKL_SYNC_SENDQ_WATERMARK(x)	(get_sendq(x) / 2)
+
+/** If the sendQ of the server stays above TKL_SYNC_SENDQ_WATERMARK() for
+ * this many seconds, send the remaining TKL entries anyway.
+ */
+#define TKL_SYNC_STALL_TIME	10
+
 MOD_TEST()
 {
 	MARK_AS_OFFICIAL_MODULE(modinfo);
@@ -221,14 +329,41 @@ MOD_TEST()
 	EfunctionAdd(modinfo->handle, EFUNC_SERVER_BAN_PARSE_MASK, TO_INTFUNC(_server_ban_parse_mask));
 	EfunctionAdd(modinfo->handle, EFUNC_SERVER_BAN_EXCEPTION_PARSE_MASK, TO_INTFUNC(_server_ban_exception_parse_mask));
 	EfunctionAddVoid(modinfo->handle, EFUNC_TKL_ADDED, _tkl_added);
+	EfunctionAddVoid(modinfo->handle, EFUNC_TKL_BULK_BEGIN, _tkl_bulk_begin);
+	EfunctionAdd(modinfo->handle, EFUNC_TKL_BULK_END, _tkl_bulk_end);
 	return MOD_SUCCESS;
 }
 
 MOD_INIT()
 {
+	ModDataInfo mreq;
+
 	MARK_AS_OFFICIAL_MODULE(modinfo);
 	if (loop.booted == 0)
 		firstboot = 1;
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.name = "tkl";
+	mreq.type = MODDATATYPE_CLIENT;
+	mreq.serialize = tkl_md_serialize;
+	mreq.unserialize = tkl_md_unserialize;
+	mreq.sync = 1;
+	mreq.self_write = 1;
+	tkl_md = ModDataAdd(modinfo->handle, mreq);
+	if (!tkl_md)
+	{
+		config_error("[tkl] Unable to ModDataAdd() -- too many 3rd party modules loaded perhaps?");
+		abort();
+	}
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.name = "tklsync";
+	mreq.type = MODDATATYPE_LOCAL_CLIENT;
+	mreq.free = tkl_sync_md_free;
+	tklsync_md = ModDataAdd(modinfo->handle, mreq);
+	if (!tklsync_md)
+	{
+		config_error("[tkl] Unable to ModDataAdd() -- too many 3rd party modules loaded perhaps?");
+		abort();
+	}
 	LoadPersistentLong(modinfo, previous_spamfilter_utf8);
 	HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN, 0, tkl_config_run_spamfilter);
 	HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN, 0, tkl_config_run_ban);
@@ -236,6 +371,7 @@ MOD_INIT()
 	HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN, 0, tkl_config_run_set);
 	HookAdd(modinfo->handle, HOOKTYPE_IP_CHANGE, 2000000000, tkl_ip_change);
 	HookAdd(modinfo->handle, HOOKTYPE_ACCEPT, -1000, tkl_accept);
+	HookAdd(modinfo->handle, HOOKTYPE_FREE_CLIENT, 0, tkl_ipusers_free_client);
 	CommandAdd(modinfo->handle, "GLINE", cmd_gline, 3, CMD_OPER);
 	CommandAdd(modinfo->handle, "SHUN", cmd_shun, 3, CMD_OPER);
 	CommandAdd(modinfo->handle, "TEMPSHUN", cmd_tempshun, 2, CMD_OPER);
@@ -245,20 +381,43 @@ MOD_INIT()
 	CommandAdd(modinfo->handle, "SPAMFILTER", cmd_spamfilter, 7, CMD_OPER);
 	CommandAdd(modinfo->handle, "ELINE", cmd_eline, 4, CMD_OPER);
 	CommandAdd(modinfo->handle, "TKL", _cmd_tkl, MAXPARA, CMD_OPER|CMD_SERVER);
+	CommandAdd(modinfo->handle, "TKLB", cmd_tklb, MAXPARA, CMD_SERVER|CMD_BIGLINES);
+	CommandAdd(modinfo->handle, "TKLD", cmd_tkld, MAXPARA, CMD_SERVER|CMD_BIGLINES);
+	CommandAdd(modinfo->handle, "TKLIMPORT", cmd_tkl_import, MAXPARA, CMD_CONTROL);
+	CommandAdd(modinfo->handle, "TKLEXPORT", cmd_tkl_export, MAXPARA, CMD_CONTROL);
 	add_default_exempts();
 	return MOD_SUCCESS;
 }
 
 MOD_LOAD()
 {
+	Client *client;
+
 	check_mtag_spamfilters_present();
 	check_set_spamfilter_utf8_setting_changed();
-	EventAdd(modinfo->handle, "tklexpire", tkl_check_expire, NULL, 5000, 0);
+	EventAdd(modinfo->handle, "tklexpire", tkl_check_expire, NULL, 1000, 0);
+	EventAdd(modinfo->handle, "tkl_check_new_bans", tkl_check_new_bans, NULL, 1000, 0);
+	EventAdd(modinfo->handle, "tkl_sync_continue", tkl_sync_continue, NULL, 100, 0);
+	moddata_client_set(&me, "tkl", TKL_PROTOCOL);
+
+	/* (Re)build the index of local clients by IP */
+	list_for_each_entry(client, &lclient_list, lclient_node)
+		if (!IsServer(client))
+			tkl_ipusers_add(client);
+	list_for_each_entry(client, &unknown_list, lclient_node)
+		tkl_ipusers_add(client);
+
 	return MOD_SUCCESS;
 }
 
 MOD_UNLOAD()
 {
+	safe_free(bulk_pending);
+	bulk_pending_num = bulk_pending_max = 0;
+	tkl_bancheck_pending_clear();
+	safe_free(bancheck_pending);
+	bancheck_pending_max = 0;
+	tkl_ipusers_free_all();
 	SavePersistentLong(modinfo, previous_spamfilter_utf8);
 	return MOD_SUCCESS;
 }
@@ -960,6 +1119,14 @@ char *spamfilter_id(TKL *tk)
 int tkl_ip_change(Client *client, const char *oldip)
 {
 	TKL *tkl;
+	char oldrawip[IPINDEX_KEYLEN];
+
+	if (MyConnect(client) && !IsServer(client))
+	{
+		if (ipindex_key(oldip, oldrawip))
+			tkl_ipusers_del(client, oldrawip);
+		tkl_ipusers_add(client);
+	}
 	if ((tkl = find_tkline_match_zap(client)))
 		banned_client(client, "Z-Lined", tkl->ptr.serverban->reason, (tkl->type & TKL_GLOBAL)?1:0, 0);
 	return 0;
@@ -973,6 +1140,7 @@ int tkl_accept(Client *client)
 		banned_client(client, "Z-Lined", tkl->ptr.serverban->reason, (tkl->type & TKL_GLOBAL)?1:0, NO_EXIT_CLIENT);
 		return 2; // TODO: HOOK_DENY_ALWAYS;
 	}
+	tkl_ipusers_add(client);
 	return 0;
 }
 
@@ -2487,41 +2655,55 @@ int tkl_banexception_matches_type(TKL *except, int bantype)
 	return 0;
 }
 
-/** Used for finding out which element of the tkl_ip hash table is used (primary element) */
-int _tkl_ip_hash(char *ip)
+/** Calculate the tkl_ip hash table element from a binary IP, see ipindex_key() */
+static int tkl_ip_hash_key(const char *key)
 {
-	char ipbuf[64], *p;
+	const unsigned char *b = (const unsigned char *)key;
 
-	for (p = ip; *p; p++)
-	{
-		if ((*p == '?') || (*p == '*') || (*p == '/'))
-			return -1; /* not an entry suitable for the ip hash table */
-	}
-	if (inet_pton(AF_INET, ip, &ipbuf) == 1)
+	if (ipindex_key_is_ipv4(key))
 	{
 		/* IPv4 */
-		unsigned int v = (ipbuf[0] << 24) +
-		                 (ipbuf[1] << 16) +
-		                 (ipbuf[2] << 8)  +
-		                 ipbuf[3];
+		unsigned int v = (b[12] << 24) +
+		                 (b[13] << 16) +
+		                 (b[14] << 8)  +
+		                 b[15];
 		return v % TKLIPHASHLEN2;
 	} else
-	if (inet_pton(AF_INET6, ip, &ipbuf) == 1)
 	{
 		/* IPv6 (only upper 64 bits) */
-		unsigned int v1 = (ipbuf[0] << 24) +
-		                 (ipbuf[1] << 16) +
-		                 (ipbuf[2] << 8)  +
-		                 ipbuf[3];
-		unsigned int v2 = (ipbuf[4] << 24) +
-		                 (ipbuf[5] << 16) +
-		                 (ipbuf[6] << 8)  +
-		                 ipbuf[7];
+		unsigned int v1 = (b[0] << 24) +
+		                 (b[1] << 16) +
+		                 (b[2] << 8)  +
+		                 b[3];
+		unsigned int v2 = (b[4] << 24) +
+		                 (b[5] << 16) +
+		                 (b[6] << 8)  +
+		                 b[7];
 		return (v1 ^ v2) % TKLIPHASHLEN2;
-	} else
+	}
+}
+
+/** Used for finding out which element of the tkl_ip hash table is used (primary element) */
+int _tkl_ip_hash(char *ip)
+{
+	char key[IPINDEX_KEYLEN], *p;
+
+	for (p = ip; *p; p++)
 	{
-		return -1;
+		if ((*p == '?') || (*p == '*') || (*p == '/'))
+			return -1; /* not an entry suitable for the ip hash table */
 	}
+	if (!ipindex_key(ip, key))
+		return -1;
+	return tkl_ip_hash_key(key);
+}
+
+/** Same as tkl_ip_hash(GetIP(client)) but without parsing the IP string */
+static int tkl_ip_hash_client(Client *client)
+{
+	if (HasRawIP(client))
+		return tkl_ip_hash_key(client->rawip);
+	return tkl_ip_hash(GetIP(client));
 }
 
 // TODO: consider efunc
@@ -2607,6 +2789,7 @@ TKL *_tkl_add_spamfilter(int type, unsigned short target, BanAction action, Matc
 	tkl->set_at = set_at;
 	safe_strdup(tkl->set_by, set_by);
 	tkl->expire_at = expire_at;
+	tkl_expiry_update(tkl);
 	/* Then the spamfilter fields */
 	tkl->ptr.spamfilter = safe_alloc(sizeof(Spamfilter));
 	tkl->ptr.spamfilter->target = target;
@@ -2623,6 +2806,7 @@ TKL *_tkl_add_spamfilter(int type, unsigned short target, BanAction action, Matc
 	/* Spamfilters go via the normal TKL list... */
 	index = tkl_hash(tkl_typetochar(type));
 	AddListItem(tkl, tklines[index]);
+	tkl_sync_index_add(tkl);
 
 	if (target & SPAMF_MTAG)
 		mtag_spamfilters_present = 1;
@@ -2663,6 +2847,7 @@ TKL *_tkl_add_serverban(int type, char *usermask, char *hostmask, char *reason,
 	tkl->set_at = set_at;
 	safe_strdup(tkl->set_by, set_by);
 	tkl->expire_at = expire_at;
+	tkl_expiry_update(tkl);
 	/* Now the server ban fields */
 	tkl->ptr.serverban = safe_alloc(sizeof(ServerBan));
 	safe_strdup(tkl->ptr.serverban->usermask, usermask);
@@ -2679,6 +2864,7 @@ TKL *_tkl_add_serverban(int type, char *usermask, char *hostmask, char *reason,
 		if (index2 >= 0)
 		{
 			AddListItem(tkl, tklines_ip_hash[index][index2]);
+			tkl_sync_index_add(tkl);
 			return tkl;
 		}
 	}
@@ -2686,6 +2872,7 @@ TKL *_tkl_add_serverban(int type, char *usermask, char *hostmask, char *reason,
 	/* If we get here it's just for our normal list.. */
 	index = tkl_hash(tkl_typetochar(type));
 	AddListItem(tkl, tklines[index]);
+	tkl_sync_index_add(tkl);
 
 	return tkl;
 }
@@ -2726,6 +2913,7 @@ TKL *_tkl_add_banexception(int type, char *usermask, char *hostmask, SecurityGro
 	tkl->set_at = set_at;
 	safe_strdup(tkl->set_by, set_by);
 	tkl->expire_at = expire_at;
+	tkl_expiry_update(tkl);
 	/* Now the ban except fields */
 	tkl->ptr.banexception = safe_alloc(sizeof(BanException));
 	safe_strdup(tkl->ptr.banexception->usermask, usermask);
@@ -2744,6 +2932,7 @@ TKL *_tkl_add_banexception(int type, char *usermask, char *hostmask, SecurityGro
 		if (index2 >= 0)
 		{
 			AddListItem(tkl, tklines_ip_hash[index][index2]);
+			tkl_sync_index_add(tkl);
 			return tkl;
 		}
 	}
@@ -2751,6 +2940,7 @@ TKL *_tkl_add_banexception(int type, char *usermask, char *hostmask, SecurityGro
 	/* If we get here it's just for our normal list.. */
 	index = tkl_hash(tkl_typetochar(type));
 	AddListItem(tkl, tklines[index]);
+	tkl_sync_index_add(tkl);
 
 	return tkl;
 }
@@ -2787,6 +2977,7 @@ TKL *_tkl_add_nameban(int type, char *name, int hold, char *reason, char *set_by
 	tkl->set_at = set_at;
 	safe_strdup(tkl->set_by, set_by);
 	tkl->expire_at = expire_at;
+	tkl_expiry_update(tkl);
 	/* Now the name ban fields */
 	tkl->ptr.nameban = safe_alloc(sizeof(ServerBan));
 	safe_strdup(tkl->ptr.nameban->name, name);
@@ -2796,6 +2987,7 @@ TKL *_tkl_add_nameban(int type, char *name, int hold, char *reason, char *set_by
 	/* Name bans go via the normal TKL list.. */
 	index = tkl_hash(tkl_typetochar(type));
 	AddListItem(tkl, tklines[index]);
+	tkl_sync_index_add(tkl);
 
 	return tkl;
 }
@@ -2893,6 +3085,14 @@ void _tkl_del_line(TKL *tkl)
 		DelListItem(tkl, tklines[index]);
 	}
 
+	if (tkl->flags & TKL_FLAG_BANCHECK_PENDING)
+		tkl_bancheck_unqueue(tkl);
+	if (tkl->flags & TKL_FLAG_BULK_PENDING)
+		tkl_bulk_unqueue(tkl);
+	if (tkl->flags & TKL_FLAG_SYNC_INDEXED)
+		tkl_sync_index_del(tkl);
+	expiry_heap_del(&tkl_expiry_heap, &tkl->expiry);
+
 	/* Finally, free the entry */
 	free_tkl(tkl);
 	check_mtag_spamfilters_present();
@@ -3050,43 +3250,25 @@ void tkl_expire_entry(TKL *tkl)
 	tkl_del_line(tkl);
 }
 
-/** Regularly check TKL entries for expiration */
-EVENT(tkl_check_expire)
+/** Add or update a TKL entry in the expiry heap, after expire_at was set */
+void tkl_expiry_update(TKL *tkl)
 {
-	TKL *tkl, *next;
-	time_t nowtime;
-	int index, index2;
-
-	nowtime = TStime();
+	if (tkl->expire_at)
+		expiry_heap_add(&tkl_expiry_heap, &tkl->expiry, tkl->expire_at);
+	else
+		expiry_heap_del(&tkl_expiry_heap, &tkl->expiry);
+}
 
-	/* First, hashed entries.. */
-	for (index = 0; index < TKLIPHASHLEN1; index++)
-	{
-		for (index2 = 0; index2 < TKLIPHASHLEN2; index2++)
-		{
-			for (tkl = tklines_ip_hash[index][index2]; tkl; tkl = next)
-			{
-				next = tkl->next;
-				if (tkl->expire_at <= nowtime && !(tkl->expire_at == 0))
-				{
-					tkl_expire_entry(tkl);
-				}
-			}
-		}
-	}
+/** Regularly check TKL entries for expiration.
+ * This only looks at the entries that expired, see tkl_expiry_heap.
+ */
+EVENT(tkl_check_expire)
+{
+	ExpiryHeapNode *n;
+	time_t nowtime = TStime();
 
-	/* Now normal entries.. */
-	for (index = 0; index < TKLISTLEN; index++)
-	{
-		for (tkl = tklines[index]; tkl; tkl = next)
-		{
-			next = tkl->next;
-			if (tkl->expire_at <= nowtime && !(tkl->expire_at == 0))
-			{
-				tkl_expire_entry(tkl);
-			}
-		}
-	}
+	while ((n = expiry_heap_pop(&tkl_expiry_heap, nowtime)))
+		tkl_expire_entry(container_of(n, TKL, expiry));
 }
 
 /* This is just a helper function for find_tkl_exception() */
@@ -3139,7 +3321,7 @@ int _find_tkl_exception(int ban_type, Client *client)
 
 	/* First, the TKL ip hash table entries.. */
 	index = tkl_ip_hash_type('e');
-	index2 = tkl_ip_hash(GetIP(client));
+	index2 = tkl_ip_hash_client(client);
 	if (index2 >= 0)
 	{
 		for (tkl = tklines_ip_hash[index][index2]; tkl; tkl = tkl->next)
@@ -3208,7 +3390,7 @@ int _find_tkline_match(Client *client, int skip_soft)
 		return 0;
 
 	/* First, the TKL ip hash table entries.. */
-	index2 = tkl_ip_hash(GetIP(client));
+	index2 = tkl_ip_hash_client(client);
 	if (index2 >= 0)
 	{
 		for (index = 0; index < TKLIPHASHLEN1; index++)
@@ -3243,8 +3425,14 @@ int _find_tkline_match(Client *client, int skip_soft)
 	if (!banned)
 		return 0;
 
-	/* User is banned... */
+	return tkl_ban_client(client, tkl);
+}
 
+/** Take action against a user who matches server ban 'tkl'.
+ * @retval 1 if client is killed, 0 if not
+ */
+int tkl_ban_client(Client *client, TKL *tkl)
+{
 	RunHookReturnInt(HOOKTYPE_FIND_TKLINE_MATCH, !=99, client, tkl);
 
 	if (tkl->type & TKL_KILL)
@@ -3285,25 +3473,36 @@ int _find_shun(Client *client)
 
 	for (tkl = tklines[tkl_hash('s')]; tkl; tkl = tkl->next)
 	{
-		char uhost[NICKLEN+HOSTLEN+1];
+		if (find_shun_matcher(client, tkl))
+			return 1;
+	}
 
-		if (!(tkl->type & TKL_SHUN))
-			continue;
+	return 0;
+}
+
+/** Helper function for find_shun(): check one shun and shun the user on match.
+ * @returns 1 if shunned, 0 if not.
+ */
+int find_shun_matcher(Client *client, TKL *tkl)
+{
+	char uhost[NICKLEN+HOSTLEN+1];
+
+	if (!(tkl->type & TKL_SHUN))
+		return 0;
 
-		tkl_uhost(tkl, uhost, sizeof(uhost), NO_SOFT_PREFIX);
+	tkl_uhost(tkl, uhost, sizeof(uhost), NO_SOFT_PREFIX);
 
-		if (match_user(uhost, client, MATCH_CHECK_REAL))
+	if (match_user(uhost, client, MATCH_CHECK_REAL))
+	{
+		/* If hard-ban, or soft-ban&unauthenticated.. */
+		if (!(tkl->ptr.serverban->subtype & TKL_SUBTYPE_SOFT) ||
+		    ((tkl->ptr.serverban->subtype & TKL_SUBTYPE_SOFT) && !IsLoggedIn(client)))
 		{
-			/* If hard-ban, or soft-ban&unauthenticated.. */
-			if (!(tkl->ptr.serverban->subtype & TKL_SUBTYPE_SOFT) ||
-			    ((tkl->ptr.serverban->subtype & TKL_SUBTYPE_SOFT) && !IsLoggedIn(client)))
-			{
-				/* Found match. Now check for exception... */
-				if (find_tkl_exception(TKL_SHUN, client))
-					return 0;
-				SetShunned(client);
-				return 1;
-			}
+			/* Found match. Now check for exception... */
+			if (find_tkl_exception(TKL_SHUN, client))
+				return 0;
+			SetShunned(client);
+			return 1;
 		}
 	}
 
@@ -3467,7 +3666,7 @@ TKL *_find_tkline_match_zap(Client *client)
 
 	/* First, the TKL ip hash table entries.. */
 	index = tkl_ip_hash_type('z');
-	index2 = tkl_ip_hash(GetIP(client));
+	index2 = tkl_ip_hash_client(client);
 	if (index2 >= 0)
 	{
 		for (tkl = tklines_ip_hash[index][index2]; tkl; tkl = tkl->next)
@@ -3799,23 +3998,23 @@ void _tkl_stats(Client *client, int type, const char *para, int *cnt)
 	}
 }
 
-/** Synchronize a TKL entry with the other server.
- * @param sender  The sender (eg: &me).
- * @param to      The remote server.
- * @param tkl     The TKL entry.
+/** Format a TKL entry in the TKL line format, that is:
+ * the parameters of the TKL server command (see cmd_tkl).
+ * This format is used by the TKL and TKLB server commands and
+ * by the TKL export files.
+ * @param add     1 for adding the entry (+), 0 for removal (-)
+ * @param tkl     The TKL entry
+ * @param buf     The buffer to write to
+ * @param buflen  Length of the buffer
+ * @returns The buffer
  */
-void tkl_sync_send_entry(int add, Client *sender, Client *to, TKL *tkl)
+const char *tkl_entry_line(int add, TKL *tkl, char *buf, size_t buflen)
 {
-	char typ;
-
-	if (!(tkl->type & TKL_GLOBAL))
-		return; /* nothing to sync */
-
-	typ = tkl_typetochar(tkl->type);
+	char typ = tkl_typetochar(tkl->type);
 
 	if (TKLIsServerBan(tkl))
 	{
-		sendto_one(to, NULL, ":%s TKL %c %c %s%s %s %s %lld %lld :%s", sender->name,
+		snprintf(buf, buflen, "%c %c %s%s %s %s %lld %lld :%s",
 			   add ? '+' : '-',
 			   typ,
 			   (tkl->ptr.serverban->subtype & TKL_SUBTYPE_SOFT) ? "%" : "",
@@ -3826,7 +4025,7 @@ void tkl_sync_send_entry(int add, Client *sender, Client *to, TKL *tkl)
 	} else
 	if (TKLIsNameBan(tkl))
 	{
-		sendto_one(to, NULL, ":%s TKL %c %c %c %s %s %lld %lld :%s", sender->name,
+		snprintf(buf, buflen, "%c %c %c %s %s %lld %lld :%s",
 			   add ? '+' : '-',
 			   typ,
 			   tkl->ptr.nameban->hold ? 'H' : '*',
@@ -3837,7 +4036,7 @@ void tkl_sync_send_entry(int add, Client *sender, Client *to, TKL *tkl)
 	} else
 	if (TKLIsSpamfilter(tkl))
 	{
-		sendto_one(to, NULL, ":%s TKL %c %c %s %c %s %lld %lld %lld %s %s :%s", sender->name,
+		snprintf(buf, buflen, "%c %c %s %c %s %lld %lld %lld %s %s :%s",
 			   add ? '+' : '-',
 			   typ,
 			   spamfilter_target_inttostring(tkl->ptr.spamfilter->target),
@@ -3850,7 +4049,7 @@ void tkl_sync_send_entry(int add, Client *sender, Client *to, TKL *tkl)
 	} else
 	if (TKLIsBanException(tkl))
 	{
-		sendto_one(to, NULL, ":%s TKL %c %c %s%s %s %s %lld %lld %s :%s", sender->name,
+		snprintf(buf, buflen, "%c %c %s%s %s %s %lld %lld %s :%s",
 			   add ? '+' : '-',
 			   typ,
 			   (tkl->ptr.banexception->subtype & TKL_SUBTYPE_SOFT) ? "%" : "",
@@ -3862,11 +4061,60 @@ void tkl_sync_send_entry(int add, Client *sender, Client *to, TKL *tkl)
 	} else
 	{
 		unreal_log(ULOG_FATAL, "tkl", "BUG_TKL_SYNC_SEND_ENTRY", NULL,
-			   "[BUG] tkl_sync_send_entry() called, but unknown type: $tkl.type_string ($tkl_type_int)",
+			   "[BUG] tkl_entry_line() called, but unknown type: $tkl.type_string ($tkl_type_int)",
 			   log_data_tkl("tkl", tkl),
 			   log_data_integer("tkl_type_int", typ));
 		abort();
 	}
+	return buf;
+}
+
+/** Split a line in TKL line format into parv[] for cmd_tkl().
+ * The line is modified in-place.
+ * @param line   The line, eg "+ G * 192.168.1.1 Oper 0 1700000000 :reason"
+ * @param parv   The parv[] array, with room for MAXPARA+1 entries
+ * @returns parc (parv[0] is NULL, so at least 1)
+ */
+int tkl_entry_line_split(char *line, const char **parv)
+{
+	int parc = 1;
+	char *p = line;
+
+	parv[0] = NULL;
+	while (*p && (parc < MAXPARA))
+	{
+		while (*p == ' ')
+			p++;
+		if (!*p)
+			break;
+		if (*p == ':')
+		{
+			parv[parc++] = p + 1;
+			break;
+		}
+		parv[parc++] = p;
+		while (*p && (*p != ' '))
+			p++;
+		if (*p)
+			*p++ = '\0';
+	}
+	parv[parc] = NULL;
+	return parc;
+}
+
+/** Synchronize a TKL entry with the other server.
+ * @param sender  The sender (eg: &me).
+ * @param to      The remote server.
+ * @param tkl     The TKL entry.
+ */
+void tkl_sync_send_entry(int add, Client *sender, Client *to, TKL *tkl)
+{
+	char buf[MAXLINELENGTH];
+
+	if (!(tkl->type & TKL_GLOBAL))
+		return; /* nothing to sync */
+
+	sendto_one(to, NULL, ":%s TKL %s", sender->name, tkl_entry_line(add, tkl, buf, sizeof(buf)));
 }
 
 /** Broadcast a TKL entry.
@@ -3878,6 +4126,21 @@ void tkl_broadcast_entry(int add, Client *sender, Client *skip, TKL *tkl)
 {
 	Client *acptr;
 
+	if (!(tkl->type & TKL_GLOBAL))
+		return; /* nothing to sync */
+
+	if (bulk_depth)
+	{
+		/* Collected and sent in batches by tkl_bulk_end() */
+		if (add)
+		{
+			tkl_bulk_queue(tkl);
+			return;
+		}
+		/* Removal: send what we have so far first, to keep the order */
+		tkl_bulk_flush(sender, skip);
+	}
+
 	/* Silly fix for RPC calls that lead to broadcasts from this sender */
 	if (!IsUser(sender) && !IsServer(sender))
 		sender = &me;
@@ -3891,107 +4154,736 @@ void tkl_broadcast_entry(int add, Client *sender, Client *skip, TKL *tkl)
 	}
 }
 
-/** Synchronize all TKL entries with this server.
- * @param client The server to synchronize with.
+/** Does this directly connected server understand TKLB (batched TKL lines)?
+ * Servers that announce TKLSYNC always do. For others we go by the
+ * moddata, which is only known after the first part of their burst.
  */
-void _tkl_sync(Client *client)
+static int tkl_batch_supported(Client *server)
 {
-	TKL *tkl;
-	int index, index2;
+	return SupportBIGLINES(server) &&
+	       (SupportTKLSYNC(server) || (moddata_client(server, tkl_md).i >= TKL_PROTOCOL_BATCH));
+}
 
-	/* First, hashed entries.. */
-	for (index = 0; index < TKLIPHASHLEN1; index++)
+void tkl_bulk_queue(TKL *tkl)
+{
+	if (tkl->flags & TKL_FLAG_BULK_PENDING)
+		return;
+	if (bulk_pending_num == bulk_pending_max)
 	{
-		for (index2 = 0; index2 < TKLIPHASHLEN2; index2++)
-		{
-			for (tkl = tklines_ip_hash[index][index2]; tkl; tkl = tkl->next)
-			{
-				tkl_sync_send_entry(1, &me, client, tkl);
-			}
-		}
+		bulk_pending_max = bulk_pending_max ? bulk_pending_max * 2 : 256;
+		bulk_pending = realloc(bulk_pending, sizeof(TKL *) * bulk_pending_max);
+		if (!bulk_pending)
+			outofmemory(sizeof(TKL *) * bulk_pending_max);
 	}
+	bulk_pending[bulk_pending_num++] = tkl;
+	tkl->flags |= TKL_FLAG_BULK_PENDING;
+}
 
-	/* Then, regular entries.. */
-	for (index = 0; index < TKLISTLEN; index++)
+void tkl_bulk_unqueue(TKL *tkl)
+{
+	int i;
+
+	for (i = 0; i < bulk_pending_num; i++)
 	{
-		for (tkl = tklines[index]; tkl; tkl = tkl->next)
+		if (bulk_pending[i] == tkl)
 		{
-			tkl_sync_send_entry(1, &me, client, tkl);
+			/* Not a swap-remove here, the order matters */
+			memmove(&bulk_pending[i], &bulk_pending[i+1], sizeof(TKL *) * (bulk_pending_num - i - 1));
+			bulk_pending_num--;
+			break;
 		}
 	}
+	tkl->flags &= ~TKL_FLAG_BULK_PENDING;
 }
 
-/** Find a server ban TKL - only used to prevent duplicates and for deletion */
-TKL *_find_tkl_serverban(int type, char *usermask, char *hostmask, int softban)
+/** Start building TKLB lines for a server, see tkl_batch_add() */
+static void tkl_batch_start(TKLBatch *b, Client *sender, Client *to)
 {
-	char tpe = tkl_typetochar(type);
-	TKL *head, *tkl;
-
-	if (!TKLIsServerBanType(type))
-		abort();
+	memset(b, 0, sizeof(TKLBatch));
+	b->sender = sender;
+	b->to = to;
+}
 
-	head = tkl_find_head(tpe, hostmask, tklines[tkl_hash(tpe)]);
-	for (tkl = head; tkl; tkl = tkl->next)
-	{
-		if (tkl->type == type)
-		{
-			if (!strcasecmp(tkl->ptr.serverban->hostmask, hostmask) &&
-			    !strcasecmp(tkl->ptr.serverban->usermask, usermask))
-			{
-				/* And an extra check for soft/hard ban mismatches.. */
-				if ((tkl->ptr.serverban->subtype & TKL_SUBTYPE_SOFT) == softban)
-					return tkl;
-			}
-		}
-	}
-	return NULL; /* Not found */
+/** Send the TKLB line that was built so far, if any */
+static void tkl_batch_flush(TKLBatch *b)
+{
+	if (!b->len)
+		return;
+	sendto_one(b->to, NULL, ":%s TKLB :[%s]", b->sender->id, b->buf);
+	b->len = 0;
 }
 
-/** Find a ban exception TKL - only used to prevent duplicates and for deletion */
-TKL *_find_tkl_banexception(int type, char *usermask, char *hostmask, int softban)
+/** Add a TKL entry to the TKLB line that is being built.
+ * Servers that do not support TKLB get the usual TKL line.
+ */
+static void tkl_batch_add(TKLBatch *b, TKL *tkl)
 {
-	char tpe = tkl_typetochar(type);
-	TKL *head, *tkl;
+	char entry[MAXLINELENGTH];
+	json_t *j;
+	char *str;
+	int len;
 
-	if (!TKLIsBanExceptionType(type))
-		abort();
+	if (!tkl_batch_supported(b->to))
+	{
+		tkl_sync_send_entry(1, b->sender, b->to, tkl);
+		return;
+	}
 
-	head = tkl_find_head(tpe, hostmask, tklines[tkl_hash(tpe)]);
-	for (tkl = head; tkl; tkl = tkl->next)
+	tkl_entry_line(1, tkl, entry, sizeof(entry));
+	if (!unrl_utf8_validate(entry, NULL))
 	{
-		if (tkl->type == type)
-		{
-			if (!strcasecmp(tkl->ptr.banexception->hostmask, hostmask) &&
-			    !strcasecmp(tkl->ptr.banexception->usermask, usermask))
-			{
-				/* And an extra check for soft/hard ban mismatches.. */
-				if ((tkl->ptr.banexception->subtype & TKL_SUBTYPE_SOFT) == softban)
-					return tkl;
-			}
-		}
+		/* JSON strings are UTF8, so send this one as-is */
+		tkl_sync_send_entry(1, b->sender, b->to, tkl);
+		return;
 	}
-	return NULL; /* Not found */
+	j = json_string(entry);
+	str = j ? json_dumps(j, JSON_COMPACT|JSON_ENCODE_ANY) : NULL;
+	json_decref(j);
+	if (!str)
+		return;
+	len = strlen(str);
+	if (len + 2 > TKLB_LINE_MAX)
+	{
+		/* Huge entry (eg a long regex), does not fit in a batch */
+		tkl_sync_send_entry(1, b->sender, b->to, tkl);
+		safe_free(str);
+		return;
+	}
+	if (b->len + len + 2 > TKLB_LINE_MAX)
+		tkl_batch_flush(b);
+	if (!b->buf)
+		b->buf = safe_alloc(TKLB_LINE_MAX + 1);
+	if (b->len)
+		b->buf[b->len++] = ',';
+	strcpy(b->buf + b->len, str); /* safe, checked above */
+	b->len += len;
+	safe_free(str);
 }
 
-/** Find a name ban TKL (qline) - only used to prevent duplicates and for deletion */
-TKL *_find_tkl_nameban(int type, char *name, int hold)
+/** Send the last TKLB line and free the buffer */
+static void tkl_batch_end(TKLBatch *b)
 {
-	char tpe = tkl_typetochar(type);
-	TKL *tkl;
+	tkl_batch_flush(b);
+	safe_free(b->buf);
+}
 
-	if (!TKLIsNameBanType(type))
-		abort();
+/** Send the TKL entries that were collected during a bulk operation.
+ * Servers that support it get them packed in TKLB lines (a JSON array
+ * of entries in TKL line format), others get the usual TKL lines.
+ */
+void tkl_bulk_flush(Client *sender, Client *skip)
+{
+	Client *acptr;
+	TKLBatch batch;
+	int i;
 
-	for (tkl = tklines[tkl_hash(tpe)]; tkl; tkl = tkl->next)
+	if (!bulk_pending_num)
+		return;
+
+	if (!IsServer(sender))
+		sender = &me;
+
+	list_for_each_entry(acptr, &server_list, special_node)
 	{
-		if ((tkl->type == type) && !strcasecmp(tkl->ptr.nameban->name, name))
-			return tkl;
+		if (skip && acptr == skip->direction)
+			continue;
+
+		tkl_batch_start(&batch, sender, acptr);
+		for (i = 0; i < bulk_pending_num; i++)
+			tkl_batch_add(&batch, bulk_pending[i]);
+		tkl_batch_end(&batch);
 	}
-	return NULL; /* Not found */
+
+	for (i = 0; i < bulk_pending_num; i++)
+		bulk_pending[i]->flags &= ~TKL_FLAG_BULK_PENDING;
+	bulk_pending_num = 0;
 }
 
-/** Find a spamfilter TKL - only used to prevent duplicates and for deletion */
-TKL *_find_tkl_spamfilter(int type, char *match_string, BanAction action, unsigned short target)
+/** Start a bulk operation, for adding many TKL entries at once.
+ * Until tkl_bulk_end() the entries that are added with
+ * tkl_added() are not announced one by one to opers, and
+ * not sent one by one to the other servers.
+ * @param client  The client that is adding the entries
+ */
+void _tkl_bulk_begin(Client *client)
+{
+	if (bulk_depth++ == 0)
+		memset(bulk_added, 0, sizeof(bulk_added));
+}
+
+/** End a bulk operation: send the new entries to the other
+ * servers in batches and log a summary.
+ * @param client  The client that added the entries, same as in tkl_bulk_begin()
+ * @returns The number of entries added.
+ */
+int _tkl_bulk_end(Client *client)
+{
+	int total;
+
+	if (--bulk_depth > 0)
+		return 0;
+
+	tkl_bulk_flush(client, client);
+
+	total = bulk_added[0] + bulk_added[1] + bulk_added[2] + bulk_added[3];
+	if (total)
+	{
+		unreal_log(ULOG_INFO, "tkl", "TKL_ADD_BULK", client,
+		           "$count TKL entries added in bulk by $client: "
+		           "[server bans: $server_bans] [exceptions: $server_ban_exceptions] "
+		           "[name bans: $name_bans] [spamfilters: $spamfilters]",
+		           log_data_integer("count", total),
+		           log_data_integer("server_bans", bulk_added[0]),
+		           log_data_integer("server_ban_exceptions", bulk_added[1]),
+		           log_data_integer("name_bans", bulk_added[2]),
+		           log_data_integer("spamfilters", bulk_added[3]));
+	}
+	return total;
+}
+
+/** TKLB: a batch of TKL entries from another server.
+ * parv[1]: JSON array of strings, each string is an entry in TKL line format
+ */
+CMD_FUNC(cmd_tklb)
+{
+	json_t *list, *item;
+	json_error_t jerr;
+	const char *tklparv[MAXPARA+1];
+	char line[MAXLINELENGTH];
+	size_t i;
+	int tklparc;
+
+	if (!IsServer(client) || (parc < 2))
+		return;
+
+	list = json_loads(parv[1], JSON_REJECT_DUPLICATES, &jerr);
+	if (!list || !json_is_array(list))
+	{
+		unreal_log(ULOG_WARNING, "tkl", "TKLB_INVALID", client,
+		           "Received invalid TKLB from $client");
+		json_decref(list);
+		return;
+	}
+
+	tkl_bulk_begin(client);
+	json_array_foreach(list, i, item)
+	{
+		if (!json_is_string(item))
+			continue;
+		strlcpy(line, json_string_value(item), sizeof(line));
+		tklparc = tkl_entry_line_split(line, tklparv);
+		if (tklparc < 2)
+			continue;
+		cmd_tkl(client, recv_mtags, tklparc, tklparv);
+	}
+	tkl_bulk_end(client);
+	json_decref(list);
+}
+
+const char *tkl_md_serialize(ModData *m)
+{
+	static char buf[32];
+
+	if (m->i == 0)
+		return NULL; /* not set */
+	snprintf(buf, sizeof(buf), "%d", m->i);
+	return buf;
+}
+
+void tkl_md_unserialize(const char *str, ModData *m)
+{
+	m->i = atoi(str);
+}
+
+/** TKLIMPORT: import TKL entries from a file (./unrealircd tkl-import).
+ * The file has one entry per line in TKL line format, as written by
+ * TKLEXPORT. Empty lines and lines starting with # are skipped.
+ */
+CMD_FUNC(cmd_tkl_import)
+{
+	FILE *fd;
+	char line[MAXLINELENGTH];
+	const char *tklparv[MAXPARA+1];
+	int tklparc, lines = 0, skipped = 0, added;
+
+	if (!IsControl(client) || (parc < 2) || BadPtr(parv[1]))
+	{
+		sendto_one(client, NULL, "REPLY ERROR: No file specified");
+		sendto_one(client, NULL, "END 1");
+		return;
+	}
+
+	fd = fopen(parv[1], "r");
+	if (!fd)
+	{
+		sendto_one(client, NULL, "REPLY ERROR: Could not open '%s': %s", parv[1], strerror(errno));
+		sendto_one(client, NULL, "END 1");
+		return;
+	}
+
+	tkl_bulk_begin(&me);
+	while (fgets(line, sizeof(line), fd))
+	{
+		stripcrlf(line);
+		if (!*line || (*line == '#'))
+			continue;
+		lines++;
+		tklparc = tkl_entry_line_split(line, tklparv);
+		if ((tklparc < 9) || strcmp(tklparv[1], "+"))
+		{
+			skipped++;
+			continue;
+		}
+		cmd_tkl(&me, NULL, tklparc, tklparv);
+	}
+	fclose(fd);
+	added = tkl_bulk_end(&me);
+
+	sendto_one(client, NULL, "REPLY Read %d entries from %s: %d added, %d invalid, %d already existed or expired",
+	           lines, parv[1], added, skipped, lines - added - skipped);
+	sendto_one(client, NULL, "END 0");
+}
+
+/** Write one TKL entry to the export file, helper for cmd_tkl_export() */
+static int tkl_export_entry(FILE *fd, TKL *tkl)
+{
+	char buf[MAXLINELENGTH];
+
+	/* Entries from the configuration file are not exported */
+	if (tkl->flags & TKL_FLAG_CONFIG)
+		return 0;
+	fprintf(fd, "%s\n", tkl_entry_line(1, tkl, buf, sizeof(buf)));
+	return 1;
+}
+
+/** TKLEXPORT: export all TKL entries to a file (./unrealircd tkl-export).
+ * See cmd_tkl_import() for the format.
+ */
+CMD_FUNC(cmd_tkl_export)
+{
+	FILE *fd;
+	TKL *tkl;
+	int index, index2, count = 0;
+
+	if (!IsControl(client) || (parc < 2) || BadPtr(parv[1]))
+	{
+		sendto_one(client, NULL, "REPLY ERROR: No file specified");
+		sendto_one(client, NULL, "END 1");
+		return;
+	}
+
+	fd = fopen(parv[1], "w");
+	if (!fd)
+	{
+		sendto_one(client, NULL, "REPLY ERROR: Could not write to '%s': %s", parv[1], strerror(errno));
+		sendto_one(client, NULL, "END 1");
+		return;
+	}
+
+	fprintf(fd, "# TKL export from %s at %lld\n", me.name, (long long)TStime());
+	fprintf(fd, "# One entry per line, in the format of the TKL server command\n");
+
+	for (index = 0; index < TKLIPHASHLEN1; index++)
+		for (index2 = 0; index2 < TKLIPHASHLEN2; index2++)
+			for (tkl = tklines_ip_hash[index][index2]; tkl; tkl = tkl->next)
+				count += tkl_export_entry(fd, tkl);
+
+	for (index = 0; index < TKLISTLEN; index++)
+		for (tkl = tklines[index]; tkl; tkl = tkl->next)
+			count += tkl_export_entry(fd, tkl);
+
+	if (fclose(fd) != 0)
+	{
+		sendto_one(client, NULL, "REPLY ERROR: Error writing to '%s': %s", parv[1], strerror(errno));
+		sendto_one(client, NULL, "END 1");
+		return;
+	}
+
+	sendto_one(client, NULL, "REPLY Exported %d entries to %s", count, parv[1]);
+	sendto_one(client, NULL, "END 0");
+}
+
+/** Hash of the identity of a TKL entry (type and mask), this decides
+ * the leaf of the entry in the TKL digest.
+ */
+static uint64_t tkl_sync_identity_hash(TKL *tkl)
+{
+	char buf[MAXLINELENGTH];
+	char typ = tkl_typetochar(tkl->type);
+
+	if (TKLIsServerBan(tkl))
+	{
+		snprintf(buf, sizeof(buf), "%c %s%s@%s", typ,
+		         (tkl->ptr.serverban->subtype & TKL_SUBTYPE_SOFT) ? "%" : "",
+		         tkl->ptr.serverban->usermask, tkl->ptr.serverban->hostmask);
+	} else
+	if (TKLIsBanException(tkl))
+	{
+		snprintf(buf, sizeof(buf), "%c %s%s@%s", typ,
+		         (tkl->ptr.banexception->subtype & TKL_SUBTYPE_SOFT) ? "%" : "",
+		         tkl->ptr.banexception->usermask, tkl->ptr.banexception->hostmask);
+	} else
+	if (TKLIsNameBan(tkl))
+	{
+		snprintf(buf, sizeof(buf), "%c %s", typ, tkl->ptr.nameban->name);
+	} else
+	if (TKLIsSpamfilter(tkl))
+	{
+		snprintf(buf, sizeof(buf), "%c %s %c %s", typ,
+		         spamfilter_target_inttostring(tkl->ptr.spamfilter->target),
+		         banact_valtochar(tkl->ptr.spamfilter->action),
+		         tkl->ptr.spamfilter->match->str);
+	} else
+	{
+		snprintf(buf, sizeof(buf), "%c", typ);
+	}
+	/* Case insensitive, since the masks are compared that way too */
+	return siphash_nocase(buf, tkl_sync_hashkey);
+}
+
+/** Add a global TKL entry to the leaves of the TKL digest */
+void tkl_sync_index_add(TKL *tkl)
+{
+	if (!(tkl->type & TKL_GLOBAL))
+		return;
+
+	tkl->sync_leaf = tkl_sync_identity_hash(tkl) % TKL_SYNC_LEAVES;
+	tkl->sync_prev = NULL;
+	tkl->sync_next = tkl_sync_leaf[tkl->sync_leaf];
+	if (tkl->sync_next)
+		tkl->sync_next->sync_prev = tkl;
+	tkl_sync_leaf[tkl->sync_leaf] = tkl;
+	tkl->flags |= TKL_FLAG_SYNC_INDEXED;
+}
+
+void tkl_sync_index_del(TKL *tkl)
+{
+	if (tkl->sync_prev)
+		tkl->sync_prev->sync_next = tkl->sync_next;
+	else
+		tkl_sync_leaf[tkl->sync_leaf] = tkl->sync_next;
+	if (tkl->sync_next)
+		tkl->sync_next->sync_prev = tkl->sync_prev;
+	tkl->sync_prev = tkl->sync_next = NULL;
+	tkl->flags &= ~TKL_FLAG_SYNC_INDEXED;
+}
+
+/** Calculate the digest of all leaves.
+ * @returns Array of TKL_SYNC_LEAVES hashes, to be freed by the caller.
+ */
+static uint64_t *tkl_sync_leaf_hashes(void)
+{
+	uint64_t *leaf_hash = safe_alloc(sizeof(uint64_t) * TKL_SYNC_LEAVES);
+	char buf[MAXLINELENGTH];
+	TKL *tkl;
+	int i;
+
+	for (i = 0; i < TKL_SYNC_LEAVES; i++)
+		for (tkl = tkl_sync_leaf[i]; tkl; tkl = tkl->sync_next)
+			leaf_hash[i] ^= siphash(tkl_entry_line(1, tkl, buf, sizeof(buf)), tkl_sync_hashkey);
+	return leaf_hash;
+}
+
+/** Calculate the digest of the buckets, from the leaves */
+static void tkl_sync_bucket_hashes(uint64_t *leaf_hash, uint64_t *bucket_hash)
+{
+	int i;
+
+	memset(bucket_hash, 0, sizeof(uint64_t) * TKL_SYNC_BUCKETS);
+	for (i = 0; i < TKL_SYNC_LEAVES; i++)
+		bucket_hash[i / (TKL_SYNC_LEAVES/TKL_SYNC_BUCKETS)] ^= leaf_hash[i];
+}
+
+/** Hex encode 'num' hashes, 'buf' must have room for num*16+1 bytes */
+static void tkl_sync_hex(char *buf, uint64_t *hash, int num)
+{
+	int i;
+
+	for (i = 0; i < num; i++)
+		snprintf(buf + i * 16, 17, "%016llx", (unsigned long long)hash[i]);
+}
+
+/** Decode 'num' hex encoded hashes.
+ * @returns 1 on success, 0 if the input is invalid.
+ */
+static int tkl_sync_unhex(const char *str, uint64_t *hash, int num)
+{
+	char chunk[17];
+	char *end;
+	int i;
+
+	if (strlen(str) != num * 16)
+		return 0;
+	for (i = 0; i < num; i++)
+	{
+		strlcpy(chunk, str + i * 16, sizeof(chunk));
+		hash[i] = strtoull(chunk, &end, 16);
+		if (*end)
+			return 0;
+	}
+	return 1;
+}
+
+void tkl_sync_md_free(ModData *m)
+{
+	TKLSync *s = m->ptr;
+
+	if (!s)
+		return;
+	safe_free(s->leaf_hash);
+	safe_free(m->ptr);
+}
+
+/** Send the TKL entries of the leaves that need to be sent to the server,
+ * for as long as its sendQ stays below TKL_SYNC_SENDQ_WATERMARK().
+ * The rest is sent later by tkl_sync_continue(). Only the position
+ * is remembered, so entries that are added or removed in the meantime
+ * are no problem: these are broadcasted to the server anyway.
+ * @param client	The server to send to.
+ * @param s		The sync state of the server.
+ * @param all		Send all remaining entries, regardless of the sendQ.
+ */
+static void tkl_sync_stream(Client *client, TKLSync *s, int all)
+{
+	TKLBatch batch;
+	TKL *tkl;
+	int start = s->next_leaf;
+
+	tkl_batch_start(&batch, &me, client);
+	for (; s->next_leaf < TKL_SYNC_LEAVES; s->next_leaf++)
+	{
+		if (!(s->send_leaf[s->next_leaf / 8] & (1 << (s->next_leaf % 8))))
+			continue;
+		if (!all && (DBufLength(&client->local->sendQ) + batch.len > TKL_SYNC_SENDQ_WATERMARK(client)))
+			break;
+		for (tkl = tkl_sync_leaf[s->next_leaf]; tkl; tkl = tkl->sync_next)
+		{
+			tkl_batch_add(&batch, tkl);
+			s->sent++;
+		}
+	}
+	tkl_batch_end(&batch);
+
+	if (s->next_leaf != start)
+		s->last_progress = TStime();
+
+	if (s->next_leaf < TKL_SYNC_LEAVES)
+		return; /* more later */
+
+	if (s->digest)
+	{
+		unreal_log(ULOG_INFO, "tkl", "TKL_SYNC_DIGEST", client,
+		           "TKL sync with $client done: $leaves of $total_leaves digest leaves differed, "
+		           "sent $count entries.",
+		           log_data_integer("leaves", s->leaves),
+		           log_data_integer("total_leaves", TKL_SYNC_LEAVES),
+		           log_data_integer("count", s->sent));
+	}
+	tkl_sync_md_free(&moddata_local_client(client, tklsync_md));
+}
+
+/** Continue sending TKL entries to servers that are being synced.
+ * If a server did not drain its sendQ for TKL_SYNC_STALL_TIME seconds,
+ * then the rest is sent in one go, as if the sync was never streamed,
+ * so the sync always finishes (or the link hits its sendq limit).
+ */
+EVENT(tkl_sync_continue)
+{
+	Client *client;
+	TKLSync *s;
+
+	list_for_each_entry(client, &server_list, special_node)
+	{
+		s = TKLSYNC(client);
+		if (s && (s->next_leaf >= 0) && !IsDead(client))
+			tkl_sync_stream(client, s, TStime() - s->last_progress >= TKL_SYNC_STALL_TIME);
+	}
+}
+
+/** Synchronize all TKL entries with this server.
+ *
+ * If the other side supports it (PROTOCTL TKLSYNC) then we first
+ * exchange digests, so only entries that differ need to be sent:
+ * - Both sides send the digest of their TKL_SYNC_BUCKETS buckets:
+ *   TKLD R <hashes>
+ * - For each bucket that differs, both sides send the digest
+ *   of the leaves in that bucket: TKLD S <bucket> <hashes>
+ *   Followed by TKLD E when done.
+ * - On TKLD E, both sides send their entries of the leaves that
+ *   differ, in TKLB lines. These are sent in portions that fit in
+ *   the sendQ of the server, see tkl_sync_stream().
+ * Note that with the digest exchange the entries arrive AFTER our
+ * NETINFO and EOS, so EOS no longer means that the other side has
+ * all our TKL entries, for example users may be checked against an
+ * incomplete set of bans briefly. The entries that arrive later are
+ * simply added, just like bans that are set during the link.
+ * Otherwise all entries are sent right away, before EOS, as always.
+ * @param client The server to synchronize with.
+ */
+void _tkl_sync(Client *client)
+{
+	TKLSync *s;
+	uint64_t bucket_hash[TKL_SYNC_BUCKETS];
+	char buf[TKL_SYNC_BUCKETS * 16 + 1];
+
+	tkl_sync_md_free(&moddata_local_client(client, tklsync_md));
+	s = safe_alloc(sizeof(TKLSync));
+	moddata_local_client(client, tklsync_md).ptr = s;
+
+	if (SupportTKLSYNC(client) && SupportBIGLINES(client))
+	{
+		s->digest = 1;
+		s->next_leaf = -1; /* until TKLD E */
+		s->leaf_hash = tkl_sync_leaf_hashes();
+		tkl_sync_bucket_hashes(s->leaf_hash, bucket_hash);
+		tkl_sync_hex(buf, bucket_hash, TKL_SYNC_BUCKETS);
+		sendto_one(client, NULL, ":%s TKLD R %s", me.id, buf);
+		return;
+	}
+
+	/* Send everything, before EOS */
+	memset(s->send_leaf, 0xff, sizeof(s->send_leaf));
+	s->leaves = TKL_SYNC_LEAVES;
+	tkl_sync_stream(client, s, 1);
+}
+
+/** TKLD: TKL digest exchange with a directly linked server, see tkl_sync().
+ * parv[1]: R (buckets), S (leaves of a bucket) or E (end)
+ * For R:
+ * parv[2]: hex encoded hashes of all buckets
+ * For S:
+ * parv[2]: bucket number
+ * parv[3]: hex encoded hashes of the leaves in this bucket
+ */
+CMD_FUNC(cmd_tkld)
+{
+	TKLSync *s;
+	uint64_t ours[TKL_SYNC_BUCKETS];
+	uint64_t theirs[TKL_SYNC_LEAVES/TKL_SYNC_BUCKETS];
+	char buf[(TKL_SYNC_LEAVES/TKL_SYNC_BUCKETS) * 16 + 1];
+	int bucket, i;
+
+	if (!IsServer(client) || !MyConnect(client) || (parc < 2))
+		return;
+
+	s = TKLSYNC(client);
+	if (!s || !s->digest || (s->next_leaf >= 0) || !s->leaf_hash)
+		return; /* not expecting this */
+
+	if (!strcmp(parv[1], "R") && (parc > 2))
+	{
+		if (!tkl_sync_unhex(parv[2], theirs, TKL_SYNC_BUCKETS))
+			return;
+		tkl_sync_bucket_hashes(s->leaf_hash, ours);
+		for (bucket = 0; bucket < TKL_SYNC_BUCKETS; bucket++)
+		{
+			if (ours[bucket] == theirs[bucket])
+				continue;
+			tkl_sync_hex(buf, s->leaf_hash + bucket * (TKL_SYNC_LEAVES/TKL_SYNC_BUCKETS),
+			             TKL_SYNC_LEAVES/TKL_SYNC_BUCKETS);
+			sendto_one(client, NULL, ":%s TKLD S %d %s", me.id, bucket, buf);
+		}
+		sendto_one(client, NULL, ":%s TKLD E", me.id);
+	} else
+	if (!strcmp(parv[1], "S") && (parc > 3))
+	{
+		bucket = atoi(parv[2]);
+		if ((bucket < 0) || (bucket >= TKL_SYNC_BUCKETS) ||
+		    !tkl_sync_unhex(parv[3], theirs, TKL_SYNC_LEAVES/TKL_SYNC_BUCKETS))
+		{
+			return;
+		}
+		for (i = 0; i < TKL_SYNC_LEAVES/TKL_SYNC_BUCKETS; i++)
+		{
+			int leaf = bucket * (TKL_SYNC_LEAVES/TKL_SYNC_BUCKETS) + i;
+			if ((theirs[i] != s->leaf_hash[leaf]) && !(s->send_leaf[leaf / 8] & (1 << (leaf % 8))))
+			{
+				s->send_leaf[leaf / 8] |= 1 << (leaf % 8);
+				s->leaves++;
+			}
+		}
+	} else
+	if (!strcmp(parv[1], "E"))
+	{
+		/* The other side compared all buckets, now send what differs */
+		safe_free(s->leaf_hash);
+		s->next_leaf = 0;
+		s->last_progress = TStime();
+		tkl_sync_stream(client, s, 0);
+	}
+}
+
+/** Find a server ban TKL - only used to prevent duplicates and for deletion */
+TKL *_find_tkl_serverban(int type, char *usermask, char *hostmask, int softban)
+{
+	char tpe = tkl_typetochar(type);
+	TKL *head, *tkl;
+
+	if (!TKLIsServerBanType(type))
+		abort();
+
+	head = tkl_find_head(tpe, hostmask, tklines[tkl_hash(tpe)]);
+	for (tkl = head; tkl; tkl = tkl->next)
+	{
+		if (tkl->type == type)
+		{
+			if (!strcasecmp(tkl->ptr.serverban->hostmask, hostmask) &&
+			    !strcasecmp(tkl->ptr.serverban->usermask, usermask))
+			{
+				/* And an extra check for soft/hard ban mismatches.. */
+				if ((tkl->ptr.serverban->subtype & TKL_SUBTYPE_SOFT) == softban)
+					return tkl;
+			}
+		}
+	}
+	return NULL; /* Not found */
+}
+
+/** Find a ban exception TKL - only used to prevent duplicates and for deletion */
+TKL *_find_tkl_banexception(int type, char *usermask, char *hostmask, int softban)
+{
+	char tpe = tkl_typetochar(type);
+	TKL *head, *tkl;
+
+	if (!TKLIsBanExceptionType(type))
+		abort();
+
+	head = tkl_find_head(tpe, hostmask, tklines[tkl_hash(tpe)]);
+	for (tkl = head; tkl; tkl = tkl->next)
+	{
+		if (tkl->type == type)
+		{
+			if (!strcasecmp(tkl->ptr.banexception->hostmask, hostmask) &&
+			    !strcasecmp(tkl->ptr.banexception->usermask, usermask))
+			{
+				/* And an extra check for soft/hard ban mismatches.. */
+				if ((tkl->ptr.banexception->subtype & TKL_SUBTYPE_SOFT) == softban)
+					return tkl;
+			}
+		}
+	}
+	return NULL; /* Not found */
+}
+
+/** Find a name ban TKL (qline) - only used to prevent duplicates and for deletion */
+TKL *_find_tkl_nameban(int type, char *name, int hold)
+{
+	char tpe = tkl_typetochar(type);
+	TKL *tkl;
+
+	if (!TKLIsNameBanType(type))
+		abort();
+
+	for (tkl = tklines[tkl_hash(tpe)]; tkl; tkl = tkl->next)
+	{
+		if ((tkl->type == type) && !strcasecmp(tkl->ptr.nameban->name, name))
+			return tkl;
+	}
+	return NULL; /* Not found */
+}
+
+/** Find a spamfilter TKL - only used to prevent duplicates and for deletion */
+TKL *_find_tkl_spamfilter(int type, char *match_string, BanAction action, unsigned short target)
 {
 	char tpe = tkl_typetochar(type);
 	TKL *tkl;
@@ -4099,19 +4991,289 @@ void _tkl_added(Client *client, TKL *tkl)
 {
 	RunHook(HOOKTYPE_TKL_ADD, client, tkl);
 
-	sendnotice_tkl_add(tkl);
+	/* During a bulk operation there is only a summary at the end */
+	if (bulk_depth)
+	{
+		if (TKLIsServerBan(tkl))
+			bulk_added[0]++;
+		else if (TKLIsBanException(tkl))
+			bulk_added[1]++;
+		else if (TKLIsNameBan(tkl))
+			bulk_added[2]++;
+		else if (TKLIsSpamfilter(tkl))
+			bulk_added[3]++;
+	} else {
+		sendnotice_tkl_add(tkl);
+	}
 
 	/* spamfilter 'warn' action is special */
 	if ((tkl->type & TKL_SPAMF) && (tkl->ptr.spamfilter->action == BAN_ACT_WARN) && (tkl->ptr.spamfilter->target & SPAMF_USER))
 		spamfilter_check_users(tkl);
 
-	/* Ban checking executes during run loop for efficiency */
-	loop.do_bancheck = 1;
+	/* Ban checking executes during run loop for efficiency.
+	 * Only the new ban is checked, see tkl_check_new_bans().
+	 */
+	if (TKLIsServerBan(tkl))
+		tkl_bancheck_queue(tkl);
 
 	if (tkl->type & TKL_GLOBAL)
 		tkl_broadcast_entry(1, client, client, tkl);
 }
 
+/** Queue a new server ban for checking against the local users */
+void tkl_bancheck_queue(TKL *tkl)
+{
+	if (tkl->flags & TKL_FLAG_BANCHECK_PENDING)
+		return;
+	if (bancheck_pending_num == bancheck_pending_max)
+	{
+		bancheck_pending_max = bancheck_pending_max ? bancheck_pending_max * 2 : 64;
+		bancheck_pending = realloc(bancheck_pending, sizeof(TKL *) * bancheck_pending_max);
+		if (!bancheck_pending)
+			outofmemory(sizeof(TKL *) * bancheck_pending_max);
+	}
+	bancheck_pending[bancheck_pending_num++] = tkl;
+	tkl->flags |= TKL_FLAG_BANCHECK_PENDING;
+}
+
+/** Remove a server ban from the queue, eg because it is being deleted */
+void tkl_bancheck_unqueue(TKL *tkl)
+{
+	int i;
+
+	for (i = 0; i < bancheck_pending_num; i++)
+	{
+		if (bancheck_pending[i] == tkl)
+		{
+			bancheck_pending[i] = bancheck_pending[--bancheck_pending_num];
+			break;
+		}
+	}
+	for (i = 0; i < bancheck_running_num; i++)
+	{
+		if (bancheck_running[i] == tkl)
+		{
+			bancheck_running[i] = NULL;
+			break;
+		}
+	}
+	tkl->flags &= ~TKL_FLAG_BANCHECK_PENDING;
+}
+
+void tkl_bancheck_pending_clear(void)
+{
+	int i;
+
+	for (i = 0; i < bancheck_pending_num; i++)
+		bancheck_pending[i]->flags &= ~TKL_FLAG_BANCHECK_PENDING;
+	bancheck_pending_num = 0;
+}
+
+/** Add a local client to the ipusers index. This is done on accept,
+ * so clients that are still registering can be found as well.
+ */
+void tkl_ipusers_add(Client *client)
+{
+	TKLIPUsers *e;
+
+	if (!HasRawIP(client))
+		return;
+
+	e = ipindex_find(&tkl_ipusers_index, client->rawip, IPINDEX_KEYLEN*8);
+	if (!e)
+	{
+		e = safe_alloc(sizeof(TKLIPUsers));
+		ipindex_add(&tkl_ipusers_index, client->rawip, IPINDEX_KEYLEN*8, e);
+	}
+	if (e->num_clients == e->max_clients)
+	{
+		e->max_clients = e->max_clients ? e->max_clients * 2 : 4;
+		e->clients = realloc(e->clients, sizeof(Client *) * e->max_clients);
+		if (!e->clients)
+			outofmemory(sizeof(Client *) * e->max_clients);
+	}
+	e->clients[e->num_clients++] = client;
+}
+
+/** Remove a local client from the ipusers index.
+ * @param client	The client
+ * @param rawip		The (previous) IP of the client in binary form
+ */
+void tkl_ipusers_del(Client *client, const char *rawip)
+{
+	TKLIPUsers *e;
+	int i;
+
+	if (!(e = ipindex_find(&tkl_ipusers_index, rawip, IPINDEX_KEYLEN*8)))
+		return;
+
+	for (i = 0; i < e->num_clients; i++)
+	{
+		if (e->clients[i] == client)
+		{
+			e->clients[i] = e->clients[--e->num_clients];
+			break;
+		}
+	}
+	if (e->num_clients == 0)
+	{
+		ipindex_del(&tkl_ipusers_index, rawip, IPINDEX_KEYLEN*8);
+		safe_free(e->clients);
+		safe_free(e);
+	}
+}
+
+int tkl_ipusers_free_client(Client *client)
+{
+	if (client->local && HasRawIP(client))
+		tkl_ipusers_del(client, client->rawip);
+	return 0;
+}
+
+static void tkl_ipusers_free_entry(void *value)
+{
+	TKLIPUsers *e = (TKLIPUsers *)value;
+
+	safe_free(e->clients);
+	safe_free(e);
+}
+
+void tkl_ipusers_free_all(void)
+{
+	ipindex_free(&tkl_ipusers_index, tkl_ipusers_free_entry);
+}
+
+/** Add the users of an ipusers entry to the list in 'data' (also a TKLIPUsers) */
+static void tkl_ipusers_collect(const char *key, int bits, void *value, void *data)
+{
+	TKLIPUsers *e = (TKLIPUsers *)value;
+	TKLIPUsers *list = (TKLIPUsers *)data;
+
+	if (list->num_clients + e->num_clients > list->max_clients)
+	{
+		list->max_clients = MAX(list->max_clients * 2, list->num_clients + e->num_clients);
+		list->clients = realloc(list->clients, sizeof(Client *) * list->max_clients);
+		if (!list->clients)
+			outofmemory(sizeof(Client *) * list->max_clients);
+	}
+	memcpy(list->clients + list->num_clients, e->clients, sizeof(Client *) * e->num_clients);
+	list->num_clients += e->num_clients;
+}
+
+/** Check one new server ban against one local client, and take action.
+ * Like the full check, this includes clients that are still registering.
+ * @returns 1 if the client was killed, 0 if not.
+ */
+static int tkl_check_new_ban_user(Client *client, TKL *tkl)
+{
+	if (!MyConnect(client) || IsServer(client) || IsMe(client) || IsDead(client))
+		return 0;
+
+	if (tkl->type & TKL_SHUN)
+	{
+		if (!IsShunned(client) &&
+		    !ValidatePermissionsForPath("immune:server-ban:shun",client,NULL,NULL,NULL))
+		{
+			find_shun_matcher(client, tkl);
+		}
+		return 0;
+	}
+
+	if (!find_tkline_match_matcher(client, 0, tkl))
+		return 0;
+
+	return tkl_ban_client(client, tkl);
+}
+
+/** Check the server bans that were added since the last call against
+ * the local clients, both registered users and clients that are still
+ * registering. Previously every new ban caused all bans to be checked
+ * against all clients. Now only the new ones are checked, and for bans
+ * on an IP address or CIDR range only the clients within it.
+ */
+EVENT(tkl_check_new_bans)
+{
+	Client *client, *next;
+	TKLIPUsers affected = { NULL, 0, 0 };
+	TKL **list, *tkl;
+	int num, num_maskbans = 0;
+	char key[IPINDEX_KEYLEN];
+	int bits;
+	int i, j;
+
+	if (bancheck_pending_num == 0)
+		return;
+
+	if (loop.do_bancheck)
+	{
+		/* All bans will be checked anyway (eg after a rehash) */
+		tkl_bancheck_pending_clear();
+		return;
+	}
+
+	/* Take the list out first. Killing a user may cause new bans to
+	 * be queued (eg. from a hook), those go in a new list and are
+	 * checked on the next run. A ban that is removed in the meantime
+	 * is set to NULL in this list by tkl_bancheck_unqueue().
+	 */
+	list = bancheck_running = bancheck_pending;
+	num = bancheck_running_num = bancheck_pending_num;
+	bancheck_pending = NULL;
+	bancheck_pending_num = bancheck_pending_max = 0;
+
+	for (i = 0; i < num; i++)
+	{
+		if (!(tkl = list[i]))
+			continue;
+		if (!ipindex_mask_key(tkl->ptr.serverban->hostmask, key, &bits))
+		{
+			/* Wildcard mask or hostname: needs checking against all users,
+			 * move it to the front of the list for that.
+			 */
+			list[i] = NULL;
+			list[num_maskbans++] = tkl;
+			continue;
+		}
+
+		/* IP address or CIDR range: only the users within it are affected.
+		 * This collects a copy, as users may be killed (and removed).
+		 */
+		affected.num_clients = 0;
+		ipindex_walk(&tkl_ipusers_index, key, bits, tkl_ipusers_collect, &affected);
+		for (j = 0; (j < affected.num_clients) && list[i]; j++)
+			tkl_check_new_ban_user(affected.clients[j], tkl);
+		if (list[i])
+		{
+			tkl->flags &= ~TKL_FLAG_BANCHECK_PENDING;
+			list[i] = NULL;
+		}
+	}
+
+	if (num_maskbans)
+	{
+		list_for_each_entry_safe(client, next, &lclient_list, lclient_node)
+		{
+			for (i = 0; i < num_maskbans; i++)
+				if (list[i] && tkl_check_new_ban_user(client, list[i]))
+					break; /* killed */
+		}
+		list_for_each_entry_safe(client, next, &unknown_list, lclient_node)
+		{
+			for (i = 0; i < num_maskbans; i++)
+				if (list[i] && tkl_check_new_ban_user(client, list[i]))
+					break; /* killed */
+		}
+		for (i = 0; i < num_maskbans; i++)
+			if (list[i])
+				list[i]->flags &= ~TKL_FLAG_BANCHECK_PENDING;
+	}
+
+	bancheck_running = NULL;
+	bancheck_running_num = 0;
+	safe_free(affected.clients);
+	safe_free(list);
+}
+
 /** Add a TKL using the TKL layer. See cmd_tkl for parv[] and protocol documentation. */
 CMD_FUNC(cmd_tkl_add)
 {
@@ -4384,6 +5546,7 @@ CMD_FUNC(cmd_tkl_add)
 				tkl->expire_at = 0;
 			else
 				tkl->expire_at = MAX(tkl->expire_at, expire_at);
+			tkl_expiry_update(tkl);
 
 			if (strcmp(tkl->set_by, parv[5]) < 0)
 				safe_strdup(tkl->set_by, parv[5]);
@@ -4882,7 +6045,7 @@ int _match_spamfilter(Client *client, const char *str_in, int target, const char
 	if (target == SPAMF_USER)
 		str = str_in;
 	else
-		str = StripControlCodes(str_in);
+		str = text_context_stripped(str_in);
 
 	/* (note: using client->user check here instead of IsUser()
 	 * due to SPAMF_USER where user isn't marked as client/person yet.
@@ -38,16 +38,18 @@ void watch_free(ModData *md);
 
 int watch_backend_user_quit(Client *client, MessageTag *mtags, const char *comment);
 int _watch_add(char *nick, Client *client, int flags);
-int _watch_check(Client *client, int event, int (*watch_notify)(Client *client, Watch *watch, Link *lp, int event));
+int _watch_add_many(Client *client, const char **nicks, int count, int flags, int max);
+int _watch_check(Client *client, int event, void *data, int (*watch_notify)(Client *client, Watch *watch, WatchSubscriber *sub, int event, void *data));
 Watch *_watch_get(char *nick);
 int _watch_del(char *nick, Client *client, int flags);
+int _watch_del_many(Client *client, const char **nicks, int count, int flags);
 int _watch_del_list(Client *client, int flags);
 uint64_t hash_watch_nick_name(const char *name);
 
 ModuleHeader MOD_HEADER
 = {
 	"watch-backend",
-	"6.0.3",
+	"6.0.4",
 	"backend for /WATCH",
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -60,6 +62,8 @@ MOD_TEST()
 	EfunctionAdd(modinfo->handle, EFUNC_WATCH_ADD, _watch_add);
 	EfunctionAdd(modinfo->handle, EFUNC_WATCH_DEL, _watch_del);
 	EfunctionAdd(modinfo->handle, EFUNC_WATCH_DEL_LIST, _watch_del_list);
+	EfunctionAdd(modinfo->handle, EFUNC_WATCH_ADD_MANY, _watch_add_many);
+	EfunctionAdd(modinfo->handle, EFUNC_WATCH_DEL_MANY, _watch_del_many);
 	EfunctionAddPVoid(modinfo->handle, EFUNC_WATCH_GET, TO_PVOIDFUNC(_watch_get));
 	EfunctionAdd(modinfo->handle, EFUNC_WATCH_CHECK, _watch_check);
 	return MOD_SUCCESS;
@@ -147,105 +151,333 @@ int watch_backend_user_quit(Client *client, MessageTag *mtags, const char *comme
 	return 0;
 }
 
+/*** Subscriber sets ***/
+
+/* Nicks with few subscribers keep them in a small array inside
+ * the Watch itself (watch->inline_subscribers). Popular nicks use
+ * a hash set on the client pointer instead, with open addressing and
+ * linear probing, so adding and removing a subscriber stays cheap
+ * no matter how many clients watch the nick.
+ */
+
+#define WATCH_SUBSCRIBERS_MIN_HASH_SIZE	16
+
+static unsigned int watch_subscriber_slot(Watch *watch, Client *client)
+{
+	uint64_t v = (uint64_t)(uintptr_t)client * 0x9E3779B97F4A7C15ULL;
+
+	return (unsigned int)(v >> 32) & (watch->subscribers_size - 1);
+}
+
+/** Find the subscriber entry of 'client', or NULL if not watching */
+static WatchSubscriber *watch_find_subscriber(Watch *watch, Client *client)
+{
+	unsigned int i;
+
+	if (!watch->subscribers_size)
+	{
+		for (i = 0; i < watch->num_subscribers; i++)
+			if (watch->inline_subscribers[i].client == client)
+				return &watch->inline_subscribers[i];
+		return NULL;
+	}
+
+	for (i = watch_subscriber_slot(watch, client);
+	     watch->subscribers[i].client;
+	     i = (i + 1) & (watch->subscribers_size - 1))
+	{
+		if (watch->subscribers[i].client == client)
+			return &watch->subscribers[i];
+	}
+	return NULL;
+}
+
+/* Add to the hash set. Caller must ensure there is room. */
+static void watch_hash_insert(Watch *watch, Client *client, int flags)
+{
+	unsigned int i;
+
+	for (i = watch_subscriber_slot(watch, client);
+	     watch->subscribers[i].client;
+	     i = (i + 1) & (watch->subscribers_size - 1))
+		;
+	watch->subscribers[i].client = client;
+	watch->subscribers[i].flags = flags;
+}
+
+/** Move the subscribers to a hash set of 'size' slots,
+ * or back inline if 'size' is 0.
+ */
+static void watch_resize_subscribers(Watch *watch, int size)
+{
+	WatchSubscriber *old = watch->subscribers_size ? watch->subscribers : watch->inline_subscribers;
+	int old_size = watch->subscribers_size ? watch->subscribers_size : watch->num_subscribers;
+	WatchSubscriber *old_hash = watch->subscribers;
+	int i, n = 0;
+
+	if (size == 0)
+	{
+		for (i = 0; i < old_size; i++)
+			if (old[i].client)
+				watch->inline_subscribers[n++] = old[i];
+		watch->subscribers = NULL;
+		watch->subscribers_size = 0;
+	} else {
+		watch->subscribers = safe_alloc(sizeof(WatchSubscriber) * size);
+		watch->subscribers_size = size;
+		for (i = 0; i < old_size; i++)
+			if (old[i].client)
+				watch_hash_insert(watch, old[i].client, old[i].flags);
+	}
+	safe_free(old_hash);
+}
+
+static void watch_add_subscriber(Watch *watch, Client *client, int flags)
+{
+	if (!watch->subscribers_size)
+	{
+		if (watch->num_subscribers < WATCH_INLINE_SUBSCRIBERS)
+		{
+			watch->inline_subscribers[watch->num_subscribers].client = client;
+			watch->inline_subscribers[watch->num_subscribers].flags = flags;
+			watch->num_subscribers++;
+			return;
+		}
+		watch_resize_subscribers(watch, WATCH_SUBSCRIBERS_MIN_HASH_SIZE);
+	} else
+	if ((watch->num_subscribers + 1) * 4 > watch->subscribers_size * 3)
+	{
+		/* Keep the hash set at most 75% full */
+		watch_resize_subscribers(watch, watch->subscribers_size * 2);
+	}
+	watch_hash_insert(watch, client, flags);
+	watch->num_subscribers++;
+}
+
+static void watch_del_subscriber(Watch *watch, WatchSubscriber *sub)
+{
+	unsigned int mask, i, j, k;
+
+	if (!watch->subscribers_size)
+	{
+		/* Keep the inline array packed */
+		*sub = watch->inline_subscribers[--watch->num_subscribers];
+		return;
+	}
+
+	/* Backward shift deletion: move up any entries that would
+	 * otherwise become unreachable, so we never need tombstones.
+	 */
+	mask = watch->subscribers_size - 1;
+	i = j = sub - watch->subscribers;
+	while (1)
+	{
+		j = (j + 1) & mask;
+		if (!watch->subscribers[j].client)
+			break;
+		k = watch_subscriber_slot(watch, watch->subscribers[j].client);
+		/* Entry can stay if its home slot 'k' lies cyclically in (i, j] */
+		if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)))
+			continue;
+		watch->subscribers[i] = watch->subscribers[j];
+		i = j;
+	}
+	watch->subscribers[i].client = NULL;
+	watch->subscribers[i].flags = 0;
+	watch->num_subscribers--;
+
+	if (watch->num_subscribers <= WATCH_INLINE_SUBSCRIBERS / 2)
+		watch_resize_subscribers(watch, 0);
+	else if ((watch->subscribers_size > WATCH_SUBSCRIBERS_MIN_HASH_SIZE) &&
+	         (watch->num_subscribers * 8 < watch->subscribers_size))
+		watch_resize_subscribers(watch, watch->subscribers_size / 2);
+}
+
+/** Remove the watch header from the hash table if nobody is watching anymore */
+static void watch_free_if_unused(Watch *watch)
+{
+	Watch **w;
+
+	if (watch->num_subscribers)
+		return;
+
+	for (w = &watchTable[hash_watch_nick_name(watch->nick)]; *w; w = &(*w)->hnext)
+	{
+		if (*w == watch)
+		{
+			*w = watch->hnext;
+			break;
+		}
+	}
+	safe_free(watch->subscribers);
+	safe_free(watch);
+}
+
+/*** Watch list of clients ***/
+
+static WatchList *watch_list(Client *client, int create)
+{
+	WatchList *wl = WATCH(client);
+
+	if (!wl && create)
+	{
+		wl = safe_alloc(sizeof(WatchList));
+		WATCH(client) = wl;
+	}
+	return wl;
+}
+
+/** Make room for at least 'num' entries in the watch list */
+static void watch_list_reserve(WatchList *wl, int num)
+{
+	int size;
+
+	if (num <= wl->size)
+		return;
+	size = wl->size ? wl->size : 8;
+	while (size < num)
+		size *= 2;
+	wl->entries = realloc(wl->entries, sizeof(WatchListEntry) * size);
+	if (!wl->entries)
+		outofmemory(sizeof(WatchListEntry) * size);
+	wl->size = size;
+}
+
+static void watch_list_free_if_empty(Client *client)
+{
+	WatchList *wl = WATCH(client);
+
+	if (wl && !wl->num_entries)
+	{
+		safe_free(wl->entries);
+		safe_free(wl);
+		WATCH(client) = NULL;
+	}
+}
+
 /*
- * _watch_add
+ * _watch_get
  */
-int _watch_add(char *nick, Client *client, int flags)
+Watch *_watch_get(char *nick)
 {
 	unsigned int hashv;
 	Watch *watch;
-	Link *lp;
-	
-	
-	/* Get the right bucket... */
+
 	hashv = hash_watch_nick_name(nick);
-	
-	/* Find the right nick (header) in the bucket, or NULL... */
+
 	if ((watch = watchTable[hashv]))
 		while (watch && mycmp(watch->nick, nick))
 		 watch = watch->hnext;
-	
-	/* If found NULL (no header for this nick), make one... */
-	if (!watch) {
+
+	return watch;
+}
+
+/** Add a single nick, the watch list must have room for it.
+ * @returns 1 if added, 0 if the client was already watching the nick.
+ */
+static int watch_add_one(const char *nick, Client *client, int flags, WatchList *wl)
+{
+	unsigned int hashv;
+	Watch *watch;
+
+	/* Get the right bucket... */
+	hashv = hash_watch_nick_name(nick);
+
+	/* Find the right nick (header) in the bucket, or NULL... */
+	for (watch = watchTable[hashv]; watch && mycmp(watch->nick, nick); watch = watch->hnext)
+		;
+
+	if (!watch)
+	{
+		/* If found NULL (no header for this nick), make one... */
 		watch = safe_alloc(sizeof(Watch)+strlen(nick));
 		watch->lasttime = timeofday;
 		strcpy(watch->nick, nick);
-		
-		watch->watch = NULL;
-		
 		watch->hnext = watchTable[hashv];
 		watchTable[hashv] = watch;
+	} else
+	if (watch_find_subscriber(watch, client))
+	{
+		/* Is this client already on the watch-list? Then we are done. */
+		return 0;
 	}
-	/* Is this client already on the watch-list? */
-	if ((lp = watch->watch))
-		while (lp && (lp->value.client != client))
-		 lp = lp->next;
-	
-	/* No it isn't, so add it in the bucket and client addint it */
-	if (!lp) {
-		lp = watch->watch;
-		watch->watch = make_link();
-		watch->watch->value.client = client;
-		watch->watch->flags = flags;
-		watch->watch->next = lp;
-		
-		lp = make_link();
-		lp->next = WATCH(client);
-		lp->value.wptr = watch;
-		lp->flags = flags;
-		WATCH(client) = lp;
-		WATCHES(client)++;
-	}
-	
+
+	watch_add_subscriber(watch, client, flags);
+	wl->entries[wl->num_entries].watch = watch;
+	wl->entries[wl->num_entries].flags = flags;
+	wl->num_entries++;
+	WATCHES(client)++;
+
+	return 1;
+}
+
+/*
+ * _watch_add
+ */
+int _watch_add(char *nick, Client *client, int flags)
+{
+	WatchList *wl = watch_list(client, 1);
+
+	watch_list_reserve(wl, wl->num_entries + 1);
+	watch_add_one(nick, client, flags, wl);
+
 	return 0;
 }
 
+/** Add multiple nicks to the watch list of a client at once.
+ * @param client	The client
+ * @param nicks		The nicks to add
+ * @param count		Number of entries in 'nicks'
+ * @param flags		WATCH_FLAG_*
+ * @param max		Stop adding once the client has this many
+ *			watch entries (or 0 for no limit)
+ * @returns The number of nicks processed. If this is less than 'count'
+ *          then the remaining nicks were not added due to 'max'.
+ */
+int _watch_add_many(Client *client, const char **nicks, int count, int flags, int max)
+{
+	WatchList *wl = watch_list(client, 1);
+	int i;
+
+	watch_list_reserve(wl, wl->num_entries + count);
+	for (i = 0; i < count; i++)
+	{
+		if (max && (WATCHES(client) >= max))
+			break;
+		watch_add_one(nicks[i], client, flags, wl);
+	}
+
+	watch_list_free_if_empty(client);
+	return i;
+}
+
 /*
  *	_watch_check
  */
-int _watch_check(Client *client, int event, int (*watch_notify)(Client *client, Watch *watch, Link *lp, int event))
+int _watch_check(Client *client, int event, void *data, int (*watch_notify)(Client *client, Watch *watch, WatchSubscriber *sub, int event, void *data))
 {
-	unsigned int hashv;
 	Watch *watch;
-	Link *lp;
+	int i;
 
-	/* Get us the right bucket */
-	hashv = hash_watch_nick_name(client->name);
-	
-	/* Find the right header in this bucket */
-	if ((watch = watchTable[hashv]))
-		while (watch && mycmp(watch->nick, client->name))
-		 watch = watch->hnext;
+	watch = _watch_get(client->name);
 	if (!watch)
 		return 0;	 /* This nick isn't on watch */
-	
+
 	/* Update the time of last change to item */
 	watch->lasttime = TStime();
-	
-	/* Send notifies out to everybody on the list in header */
-	for (lp = watch->watch; lp; lp = lp->next)
+
+	/* Send notifies out to everybody watching this nick */
+	if (!watch->subscribers_size)
 	{
-		watch_notify(client, watch, lp, event);
+		for (i = 0; i < watch->num_subscribers; i++)
+			watch_notify(client, watch, &watch->inline_subscribers[i], event, data);
+	} else {
+		for (i = 0; i < watch->subscribers_size; i++)
+			if (watch->subscribers[i].client)
+				watch_notify(client, watch, &watch->subscribers[i], event, data);
 	}
-	
-	return 0;
-}
 
-/*
- * _watch_get
- */
-Watch *_watch_get(char *nick)
-{
-	unsigned int hashv;
-	Watch *watch;
-	
-	hashv = hash_watch_nick_name(nick);
-	
-	if ((watch = watchTable[hashv]))
-		while (watch && mycmp(watch->nick, nick))
-		 watch = watch->hnext;
-	
-	return watch;
+	return 0;
 }
 
 /*
@@ -253,135 +485,174 @@ Watch *_watch_get(char *nick)
  */
 int _watch_del(char *nick, Client *client, int flags)
 {
-	unsigned int hashv;
-	Watch **watch, *wprev;
-	Link **lp, *prev;
+	Watch *watch;
+	WatchSubscriber *sub;
+	WatchList *wl;
+	int i;
 
-	/* Get the bucket for this nick... */
-	hashv = hash_watch_nick_name(nick);
-	
-	/* Find the right header, maintaining last-link pointer... */
-	watch = (Watch **)&watchTable[hashv];
-	while (*watch && mycmp((*watch)->nick, nick))
-		watch = &(*watch)->hnext;
-	if (!*watch)
+	watch = _watch_get(nick);
+	if (!watch)
 		return 0;	 /* No such watch */
-	
-	/* Find this client from the list of notifies... with last-ptr. */
-	lp = &(*watch)->watch;
-	while (*lp)
-	{
-		if ((*lp)->value.client == client && ((*lp)->flags & flags) == flags)
-			break;
-		lp = &(*lp)->next;
-	}
-	if (!*lp)
+
+	sub = watch_find_subscriber(watch, client);
+	if (!sub || ((sub->flags & flags) != flags))
 		return 0;	 /* No such client to watch */
-	
-	/* Fix the linked list under header, then remove the watch entry */
-	prev = *lp;
-	*lp = prev->next;
-	free_link(prev);
-	
-	/* Do the same regarding the links in client-record... */
-	lp = (Link **)&WATCH(client);
-	while (*lp && ((*lp)->value.wptr != *watch))
-		lp = &(*lp)->next;
-	
+
+	watch_del_subscriber(watch, sub);
+
+	/* Do the same regarding the entries in client-record... */
+	wl = WATCH(client);
+	for (i = 0; wl && (i < wl->num_entries); i++)
+		if (wl->entries[i].watch == watch)
+			break;
+
 	/*
 	 * Give error on the odd case... probobly not even neccessary
 	 * No error checking in ircd is unneccessary ;) -Cabal95
 	 */
-	if (!*lp)
+	if (!wl || (i == wl->num_entries))
 	{
 		unreal_log(ULOG_WARNING, "watch", "BUG_WATCH_DEL", client,
 		           "[BUG] watch_del found a watch entry with no client counterpoint, "
 		           "while processing nick $nick on client $client.details",
 		           log_data_string("nick", nick));
 	} else {
-		prev = *lp;
-		*lp = prev->next;
-		free_link(prev);
+		/* Keep the order of the list, for WATCH L and MONITOR L */
+		memmove(&wl->entries[i], &wl->entries[i+1], sizeof(WatchListEntry) * (wl->num_entries - i - 1));
+		wl->num_entries--;
 	}
+
 	/* In case this header is now empty of notices, remove it */
-	if (!(*watch)->watch) {
-		wprev = *watch;
-		*watch = wprev->hnext;
-		safe_free(wprev);
-	}
-	
+	watch_free_if_unused(watch);
+
 	/* Update count of notifies on nick */
 	WATCHES(client)--;
-	
+
+	watch_list_free_if_empty(client);
+
 	return 0;
 }
 
+/** Remove multiple nicks from the watch list of a client at once.
+ * This walks the watch list of the client only once,
+ * instead of once for every nick like watch_del() would.
+ * @param client	The client
+ * @param nicks		The nicks to remove
+ * @param count		Number of entries in 'nicks'
+ * @param flags		WATCH_FLAG_* that the entries must have
+ * @returns The number of entries removed.
+ */
+int _watch_del_many(Client *client, const char **nicks, int count, int flags)
+{
+	WatchList *wl = WATCH(client);
+	WatchSubscriber *sub;
+	Watch *watch;
+	int i, j, removed = 0, cleared = 0;
+
+	if (!wl)
+		return 0;
+
+	for (i = 0; i < count; i++)
+	{
+		watch = _watch_get((char *)nicks[i]);
+		if (!watch || watch->del_mark)
+			continue; /* No such watch, or a duplicate */
+		sub = watch_find_subscriber(watch, client);
+		if (!sub || ((sub->flags & flags) != flags))
+			continue;
+		watch_del_subscriber(watch, sub);
+		watch->del_mark = 1;
+		removed++;
+	}
+
+	if (!removed)
+		return 0;
+
+	/* Now remove all marked entries from the client's list in one pass.
+	 * The watch headers can only be freed after this.
+	 */
+	for (i = j = 0; i < wl->num_entries; i++)
+	{
+		watch = wl->entries[i].watch;
+		if (watch->del_mark)
+		{
+			watch->del_mark = 0;
+			cleared++;
+			WATCHES(client)--;
+			watch_free_if_unused(watch);
+			continue;
+		}
+		wl->entries[j++] = wl->entries[i];
+	}
+	wl->num_entries = j;
+
+	/* A watch that was not on the client's list (should not happen)
+	 * must not stay marked, or the next call would skip it.
+	 */
+	if (cleared != removed)
+	{
+		for (i = 0; i < count; i++)
+		{
+			watch = _watch_get((char *)nicks[i]);
+			if (watch && watch->del_mark)
+			{
+				watch->del_mark = 0;
+				watch_free_if_unused(watch);
+			}
+		}
+	}
+
+	watch_list_free_if_empty(client);
+
+	return removed;
+}
+
 /*
  * _watch_del_list
  */
 int _watch_del_list(Client *client, int flags)
 {
-	unsigned int hashv;
-	Watch *watch;
-	Link **np, **lp, *prev;
-	
-	np = (Link **)&WATCH(client);
-	
-	while (*np) {
-		if (((*np)->flags & flags) != flags)
+	WatchList *wl = WATCH(client);
+	WatchListEntry *e;
+	WatchSubscriber *sub;
+	int i, j;
+
+	if (!wl)
+		return 0;
+
+	for (i = j = 0; i < wl->num_entries; i++)
+	{
+		e = &wl->entries[i];
+		if ((e->flags & flags) != flags)
 		{
 			/* this entry is not fitting requested flags */
-			np = &(*np)->next;
+			wl->entries[j++] = *e;
 			continue;
 		}
-		
+
 		WATCHES(client)--;
-		
-		/* Find the watch-record from hash-table... */
-		watch = (*np)->value.wptr;
-		lp = &(watch->watch);
-		while (*lp && ((*lp)->value.client != client))
-			lp = &(*lp)->next;
-
-		/* Not found, another "worst case" debug error */
-		if (!*lp)
+
+		sub = watch_find_subscriber(e->watch, client);
+		if (!sub)
 		{
+			/* Not found, another "worst case" debug error */
 			unreal_log(ULOG_WARNING, "watch", "BUG_WATCH_DEL_LIST", client,
 				   "[BUG] watch_del_list found a watch entry with no table counterpoint, "
 				   "while processing client $client.details");
-		} else {
-			/* Fix the watch-list and remove entry */
-			Link *prev = *lp;
-			*lp = prev->next;
-			free_link(prev);
-			
-			/*
-			 * If this leaves a header without notifies,
-			 * remove it. Need to find the last-pointer!
-			 */
-			if (!watch->watch) {
-				Watch **np2, *wprev;
-				
-				hashv = hash_watch_nick_name(watch->nick);
-				
-				np2 = &watchTable[hashv];
-				while (*np2 && *np2 != watch)
-					np2 = &(*np2)->hnext;
-
-				*np2 = watch->hnext;
-
-				safe_free(watch);
-			}
+			continue;
 		}
-		
-		prev = *np; /* Save last pointer processed */
-		*np = prev->next; /* Jump to the next pointer */
-		free_link(prev); /* Free the previous */
+
+		watch_del_subscriber(e->watch, sub);
+		/* If this leaves a header without notifies, remove it. */
+		watch_free_if_unused(e->watch);
 	}
-	
+	wl->num_entries = j;
+
 	if (!flags)
 		WATCHES(client) = 0;
-	
+
+	watch_list_free_if_empty(client);
+
 	return 0;
 }
 
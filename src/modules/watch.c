@@ -30,7 +30,7 @@ int watch_away(Client *client, MessageTag *mtags, const char *reason, int alread
 int watch_nickchange(Client *client, MessageTag *mtags, const char *newnick);
 int watch_post_nickchange(Client *client, MessageTag *mtags, const char *oldnick);
 int watch_user_connect(Client *client);
-int watch_notification(Client *client, Watch *watch, Link *lp, int event);
+int watch_notification(Client *client, Watch *watch, WatchSubscriber *sub, int event, void *data);
 
 ModuleHeader MOD_HEADER
   = {
@@ -223,9 +223,9 @@ CMD_FUNC(cmd_watch)
 		 */
 		if ((*s == 'S' || *s == 's') && !did_s)
 		{
-			Link *lp;
+			WatchList *wl;
 			Watch *watch;
-			int  count = 0;
+			int  count = 0, i;
 			
 			did_s = 1;
 			
@@ -237,26 +237,22 @@ CMD_FUNC(cmd_watch)
 			 */
 			watch = watch_get(client->name);
 			if (watch)
-				for (lp = watch->watch, count = 1;
-				    (lp = lp->next); count++)
-					;
+				count = watch->num_subscribers;
 			sendnumeric(client, RPL_WATCHSTAT, WATCHES(client), count);
 
 			/*
 			 * Send a list of everybody in their WATCH list. Be careful
 			 * not to buffer overflow.
 			 */
-			lp = WATCH(client);
+			wl = WATCH(client);
 			*buf = '\0';
 			count = strlen(client->name) + strlen(me.name) + 10;
-			while (lp)
+			for (i = 0; wl && (i < wl->num_entries); i++)
 			{
-				if (!(lp->flags & WATCH_FLAG_TYPE_WATCH))
-				{
-					lp = lp->next;
+				Watch *w = wl->entries[i].watch;
+				if (!(wl->entries[i].flags & WATCH_FLAG_TYPE_WATCH))
 					continue; /* this one is not ours */
-				}
-				if (count + strlen(lp->value.wptr->nick) + 1 >
+				if (count + strlen(w->nick) + 1 >
 				    BUFSIZE - 2)
 				{
 					sendnumeric(client, RPL_WATCHLIST, buf);
@@ -264,10 +260,8 @@ CMD_FUNC(cmd_watch)
 					count = strlen(client->name) + strlen(me.name) + 10;
 				}
 				strcat(buf, " ");
-				strcat(buf, lp->value.wptr->nick);
-				count += (strlen(lp->value.wptr->nick) + 1);
-				
-				lp = lp->next;
+				strcat(buf, w->nick);
+				count += (strlen(w->nick) + 1);
 			}
 			if (*buf)
 				/* anything to send */
@@ -284,18 +278,17 @@ CMD_FUNC(cmd_watch)
 		 */
 		if ((*s == 'L' || *s == 'l') && !did_l)
 		{
-			Link *lp = WATCH(client);
+			WatchList *wl = WATCH(client);
+			int i;
 
 			did_l = 1;
 
-			while (lp)
+			for (i = 0; wl && (i < wl->num_entries); i++)
 			{
-				if (!(lp->flags & WATCH_FLAG_TYPE_WATCH))
-				{
-					lp = lp->next;
+				Watch *w = wl->entries[i].watch;
+				if (!(wl->entries[i].flags & WATCH_FLAG_TYPE_WATCH))
 					continue; /* this one is not ours */
-				}
-				if ((target = find_user(lp->value.wptr->nick, NULL)))
+				if ((target = find_user(w->nick, NULL)))
 				{
 					sendnumeric(client, RPL_NOWON, target->name,
 					    target->user->username,
@@ -309,9 +302,8 @@ CMD_FUNC(cmd_watch)
 				 */
 				else if (isupper(*s))
 					sendnumeric(client, RPL_NOWOFF,
-					    lp->value.wptr->nick, "*", "*",
-					    (long long)lp->value.wptr->lasttime);
-				lp = lp->next;
+					    w->nick, "*", "*",
+					    (long long)w->lasttime);
 			}
 
 			sendnumeric(client, RPL_ENDOFWATCHLIST, *s);
@@ -328,46 +320,46 @@ CMD_FUNC(cmd_watch)
 int watch_user_quit(Client *client, MessageTag *mtags, const char *comment)
 {
 	if (IsUser(client))
-		watch_check(client, WATCH_EVENT_OFFLINE, watch_notification);
+		watch_check(client, WATCH_EVENT_OFFLINE, NULL, watch_notification);
 	return 0;
 }
 
 int watch_away(Client *client, MessageTag *mtags, const char *reason, int already_as_away)
 {
 	if (reason)
-		watch_check(client, already_as_away ? WATCH_EVENT_REAWAY : WATCH_EVENT_AWAY, watch_notification);
+		watch_check(client, already_as_away ? WATCH_EVENT_REAWAY : WATCH_EVENT_AWAY, NULL, watch_notification);
 	else
-		watch_check(client, WATCH_EVENT_NOTAWAY, watch_notification);
+		watch_check(client, WATCH_EVENT_NOTAWAY, NULL, watch_notification);
 
 	return 0;
 }
 
 int watch_nickchange(Client *client, MessageTag *mtags, const char *newnick)
 {
-	watch_check(client, WATCH_EVENT_OFFLINE, watch_notification);
+	watch_check(client, WATCH_EVENT_OFFLINE, NULL, watch_notification);
 
 	return 0;
 }
 
 int watch_post_nickchange(Client *client, MessageTag *mtags, const char *oldnick)
 {
-	watch_check(client, WATCH_EVENT_ONLINE, watch_notification);
+	watch_check(client, WATCH_EVENT_ONLINE, NULL, watch_notification);
 
 	return 0;
 }
 
 int watch_user_connect(Client *client)
 {
-	watch_check(client, WATCH_EVENT_ONLINE, watch_notification);
+	watch_check(client, WATCH_EVENT_ONLINE, NULL, watch_notification);
 
 	return 0;
 }
 
-int watch_notification(Client *client, Watch *watch, Link *lp, int event)
+int watch_notification(Client *client, Watch *watch, WatchSubscriber *sub, int event, void *data)
 {
 	int awaynotify = 0;
 	
-	if (!(lp->flags & WATCH_FLAG_TYPE_WATCH))
+	if (!(sub->flags & WATCH_FLAG_TYPE_WATCH))
 		return 0;
 	
 	if ((event == WATCH_EVENT_AWAY) || (event == WATCH_EVENT_NOTAWAY) || (event == WATCH_EVENT_REAWAY))
@@ -377,13 +369,13 @@ int watch_notification(Client *client, Watch *watch, Link *lp, int event)
 	{
 		if (event == WATCH_EVENT_OFFLINE)
 		{
-			sendnumeric(lp->value.client, RPL_LOGOFF,
+			sendnumeric(sub->client, RPL_LOGOFF,
 			            client->name,
 			            (IsUser(client) ? client->user->username : "<N/A>"),
 			            (IsUser(client) ? (IsHidden(client) ? client->user->virthost : client->user->realhost) : "<N/A>"),
 			            (long long)watch->lasttime);
 		} else {
-			sendnumeric(lp->value.client, RPL_LOGON,
+			sendnumeric(sub->client, RPL_LOGON,
 			            client->name,
 			            (IsUser(client) ? client->user->username : "<N/A>"),
 			            (IsUser(client) ? (IsHidden(client) ? client->user->virthost : client->user->realhost) : "<N/A>"),
@@ -393,12 +385,12 @@ int watch_notification(Client *client, Watch *watch, Link *lp, int event)
 	else
 	{
 		/* AWAY or UNAWAY */
-		if (!(lp->flags & WATCH_FLAG_AWAYNOTIFY))
+		if (!(sub->flags & WATCH_FLAG_AWAYNOTIFY))
 			return 0; /* skip away/unaway notification for users not interested in them */
 
 		if (event == WATCH_EVENT_NOTAWAY)
 		{
-			sendnumeric(lp->value.client, RPL_NOTAWAY,
+			sendnumeric(sub->client, RPL_NOTAWAY,
 			    client->name,
 			    (IsUser(client) ? client->user->username : "<N/A>"),
 			    (IsUser(client) ? (IsHidden(client) ? client->user->virthost : client->user->realhost) : "<N/A>"),
@@ -406,7 +398,7 @@ int watch_notification(Client *client, Watch *watch, Link *lp, int event)
 		} else
 		if (event == RPL_GONEAWAY)
 		{
-			sendnumeric(lp->value.client, RPL_GONEAWAY,
+			sendnumeric(sub->client, RPL_GONEAWAY,
 			            client->name,
 			            (IsUser(client) ? client->user->username : "<N/A>"),
 			            (IsUser(client) ? (IsHidden(client) ? client->user->virthost : client->user->realhost) : "<N/A>"),
@@ -415,7 +407,7 @@ int watch_notification(Client *client, Watch *watch, Link *lp, int event)
 		} else
 		if (event == RPL_REAWAY)
 		{
-			sendnumeric(lp->value.client, RPL_REAWAY,
+			sendnumeric(sub->client, RPL_REAWAY,
 			            client->name,
 			            (IsUser(client) ? client->user->username : "<N/A>"),
 			            (IsUser(client) ? (IsHidden(client) ? client->user->virthost : client->user->realhost) : "<N/A>"),
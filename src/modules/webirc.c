@@ -168,7 +168,7 @@ void dowebirc(Client *client, const char *ip, const char *host, const char *opti
 
 	/* STEP 2: Update GetIP() */
 	strlcpy(oldip, client->ip, sizeof(oldip));
-	safe_strdup(client->ip, ip);
+	set_client_ip(client, ip);
 		
 	/* STEP 3: Update client->local->hostp */
 	/* (free old) */
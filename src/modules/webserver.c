@@ -10,7 +10,7 @@
 ModuleHeader MOD_HEADER
   = {
 	"webserver",
-	"1.0.0",
+	"1.1.1",
 	"Webserver",
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -26,6 +26,15 @@ ModuleHeader MOD_HEADER
 /* The "Server: xyz" in the response */
 #define WEB_SOFTWARE "UnrealIRCd"
 
+/* Maximum amount of pipelined data we buffer while a request is being handled */
+#define WEB_MAX_PIPELINE 65536
+
+/* Configuration */
+struct {
+	long keep_alive_timeout;
+	int keep_alive_max_requests;
+} cfg;
+
 /* Macros */
 #define WEB(client)		((WebRequest *)moddata_client(client, webserver_md).ptr)
 #define WEBSERVER(client)	((client->local && client->local->listener) ? client->local->listener->webserver : NULL)
@@ -43,6 +52,16 @@ void _webserver_send_response(Client *client, int status, char *msg);
 void _webserver_close_client(Client *client);
 int _webserver_handle_body(Client *client, WebRequest *web, const char *readbuf, int length);
 void parse_proxy_header(Client *client);
+int webserver_config_test(ConfigFile *cf, ConfigEntry *ce, int type, int *errs);
+int webserver_config_run(ConfigFile *cf, ConfigEntry *ce, int type);
+static int webserver_feed(Client *client, const char *buf, int len);
+static void webserver_process_pipeline(Client *client);
+
+/* Set while we are processing data from a web client, so that
+ * a request that completes from within that processing does not
+ * start on the next (pipelined) request recursively.
+ */
+static int webserver_processing = 0;
 
 /* Global variables */
 ModDataInfo *webserver_md; /* (by us) */
@@ -54,6 +73,7 @@ MOD_TEST()
 	EfunctionAddVoid(modinfo->handle, EFUNC_WEBSERVER_SEND_RESPONSE, _webserver_send_response);
 	EfunctionAddVoid(modinfo->handle, EFUNC_WEBSERVER_CLOSE_CLIENT, _webserver_close_client);
 	EfunctionAdd(modinfo->handle, EFUNC_WEBSERVER_HANDLE_BODY, _webserver_handle_body);
+	HookAdd(modinfo->handle, HOOKTYPE_CONFIGTEST, 0, webserver_config_test);
 	return MOD_SUCCESS;
 }
 
@@ -65,6 +85,11 @@ MOD_INIT()
 
 	//HookAdd(modinfo->handle, HOOKTYPE_PACKET, INT_MAX, webserver_packet_out);
 	HookAdd(modinfo->handle, HOOKTYPE_RAWPACKET_IN, INT_MIN, webserver_packet_in);
+	HookAdd(modinfo->handle, HOOKTYPE_CONFIGRUN, 0, webserver_config_run);
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.keep_alive_timeout = 15;
+	cfg.keep_alive_max_requests = 100;
 
 	memset(&mreq, 0, sizeof(mreq));
 	mreq.name = "web";
@@ -101,10 +126,83 @@ void webserver_webrequest_mdata_free(ModData *m)
 		safe_free(wsu->lefttoparse);
 		safe_free(wsu->request_buffer);
 		safe_free(wsu->forwarded);
+		DBufClear(&wsu->response);
+		safe_free(wsu->pipeline);
 		safe_free(m->ptr);
 	}
 }
 
+int webserver_config_test(ConfigFile *cf, ConfigEntry *ce, int type, int *errs)
+{
+	int errors = 0;
+	ConfigEntry *cep;
+
+	if (type != CONFIG_SET)
+		return 0;
+
+	/* We are only interrested in set::webserver... */
+	if (!ce || !ce->name || strcmp(ce->name, "webserver"))
+		return 0;
+
+	for (cep = ce->items; cep; cep = cep->next)
+	{
+		if (!cep->value)
+		{
+			config_error("%s:%i: set::webserver::%s with no value",
+				cep->file->filename, cep->line_number, cep->name);
+			errors++;
+		} else
+		if (!strcmp(cep->name, "keep-alive-timeout"))
+		{
+			long v = config_checkval(cep->value, CFG_TIME);
+			if ((v < 0) || (v > 3600))
+			{
+				config_error("%s:%i: set::webserver::keep-alive-timeout should be between 0 and 3600 seconds",
+					cep->file->filename, cep->line_number);
+				errors++;
+			}
+		} else
+		if (!strcmp(cep->name, "keep-alive-max-requests"))
+		{
+			int v = atoi(cep->value);
+			if ((v < 0) || (v > 1000000))
+			{
+				config_error("%s:%i: set::webserver::keep-alive-max-requests should be between 0 and 1000000",
+					cep->file->filename, cep->line_number);
+				errors++;
+			}
+		} else
+		{
+			config_error("%s:%i: unknown directive set::webserver::%s",
+				cep->file->filename, cep->line_number, cep->name);
+			errors++;
+		}
+	}
+	*errs = errors;
+	return errors ? -1 : 1;
+}
+
+int webserver_config_run(ConfigFile *cf, ConfigEntry *ce, int type)
+{
+	ConfigEntry *cep;
+
+	if (type != CONFIG_SET)
+		return 0;
+
+	/* We are only interrested in set::webserver... */
+	if (!ce || !ce->name || strcmp(ce->name, "webserver"))
+		return 0;
+
+	for (cep = ce->items; cep; cep = cep->next)
+	{
+		if (!strcmp(cep->name, "keep-alive-timeout"))
+			cfg.keep_alive_timeout = config_checkval(cep->value, CFG_TIME);
+		else if (!strcmp(cep->name, "keep-alive-max-requests"))
+			cfg.keep_alive_max_requests = atoi(cep->value);
+	}
+	return 1;
+}
+
 /** Outgoing packet hook.
  * Do we need this?
  */
@@ -155,6 +253,56 @@ void webserver_possible_request(Client *client, const char *buf, int len)
 	/* Set some default values: */
 	WEB(client)->content_length = -1;
 	WEB(client)->config_max_request_buffer_size = 4096; /* 4k */
+	dbuf_queue_init(&WEB(client)->response);
+}
+
+/** Reset the request state, so the connection can be used for the next request
+ * (HTTP keep-alive). The pipeline buffer and the request counter are kept.
+ */
+static void webserver_reset_request(Client *client)
+{
+	WebRequest *web = WEB(client);
+
+	safe_free(web->uri);
+	free_nvplist(web->headers);
+	web->headers = NULL;
+	web->num_headers = 0;
+	safe_free(web->lefttoparse);
+	web->lefttoparselen = 0;
+	safe_free(web->request_buffer);
+	web->request_buffer_size = 0;
+	web->request_header_parsed = 0;
+	web->request_body_complete = 0;
+	web->content_length = -1;
+	web->chunk_remaining = 0;
+	web->transfer_encoding = TRANSFER_ENCODING_NONE;
+	web->keep_alive = 0;
+	web->response_status = 0;
+	web->response_deferred = 0;
+	web->response_content_type = NULL;
+	DBufClear(&web->response);
+}
+
+/** Store data that belongs to a next (pipelined) request.
+ * @returns 1 if stored, 0 if the client is killed for sending too much.
+ */
+static int webserver_pipeline_append(Client *client, const char *buf, int len)
+{
+	WebRequest *web = WEB(client);
+
+	if (len <= 0)
+		return 1;
+	if (web->pipelinelen + len > WEB_MAX_PIPELINE)
+	{
+		dead_socket(client, "HTTP pipeline too large");
+		return 0;
+	}
+	web->pipeline = realloc(web->pipeline, web->pipelinelen + len);
+	if (!web->pipeline)
+		outofmemory(web->pipelinelen + len);
+	memcpy(web->pipeline + web->pipelinelen, buf, len);
+	web->pipelinelen += len;
+	return 1;
 }
 
 /** Incoming packet hook. This processes web requests.
@@ -174,11 +322,71 @@ int webserver_packet_in(Client *client, const char *readbuf, int *length)
 	if (!WEBSERVER(client))
 		return 0; /* handler is gone!? */
 
+	webserver_processing++;
+	webserver_feed(client, readbuf, *length);
+	webserver_processing--;
+	if (IsDead(client))
+		return -1;
+
+	/* Start on any pipelined requests that are now complete */
+	webserver_process_pipeline(client);
+	return IsDead(client) ? -1 : 0;
+}
+
+/** Pass data to the request header parser or body handler,
+ * or save it for later if we are still busy with a request.
+ */
+static int webserver_feed(Client *client, const char *buf, int len)
+{
+	/* Still answering the current request, or there is already
+	 * pipelined data waiting: append to it (keeps the order).
+	 */
+	if (WEB(client)->pipeline || WEB(client)->request_body_complete)
+		return webserver_pipeline_append(client, buf, len);
+
 	if (WEB(client)->request_header_parsed)
-		return WEBSERVER(client)->handle_body(client, WEB(client), readbuf, *length);
+		return WEBSERVER(client)->handle_body(client, WEB(client), buf, len);
 
 	/* else.. */
-	return webserver_handle_request_header(client, readbuf, length);
+	return webserver_handle_request_header(client, buf, &len);
+}
+
+/** Process requests that were pipelined by the client,
+ * until we run out of data or have to wait for a response.
+ */
+static void webserver_process_pipeline(Client *client)
+{
+	char *buf, *p;
+	int len, n;
+
+	while (!IsDead(client) && WEB(client) && WEBSERVER(client) &&
+	       WEB(client)->pipeline && !WEB(client)->request_body_complete)
+	{
+		buf = p = WEB(client)->pipeline;
+		len = WEB(client)->pipelinelen;
+		WEB(client)->pipeline = NULL;
+		WEB(client)->pipelinelen = 0;
+
+		/* Skip empty lines between requests (eg. after a chunked body) */
+		if (!WEB(client)->request_header_parsed && !WEB(client)->lefttoparse)
+		{
+			while ((len > 0) && ((*p == '\r') || (*p == '\n')))
+			{
+				p++;
+				len--;
+			}
+		}
+
+		/* Feed it in pieces, the header parser works on one packet at a time */
+		webserver_processing++;
+		for (; (len > 0) && !IsDead(client); p += n, len -= n)
+		{
+			n = MIN(len, READBUFSIZE);
+			webserver_feed(client, p, n);
+		}
+		webserver_processing--;
+		safe_free(buf);
+	}
 }
 
 /** Helper function to parse the HTTP header consisting of multiple 'Key: value' pairs */
@@ -351,8 +559,9 @@ char *find_end_of_request(char *header, int totalsize, int *remaining_bytes)
 	return NULL;
 }
 
-/** Handle HTTP request
- * Yes, I'm going to assume that the header fits in one packet and one packet only.
+/** Handle HTTP request.
+ * The header is collected until it is complete (it may arrive in
+ * multiple packets), then parsed in one go.
  */
 int webserver_handle_request_header(Client *client, const char *readbuf, int *length)
 {
@@ -360,9 +569,9 @@ int webserver_handle_request_header(Client *client, const char *readbuf, int *le
 	int r, end_of_request;
 	static char netbuf[16384];
 	static char netbuf2[16384];
-	char *lastloc = NULL;
+	char *lastloc = NULL, *p;
 	int n, maxcopy, nprefix=0;
-	int totalsize;
+	int totalsize, copied;
 
 	/* Totally paranoid: */
 	memset(netbuf, 0, sizeof(netbuf));
@@ -387,11 +596,40 @@ int webserver_handle_request_header(Client *client, const char *readbuf, int *le
 		return -1;
 	}
 	memcpy(netbuf+nprefix, readbuf, n); /* SAFE: see checking above */
+	copied = n;
 	totalsize = n + nprefix;
 	netbuf[totalsize] = '\0';
 	memcpy(netbuf2, netbuf, totalsize+1); // copy, including the "always present \0 at the end just in case we use strstr etc".
+
+	/* Wait until we have the complete request header, it may be
+	 * split over several packets (especially with pipelining).
+	 */
+	if (!strstr(netbuf, "\r\n\r\n") && !strstr(netbuf, "\n\n"))
+	{
+		if ((copied < *length) || (totalsize >= sizeof(netbuf) - 1))
+		{
+			webserver_send_response(client, 400, "Request header too large");
+			return -1;
+		}
+		safe_strdup(WEB(client)->lefttoparse, netbuf);
+		return 0;
+	}
 	safe_free(WEB(client)->lefttoparse);
 
+	/* The request line */
+	WEB(client)->method = webserver_get_method(netbuf2);
+	if (WEB(client)->method == HTTP_METHOD_NONE)
+	{
+		webserver_send_response(client, 400, "Malformed HTTP request");
+		return -1;
+	}
+	/* HTTP/1.1 defaults to keep-alive, HTTP/1.0 needs to ask for it */
+	p = strchr(netbuf2, '\n');
+	*p = '\0'; /* SAFE: there is at least an empty line after it, see above */
+	if (strstr(netbuf2, " HTTP/1.1"))
+		WEB(client)->keep_alive = 1;
+	*p = '\n';
+
 	/** Now step through the lines.. **/
 	for (r = webserver_handshake_helper(netbuf, strlen(netbuf), &key, &value, &lastloc, &end_of_request);
 	     r;
@@ -413,6 +651,13 @@ int webserver_handle_request_header(Client *client, const char *readbuf, int *le
 			{
 				if (!strcasecmp(value, "chunked"))
 					WEB(client)->transfer_encoding = TRANSFER_ENCODING_CHUNKED;
+			} else
+			if (!strcasecmp(key, "Connection"))
+			{
+				if (!strcasecmp(value, "close"))
+					WEB(client)->keep_alive = 0;
+				else if (!strcasecmp(value, "keep-alive"))
+					WEB(client)->keep_alive = 1;
 			}
 			add_nvplist(&WEB(client)->headers, WEB(client)->num_headers, key, value);
 		}
@@ -423,6 +668,8 @@ int webserver_handle_request_header(Client *client, const char *readbuf, int *le
 		int n;
 		int remaining_bytes = 0;
 		char *nextframe;
+		long long body_length;
+		int chunked;
 
 		/* Some sanity checks */
 		if (!WEB(client)->uri)
@@ -432,26 +679,99 @@ int webserver_handle_request_header(Client *client, const char *readbuf, int *le
 		}
 
 		WEB(client)->request_header_parsed = 1;
-		parse_proxy_header(client);
+		if (WEB(client)->num_requests == 0)
+			parse_proxy_header(client);
+
+		/* A request without Content-Length and without chunked
+		 * encoding has no body (RFC 9112 6.3), eg a plain GET.
+		 * This way we also know where the next request starts.
+		 * Also, the IP of a client behind a proxy is only known
+		 * for the first request, so no keep-alive then.
+		 */
+		if ((WEB(client)->content_length < 0) && (WEB(client)->transfer_encoding != TRANSFER_ENCODING_CHUNKED))
+			WEB(client)->content_length = 0;
+		if (WEB(client)->forwarded || (cfg.keep_alive_timeout <= 0) ||
+		    (WEB(client)->num_requests + 1 >= cfg.keep_alive_max_requests))
+		{
+			WEB(client)->keep_alive = 0;
+		}
+		body_length = WEB(client)->content_length;
+		chunked = (WEB(client)->transfer_encoding == TRANSFER_ENCODING_CHUNKED);
 		n = WEBSERVER(client)->handle_request(client, WEB(client));
-		if ((n <= 0) || IsDead(client))
-			return n; /* byebye */
-		
+		if (IsDead(client))
+			return -1; /* byebye */
+		if (n <= 0)
+		{
+			/* If the handler already completed the request and the
+			 * connection is kept alive (eg. metrics), then anything
+			 * after the request is for the next pipelined request.
+			 */
+			if (!WEB(client) || WEB(client)->request_header_parsed)
+				return n;
+			nextframe = find_end_of_request(netbuf2, totalsize, &remaining_bytes);
+			if (chunked || (body_length > (nextframe ? remaining_bytes : 0)))
+			{
+				/* The body was not read, so we don't know where it ends */
+				webserver_close_client(client);
+				return -1;
+			}
+			if (nextframe && !webserver_pipeline_append(client, nextframe + body_length, remaining_bytes - body_length))
+				return -1;
+			if ((copied < *length) && !webserver_pipeline_append(client, readbuf + copied, *length - copied))
+				return -1;
+			return n;
+		}
+
 		/* There could be data directly after the request header (eg for
 		 * a POST or PUT), check for it here so it isn't lost.
 		 */
 		nextframe = find_end_of_request(netbuf2, totalsize, &remaining_bytes);
 		if (nextframe)
-			return WEBSERVER(client)->handle_body(client, WEB(client), nextframe, remaining_bytes);
+		{
+			WEBSERVER(client)->handle_body(client, WEB(client), nextframe, remaining_bytes);
+			if (IsDead(client))
+				return -1;
+		}
+
+		/* Anything that did not fit in netbuf comes after that */
+		if ((copied < *length) && !webserver_pipeline_append(client, readbuf + copied, *length - copied))
+			return -1;
 		return 0;
 	}
 
-	if (lastloc)
-	{
-		/* Last line was cut somewhere, save it for next round. */
-		safe_strdup(WEB(client)->lefttoparse, lastloc);
-	}
-	return 0; /* don't let UnrealIRCd process this */
+	/* We had the complete header, so this means it could not be parsed */
+	webserver_send_response(client, 400, "Malformed HTTP request");
+	return -1;
+}
+
+static const char *webserver_status_message(int status)
+{
+	if (status == 200)
+		return "OK";
+	else if (status == 201)
+		return "Created";
+	else if (status == 500)
+		return "Internal Server Error";
+	else if (status == 400)
+		return "Bad Request";
+	else if (status == 401)
+		return "Unauthorized";
+	else if (status == 403)
+		return "Forbidden";
+	else if (status == 404)
+		return "Not Found";
+	else if (status == 416)
+		return "Range Not Satisfiable";
+	return "???";
+}
+
+/** The "Content-Type: xyz" header line, if the request handler set one */
+static const char *webserver_content_type_header(Client *client, char *buf, size_t buflen)
+{
+	if (!WEB(client) || !WEB(client)->response_content_type)
+		return "";
+	snprintf(buf, buflen, "Content-Type: %s\r\n", WEB(client)->response_content_type);
+	return buf;
 }
 
 /** Send a HTTP(S) response.
@@ -459,36 +779,43 @@ int webserver_handle_request_header(Client *client, const char *readbuf, int *le
  * @param status	HTTP status code
  * @param msg		The message body.
  * @note if 'msgs' is NULL then don't close the connection.
+ *       In that case the caller sends the body and calls
+ *       webserver_close_client() when it is done. For keep-alive
+ *       requests the headers are held back until then, so we
+ *       can send a Content-Length.
  */
 void _webserver_send_response(Client *client, int status, char *msg)
 {
 	char buf[512];
-	char *statusmsg = "???";
+	char body[512];
+	char ctype[128];
 
-	if (status == 200)
-		statusmsg = "OK";
-	else if (status == 201)
-		statusmsg = "Created";
-	else if (status == 500)
-		statusmsg = "Internal Server Error";
-	else if (status == 400)
-		statusmsg = "Bad Request";
-	else if (status == 401)
-		statusmsg = "Unauthorized";
-	else if (status == 403)
-		statusmsg = "Forbidden";
-	else if (status == 404)
-		statusmsg = "Not Found";
-	else if (status == 416)
-		statusmsg = "Range Not Satisfiable";
+	if (!msg && WEB(client) && WEB(client)->keep_alive)
+	{
+		WEB(client)->response_status = status;
+		WEB(client)->response_deferred = 1;
+		return;
+	}
+
+	if (WEB(client))
+	{
+		/* Any deferred response is replaced by this one */
+		WEB(client)->keep_alive = 0;
+		WEB(client)->response_deferred = 0;
+		DBufClear(&WEB(client)->response);
+	}
 
-	snprintf(buf, sizeof(buf),
-		"HTTP/1.1 %d %s\r\nServer: %s\r\nConnection: close\r\n\r\n",
-		status, statusmsg, WEB_SOFTWARE);
 	if (msg)
 	{
-		strlcat(buf, msg, sizeof(buf));
-		strlcat(buf, "\n", sizeof(buf));
+		snprintf(body, sizeof(body), "%s\n", msg);
+		snprintf(buf, sizeof(buf),
+			"HTTP/1.1 %d %s\r\nServer: %s\r\nConnection: close\r\nContent-Length: %d\r\n\r\n%s",
+			status, webserver_status_message(status), WEB_SOFTWARE, (int)strlen(body), body);
+	} else {
+		snprintf(buf, sizeof(buf),
+			"HTTP/1.1 %d %s\r\nServer: %s\r\n%sConnection: close\r\n\r\n",
+			status, webserver_status_message(status), WEB_SOFTWARE,
+			webserver_content_type_header(client, ctype, sizeof(ctype)));
 	}
 
 	dbuf_put(&client->local->sendQ, buf, strlen(buf));
@@ -496,9 +823,67 @@ void _webserver_send_response(Client *client, int status, char *msg)
 		webserver_close_client(client);
 }
 
-/** Close a web client softly, after data has been sent. */
+/** Send the deferred response (headers + body) of a keep-alive request. */
+static void webserver_send_deferred_response(Client *client)
+{
+	WebRequest *web = WEB(client);
+	char buf[512];
+	char ctype[128];
+	char *body = NULL;
+	int len;
+
+	web->response_deferred = 0;
+	web->num_requests++;
+	if (web->num_requests >= cfg.keep_alive_max_requests)
+		web->keep_alive = 0;
+
+	len = dbuf_get(&web->response, &body);
+	if (web->keep_alive)
+	{
+		snprintf(buf, sizeof(buf),
+			"HTTP/1.1 %d %s\r\nServer: %s\r\n%sContent-Length: %d\r\n"
+			"Keep-Alive: timeout=%ld, max=%d\r\n\r\n",
+			web->response_status, webserver_status_message(web->response_status), WEB_SOFTWARE,
+			webserver_content_type_header(client, ctype, sizeof(ctype)), len,
+			cfg.keep_alive_timeout, cfg.keep_alive_max_requests - web->num_requests);
+	} else {
+		snprintf(buf, sizeof(buf),
+			"HTTP/1.1 %d %s\r\nServer: %s\r\n%sConnection: close\r\nContent-Length: %d\r\n\r\n",
+			web->response_status, webserver_status_message(web->response_status), WEB_SOFTWARE,
+			webserver_content_type_header(client, ctype, sizeof(ctype)), len);
+	}
+	dbuf_put(&client->local->sendQ, buf, strlen(buf));
+	if (len > 0)
+		dbuf_put(&client->local->sendQ, body, len);
+	safe_free(body);
+}
+
+/** Called when the response to a request is complete.
+ * For keep-alive requests this sends the response and waits
+ * for the next request, otherwise the web client is closed
+ * softly, after data has been sent.
+ */
 void _webserver_close_client(Client *client)
 {
+	if (WEB(client) && WEB(client)->response_deferred)
+	{
+		webserver_send_deferred_response(client);
+		if (WEB(client)->keep_alive)
+		{
+			send_queued(client);
+			webserver_reset_request(client);
+			/* The handshake timeout doubles as idle timeout */
+			reset_handshake_timeout(client, cfg.keep_alive_timeout);
+			if (!webserver_processing)
+				webserver_process_pipeline(client);
+			return;
+		}
+	}
+
+	/* The HTTP response is complete, an IRC ERROR line would only
+	 * end up as garbage after the response body.
+	 */
+	SetNoErrorMsg(client);
 	send_queued(client);
 	if (DBufLength(&client->local->sendQ) == 0)
 	{
@@ -566,14 +951,24 @@ int _webserver_handle_body(Client *client, WebRequest *web, const char *readbuf,
 
 	if (WEB(client)->transfer_encoding == TRANSFER_ENCODING_NONE)
 	{
-		if (!webserver_handle_body_append_buffer(client, readbuf, pktsize))
-			return 0;
-
-		if ((WEB(client)->content_length >= 0) &&
-		    (WEB(client)->request_buffer_size >= WEB(client)->content_length))
+		if (WEB(client)->content_length >= 0)
 		{
-			WEB(client)->request_body_complete = 1;
+			/* Only take what belongs to this request,
+			 * anything after it is the next (pipelined) request.
+			 */
+			n = MIN(pktsize, WEB(client)->content_length - WEB(client)->request_buffer_size);
+			if ((n > 0) && !webserver_handle_body_append_buffer(client, readbuf, n))
+				return 0;
+			if (WEB(client)->request_buffer_size >= WEB(client)->content_length)
+			{
+				WEB(client)->request_body_complete = 1;
+				if ((pktsize > n) && !webserver_pipeline_append(client, readbuf + n, pktsize - n))
+					return 0;
+			}
+			return 1;
 		}
+		if (!webserver_handle_body_append_buffer(client, readbuf, pktsize))
+			return 0;
 		return 1;
 	}
 
@@ -670,8 +1065,27 @@ int _webserver_handle_body(Client *client, WebRequest *web, const char *readbuf,
 			}
 			if (WEB(client)->chunk_remaining == 0)
 			{
-				/* DONE! */
+				/* DONE! Anything after the final chunk (and the
+				 * empty line that follows it) is the next request.
+				 */
 				WEB(client)->request_body_complete = 1;
+				buf += i;
+				n -= i;
+				if ((n >= 2) && !strncmp(buf, "\r\n", 2))
+				{
+					buf += 2;
+					n -= 2;
+				} else
+				if ((n >= 1) && !strncmp(buf, "\n", 1))
+				{
+					buf++;
+					n--;
+				}
+				if ((n > 0) && !webserver_pipeline_append(client, buf, n))
+				{
+					safe_free(free_this_buffer);
+					return 0;
+				}
 				safe_free(free_this_buffer);
 				return 1;
 			}
@@ -757,7 +1171,7 @@ void webserver_handle_proxy(Client *client, ConfigItem_proxy *proxy)
 
 	/* store data / set new IP */
 	strlcpy(oldip, client->ip, sizeof(oldip));
-	safe_strdup(client->ip, forwarded->ip);
+	set_client_ip(client, forwarded->ip);
 	strlcpy(client->local->sockhost, forwarded->ip, sizeof(client->local->sockhost)); /* in case dns lookup fails or is disabled */
 
 	/* restart DNS & ident lookups */
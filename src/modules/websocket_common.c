@@ -10,7 +10,7 @@
 ModuleHeader MOD_HEADER
   = {
 	"websocket_common",
-	"6.0.0",
+	"6.0.1",
 	"WebSocket support (RFC6455)",
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -95,7 +95,8 @@ int _websocket_handle_websocket(Client *client, WebRequest *web, const char *rea
 	char *ptr;
 	int length;
 	int length1 = WSU(client)->lefttoparselen;
-	char readbuf[MAXLINELENGTH];
+	/* Room for one full read (READBUFSIZE) on top of a partial frame */
+	char readbuf[MAXLINELENGTH*2];
 
 	length = length1 + length2;
 	if (length > sizeof(readbuf)-1)
@@ -207,6 +208,12 @@ int websocket_handle_packet(Client *client, const char *readbuf, int length, int
 		}
 		p += 2; /* advance pointer 2 bytes */
 
+		if (len > sizeof(payloadbuf))
+		{
+			dead_socket(client, "WebSocket packet too large");
+			return -1;
+		}
+
 		/* Need to check the length again, now it has changed: */
 		if (length < len + 4 + maskkeylen)
 		{
@@ -29,7 +29,7 @@ CMD_FUNC(cmd_whowas);
 ModuleHeader MOD_HEADER
   = {
 	"whowas",
-	"5.0",
+	"5.1",
 	"command /whowas", 
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -52,10 +52,6 @@ MOD_UNLOAD()
 	return MOD_SUCCESS;
 }
 
-/* externally defined functions */
-extern WhoWas MODVAR WHOWAS[NICKNAMEHISTORYLENGTH];
-extern WhoWas MODVAR *WHOWASHASH[WHOWAS_HASH_TABLE_SIZE];
-
 /*
 ** cmd_whowas
 **      parv[1] = nickname queried
@@ -92,37 +88,33 @@ CMD_FUNC(cmd_whowas)
 		*p = '\0'; /* cut off at first */
 
 	nick = request;
-	temp = WHOWASHASH[hash_whowas_name(nick)];
 	found = 0;
-	for (; temp; temp = temp->next)
+	for (temp = whowas_find_nick(nick); temp; temp = whowas_next_nick(temp))
 	{
-		if (!mycmp(nick, temp->name))
+		sendnumeric(client, RPL_WHOWASUSER, temp->name,
+		    temp->username,
+		    BadPtr(temp->virthost) ? temp->hostname : temp->virthost,
+		    temp->realname);
+		if (!BadPtr(temp->ip) && ValidatePermissionsForPath("client:see:ip",client,NULL,NULL,NULL))
+		{
+			sendnumericfmt(client, RPL_WHOISHOST, "%s :was connecting from %s@%s %s",
+				temp->name,
+				temp->username, temp->hostname,
+				temp->ip ? temp->ip : "");
+		}
+		if (IsOper(client) && !BadPtr(temp->account))
+		{
+			sendnumericfmt(client, RPL_WHOISLOGGEDIN, "%s %s :was logged in as",
+				temp->name,
+				temp->account);
+		}
+		if (!((find_uline(temp->servername)) && !IsOper(client) && HIDE_ULINES))
 		{
-			sendnumeric(client, RPL_WHOWASUSER, temp->name,
-			    temp->username,
-			    BadPtr(temp->virthost) ? temp->hostname : temp->virthost,
-			    temp->realname);
-			if (!BadPtr(temp->ip) && ValidatePermissionsForPath("client:see:ip",client,NULL,NULL,NULL))
-			{
-				sendnumericfmt(client, RPL_WHOISHOST, "%s :was connecting from %s@%s %s",
-					temp->name,
-					temp->username, temp->hostname,
-					temp->ip ? temp->ip : "");
-			}
-			if (IsOper(client) && !BadPtr(temp->account))
-			{
-				sendnumericfmt(client, RPL_WHOISLOGGEDIN, "%s %s :was logged in as",
-					temp->name,
-					temp->account);
-			}
-			if (!((find_uline(temp->servername)) && !IsOper(client) && HIDE_ULINES))
-			{
-				sendnumeric(client, RPL_WHOISSERVER, temp->name, temp->servername,
-				            myctime(temp->logoff));
-			}
-			cur++;
-			found++;
+			sendnumeric(client, RPL_WHOISSERVER, temp->name, temp->servername,
+			            myctime(temp->logoff));
 		}
+		cur++;
+		found++;
 		if (max > 0 && cur >= max)
 			break;
 	}
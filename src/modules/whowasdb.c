@@ -8,7 +8,7 @@
 
 ModuleHeader MOD_HEADER = {
 	"whowasdb",
-	"1.0",
+	"1.1",
 	"Stores and retrieves WHOWAS history",
 	"UnrealIRCd Team",
 	"unrealircd-6",
@@ -17,9 +17,14 @@ ModuleHeader MOD_HEADER = {
 /* Our header */
 #define WHOWASDB_HEADER		0x57484F57
 /* Database version */
-#define WHOWASDB_VERSION 100
+#define WHOWASDB_VERSION 101
 /* Save whowas of users to file every <this> seconds */
 #define WHOWASDB_SAVE_EVERY 300
+/* Only the new entries are saved every WHOWASDB_SAVE_EVERY seconds,
+ * to a journal file next to the database. After this many journal
+ * files the entire database is written out again.
+ */
+#define WHOWASDB_JOURNAL_MAX 12
 /* The very first save after boot, apply this delta, this
  * so we don't coincide with other (potentially) expensive
  * I/O events like saving tkldb.
@@ -88,13 +93,10 @@ int whowasdb_config_posttest(int *errs);
 int whowasdb_config_run(ConfigFile *cf, ConfigEntry *ce, int type);
 EVENT(write_whowasdb_evt);
 int write_whowasdb(void);
+int write_whowasdb_journal(void);
 int write_whowas_entry(UnrealDB *db, const char *tmpfname, WhoWas *e);
 int read_whowasdb(void);
-
-/* External variables */
-extern WhoWas MODVAR WHOWAS[NICKNAMEHISTORYLENGTH];
-extern WhoWas MODVAR *WHOWASHASH[WHOWAS_HASH_TABLE_SIZE];
-extern MODVAR int whowas_next;
+int read_whowasdb_file(const char *fname, int journal);
 
 /* Global variables */
 static uint32_t whowasdb_version = WHOWASDB_VERSION;
@@ -102,6 +104,15 @@ static struct cfgstruct cfg;
 static struct cfgstruct test;
 
 static long whowasdb_next_event = 0;
+/** Random number of the last full database write, journal files
+ * carry the same number so we never replay a journal on top of
+ * a database it does not belong to.
+ */
+static long whowasdb_generation = 0;
+/** Number of journal files written since the last full write */
+static int whowasdb_journal_count = 0;
+/** Highest WhoWas serial that is already on disk */
+static long whowasdb_saved_serial = 0;
 
 MOD_TEST()
 {
@@ -118,6 +129,9 @@ MOD_INIT()
 	MARK_AS_OFFICIAL_MODULE(modinfo);
 
 	LoadPersistentLong(modinfo, whowasdb_next_event);
+	LoadPersistentLong(modinfo, whowasdb_generation);
+	LoadPersistentInt(modinfo, whowasdb_journal_count);
+	LoadPersistentLong(modinfo, whowasdb_saved_serial);
 
 	setcfg(&cfg);
 
@@ -139,6 +153,7 @@ MOD_LOAD()
 			else
 				config_warn("[whowasdb] Failed to rename database from %s to %s: %s", cfg.database, fname, strerror(errno));
 		}
+		whowasdb_saved_serial = whowas_serial;
 		whowasdb_next_event = TStime() + WHOWASDB_SAVE_EVERY + WHOWASDB_SAVE_EVERY_DELTA;
 	}
 	EventAdd(modinfo->handle, "whowasdb_write_whowasdb", write_whowasdb_evt, NULL, 1000, 0);
@@ -157,6 +172,9 @@ MOD_UNLOAD()
 	freecfg(&test);
 	freecfg(&cfg);
 	SavePersistentLong(modinfo, whowasdb_next_event);
+	SavePersistentLong(modinfo, whowasdb_generation);
+	SavePersistentInt(modinfo, whowasdb_journal_count);
+	SavePersistentLong(modinfo, whowasdb_saved_serial);
 	return MOD_SUCCESS;
 }
 
@@ -265,21 +283,24 @@ EVENT(write_whowasdb_evt)
 	if (whowasdb_next_event > TStime())
 		return;
 	whowasdb_next_event = TStime() + WHOWASDB_SAVE_EVERY;
-	write_whowasdb();
+	if (!whowasdb_generation || (whowasdb_journal_count >= WHOWASDB_JOURNAL_MAX))
+		write_whowasdb();
+	else
+		write_whowasdb_journal();
+}
+
+static void journal_filename(char *buf, size_t buflen, int n)
+{
+	snprintf(buf, buflen, "%s.journal.%d", cfg.database, n);
 }
 
 int count_whowas_and_user_entries(void)
 {
-	int i;
-	int cnt = 0;
+	int cnt = whowas_count;
 	Client *client;
 
-	for (i=0; i < NICKNAMEHISTORYLENGTH; i++)
-	{
-		WhoWas *e = &WHOWAS[i];
-		if (e->name)
-			cnt++;
-	}
+	if (!loop.terminating)
+		return cnt;
 
 	list_for_each_entry(client, &client_list, client_node)
 		if (IsUser(client))
@@ -291,9 +312,11 @@ int count_whowas_and_user_entries(void)
 int write_whowasdb(void)
 {
 	char tmpfname[512];
+	char fname[512];
 	UnrealDB *db;
 	WhoWas *e;
 	Client *client;
+	long generation;
 	int cnt, i;
 #ifdef BENCHMARK
 	struct timeval tv_alpha, tv_beta;
@@ -310,26 +333,30 @@ int write_whowasdb(void)
 		return 0;
 	}
 
+	do {
+		generation = getrandom32();
+	} while (!generation || (generation == whowasdb_generation));
+
 	W_SAFE(unrealdb_write_int32(db, WHOWASDB_HEADER));
 	W_SAFE(unrealdb_write_int32(db, whowasdb_version));
+	W_SAFE(unrealdb_write_int64(db, generation));
 
 	cnt = count_whowas_and_user_entries();
 	W_SAFE(unrealdb_write_int64(db, cnt));
 
-	for (i=0; i < NICKNAMEHISTORYLENGTH; i++)
+	for (e = whowas_oldest(); e; e = whowas_newer(e))
 	{
-		WhoWas *e = &WHOWAS[i];
-		if (e->name)
-		{
-			if (!write_whowas_entry(db, tmpfname, e))
-				return 0;
-		}
+		if (!write_whowas_entry(db, tmpfname, e))
+			return 0;
 	}
 
-	/* Add all the currently connected users to WHOWAS history (as if they left just now) */
+	/* Add all the currently connected users to WHOWAS history (as if they left just now).
+	 * Only when shutting down: during normal operation their real QUIT ends up
+	 * in a journal file later, and replaying that would add them a second time.
+	 */
 	list_for_each_entry(client, &client_list, client_node)
 	{
-		if (IsUser(client))
+		if (loop.terminating && IsUser(client))
 		{
 			WhoWas *e = safe_alloc(sizeof(WhoWas));
 			int ret;
@@ -361,6 +388,17 @@ int write_whowasdb(void)
 		config_error("[whowasdb] Error renaming '%s' to '%s': %s (DATABASE NOT SAVED)", tmpfname, cfg.database, strerror(errno));
 		return 0;
 	}
+
+	/* Everything is in the database now, so the journal can go */
+	for (i = 1; ; i++)
+	{
+		journal_filename(fname, sizeof(fname), i);
+		if ((unlink(fname) < 0) && (i > whowasdb_journal_count))
+			break;
+	}
+	whowasdb_generation = generation;
+	whowasdb_journal_count = 0;
+	whowasdb_saved_serial = whowas_serial;
 #ifdef BENCHMARK
 	gettimeofday(&tv_beta, NULL);
 	config_status("[whowasdb] Benchmark: SAVE DB: %ld microseconds",
@@ -369,6 +407,70 @@ int write_whowasdb(void)
 	return 1;
 }
 
+/** Write the WHOWAS entries that were added since the previous save
+ * to a new journal file. This is a lot cheaper than write_whowasdb()
+ * on servers with a big set::whowas-history-length.
+ */
+int write_whowasdb_journal(void)
+{
+	char tmpfname[512];
+	char fname[512];
+	UnrealDB *db;
+	WhoWas *e, *first = NULL;
+	int cnt = 0;
+
+	for (e = whowas_oldest(); e; e = whowas_newer(e))
+	{
+		if (e->serial > (uint64_t)whowasdb_saved_serial)
+		{
+			if (!first)
+				first = e;
+			cnt++;
+		}
+	}
+	if (!cnt)
+		return 1; /* Nothing new */
+
+	journal_filename(fname, sizeof(fname), whowasdb_journal_count + 1);
+	snprintf(tmpfname, sizeof(tmpfname), "%s.%x.tmp", fname, getrandom32());
+	db = unrealdb_open(tmpfname, UNREALDB_MODE_WRITE, cfg.db_secret);
+	if (!db)
+	{
+		WARN_WRITE_ERROR(tmpfname);
+		return 0;
+	}
+
+	W_SAFE(unrealdb_write_int32(db, WHOWASDB_HEADER));
+	W_SAFE(unrealdb_write_int32(db, whowasdb_version));
+	W_SAFE(unrealdb_write_int64(db, whowasdb_generation));
+	W_SAFE(unrealdb_write_int64(db, cnt));
+
+	for (e = first; e; e = whowas_newer(e))
+	{
+		if (!write_whowas_entry(db, tmpfname, e))
+			return 0;
+	}
+
+	if (!unrealdb_close(db))
+	{
+		WARN_WRITE_ERROR(tmpfname);
+		return 0;
+	}
+
+#ifdef _WIN32
+	unlink(fname);
+#endif
+	if (rename(tmpfname, fname) < 0)
+	{
+		config_error("[whowasdb] Error renaming '%s' to '%s': %s (JOURNAL NOT SAVED)", tmpfname, fname, strerror(errno));
+		return 0;
+	}
+
+	whowasdb_journal_count++;
+	whowasdb_saved_serial = whowas_serial;
+	return 1;
+}
+
 int write_whowas_entry(UnrealDB *db, const char *tmpfname, WhoWas *e)
 {
 	char connected_since[64];
@@ -419,7 +521,7 @@ int write_whowas_entry(UnrealDB *db, const char *tmpfname, WhoWas *e)
 #define R_SAFE(x) \
 	do { \
 		if (!(x)) { \
-			config_warn("[whowasdb] Read error from database file '%s' (possible corruption): %s", cfg.database, unrealdb_get_error_string()); \
+			config_warn("[whowasdb] Read error from database file '%s' (possible corruption): %s", fname, unrealdb_get_error_string()); \
 			unrealdb_close(db); \
 			FreeWhowasEntry(); \
 			return 0; \
@@ -427,9 +529,41 @@ int write_whowas_entry(UnrealDB *db, const char *tmpfname, WhoWas *e)
 	} while(0)
 
 int read_whowasdb(void)
+{
+	char fname[512];
+	int i;
+
+	whowasdb_generation = 0;
+	whowasdb_journal_count = 0;
+
+	if (!read_whowasdb_file(cfg.database, 0))
+		return 0;
+
+	/* Replay the journal files that belong to this database, if any */
+	if (!whowasdb_generation)
+		return 1;
+	for (i = 1; ; i++)
+	{
+		journal_filename(fname, sizeof(fname), i);
+		if (read_whowasdb_file(fname, 1) <= 0)
+			break;
+		whowasdb_journal_count = i;
+	}
+	return 1;
+}
+
+/** Read a whowas database or journal file.
+ * @param fname		The file name
+ * @param journal	Set to 1 if this is a journal file
+ * @returns 1 on success, 0 on read error / corruption,
+ *          -1 if the journal file does not exist or belongs
+ *          to another database.
+ */
+int read_whowasdb_file(const char *fname, int journal)
 {
 	UnrealDB *db;
 	uint32_t version;
+	uint64_t generation = 0;
 	int added = 0;
 	int i;
 	uint64_t count = 0;
@@ -454,28 +588,30 @@ int read_whowasdb(void)
 	gettimeofday(&tv_alpha, NULL);
 #endif
 
-	db = unrealdb_open(cfg.database, UNREALDB_MODE_READ, cfg.db_secret);
+	db = unrealdb_open(fname, UNREALDB_MODE_READ, cfg.db_secret);
 	if (!db)
 	{
 		if (unrealdb_get_error_code() == UNREALDB_ERROR_FILENOTFOUND)
 		{
+			if (journal)
+				return -1;
 			/* Database does not exist. Could be first boot */
-			config_warn("[whowasdb] No database present at '%s', will start a new one", cfg.database);
+			config_warn("[whowasdb] No database present at '%s', will start a new one", fname);
 			return 1;
 		} else
 		if (unrealdb_get_error_code() == UNREALDB_ERROR_NOTCRYPTED)
 		{
 			/* Re-open as unencrypted */
-			db = unrealdb_open(cfg.database, UNREALDB_MODE_READ, NULL);
+			db = unrealdb_open(fname, UNREALDB_MODE_READ, NULL);
 			if (!db)
 			{
 				/* This should actually never happen, unless some weird I/O error */
-				config_warn("[whowasdb] Unable to open the database file '%s': %s", cfg.database, unrealdb_get_error_string());
+				config_warn("[whowasdb] Unable to open the database file '%s': %s", fname, unrealdb_get_error_string());
 				return 0;
 			}
 		} else
 		{
-			config_warn("[whowasdb] Unable to open the database file '%s' for reading: %s", cfg.database, unrealdb_get_error_string());
+			config_warn("[whowasdb] Unable to open the database file '%s' for reading: %s", fname, unrealdb_get_error_string());
 			return 0;
 		}
 	}
@@ -483,18 +619,29 @@ int read_whowasdb(void)
 	R_SAFE(unrealdb_read_int32(db, &version));
 	if (version != WHOWASDB_HEADER)
 	{
-		config_warn("[whowasdb] Database '%s' is not a whowas db (incorrect header)", cfg.database);
+		config_warn("[whowasdb] Database '%s' is not a whowas db (incorrect header)", fname);
 		unrealdb_close(db);
 		return 0;
 	}
 	R_SAFE(unrealdb_read_int32(db, &version));
 	if (version > whowasdb_version)
 	{
-		config_warn("[whowasdb] Database '%s' has a wrong version: expected it to be <= %u but got %u instead", cfg.database, whowasdb_version, version);
+		config_warn("[whowasdb] Database '%s' has a wrong version: expected it to be <= %u but got %u instead", fname, whowasdb_version, version);
 		unrealdb_close(db);
 		return 0;
 	}
 
+	if (version >= 101)
+		R_SAFE(unrealdb_read_int64(db, &generation));
+	if (journal && (generation != (uint64_t)whowasdb_generation))
+	{
+		/* Left-over from before the last full save */
+		unrealdb_close(db);
+		return -1;
+	}
+	if (!journal)
+		whowasdb_generation = generation;
+
 	R_SAFE(unrealdb_read_int64(db, &count));
 
 	for (i=1; i <= count; i++)
@@ -508,7 +655,7 @@ int read_whowasdb(void)
 		R_SAFE(unrealdb_read_int32(db, &magic));
 		if (magic != MAGIC_WHOWASDB_START)
 		{
-			config_error("[whowasdb] Corrupt database (%s) - whowasdb magic start is 0x%x. Further reading aborted.", cfg.database, magic);
+			config_error("[whowasdb] Corrupt database (%s) - whowasdb magic start is 0x%x. Further reading aborted.", fname, magic);
 			break;
 		}
 		while(1)
@@ -581,44 +728,32 @@ int read_whowasdb(void)
 		R_SAFE(unrealdb_read_int32(db, &magic));
 		if (magic != MAGIC_WHOWASDB_END)
 		{
-			config_error("[whowasdb] Corrupt database (%s) - whowasdb magic end is 0x%x. Further reading aborted.", cfg.database, magic);
+			config_error("[whowasdb] Corrupt database (%s) - whowasdb magic end is 0x%x. Further reading aborted.", fname, magic);
 			FreeWhowasEntry();
 			break;
 		}
 
 		if (nick && username && hostname && realname)
 		{
-			WhoWas *e = &WHOWAS[whowas_next];
-			if (e->hashv != -1)
-				free_whowas_fields(e);
+			WhoWas *e = whowas_alloc();
 			/* Set values */
 			//unreal_log(ULOG_DEBUG, "whowasdb", "WHOWASDB_READ_RECORD", NULL,
 			//           "[whowasdb] Adding '$nick'...",
 			//           log_data_string("nick", nick));
-			e->hashv = hash_whowas_name(nick);
 			e->event = event;
 			e->connected_since = connected_since;
 			e->logon = logontime;
 			e->logoff = logofftime;
 			safe_strdup(e->name, nick);
-			safe_strdup(e->username, username);
-			safe_strdup(e->hostname, hostname);
-			safe_strdup(e->ip, ip);
-			if (virthost)
-				safe_strdup(e->virthost, virthost);
-			else
-				safe_strdup(e->virthost, "");
+			e->username = whowas_intern(username);
+			e->hostname = whowas_intern(hostname);
+			e->ip = whowas_intern(ip);
+			e->virthost = whowas_intern(virthost ? virthost : "");
 			e->servername = find_or_add(server); /* scache */
-			safe_strdup(e->realname, realname);
-			safe_strdup(e->account, account);
-			e->online = NULL;
-			/* Server is special - scache shit */
-			/* Add to hash table */
-			add_whowas_to_list(&WHOWASHASH[e->hashv], e);
-			/* And advance pointer (well, integer) */
-			whowas_next++;
-			if (whowas_next == NICKNAMEHISTORYLENGTH)
-				whowas_next = 0;
+			e->realname = whowas_intern(realname);
+			e->account = whowas_intern(account);
+			/* Add to the WHOWAS store */
+			whowas_link(e, NULL);
 		}
 
 		FreeWhowasEntry();
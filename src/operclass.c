@@ -300,7 +300,7 @@ OperPermission ValidatePermissionsForPath(const char *path, Client *client, Clie
 	ce_oper = find_oper(client->user->operlogin);
 	if (!ce_oper)
 	{
-		operclass = moddata_client_get(client, "operclass");
+		operclass = get_operclass(client);
 		if (!operclass)
 			return OPER_DENY;
 	} else
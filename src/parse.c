@@ -52,7 +52,20 @@ static void ban_handshake_data_flooder(Client *client);
 int process_packet(Client *client, char *readbuf, int length, int killsafely)
 {
 	dbuf_put(&client->local->recvQ, readbuf, length);
+	return process_recvq(client, killsafely);
+}
 
+/** Process the data in the client receive queue (if the 'fake lag'
+ * rules permit doing so) and check for floods.
+ * This is process_packet() for when the data has already been
+ * put in the receive queue, eg. after reading a batch of packets.
+ * @param client      The client
+ * @param killsafely  If 1 then we may call exit_client() if the client
+ *                    is flooding. If 0 then we use dead_socket().
+ * @returns 1 in normal circumstances, 0 if client was killed.
+ */
+int process_recvq(Client *client, int killsafely)
+{
 	/* parse some of what we have (inducing fakelag, etc) */
 	parse_client_queued(client);
 
@@ -103,6 +116,9 @@ void parse_client_queued(Client *client)
 	if (IsIdentLookup(client))
 		return; /* we delay processing of data until identd has replied */
 
+	if (IsAuthPending(client))
+		return; /* we delay processing of data until the password check is done */
+
 	/* Handshake delay and such.. */
 	if (!IsUser(client) && !IsServer(client) && !IsUnixSocket(client) && !IsLocalhost(client))
 	{
@@ -125,7 +141,7 @@ void parse_client_queued(Client *client)
 		}
 	}
 
-	while (DBufLength(&client->local->recvQ) && !client_lagged_up(client))
+	while (DBufLength(&client->local->recvQ) && !client_lagged_up(client) && !IsAuthPending(client))
 	{
 		dolen = dbuf_getmsg(&client->local->recvQ, buf);
 
@@ -265,6 +281,7 @@ static void parse2(Client *cptr, Client **fromptr, MessageTag *mtags, int mtags_
 #endif
 	RealCommand *cmptr = NULL;
 	int bytes;
+	long long start;
 
 	*fromptr = cptr; /* The default, unless a source is specified (and permitted) */
 
@@ -553,6 +570,7 @@ static void parse2(Client *cptr, Client **fromptr, MessageTag *mtags, int mtags_
 		cptr->local->idle_since = TStime();
 
 	/* Now ready to execute the command */
+	start = loop_time_usec();
 #ifndef DEBUGMODE
 	if (cmptr->flags & CMD_ALIAS)
 	{
@@ -583,6 +601,7 @@ static void parse2(Client *cptr, Client **fromptr, MessageTag *mtags, int mtags_
 			cmptr->lticks += ticks;
 	}
 #endif
+	loop_trace_record(LOOP_TRACE_COMMAND, cmptr->cmd, from->name, start);
 }
 
 /** Ban user that is "flooding from an unknown connection".
@@ -29,6 +29,7 @@
 /* Forward declarations */
 CMD_FUNC(procio_status);
 CMD_FUNC(procio_modules);
+CMD_FUNC(procio_loopstats);
 CMD_FUNC(procio_rehash);
 CMD_FUNC(procio_exit);
 CMD_FUNC(procio_help);
@@ -56,6 +57,7 @@ void add_proc_io_server(void)
 		exit(-1);
 	CommandAdd(NULL, "STATUS", procio_status, MAXPARA, CMD_CONTROL);
 	CommandAdd(NULL, "MODULES", procio_modules, MAXPARA, CMD_CONTROL);
+	CommandAdd(NULL, "LOOPSTATS", procio_loopstats, MAXPARA, CMD_CONTROL);
 	CommandAdd(NULL, "REHASH", procio_rehash, MAXPARA, CMD_CONTROL);
 	CommandAdd(NULL, "EXIT", procio_exit, MAXPARA, CMD_CONTROL);
 	CommandAdd(NULL, "HELP", procio_help, MAXPARA, CMD_CONTROL);
@@ -132,6 +134,45 @@ CMD_FUNC(procio_modules)
 	sendto_one(client, NULL, "END 0");
 }
 
+CMD_FUNC(procio_loopstats)
+{
+	LoopHistogram *h;
+	LoopSlowIteration *e;
+	int i, n;
+
+	for (i = 0; i < LOOP_PHASES; i++)
+	{
+		h = &loop_histogram[i];
+		sendto_one(client, NULL, "REPLY %s count=%lld avg=%lldus p50=%lldus p90=%lldus p99=%lldus p99.9=%lldus max=%lldus",
+		           loop_phase_name(i), h->count, h->count ? h->total / h->count : 0,
+		           loop_histogram_percentile(h, 50.0),
+		           loop_histogram_percentile(h, 90.0),
+		           loop_histogram_percentile(h, 99.0),
+		           loop_histogram_percentile(h, 99.9),
+		           h->max);
+	}
+	sendto_one(client, NULL, "REPLY slow_iterations %lld (threshold %ld msec)",
+	           loop_slow_iterations_total, iConf.slow_loop_threshold);
+	for (n = 0; (e = loop_slow_iteration(n)); n++)
+	{
+		sendto_one(client, NULL, "REPLY slow[%d] %s took %lldus (events %lldus, io %lldus, clients %lldus)",
+		           n, timestamp_iso8601(e->when), e->usec,
+		           e->phase_usec[LOOP_PHASE_EVENTS],
+		           e->phase_usec[LOOP_PHASE_IO],
+		           e->phase_usec[LOOP_PHASE_CLIENTS]);
+		for (i = 0; i < e->num_items; i++)
+		{
+			sendto_one(client, NULL, "REPLY slow[%d]   %s %s%s%s %lldus",
+			           n, loop_trace_type_name(e->item[i].type),
+			           e->item[i].name,
+			           *e->item[i].client ? " from " : "",
+			           e->item[i].client,
+			           e->item[i].usec);
+		}
+	}
+	sendto_one(client, NULL, "END 0");
+}
+
 CMD_FUNC(procio_rehash)
 {
 	if (loop.rehashing)
@@ -172,6 +213,7 @@ CMD_FUNC(procio_help)
 	sendto_one(client, NULL, "REPLY REHASH");
 	sendto_one(client, NULL, "REPLY STATUS");
 	sendto_one(client, NULL, "REPLY MODULES");
+	sendto_one(client, NULL, "REPLY LOOPSTATS");
 	sendto_one(client, NULL, "END 0");
 }
 
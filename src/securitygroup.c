@@ -743,6 +743,9 @@ int user_allowed_by_security_group_list(Client *client, NameList *l)
 	return 0;
 }
 
+static ModDataRef webirc_ref = MODDATA_REF("webirc", MODDATATYPE_CLIENT);
+static ModDataRef websocket_ref = MODDATA_REF("websocket", MODDATATYPE_CLIENT);
+
 /** Returns 1 if the user is OK as far as the security-group is concerned.
  * @param client	The client to check
  * @param s		The security-group to check against
@@ -774,9 +777,9 @@ int user_allowed_by_security_group(Client *client, SecurityGroup *s)
 	/* Process EXCLUSION criteria first... */
 	if (s->exclude_identified && IsLoggedIn(client))
 		goto user_not_allowed;
-	if (s->exclude_webirc && moddata_client_get(client, "webirc"))
+	if (s->exclude_webirc && moddata_client_ref_long(client, &webirc_ref))
 		goto user_not_allowed;
-	if (s->exclude_websocket && moddata_client_get(client, "websocket"))
+	if (s->exclude_websocket && moddata_client_ref_ptr(client, &websocket_ref))
 		goto user_not_allowed;
 	if ((s->exclude_reputation_score > 0) && (GetReputation(client) >= s->exclude_reputation_score))
 		goto user_not_allowed;
@@ -804,9 +807,9 @@ int user_allowed_by_security_group(Client *client, SecurityGroup *s)
 	/* Then process INCLUSION criteria... */
 	if (s->identified && IsLoggedIn(client))
 		goto user_allowed;
-	if (s->webirc && moddata_client_get(client, "webirc"))
+	if (s->webirc && moddata_client_ref_long(client, &webirc_ref))
 		goto user_allowed;
-	if (s->websocket && moddata_client_get(client, "websocket"))
+	if (s->websocket && moddata_client_ref_ptr(client, &websocket_ref))
 		goto user_allowed;
 	if ((s->reputation_score > 0) && (GetReputation(client) >= s->reputation_score))
 		goto user_allowed;
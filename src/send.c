@@ -52,6 +52,7 @@ void vsendto_one(Client *to, MessageTag *mtags, const char *pattern, va_list vl)
 void vsendto_prefix_one(Client *to, Client *from, MessageTag *mtags, const char *pattern, va_list vl) __attribute__((format(printf,4,0)));
 static int vmakebuf_local_withprefix(char *buf, size_t buflen, Client *from, const char *pattern, va_list vl) __attribute__((format(printf,4,0)));
 static void vsendto_prefix_one_cached(LineCache *cache, int line_opts, Client *to, Client *from, MessageTag *mtags, const char *pattern, va_list vl) __attribute__((format(printf,6,0)));
+static void sendto_one_cached(LineCache *cache, Client *to, MessageTag *mtags, FORMAT_STRING(const char *pattern), ...) __attribute__((format(printf,4,5)));
 static LineCache *linecache_init(void);
 static void linecache_free(LineCache *cache);
 static void linecache_add(LineCache *cache, int line_opts, Client *to, const char *line, int linelen);
@@ -415,6 +416,34 @@ void sendbufto_one(Client *to, char *msg, unsigned int quick)
 		mark_data_to_send(to);
 }
 
+/* Returns 1 if 'lp' should not get the message in sendto_channel() */
+static inline int sendto_channel_skip(Member *lp, Client *from, Client *skip,
+                                      const char *member_modes, long clicap, int sendflags,
+                                      char check_invisible)
+{
+	Client *acptr = lp->client;
+
+	/* Skip sending to 'skip' */
+	if ((acptr == skip) || (acptr->direction == skip))
+		return 1;
+	/* Don't send to deaf clients (unless 'senddeaf' is set) */
+	if (IsDeaf(acptr) && (sendflags & SKIP_DEAF))
+		return 1;
+	/* Don't send to NOCTCP clients */
+	if (has_user_mode(acptr, 'T') && (sendflags & SKIP_CTCP))
+		return 1;
+	/* Sender ('from') is invisible for 'acptr' and we were asked to CHECK_INVISIBLE */
+	if (check_invisible && !check_channel_access_member(lp, "hoaq") && (from != acptr))
+		return 1;
+	/* Now deal with 'member_modes' (if not NULL) */
+	if (member_modes && !check_channel_access_member(lp, member_modes))
+		return 1;
+	/* Now deal with 'clicap' (if non-zero) */
+	if (clicap && MyUser(acptr) && ((clicap & CAP_INVERT) ? HasCapabilityFast(acptr, clicap) : !HasCapabilityFast(acptr, clicap)))
+		return 1;
+	return 0;
+}
+
 /** A single function to send data to a channel.
  * Previously there were 6 different functions to send channel data,
  * now there is 1 single function. This also means that you most
@@ -487,27 +516,33 @@ void sendto_channel(Channel *channel, Client *from, Client *skip,
 
 	++current_serial;
 	cache = linecache_init();
+
+	if ((sendflags & (SEND_LOCAL|SEND_REMOTE)) == SEND_LOCAL)
+	{
+		/* Only local users are interested, which may be a lot less
+		 * than all the channel members (think: a SJOIN burst of
+		 * thousands of users in a channel with a few local users).
+		 */
+		int i;
+		for (i = 0; i < channel->local_member_count; i++)
+		{
+			lp = channel->local_members[i];
+			acptr = lp->client;
+			if (!MyUser(acptr) || sendto_channel_skip(lp, from, skip, member_modes, clicap, sendflags, check_invisible))
+				continue;
+			va_start(vl, pattern);
+			vsendto_prefix_one_cached(cache, 0, acptr, from, mtags, pattern, vl);
+			va_end(vl);
+		}
+		linecache_free(cache);
+		return;
+	}
+
 	for (lp = channel->members; lp; lp = lp->next)
 	{
 		acptr = lp->client;
 
-		/* Skip sending to 'skip' */
-		if ((acptr == skip) || (acptr->direction == skip))
-			continue;
-		/* Don't send to deaf clients (unless 'senddeaf' is set) */
-		if (IsDeaf(acptr) && (sendflags & SKIP_DEAF))
-			continue;
-		/* Don't send to NOCTCP clients */
-		if (has_user_mode(acptr, 'T') && (sendflags & SKIP_CTCP))
-			continue;
-		/* Sender ('from') is invisible for 'acptr' and we were asked to CHECK_INVISIBLE */
-		if (check_invisible && !check_channel_access_member(lp, "hoaq") && (from != acptr))
-			continue;
-		/* Now deal with 'member_modes' (if not NULL) */
-		if (member_modes && !check_channel_access_member(lp, member_modes))
-			continue;
-		/* Now deal with 'clicap' (if non-zero) */
-		if (clicap && MyUser(acptr) && ((clicap & CAP_INVERT) ? HasCapabilityFast(acptr, clicap) : !HasCapabilityFast(acptr, clicap)))
+		if (sendto_channel_skip(lp, from, skip, member_modes, clicap, sendflags, check_invisible))
 			continue;
 
 		if (MyUser(acptr))
@@ -623,6 +658,7 @@ void sendto_local_common_channels(Client *user, Client *skip, long clicap, Messa
 	Client *acptr;
 	LineCache *cache;
 	char check_invisible;
+	int i;
 
 	cache = linecache_init();
 	++current_serial;
@@ -630,15 +666,18 @@ void sendto_local_common_channels(Client *user, Client *skip, long clicap, Messa
 	{
 		for (channels = user->user->channel; channels; channels = channels->next)
 		{
-			check_invisible = invisible_user_in_channel(user, channels->channel); // FIXME: we only have a slow version of this function
+			/* Whether 'user' is invisible is the same for all recipients in
+			 * this channel, so only check it once. After that it only depends
+			 * on the member modes of each recipient, see user_can_see_member_fast().
+			 */
+			check_invisible = invisible_user_in_channel(user, channels->channel);
 
-			for (users = channels->channel->members; users; users = users->next)
+			/* Only local clients, so walk the local member list */
+			for (i = 0; i < channels->channel->local_member_count; i++)
 			{
+				users = channels->channel->local_members[i];
 				acptr = users->client;
 
-				if (!MyConnect(acptr))
-					continue; /* only process local clients */
-
 				if (acptr->local->serial == current_serial)
 					continue; /* message already sent to this client */
 
@@ -648,8 +687,7 @@ void sendto_local_common_channels(Client *user, Client *skip, long clicap, Messa
 				if (acptr == skip)
 					continue; /* the one to skip */
 
-				// FIXME: use user_can_see_member_fast()
-				if (check_invisible && user_can_see_member(acptr, user, channels->channel))
+				if (check_invisible && (acptr != user) && !check_channel_access_member(users, "hoaq"))
 					continue; /* the sending user (quit'ing or nick changing) is 'invisible' -- skip */
 
 				acptr->local->serial = current_serial;
@@ -662,6 +700,16 @@ void sendto_local_common_channels(Client *user, Client *skip, long clicap, Messa
 	linecache_free(cache);
 }
 
+/* Helper for quit_sendto_local_common_channels() since we can't pass a va_list directly */
+static void sendto_one_cached(LineCache *cache, Client *to, MessageTag *mtags, FORMAT_STRING(const char *pattern), ...)
+{
+	va_list vl;
+
+	va_start(vl, pattern);
+	vsendto_prefix_one_cached(cache, 0, to, NULL, mtags, pattern, vl);
+	va_end(vl);
+}
+
 /** Send a QUIT message to all local users on all channels where
  * the user 'user' is on.
  * This is used for events such as a nick change and quit.
@@ -677,11 +725,13 @@ void sendto_local_common_channels(Client *user, Client *skip, long clicap, Messa
  */
 void quit_sendto_local_common_channels(Client *user, MessageTag *mtags, const char *reason)
 {
-	va_list vl;
 	Membership *channels;
 	Member *users;
 	Client *acptr;
+	LineCache *cache;
 	char sender[512];
+	char check_invisible;
+	int i;
 	MessageTag *m;
 	const char *real_quit_reason = NULL;
 
@@ -697,35 +747,42 @@ void quit_sendto_local_common_channels(Client *user, MessageTag *mtags, const ch
 		strlcpy(sender, user->name, sizeof(sender));
 	}
 
+	cache = linecache_init();
 	++current_serial;
 
 	if (user->user)
 	{
 		for (channels = user->user->channel; channels; channels = channels->next)
 		{
-			for (users = channels->channel->members; users; users = users->next)
+			/* See sendto_local_common_channels() */
+			check_invisible = invisible_user_in_channel(user, channels->channel);
+
+			/* Only local clients, so walk the local member list */
+			for (i = 0; i < channels->channel->local_member_count; i++)
 			{
+				users = channels->channel->local_members[i];
 				acptr = users->client;
 
-				if (!MyConnect(acptr))
-					continue; /* only process local clients */
-
 				if (acptr->local->serial == current_serial)
 					continue; /* message already sent to this client */
 
-				if (!user_can_see_member(acptr, user, channels->channel))
+				if (check_invisible && (acptr != user) && !check_channel_access_member(users, "hoaq"))
 					continue; /* the sending user (QUITing) is 'invisible' -- skip */
 
 				acptr->local->serial = current_serial;
+				/* The line for ircops may differ (real quit reason),
+				 * which is fine since the LineCache has separate lines for them.
+				 */
 				if (!reason)
-					sendto_one(acptr, mtags, ":%s QUIT", sender);
+					sendto_one_cached(cache, acptr, mtags, ":%s QUIT", sender);
 				else if (!IsOper(acptr) || !real_quit_reason)
-					sendto_one(acptr, mtags, ":%s QUIT :%s", sender, reason);
+					sendto_one_cached(cache, acptr, mtags, ":%s QUIT :%s", sender, reason);
 				else
-					sendto_one(acptr, mtags, ":%s QUIT :%s", sender, real_quit_reason);
+					sendto_one_cached(cache, acptr, mtags, ":%s QUIT :%s", sender, real_quit_reason);
 			}
 		}
 	}
+	linecache_free(cache);
 }
 
 /*
@@ -1054,6 +1111,7 @@ static void linecache_add(LineCache *cache, int line_opts, Client *to, const cha
 	LineCacheLine *e = safe_alloc(sizeof(LineCacheLine));
 	e->user_type = linecache_usertype(to);
 	e->caps = linecache_caps(to);
+	e->line_opts = line_opts;
 	safe_strdup(e->line, line);
 	e->linelen = linelen ? linelen : strlen(line);
 	AddListItem(e, cache->items);
@@ -1063,7 +1121,7 @@ static LineCacheLine *linecache_get(LineCache *cache, int line_opts, Client *to)
 {
 	LineCacheLine *l;
 	int user_type = linecache_usertype(to);
-	int caps = linecache_caps(to);
+	unsigned long caps = linecache_caps(to);
 
 	for (l = cache->items; l; l = l->next)
 		if ((l->caps == caps) && (l->user_type == user_type) && (l->line_opts == line_opts))
@@ -49,6 +49,10 @@ MOTDFile smotd;
 MODVAR TKL *tklines[TKLISTLEN];
 /** 2D hash list of TKL entries + IP address */
 MODVAR TKL *tklines_ip_hash[TKLIPHASHLEN1][TKLIPHASHLEN2];
+/** TKL entries with an expiry time, see tkl_check_expire() */
+MODVAR ExpiryHeap tkl_expiry_heap;
+/** Global TKL entries by sync leaf, for the TKL digest, see tkl_sync() */
+MODVAR TKL *tkl_sync_leaf[TKL_SYNC_LEAVES];
 int MODVAR spamf_ugly_vchanoverride = 0;
 
 void read_motd(const char *filename, MOTDFile *motd);
@@ -264,7 +268,7 @@ void send_proto(Client *client, ConfigItem_link *aconf)
 		me.id, (long long)TStime());
 
 	/* Third line */
-	sendto_one(client, NULL, "PROTOCTL NICKCHARS=%s CHANNELCHARS=%s BIGLINES",
+	sendto_one(client, NULL, "PROTOCTL NICKCHARS=%s CHANNELCHARS=%s BIGLINES TKLSYNC",
 		charsys_get_current_languages(),
 		allowed_channelchars_valtostr(iConf.allowed_channelchars));
 }
@@ -1160,6 +1164,7 @@ void tkl_init(void)
 {
 	memset(tklines, 0, sizeof(tklines));
 	memset(tklines_ip_hash, 0, sizeof(tklines_ip_hash));
+	memset(tkl_sync_leaf, 0, sizeof(tkl_sync_leaf));
 }
 
 /** Called when a server link is lost.
@@ -36,7 +36,14 @@ void set_sock_opts(int, Client *, SocketType);
 void set_ipv6_opts(int);
 void close_all_listeners(void);
 void close_listener(ConfigItem_listen *listener);
-static char readbuf[BUFSIZE];
+/** The buffer read_packet() reads into. This is the same as the
+ * maximum size of a TLS record, so one SSL_read() can return a full record.
+ */
+static char readbuf[READBUFSIZE];
+/** Read at most this many bytes from a client in one go, before
+ * parsing it and moving on to the next client.
+ */
+#define READ_BATCH_SIZE		(4*READBUFSIZE)
 char zlinebuf[BUFSIZE];
 extern char *version;
 MODVAR time_t last_allinuse = 0;
@@ -635,6 +642,9 @@ void close_connection(Client *client)
 	 */
 	unrealdns_delreq_bycptr(client);
 
+	/* and outstanding asynchronous password checks */
+	Auth_CancelAsync(client);
+
 	if (client->local->authfd >= 0)
 	{
 		fd_close(client->local->authfd);
@@ -861,7 +871,7 @@ refuse_client:
 
 	/* Fill in sockhost & ip ASAP */
 	set_sockhost(client, ip);
-	safe_strdup(client->ip, ip);
+	set_client_ip(client, ip);
 	client->local->port = port;
 	client->local->fd = fd;
 
@@ -1144,6 +1154,7 @@ void read_packet(int fd, int revents, void *data)
 	time_t now = TStime();
 	Hook *h;
 	int processdata;
+	int total = 0, queued = 0;
 
 	/* Don't read from dead sockets */
 	if (IsDeadSocket(client))
@@ -1205,7 +1216,16 @@ void read_packet(int fd, int revents, void *data)
 		if (length <= 0)
 		{
 			if (length < 0 && ((ERRNO == P_EWOULDBLOCK) || (ERRNO == P_EAGAIN) || (ERRNO == P_EINTR)))
-				return;
+				break;
+
+			/* Process what we already read (eg. a QUIT) before closing */
+			if (queued)
+			{
+				int save_errno = ERRNO;
+				if (!process_recvq(client, 0))
+					return;
+				SET_ERRNO(save_errno);
+			}
 
 			if (IsServer(client) || client->server) /* server or outgoing connection */
 				lost_server_link(client, NULL);
@@ -1214,6 +1234,10 @@ void read_packet(int fd, int revents, void *data)
 			return;
 		}
 
+		total += length;
+		client->local->traffic.reads++;
+		me.local->traffic.reads++;
+
 		client->local->last_msg_received = now;
 		if (client->local->last_msg_received > client->local->fake_lag)
 			client->local->fake_lag = client->local->last_msg_received;
@@ -1232,13 +1256,38 @@ void read_packet(int fd, int revents, void *data)
 				return; /* if hook tells client is dead, return now */
 		}
 
-		if (processdata && !process_packet(client, readbuf, length, 0))
-			return;
+		if (processdata)
+		{
+			if (IsUnknown(client))
+			{
+				/* During the handshake every read is processed right
+				 * away, so the handshake checks see the data early.
+				 */
+				if (!process_packet(client, readbuf, length, 0))
+					return;
+			} else {
+				/* Otherwise queue it and parse the batch at once */
+				dbuf_put(&client->local->recvQ, readbuf, length);
+				queued = 1;
+			}
+		}
 
-		/* bail on short read! */
-		if (length < sizeof(readbuf))
-			return;
+		/* Move on to the next client after a batch, unless OpenSSL
+		 * still has data buffered (there would be no read event for it).
+		 */
+		if ((total >= READ_BATCH_SIZE) &&
+		    !(IsTLS(client) && client->local->ssl && SSL_pending(client->local->ssl)))
+		{
+			break;
+		}
+
+		/* bail on short read! (not for TLS, a record may be smaller than the buffer) */
+		if (!IsTLS(client) && (length < sizeof(readbuf)))
+			break;
 	}
+
+	if (queued)
+		process_recvq(client, 0);
 }
 
 /** Process input from clients that may have been deliberately delayed due to fake lag */
@@ -1492,23 +1492,21 @@ char *unreal_strftime(const char *str)
 /** Convert a string to lowercase - with separate input/output buffer */
 void strtolower_safe(char *dst, const char *src, int size)
 {
+	size_t len;
+
 	if (!size)
 		return; /* size of 0 is unworkable */
 	size--; /* for \0 */
 
-	for (; *src && size; src++)
-	{
-		*dst++ = tolower(*src);
-		size--;
-	}
-	*dst = '\0';
+	len = strnlen(src, size);
+	text_tolower(dst, src, len);
+	dst[len] = '\0';
 }
 
 /** Convert a string to lowercase - modifying existing string */
 void strtolower(char *str)
 {
-	for (; *str; str++)
-		*str = tolower(*str);
+	text_tolower(str, str, strlen(str));
 }
 
 /** Convert a string to uppercase - with separate input/output buffer */
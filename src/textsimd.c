@@ -0,0 +1,350 @@
+/************************************************************************
+ *   UnrealIRCd - Unreal Internet Relay Chat Daemon - src/textsimd.c
+ *   (C) 2026 The UnrealIRCd Team
+ *
+ *   See file AUTHORS in IRC package for additional names of
+ *   the programmers.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** @file
+ * @brief Vectorized text scanning kernels.
+ *
+ * These are small building blocks for the functions that walk over
+ * every message or nick: UTF8 validation, stripping of control codes,
+ * lowercasing and finding the end of a line. Each kernel skips over
+ * the "boring" part of a string 16 or 32 bytes at a time, so the
+ * (more complex) byte-at-a-time code only needs to deal with the
+ * interesting bytes.
+ *
+ * On x86 we have SSE2 and AVX2 versions, the AVX2 version is picked
+ * at runtime by text_kernels_init() if the CPU supports it.
+ * Everywhere else the scalar versions are used.
+ * All versions return exactly the same results.
+ */
+
+#include "unrealircd.h"
+
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+ #define TEXT_KERNELS_SSE2
+ #include <emmintrin.h>
+ #if defined(__clang__) || (__GNUC__ >= 5)
+  #define TEXT_KERNELS_AVX2
+  #include <immintrin.h>
+ #endif
+#endif
+
+/* Count trailing zeroes, 'x' must be non-zero */
+#define CTZ(x)	__builtin_ctz(x)
+
+/*** Scalar versions ***/
+
+static size_t ascii_span_scalar(const char *s, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if ((unsigned char)s[i] >= 0x80)
+			break;
+	return i;
+}
+
+/** Returns 1 for bytes that may start a control code sequence (see StripControlCodesEx) */
+#define IS_CONTROLCODE_START(c)	(((unsigned char)(c) < 0x20) || ((unsigned char)(c) == 0xe2))
+
+static size_t plain_span_scalar(const char *s, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if (IS_CONTROLCODE_START(s[i]))
+			break;
+	return i;
+}
+
+static size_t eol_span_scalar(const char *s, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if ((s[i] == '\r') || (s[i] == '\n') || (s[i] == '\0'))
+			break;
+	return i;
+}
+
+/** Lowercase 8 ASCII characters at once, bytes >= 0x80 are left alone.
+ * This is the same as tolower() on each byte.
+ */
+uint64_t text_tolower64(uint64_t x)
+{
+	uint64_t heptets = x & 0x7f7f7f7f7f7f7f7fULL;
+	uint64_t is_gt_Z = heptets + 0x2525252525252525ULL; /* high bit set if > 'Z' */
+	uint64_t is_ge_A = heptets + 0x3f3f3f3f3f3f3f3fULL; /* high bit set if >= 'A' */
+	uint64_t is_ascii = ~x & 0x8080808080808080ULL;
+	uint64_t is_upper = is_ascii & (is_ge_A ^ is_gt_Z);
+
+	return x | (is_upper >> 2);
+}
+
+static void tolower_scalar(char *dst, const char *src, size_t len)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= len; i += 8)
+	{
+		uint64_t x;
+		memcpy(&x, src + i, 8);
+		x = text_tolower64(x);
+		memcpy(dst + i, &x, 8);
+	}
+	for (; i < len; i++)
+		dst[i] = tolower(src[i]);
+}
+
+#ifdef TEXT_KERNELS_SSE2
+/*** SSE2 versions ***/
+
+static size_t ascii_span_sse2(const char *s, size_t len)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+		int mask = _mm_movemask_epi8(v);
+		if (mask)
+			return i + CTZ(mask);
+	}
+	return i + ascii_span_scalar(s + i, len - i);
+}
+
+static size_t plain_span_sse2(const char *s, size_t len)
+{
+	const __m128i max_low = _mm_set1_epi8(0x1f);
+	const __m128i e2 = _mm_set1_epi8((char)0xe2);
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+		/* v <= 0x1f (unsigned) is the same as min(v, 0x1f) == v */
+		__m128i low = _mm_cmpeq_epi8(_mm_min_epu8(v, max_low), v);
+		int mask = _mm_movemask_epi8(_mm_or_si128(low, _mm_cmpeq_epi8(v, e2)));
+		if (mask)
+			return i + CTZ(mask);
+	}
+	return i + plain_span_scalar(s + i, len - i);
+}
+
+static size_t eol_span_sse2(const char *s, size_t len)
+{
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i nul = _mm_setzero_si128();
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)), _mm_cmpeq_epi8(v, nul));
+		int mask = _mm_movemask_epi8(m);
+		if (mask)
+			return i + CTZ(mask);
+	}
+	return i + eol_span_scalar(s + i, len - i);
+}
+
+static void tolower_sse2(char *dst, const char *src, size_t len)
+{
+	const __m128i A = _mm_set1_epi8('A');
+	const __m128i max_off = _mm_set1_epi8('Z' - 'A');
+	const __m128i bit = _mm_set1_epi8(0x20);
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i off = _mm_sub_epi8(v, A);
+		/* off <= 25 (unsigned) means 'A' ... 'Z' */
+		__m128i upper = _mm_cmpeq_epi8(_mm_min_epu8(off, max_off), off);
+		v = _mm_or_si128(v, _mm_and_si128(upper, bit));
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+	}
+	tolower_scalar(dst + i, src + i, len - i);
+}
+#endif
+
+#ifdef TEXT_KERNELS_AVX2
+/*** AVX2 versions ***/
+
+__attribute__((target("avx2")))
+static size_t ascii_span_avx2(const char *s, size_t len)
+{
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(v);
+		if (mask)
+			return i + CTZ(mask);
+	}
+	return i + ascii_span_sse2(s + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t plain_span_avx2(const char *s, size_t len)
+{
+	const __m256i max_low = _mm256_set1_epi8(0x1f);
+	const __m256i e2 = _mm256_set1_epi8((char)0xe2);
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+		__m256i low = _mm256_cmpeq_epi8(_mm256_min_epu8(v, max_low), v);
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(low, _mm256_cmpeq_epi8(v, e2)));
+		if (mask)
+			return i + CTZ(mask);
+	}
+	return i + plain_span_sse2(s + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t eol_span_avx2(const char *s, size_t len)
+{
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i nul = _mm256_setzero_si256();
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+		__m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)), _mm256_cmpeq_epi8(v, nul));
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(m);
+		if (mask)
+			return i + CTZ(mask);
+	}
+	return i + eol_span_sse2(s + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void tolower_avx2(char *dst, const char *src, size_t len)
+{
+	const __m256i A = _mm256_set1_epi8('A');
+	const __m256i max_off = _mm256_set1_epi8('Z' - 'A');
+	const __m256i bit = _mm256_set1_epi8(0x20);
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i off = _mm256_sub_epi8(v, A);
+		__m256i upper = _mm256_cmpeq_epi8(_mm256_min_epu8(off, max_off), off);
+		v = _mm256_or_si256(v, _mm256_and_si256(upper, bit));
+		_mm256_storeu_si256((__m256i *)(dst + i), v);
+	}
+	tolower_sse2(dst + i, src + i, len - i);
+}
+#endif
+
+/*** Dispatch ***/
+
+#ifdef TEXT_KERNELS_SSE2
+static size_t (*ascii_span_impl)(const char *s, size_t len) = ascii_span_sse2;
+static size_t (*plain_span_impl)(const char *s, size_t len) = plain_span_sse2;
+static size_t (*eol_span_impl)(const char *s, size_t len) = eol_span_sse2;
+static void (*tolower_impl)(char *dst, const char *src, size_t len) = tolower_sse2;
+#else
+static size_t (*ascii_span_impl)(const char *s, size_t len) = ascii_span_scalar;
+static size_t (*plain_span_impl)(const char *s, size_t len) = plain_span_scalar;
+static size_t (*eol_span_impl)(const char *s, size_t len) = eol_span_scalar;
+static void (*tolower_impl)(char *dst, const char *src, size_t len) = tolower_scalar;
+#endif
+
+/** Pick the best kernels for this CPU.
+ * This is called early on boot. Before that the SSE2 or scalar
+ * versions are used, which give the same results.
+ */
+void text_kernels_init(void)
+{
+#ifdef TEXT_KERNELS_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		ascii_span_impl = ascii_span_avx2;
+		plain_span_impl = plain_span_avx2;
+		eol_span_impl = eol_span_avx2;
+		tolower_impl = tolower_avx2;
+	}
+#endif
+}
+
+/** Returns the name of the kernels in use, eg for debugging output */
+const char *text_kernels_name(void)
+{
+#ifdef TEXT_KERNELS_AVX2
+	if (ascii_span_impl == ascii_span_avx2)
+		return "avx2";
+#endif
+#ifdef TEXT_KERNELS_SSE2
+	return "sse2";
+#else
+	return "scalar";
+#endif
+}
+
+/** Returns the number of bytes at the start of 's' that are ASCII (< 0x80).
+ * @param s	The string
+ * @param len	Length of the string
+ * @returns Number of ASCII bytes, or 'len' if all of them are.
+ */
+size_t text_ascii_span(const char *s, size_t len)
+{
+	return ascii_span_impl(s, len);
+}
+
+/** Returns the number of bytes at the start of 's' that cannot start a
+ * control code (color, bold, etc). That is: all bytes from 0x20 and
+ * up, except 0xe2 which may start a zero width space.
+ * @param s	The string
+ * @param len	Length of the string
+ * @returns Number of plain bytes, or 'len' if all of them are.
+ */
+size_t text_plain_span(const char *s, size_t len)
+{
+	return plain_span_impl(s, len);
+}
+
+/** Returns the number of bytes at the start of 's' before the
+ * first CR, LF or NUL byte.
+ * @param s	The buffer
+ * @param len	Length of the buffer
+ * @returns Number of bytes, or 'len' if none of these are present.
+ */
+size_t text_eol_span(const char *s, size_t len)
+{
+	return eol_span_impl(s, len);
+}
+
+/** Lowercase 'len' bytes from 'src' to 'dst', just like tolower()
+ * does for each byte. The buffers may be the same (but not overlap otherwise).
+ */
+void text_tolower(char *dst, const char *src, size_t len)
+{
+	tolower_impl(dst, src, len);
+}
@@ -314,6 +314,14 @@ SSL_CTX *init_ctx(TLSOptions *tlsoptions, int server)
 #endif
 	SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
 
+	/* Free the read and write record buffers whenever they are empty.
+	 * Most connections are idle most of the time, so this saves
+	 * roughly 11KB of resident memory per connection (OpenSSL 3),
+	 * at the cost of an occasional malloc.
+	 */
+	if (!(tlsoptions->options & TLSFLAG_NORELEASEBUFFERS))
+		SSL_CTX_set_mode(ctx, SSL_MODE_RELEASE_BUFFERS);
+
 	if (SSL_CTX_use_certificate_chain_file(ctx, tlsoptions->certificate_file) <= 0)
 	{
 		unreal_log(ULOG_ERROR, "config", "TLS_LOAD_FAILED", NULL,
@@ -606,13 +614,15 @@ void SSL_set_nonblocking(SSL *s)
 	BIO_set_nbio(SSL_get_wbio(s),1);
 }
 
+static ModDataRef tls_cipher_ref = MODDATA_REF("tls_cipher", MODDATATYPE_CLIENT);
+
 /** Get TLS ciphersuite */
 const char *tls_get_cipher(Client *client)
 {
 	static char buf[256];
 	const char *cached;
 
-	cached = moddata_client_get(client, "tls_cipher");
+	cached = moddata_client_ref_str(client, &tls_cipher_ref);
 	if (cached)
 		return cached;
 
@@ -627,6 +637,45 @@ const char *tls_get_cipher(Client *client)
 	return buf;
 }
 
+/** Approximate resident size of the TLS state of an idle connection
+ * (SSL object, cipher contexts, etc), excluding record buffers.
+ * Measured with OpenSSL 3, older versions use somewhat less.
+ */
+#define TLS_STATE_MEMORY_ESTIMATE	18432
+/** Approximate resident size of the read + write record buffers */
+#define TLS_RECORD_BUFFERS_ESTIMATE	11264
+
+/** Estimate how much memory the TLS layer uses for this local client.
+ * This is an estimate, OpenSSL does not expose its allocations.
+ * With SSL_MODE_RELEASE_BUFFERS the record buffers only exist while
+ * a handshake is in progress or data is pending.
+ * @param client	The client
+ * @param buffered	Set to 1 if the record buffers are (likely) allocated,
+ *                      may be NULL.
+ * @returns Estimated number of bytes, 0 for non-TLS connections.
+ */
+long tls_memory_estimate(Client *client, int *buffered)
+{
+	SSL *ssl;
+	long n;
+
+	if (buffered)
+		*buffered = 0;
+
+	if (!MyConnect(client) || !(ssl = client->local->ssl))
+		return 0;
+
+	n = TLS_STATE_MEMORY_ESTIMATE;
+	if (!(SSL_get_mode(ssl) & SSL_MODE_RELEASE_BUFFERS) ||
+	    !SSL_is_init_finished(ssl) || SSL_pending(ssl))
+	{
+		n += TLS_RECORD_BUFFERS_ESTIMATE;
+		if (buffered)
+			*buffered = 1;
+	}
+	return n;
+}
+
 /** Get the applicable ::tls-options block for this local client,
  * which may be defined in the link block, listen block, or set block.
  */
@@ -787,6 +836,7 @@ int unreal_tls_accept(Client *client, int fd)
 		return -1;
 	}
 
+	ircstats.is_tls++;
 	client->local->listener->start_handshake(client);
 
 	return 1;
@@ -834,6 +884,7 @@ int unreal_tls_connect(Client *client, int fd)
 		return -1;
 	}
 
+	ircstats.is_tls++;
 	fd_setselect(fd, FD_SELECT_READ | FD_SELECT_WRITE, NULL, client);
 	completed_connection(fd, FD_SELECT_READ | FD_SELECT_WRITE, client);
 
@@ -916,6 +967,9 @@ static int fatal_tls_error(int ssl_error, int where, int my_errno, Client *clien
 
 	ssl_errstr = ssl_error_str(ssl_error, my_errno);
 
+	if ((where == FUNC_TLS_ACCEPT) || (where == FUNC_TLS_CONNECT))
+		ircstats.is_tlsbad++;
+
 	SetDeadSocket(client);
 	unreal_log(ULOG_DEBUG, "tls", "DEBUG_TLS_FATAL_ERROR", client,
 		   "Exiting TLS client $client.details: $tls_function: $tls_error_string: $tls_additional_info",
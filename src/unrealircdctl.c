@@ -42,6 +42,9 @@ void unrealircdctl_usage(const char *program_name)
 	       "reloadtls      - Reload the SSL/TLS certificates\n"
 	       "status         - Show current status of server\n"
 	       "module-status  - Show currently loaded modules\n"
+	       "loop-stats     - Show main loop latency and recent slow iterations\n"
+	       "tkl-export     - Export all server bans, spamfilters, etc. to a file\n"
+	       "tkl-import     - Import server bans, spamfilters, etc. from a file\n"
 	       "mkpasswd       - Hash a password\n"
 	       "gencloak       - Display 3 random cloak keys\n"
 	       "spkifp         - Display SPKI Fingerprint\n"
@@ -90,6 +93,38 @@ void unrealircdctl_module_status(void)
 	exit(1);
 }
 
+void unrealircdctl_loop_stats(void)
+{
+	if (procio_client("LOOPSTATS", 2) == 0)
+		exit(0);
+	printf("Could not retrieve main loop statistics.\n");
+	exit(1);
+}
+
+/** Used by tkl-export/tkl-import: the server may have a different
+ * working directory than us, so send it an absolute path.
+ */
+static void unrealircdctl_tkl_file(int argc, char *argv[], const char *command)
+{
+	char cmd[1024];
+	char cwd[512];
+
+	if (argc < 3)
+	{
+		printf("Usage: %s %s <file>\n", UNREALCMD, argv[1]);
+		exit(1);
+	}
+
+	if ((*argv[2] == '/') || !getcwd(cwd, sizeof(cwd)))
+		snprintf(cmd, sizeof(cmd), "%s :%s", command, argv[2]);
+	else
+		snprintf(cmd, sizeof(cmd), "%s :%s/%s", command, cwd, argv[2]);
+
+	if (procio_client(cmd, 2) == 0)
+		exit(0);
+	exit(1);
+}
+
 void unrealircdctl_mkpasswd(int argc, char *argv[])
 {
 	AuthenticationType type;
@@ -256,6 +291,12 @@ int main(int argc, char *argv[])
 		unrealircdctl_status();
 	else if (!strcmp(argv[1], "module-status"))
 		unrealircdctl_module_status();
+	else if (!strcmp(argv[1], "loop-stats"))
+		unrealircdctl_loop_stats();
+	else if (!strcmp(argv[1], "tkl-export"))
+		unrealircdctl_tkl_file(argc, argv, "TKLEXPORT");
+	else if (!strcmp(argv[1], "tkl-import"))
+		unrealircdctl_tkl_file(argc, argv, "TKLIMPORT");
 	else if (!strcmp(argv[1], "mkpasswd"))
 		unrealircdctl_mkpasswd(argc, argv);
 	else if (!strcmp(argv[1], "gencloak"))
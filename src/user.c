@@ -737,23 +737,25 @@ int hide_idle_time(Client *client, Client *target)
 	}
 }
 
+/* ModData that is looked up on hot paths, see ModDataRef */
+static ModDataRef creationtime_ref = MODDATA_REF("creationtime", MODDATATYPE_CLIENT);
+static ModDataRef geoip_ref = MODDATA_REF("geoip", MODDATATYPE_CLIENT);
+static ModDataRef operlogin_ref = MODDATA_REF("operlogin", MODDATATYPE_CLIENT);
+static ModDataRef operclass_ref = MODDATA_REF("operclass", MODDATATYPE_CLIENT);
+static ModDataRef reputation_ref = MODDATA_REF("reputation", MODDATATYPE_CLIENT);
+
 /** Get creation time of a client.
  * @param client	The client to check (user, server, anything)
  * @returns the time when the client first connected to IRC, or 0 for unknown.
  */
 time_t get_creationtime(Client *client)
 {
-	const char *str;
-
 	/* Shortcut for local clients */
 	if (client->local)
 		return client->local->creationtime;
 
 	/* Otherwise, hopefully available through this... */
-	str = moddata_client_get(client, "creationtime");
-	if (!BadPtr(str) && (*str != '0'))
-		return atoll(str);
-	return 0;
+	return moddata_client_ref_ll(client, &creationtime_ref);
 }
 
 /** Get how long a client is connected to IRC.
@@ -762,17 +764,16 @@ time_t get_creationtime(Client *client)
  */
 long get_connected_time(Client *client)
 {
-	const char *str;
-	long connect_time = 0;
+	long long creationtime;
 
 	/* Shortcut for local clients */
 	if (client->local)
 		return TStime() - client->local->creationtime;
 
 	/* Otherwise, hopefully available through this... */
-	str = moddata_client_get(client, "creationtime");
-	if (!BadPtr(str) && (*str != '0'))
-		return TStime() - atoll(str);
+	creationtime = moddata_client_ref_ll(client, &creationtime_ref);
+	if (creationtime)
+		return TStime() - creationtime;
 	return 0;
 }
 
@@ -967,10 +968,7 @@ void free_geoip_result(GeoIPResult *r)
 /** Grab geoip information for client */
 GeoIPResult *geoip_client(Client *client)
 {
-	ModData *m = moddata_client_get_raw(client, "geoip");
-	if (!m)
-		return NULL;
-	return m->ptr; /* can still be NULL */
+	return moddata_client_ref_ptr(client, &geoip_ref); /* can be NULL */
 }
 
 /** Get the oper block that was used to become OPER.
@@ -981,7 +979,7 @@ const char *get_operlogin(Client *client)
 {
 	if (client->user->operlogin)
 		return client->user->operlogin;
-	return moddata_client_get(client, "operlogin");
+	return moddata_client_ref_str(client, &operlogin_ref);
 }
 
 /** Get the operclass of the IRCOp.
@@ -1004,7 +1002,30 @@ const char *get_operclass(Client *client)
 	/* Remote user or locally no longer available
 	 * (eg oper block removed but user is still oper)
 	 */
-	return moddata_client_get(client, "operclass");
+	return moddata_client_ref_str(client, &operclass_ref);
+}
+
+/** Get the reputation score of a client.
+ * @param client	The client
+ * @returns The reputation score, 0 if unknown.
+ */
+int get_reputation(Client *client)
+{
+	return moddata_client_ref_long(client, &reputation_ref);
+}
+
+/** Set the IP address of a client.
+ * This also sets client->rawip, the binary form used by the IP index.
+ * @param client	The client
+ * @param ip		The IP address
+ */
+void set_client_ip(Client *client, const char *ip)
+{
+	safe_strdup(client->ip, ip);
+	if (ipindex_key(client->ip, client->rawip))
+		client->flags |= CLIENT_FLAG_RAWIP;
+	else
+		client->flags &= ~CLIENT_FLAG_RAWIP;
 }
 
 /* Yeah we should really start storing IP in raw form again... */
@@ -31,9 +31,15 @@
 static const char *fast_validate(const char *str)
 {
 	const char *p;
+	const char *end = str + strlen(str);
 
 	for (p = str; *p; p++)
 	{
+		/* Skip over plain ASCII in one go, that is always valid */
+		p += text_ascii_span(p, end - p);
+		if (*p == '\0')
+			break;
+
 		if (*p >= 128)
 		{
 			const char *last;
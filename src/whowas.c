@@ -23,88 +23,262 @@
 // Consider making add_history an efunc? Or via a hook?
 // Some users may not want to load cmd_whowas at all.
 
-void add_whowas_to_clist(WhoWas **, WhoWas *);
-void del_whowas_from_clist(WhoWas **, WhoWas *);
-void add_whowas_to_list(WhoWas **, WhoWas *);
-void del_whowas_from_list(WhoWas **, WhoWas *);
+/* The WHOWAS store.
+ *
+ * All entries live in one contiguous ring of 'whowas_size' slots, so
+ * adding an entry simply overwrites the oldest one (O(1) eviction) and
+ * there is no allocation per entry apart from the nick name.
+ * Usernames, hostnames, vhosts, IPs, realnames and accounts are interned
+ * through whowas_intern(): they repeat a lot between entries (nick changes,
+ * reconnects, clones) and are shared instead of being strdup'd each time.
+ * The servername points into the scache, as it always did.
+ *
+ * Entries are indexed by nick, IP and account. The index tables grow with
+ * the ring, which can be resized at runtime through
+ * set::whowas-history-length (see whowas_resize()).
+ *
+ * Every entry gets a serial number, this way the whowasdb module can
+ * write out only the entries that were added since its last save.
+ *
+ * The index lists are singly linked, newest first. Entries only ever
+ * leave the store oldest first, so the entry that is removed is always
+ * the last one of each list it is on. It is only unlinked if it is also
+ * the first one, otherwise the 'next' pointer of the entry before it is
+ * left as it is. Such a stale pointer points to a slot that is now empty
+ * or holds a newer entry, which is how whowas_list_next() detects it.
+ */
 
-WhoWas MODVAR WHOWAS[NICKNAMEHISTORYLENGTH];
-WhoWas MODVAR *WHOWASHASH[WHOWAS_HASH_TABLE_SIZE];
+typedef struct WhoWasString WhoWasString;
+struct WhoWasString {
+	WhoWasString *next;
+	unsigned int refcount;
+	char str[1];
+};
 
+static void whowas_link_indexes(WhoWas *e);
+static void whowas_unlink(WhoWas *e);
+
+WhoWas MODVAR *whowas_ring = NULL;
+MODVAR int whowas_size = 0;
 MODVAR int whowas_next = 0;
+MODVAR int whowas_count = 0;
+MODVAR uint64_t whowas_serial = 0;
+
+static WhoWas **whowas_nick_hash = NULL;
+static WhoWas **whowas_ip_hash = NULL;
+static WhoWas **whowas_account_hash = NULL;
+static WhoWasString **whowas_string_hash = NULL;
+static unsigned int whowas_hash_size = 0; /**< Always a power of 2 */
+static int whowas_string_count = 0;
+static size_t whowas_string_bytes = 0;
+
+#define WHOWAS_BUCKET(x)	(hash_whowas_name(x) & (whowas_hash_size - 1))
+#define WHOWAS_STRING_BUCKET(x)	(hash_whowas_string(x) & (whowas_hash_size - 1))
+
+/** Follow a 'next' pointer of entry 'e' in one of the index lists.
+ * Returns NULL at the end of the list, see the comment at the top.
+ */
+static inline WhoWas *whowas_list_next(WhoWas *e, WhoWas *n)
+{
+	if (!n || !n->serial || (n->serial >= e->serial))
+		return NULL;
+	return n;
+}
+
+/** Return a shared copy of 'str' for use in a WhoWas entry.
+ * The result must be released with whowas_unintern().
+ * @param str	The string, may be NULL.
+ * @returns The interned string, or NULL if 'str' was NULL.
+ */
+const char *whowas_intern(const char *str)
+{
+	WhoWasString *s;
+	unsigned int hashv;
+	size_t len;
+
+	if (!str)
+		return NULL;
 
+	hashv = WHOWAS_STRING_BUCKET(str);
+	for (s = whowas_string_hash[hashv]; s; s = s->next)
+	{
+		if (!strcmp(s->str, str))
+		{
+			s->refcount++;
+			return s->str;
+		}
+	}
+
+	len = strlen(str);
+	s = safe_alloc(sizeof(WhoWasString) + len);
+	memcpy(s->str, str, len + 1);
+	s->refcount = 1;
+	s->next = whowas_string_hash[hashv];
+	whowas_string_hash[hashv] = s;
+	whowas_string_count++;
+	whowas_string_bytes += sizeof(WhoWasString) + len;
+	return s->str;
+}
+
+/** Release a string that was returned by whowas_intern() */
+void whowas_unintern(const char *str)
+{
+	WhoWasString *s, **p;
+
+	if (!str)
+		return;
+
+	s = container_of(str, WhoWasString, str);
+	if (--s->refcount > 0)
+		return;
+
+	for (p = &whowas_string_hash[WHOWAS_STRING_BUCKET(s->str)]; *p; p = &(*p)->next)
+	{
+		if (*p == s)
+		{
+			*p = s->next;
+			break;
+		}
+	}
+	whowas_string_count--;
+	whowas_string_bytes -= sizeof(WhoWasString) + strlen(s->str);
+	safe_free(s);
+}
+
+/** Free all fields of a WhoWas entry and, if the entry is in the
+ * WHOWAS store, remove it from there.
+ * Afterwards the entry is all zeroes again.
+ */
 void free_whowas_fields(WhoWas *e)
 {
+	if (e->serial)
+		whowas_unlink(e);
 	safe_free(e->name);
-	safe_free(e->hostname);
-	safe_free(e->virthost);
-	safe_free(e->realname);
-	safe_free(e->username);
-	safe_free(e->account);
-	safe_free(e->ip);
-	e->servername = NULL;
-	e->event = 0;
-	e->logon = 0;
-	e->logoff = 0;
-	e->connected_since = 0;
-
-	/* Remove from lists and reset hashv */
-	if (e->online)
-		del_whowas_from_clist(&(e->online->user->whowas), e);
-	del_whowas_from_list(&WHOWASHASH[e->hashv], e);
-	e->hashv = -1;
+	whowas_unintern(e->username);
+	whowas_unintern(e->hostname);
+	whowas_unintern(e->virthost);
+	whowas_unintern(e->ip);
+	whowas_unintern(e->realname);
+	whowas_unintern(e->account);
+	memset(e, 0, sizeof(WhoWas));
 }
 
+/** Fill in a (cleared) WhoWas entry with the details of 'client'.
+ * This does not add the entry to the WHOWAS store, use
+ * whowas_alloc() and whowas_link() for that (or just add_history()).
+ */
 void create_whowas_entry(Client *client, WhoWas *e, WhoWasEvent event)
 {
-	e->hashv = hash_whowas_name(client->name);
 	e->event = event;
 	e->connected_since = get_creationtime(client);
 	e->logon = client->lastnick;
 	e->logoff = TStime();
 	e->umodes = client->umodes;
 	safe_strdup(e->name, client->name);
-	safe_strdup(e->username, client->user->username);
-	safe_strdup(e->hostname, client->user->realhost);
-	safe_strdup(e->ip, client->ip);
-	if (client->user->virthost)
-		safe_strdup(e->virthost, client->user->virthost);
-	else
-		safe_strdup(e->virthost, "");
-	e->servername = client->user->server;
-	safe_strdup(e->realname, client->info);
+	e->username = whowas_intern(client->user->username);
+	e->hostname = whowas_intern(client->user->realhost);
+	e->ip = whowas_intern(client->ip);
+	e->virthost = whowas_intern(client->user->virthost ? client->user->virthost : "");
+	e->realname = whowas_intern(client->info);
 	if (strcmp(client->user->account, "0"))
-		safe_strdup(e->account, client->user->account);
+		e->account = whowas_intern(client->user->account);
 
 	/* Its not string copied, a pointer to the scache hash is copied
 	   -Dianora
 	 */
-	/*  strlcpy(e->servername, client->user->server,HOSTLEN); */
 	e->servername = client->user->server;
 }
 
-void add_history(Client *client, int online, WhoWasEvent event)
+/** Take the next slot from the WHOWAS ring, evicting the oldest
+ * entry if the ring is full.
+ * The caller fills in the entry and then calls whowas_link().
+ */
+WhoWas *whowas_alloc(void)
 {
-	WhoWas *new;
+	WhoWas *e = &whowas_ring[whowas_next];
 
-	new = &WHOWAS[whowas_next];
+	if (e->serial)
+		free_whowas_fields(e);
 
-	if (new->hashv != -1)
-		free_whowas_fields(new);
+	whowas_next++;
+	if (whowas_next == whowas_size)
+		whowas_next = 0;
 
-	create_whowas_entry(client, new, event);
+	return e;
+}
 
+/** Add an entry, previously returned by whowas_alloc() and filled in,
+ * to the WHOWAS store.
+ * @param e		The entry
+ * @param online	The client that is still online under a new nick
+ *			(for nick chasing), or NULL.
+ */
+void whowas_link(WhoWas *e, Client *online)
+{
+	e->serial = ++whowas_serial;
+	whowas_link_indexes(e);
+	e->online = online;
 	if (online)
+		add_whowas_to_clist(&(online->user->whowas), e);
+	whowas_count++;
+}
+
+static void whowas_link_indexes(WhoWas *e)
+{
+	unsigned int hashv;
+
+	add_whowas_to_list(&whowas_nick_hash[WHOWAS_BUCKET(e->name)], e);
+
+	if (e->ip)
 	{
-		new->online = client;
-		add_whowas_to_clist(&(client->user->whowas), new);
-	} else {
-		new->online = NULL;
+		hashv = WHOWAS_BUCKET(e->ip);
+		e->ipnext = whowas_ip_hash[hashv];
+		whowas_ip_hash[hashv] = e;
+	}
+
+	if (e->account)
+	{
+		hashv = WHOWAS_BUCKET(e->account);
+		e->accountnext = whowas_account_hash[hashv];
+		whowas_account_hash[hashv] = e;
 	}
-	add_whowas_to_list(&WHOWASHASH[new->hashv], new);
-	whowas_next++;
-	if (whowas_next == NICKNAMEHISTORYLENGTH)
-		whowas_next = 0;
+}
+
+/* 'e' must be the oldest entry in the store */
+static void whowas_unlink(WhoWas *e)
+{
+	unsigned int hashv;
+
+	if (e->online)
+		del_whowas_from_clist(&(e->online->user->whowas), e);
+	e->online = NULL;
+
+	del_whowas_from_list(&whowas_nick_hash[WHOWAS_BUCKET(e->name)], e);
+
+	if (e->ip)
+	{
+		hashv = WHOWAS_BUCKET(e->ip);
+		if (whowas_ip_hash[hashv] == e)
+			whowas_ip_hash[hashv] = NULL;
+	}
+
+	if (e->account)
+	{
+		hashv = WHOWAS_BUCKET(e->account);
+		if (whowas_account_hash[hashv] == e)
+			whowas_account_hash[hashv] = NULL;
+	}
+
+	e->serial = 0;
+	whowas_count--;
+}
+
+void add_history(Client *client, int online, WhoWasEvent event)
+{
+	WhoWas *e = whowas_alloc();
+
+	create_whowas_entry(client, e, event);
+	whowas_link(e, online ? client : NULL);
 }
 
 void off_history(Client *client)
@@ -113,24 +287,19 @@ void off_history(Client *client)
 
 	for (temp = client->user->whowas; temp; temp = next)
 	{
-		next = temp->cnext;
+		next = whowas_list_next(temp, temp->cnext);
 		temp->online = NULL;
-		del_whowas_from_clist(&(client->user->whowas), temp);
 	}
+	client->user->whowas = NULL;
 }
 
 Client *get_history(const char *nick, time_t timelimit)
 {
 	WhoWas *temp;
-	int  blah;
 
 	timelimit = TStime() - timelimit;
-	blah = hash_whowas_name(nick);
-	temp = WHOWASHASH[blah];
-	for (; temp; temp = temp->next)
+	for (temp = whowas_find_nick(nick); temp; temp = whowas_next_nick(temp))
 	{
-		if (mycmp(nick, temp->name))
-			continue;
 		if (temp->logoff < timelimit)
 			continue;
 		return temp->online;
@@ -138,71 +307,232 @@ Client *get_history(const char *nick, time_t timelimit)
 	return NULL;
 }
 
-void count_whowas_memory(int *wwu, u_long *wwum)
+/** Find the most recent WHOWAS entry for a nick.
+ * Use whowas_next_nick() to walk to older entries for the same nick.
+ */
+WhoWas *whowas_find_nick(const char *nick)
 {
-	WhoWas *tmp;
-	int  i;
-	int  u = 0;
-	u_long um = 0;
-	/* count the number of used whowas structs in 'u' */
-	/* count up the memory used of whowas structs in um */
+	WhoWas *e;
 
-	for (i = 0, tmp = &WHOWAS[0]; i < NICKNAMEHISTORYLENGTH; i++, tmp++)
-		if (tmp->hashv != -1)
+	for (e = whowas_nick_hash[WHOWAS_BUCKET(nick)]; e; e = whowas_list_next(e, e->next))
+		if (!mycmp(nick, e->name))
+			return e;
+	return NULL;
+}
+
+WhoWas *whowas_next_nick(WhoWas *e)
+{
+	WhoWas *n;
+
+	for (n = whowas_list_next(e, e->next); n; n = whowas_list_next(n, n->next))
+		if (!mycmp(e->name, n->name))
+			return n;
+	return NULL;
+}
+
+/** Find the most recent WHOWAS entry for an IP address.
+ * Use whowas_next_ip() to walk to older entries for the same IP.
+ */
+WhoWas *whowas_find_ip(const char *ip)
+{
+	WhoWas *e;
+
+	for (e = whowas_ip_hash[WHOWAS_BUCKET(ip)]; e; e = whowas_list_next(e, e->ipnext))
+		if (!strcmp(ip, e->ip))
+			return e;
+	return NULL;
+}
+
+WhoWas *whowas_next_ip(WhoWas *e)
+{
+	WhoWas *n;
+
+	for (n = whowas_list_next(e, e->ipnext); n; n = whowas_list_next(n, n->ipnext))
+		if (n->ip == e->ip)
+			return n;
+	return NULL;
+}
+
+/** Find the most recent WHOWAS entry for a services account.
+ * Use whowas_next_account() to walk to older entries for the same account.
+ */
+WhoWas *whowas_find_account(const char *account)
+{
+	WhoWas *e;
+
+	for (e = whowas_account_hash[WHOWAS_BUCKET(account)]; e; e = whowas_list_next(e, e->accountnext))
+		if (!strcasecmp(account, e->account))
+			return e;
+	return NULL;
+}
+
+WhoWas *whowas_next_account(WhoWas *e)
+{
+	WhoWas *n;
+
+	for (n = whowas_list_next(e, e->accountnext); n; n = whowas_list_next(n, n->accountnext))
+		if (!strcasecmp(e->account, n->account))
+			return n;
+	return NULL;
+}
+
+/* Return the first used slot, starting at slot 'i' and looking
+ * at no more than 'remaining' slots.
+ */
+static WhoWas *whowas_scan(int i, int remaining)
+{
+	for (; remaining > 0; remaining--)
+	{
+		if (whowas_ring[i].serial)
+			return &whowas_ring[i];
+		i++;
+		if (i == whowas_size)
+			i = 0;
+	}
+	return NULL;
+}
+
+/** Return the oldest entry in the WHOWAS store, or NULL if empty.
+ * Use whowas_newer() to walk the store in chronological order.
+ */
+WhoWas *whowas_oldest(void)
+{
+	return whowas_scan(whowas_next, whowas_size);
+}
+
+WhoWas *whowas_newer(WhoWas *e)
+{
+	int i = (e - whowas_ring) + 1;
+
+	if (i == whowas_size)
+		i = 0;
+	return whowas_scan(i, (whowas_next - i + whowas_size) % whowas_size);
+}
+
+/** Change the number of entries the WHOWAS store can hold.
+ * When shrinking, the oldest entries are dropped.
+ */
+void whowas_resize(int size)
+{
+	WhoWas *new_ring, *e, *next;
+	WhoWasString **new_string_hash, *s, *s_next;
+	unsigned int hash_size, i;
+	int n, drop;
+
+	if (size <= 0)
+		size = NICKNAMEHISTORYLENGTH;
+	if (size == whowas_size)
+		return;
+
+	/* Drop the oldest entries that no longer fit */
+	drop = whowas_count - size;
+	for (e = whowas_oldest(); e && (drop > 0); e = next, drop--)
+	{
+		next = whowas_newer(e);
+		free_whowas_fields(e);
+	}
+
+	/* The client lists point into the old ring, they are rebuilt below */
+	for (e = whowas_oldest(); e; e = whowas_newer(e))
+		if (e->online)
+			e->online->user->whowas = NULL;
+
+	/* Move the remaining entries to the new ring, oldest first */
+	new_ring = safe_alloc(sizeof(WhoWas) * size);
+	n = 0;
+	for (e = whowas_oldest(); e; e = whowas_newer(e))
+		new_ring[n++] = *e;
+	safe_free(whowas_ring);
+	whowas_ring = new_ring;
+	whowas_size = size;
+	whowas_next = n % size;
+
+	/* Grow (or shrink) the index tables along with the ring */
+	hash_size = WHOWAS_HASH_TABLE_SIZE;
+	while (hash_size < (unsigned int)size)
+		hash_size <<= 1;
+	if (hash_size != whowas_hash_size)
+	{
+		new_string_hash = safe_alloc(sizeof(WhoWasString *) * hash_size);
+		for (i = 0; i < whowas_hash_size; i++)
 		{
-			u++;
-			um += sizeof(WhoWas);
+			for (s = whowas_string_hash[i]; s; s = s_next)
+			{
+				unsigned int hashv = hash_whowas_string(s->str) & (hash_size - 1);
+				s_next = s->next;
+				s->next = new_string_hash[hashv];
+				new_string_hash[hashv] = s;
+			}
 		}
-	*wwu = u;
+		safe_free(whowas_string_hash);
+		whowas_string_hash = new_string_hash;
+
+		safe_free(whowas_nick_hash);
+		safe_free(whowas_ip_hash);
+		safe_free(whowas_account_hash);
+		whowas_nick_hash = safe_alloc(sizeof(WhoWas *) * hash_size);
+		whowas_ip_hash = safe_alloc(sizeof(WhoWas *) * hash_size);
+		whowas_account_hash = safe_alloc(sizeof(WhoWas *) * hash_size);
+		whowas_hash_size = hash_size;
+	} else {
+		memset(whowas_nick_hash, 0, sizeof(WhoWas *) * hash_size);
+		memset(whowas_ip_hash, 0, sizeof(WhoWas *) * hash_size);
+		memset(whowas_account_hash, 0, sizeof(WhoWas *) * hash_size);
+	}
+
+	/* And re-add everything, so the newest entries end up first again */
+	for (i = 0; i < (unsigned int)n; i++)
+	{
+		e = &whowas_ring[i];
+		whowas_link_indexes(e);
+		if (e->online)
+			add_whowas_to_clist(&(e->online->user->whowas), e);
+	}
+}
+
+void count_whowas_memory(int *wwu, u_long *wwum)
+{
+	WhoWas *e;
+	u_long um;
+
+	um = sizeof(WhoWas) * whowas_size;
+	um += sizeof(WhoWas *) * whowas_hash_size * 3;
+	um += sizeof(WhoWasString *) * whowas_hash_size;
+	um += whowas_string_bytes;
+	for (e = whowas_oldest(); e; e = whowas_newer(e))
+		um += strlen(e->name) + 1;
+
+	*wwu = whowas_count;
 	*wwum = um;
-	return;
 }
 
 void initwhowas()
 {
-	int  i;
-
-	for (i = 0; i < NICKNAMEHISTORYLENGTH; i++)
-	{
-		memset(&WHOWAS[i], 0, sizeof(WhoWas));
-		WHOWAS[i].hashv = -1;
-	}
-	for (i = 0; i < WHOWAS_HASH_TABLE_SIZE; i++)
-		WHOWASHASH[i] = NULL;
+	whowas_resize(NICKNAMEHISTORYLENGTH);
 }
 
 void add_whowas_to_clist(WhoWas ** bucket, WhoWas * whowas)
 {
-	whowas->cprev = NULL;
-	if ((whowas->cnext = *bucket) != NULL)
-		whowas->cnext->cprev = whowas;
+	whowas->cnext = *bucket;
 	*bucket = whowas;
 }
 
+/* 'whowas' must be the oldest entry on the list, see the comment at the top */
 void del_whowas_from_clist(WhoWas ** bucket, WhoWas * whowas)
 {
-	if (whowas->cprev)
-		whowas->cprev->cnext = whowas->cnext;
-	else
-		*bucket = whowas->cnext;
-	if (whowas->cnext)
-		whowas->cnext->cprev = whowas->cprev;
+	if (*bucket == whowas)
+		*bucket = NULL;
 }
 
 void add_whowas_to_list(WhoWas ** bucket, WhoWas * whowas)
 {
-	whowas->prev = NULL;
-	if ((whowas->next = *bucket) != NULL)
-		whowas->next->prev = whowas;
+	whowas->next = *bucket;
 	*bucket = whowas;
 }
 
+/* 'whowas' must be the oldest entry on the list, see the comment at the top */
 void del_whowas_from_list(WhoWas ** bucket, WhoWas * whowas)
 {
-	if (whowas->prev)
-		whowas->prev->next = whowas->next;
-	else
-		*bucket = whowas->next;
-	if (whowas->next)
-		whowas->next->prev = whowas->prev;
+	if (*bucket == whowas)
+		*bucket = NULL;
 }